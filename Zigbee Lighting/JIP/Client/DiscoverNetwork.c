@@ -430,7 +430,8 @@ static teJIP_Status eJIPService_DiscoverNetworkChildTable(tsJIP_Context *psJIP_C
                                     psJIP_Private->prCbNetworkChange(E_JIP_NODE_LEAVE, psNode);
                                 }
                                 
-                                eJIP_NetFreeNode(psJIP_Context, psNode);
+                                eJIP_UnlockNode(psNode);
+                                eJIP_ReleaseNode(psNode);
                             }
                         }
                     }
@@ -24,6 +24,7 @@
  *
  ***************************************************************************/
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -43,9 +44,47 @@
 #define DBG_FUNCTION_CALLS 0
 #define DBG_JIP_CLIENT 0
 
+/** A run of consecutive variables of one MIB, requested with one range of a multi get */
+typedef struct
+{
+    tsVar*      psFirstVar;
+    uint8_t     u8VarCount;
+} tsVarRange;
+
+/** A node's membership of a multicast group, as shown by its Groups MIB */
+typedef struct
+{
+    tsNode*         psNode;
+    struct in6_addr sGroup;
+} tsGroupMembership;
+
 static void *pvNetworkChangeMonitorThread(void *psThreadInfoVoid);
+static void *pvSetCoalescerThread(void *psThreadInfoVoid);
+static void *pvMulticastThread(void *psThreadInfoVoid);
 
+static teJIP_Status eJIP_ExchangeStatus(teNetworkStatus eNetStatus);
+static teJIP_Status eJIP_EncodeSetData(tsVar *psVar, void *pvData, uint32_t *pu32Size, char *pcBuffer, uint32_t *pu32Offset, uint32_t u32BufferSize);
+static teJIP_Status eJIP_MulticastSend(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, int iMaxHops, 
+                                       teJIP_Command eCommand, char *pcBuffer, uint32_t u32Length);
+static teJIP_Status eJIP_GetVarExchange(tsJIP_Context *psJIP_Context, tsVar *psVar);
 static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer);
+static teJIP_Status eJIP_SetVarFromData(tsVar *psVar, uint8_t *pu8Data);
+static teJIP_Status eJIP_GetVarRange(tsJIP_Context *psJIP_Context, tsVar *psFirstVar, uint8_t u8VarCount);
+static teJIP_Status eJIP_ParseVarEntries(tsVar *psFirstVar, uint32_t u32VarCount, char *buffer, uint32_t *pu32Offset, 
+                                         uint32_t u32ResponseLen, teJIP_Status *peVarStatus);
+static teJIP_Status eJIP_SceneGroupMembership(tsJIP_Context *psJIP_Context, tsGroupMembership **ppasMembers, uint32_t *pu32NumMembers,
+                                              uint32_t *pu32NumNodes, bool_t bHold);
+static teJIP_Status eJIP_SceneCompile(tsJIP_Context *psJIP_Context, const tsSceneEntry *pasEntries, uint32_t u32NumEntries, 
+                                      int iMaxHops, bool_t bUseGroups, tsScene **ppsScene);
+static void vJIP_SceneUnicastCost(tsSceneEntryPlan *psPlan);
+static void vJIP_SceneMergeGroups(tsScene *psScene, tsGroupMembership *pasMembers, uint32_t u32NumMembers);
+static teJIP_Status eJIP_ScenePacketise(tsScene *psScene);
+static teJIP_Status eJIP_GroupMemberVars(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, uint32_t u32MibId, uint8_t u8VarIndex,
+                                         tsVar ***ppapsVars, uint32_t *pu32NumVars);
+static teJIP_Status eJIP_ReadBackVars(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, int iMaxHops, tsVar **papsVars, uint32_t u32NumVars, 
+                                      const uint8_t *pu8Value, uint32_t u32ValueLength, bool_t *pabConverged);
+static teJIP_Status eJIP_GroupGet(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psAddress, int iMaxHops, uint32_t u32JitterMs,
+                                  tsNetworkResponse *pasResponses, uint32_t u32MaxResponses, uint32_t *pu32NumResponses);
 
 
 teJIP_Status eJIP_Connect(tsJIP_Context *psJIP_Context, const char *pcAddress, const int iPort)
@@ -150,6 +189,7 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
     tsJIP_Msg_SetMibRequest *psSetRequest;
     tsNode *psNode;
     tsMib *psMib;
+    teJIP_Status eStatus;
      
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
     
@@ -178,101 +218,24 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
         
         u32CommandLen = sizeof(tsJIP_Msg_SetMibRequest);
 
-        switch (psVar->eVarType)
+        eStatus = eJIP_EncodeSetData(psVar, pvData, &u32Size, buffer, &u32CommandLen, sizeof(buffer));
+        if (eStatus != E_JIP_OK)
         {
-            case (E_JIP_VAR_TYPE_INT8):
-            case (E_JIP_VAR_TYPE_UINT8):
-                u32Size = sizeof(uint8_t);
-                buffer[u32CommandLen] = *((uint8_t *)pvData);
-                u32CommandLen += sizeof(uint8_t);
-                break;
-
-            case (E_JIP_VAR_TYPE_INT16):
-            case (E_JIP_VAR_TYPE_UINT16):
-            {
-                uint16_t u16Var = htons(*((uint16_t *)pvData));
-                u32Size = sizeof(uint16_t);
-                memcpy(&buffer[u32CommandLen], &u16Var, sizeof(uint16_t));
-                u32CommandLen += sizeof(uint16_t);
-                break;
-            }
-                
-            case (E_JIP_VAR_TYPE_INT32):
-            case (E_JIP_VAR_TYPE_UINT32):
-            case (E_JIP_VAR_TYPE_FLT):
-            {
-                uint32_t u32Var = htonl(*((uint32_t *)pvData));
-                u32Size = sizeof(uint32_t);
-                memcpy(&buffer[u32CommandLen], &u32Var, sizeof(uint32_t));
-                u32CommandLen += sizeof(uint32_t);
-                break;
-            }
-            
-            case (E_JIP_VAR_TYPE_INT64):
-            case (E_JIP_VAR_TYPE_UINT64):
-            case (E_JIP_VAR_TYPE_DBL):
-            {
-                uint64_t u64Var = htobe64(*((uint64_t *)pvData));
-                u32Size = sizeof(uint64_t);
-                memcpy(&buffer[u32CommandLen], &u64Var, sizeof(uint64_t));
-                u32CommandLen += sizeof(uint64_t);
-                break;
-            }
-
-            case(E_JIP_VAR_TYPE_STR):
-            {
-                if (u32Size > 255)
-                {
-                    eJIP_Unlock(psJIP_Context);
-                    return E_JIP_ERROR_BAD_BUFFER_SIZE;
-                }
-                buffer[u32CommandLen++] = u32Size;
-                memcpy(&buffer[u32CommandLen], (uint8_t *)pvData, u32Size);
-                u32CommandLen += u32Size;
-                /* Increment size to include NULL terminator when local copy is updated */
-                u32Size++;
-                break;
-            }
-            
-            case(E_JIP_VAR_TYPE_BLOB):
-            {
-                buffer[u32CommandLen++] = u32Size;
-                memcpy(&buffer[u32CommandLen], (uint8_t *)pvData, u32Size);
-                u32CommandLen += u32Size;
-                break;
-            }
-            
-            default:
-                DBG_vPrintf(DBG_JIP_CLIENT, "Set not supported for this type\n");
-                eJIP_UnlockNode(psNode);
-                return E_JIP_ERROR_FAILED;
+            eJIP_UnlockNode(psNode);
+            return eStatus;
         }
 
         if (!psAddress)
         {
-            teNetworkStatus eNetStatus;
-            
             // If we wern't given an address, send to the node
-            eNetStatus = Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
-                                            E_JIP_COMMAND_SET_MIB_REQUEST, buffer, u32CommandLen, 
-                                            E_JIP_COMMAND_SET_RESPONSE, buffer, &u32ResponseLen);
-            if (eNetStatus!= E_NETWORK_OK)
+            eStatus = eJIP_ExchangeStatus(Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                                                              E_JIP_COMMAND_SET_MIB_REQUEST, buffer, u32CommandLen, 
+                                                              E_JIP_COMMAND_SET_RESPONSE, buffer, &u32ResponseLen));
+            if (eStatus != E_JIP_OK)
             {
                 DBG_vPrintf(DBG_JIP_CLIENT, "Error setting variable\n");
                 eJIP_UnlockNode(psNode);
-                
-                if (eNetStatus == E_NETWORK_ERROR_TIMEOUT)
-                {
-                    return E_JIP_ERROR_TIMEOUT;
-                }
-                else if (eNetStatus == E_NETWORK_ERROR_NO_MEM)
-                {
-                    return E_JIP_ERROR_NO_MEM;
-                }
-                else
-                {
-                    return E_JIP_ERROR_FAILED;
-                }
+                return eStatus;
             }
             else
             {
@@ -286,621 +249,3094 @@ teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, vo
             }
   
             // Update local copy 
-            {
-                teJIP_Status eStatus = eJIP_SetVarValue(psVar, pvData, u32Size);
-                eJIP_UnlockNode(psNode);
-                return eStatus;
-            }
+            eStatus = eJIP_SetVarValue(psVar, pvData, u32Size);
         }
         else
         {
-            int i, j;
-            
-            if (psJIP_Private->sNetworkContext.eProtocol == E_NETWORK_PROTO_IPV6)
-            {
-                // For Mcast needs to be at least 2 Hops for now - enough to go across the border router from the local network
-                if (setsockopt(psJIP_Private->sNetworkContext.iSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &iMaxHops, sizeof(int)) < 0)
-                {
-                    DBG_vPrintf(DBG_JIP_CLIENT, "Error setting Number of hops\n");
-                    eJIP_UnlockNode(psNode);
-                    return E_JIP_ERROR_FAILED;
-                }
-            }
-            
-            if ((psJIP_Context->iMulticastInterface == -1) && (psJIP_Private->sNetworkContext.eProtocol == E_NETWORK_PROTO_IPV6))
-            {
-                // Send the multicast up each interface
-                struct ifaddrs *ifp, *ifs;
-                int iInterfaceIndex = -1;
-                int iLastInterfaceIndex = -1;
-                char acAddr[INET6_ADDRSTRLEN] = "Could not determine address\n";
-                
-                if (getifaddrs(&ifs) < 0) 
-                {
-                    DBG_vPrintf(DBG_JIP_CLIENT, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
-                    return E_JIP_ERROR_FAILED;
-                }
-
-                for (ifp = ifs; ifp; ifp = ifp->ifa_next)
-                {
-                    if (ifp->ifa_addr != NULL && ifp->ifa_addr->sa_family == AF_INET6)
-                    {
-                        DBG_vPrintf(DBG_JIP_CLIENT, "Found address [%s] on interface %s\n",
-                            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr, acAddr, INET6_ADDRSTRLEN), ifp->ifa_name);
-                        
-                        iInterfaceIndex = if_nametoindex(ifp->ifa_name);
-                        
-                        if ((iLastInterfaceIndex != iInterfaceIndex) && 
-                            (strcmp(ifp->ifa_name, "lo")))
-                        {
-                            /* Only multicast on each interface once, and don't bother with the loopback interface */
-                            
-                            DBG_vPrintf(DBG_JIP_CLIENT, "Multicast on interface %s\n", ifp->ifa_name);
-                            iLastInterfaceIndex = iInterfaceIndex;
-                            
-                            if (psJIP_Private->sNetworkContext.eProtocol == E_NETWORK_PROTO_IPV6)
-                            {
-                                if (setsockopt(psJIP_Private->sNetworkContext.iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF,
-                                    &iInterfaceIndex, sizeof(int)) < 0)
-                                {
-                                    perror("setsockopt IPV6_MULTICAST_IF");
-                                }
-                            }
-                            
-                            for (i = 0; i < psJIP_Context->iMulticastSendCount; i++)
-                            {
-                                // Send multicast packet.
-                                if (Network_SendJIP(&psJIP_Private->sNetworkContext, psAddress,
-                                                    E_JIP_COMMAND_SET_MIB_REQUEST, buffer, u32CommandLen) != E_NETWORK_OK)
-                                {
-                                    // There is no response to a multicast command
-                                    eJIP_UnlockNode(psNode);
-                                    freeifaddrs(ifs);
-                                    return E_JIP_ERROR_FAILED;
-                                }
-                                
-                                if (psJIP_Context->iMulticastSendCount > 0)
-                                {
-                                    /* Retransmit delay - 200ms */
-                                    usleep(200000);
-                                }
-                            }
-                            
-                        }
-                    }
-                }
-
-                freeifaddrs(ifs);                
-            }
-            else
-            {
-                // Just send up the one interface.
-                if (psJIP_Private->sNetworkContext.eProtocol == E_NETWORK_PROTO_IPV6)
-                {
-                    if (setsockopt(psJIP_Private->sNetworkContext.iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF,
-                        &psJIP_Context->iMulticastInterface, sizeof(psJIP_Context->iMulticastInterface)) < 0)
-                    {
-                        perror("setsockopt IPV6_MULTICAST_IF");
-                    }
-                }
-                
-                for (i = 0; i < psJIP_Context->iMulticastSendCount; i++)
-                {
-                    // Send multicast packet.
-                    if (Network_SendJIP(&psJIP_Private->sNetworkContext, psAddress,
-                                        E_JIP_COMMAND_SET_MIB_REQUEST, buffer, u32CommandLen) != E_NETWORK_OK)
-                    {
-                        // There is no response to a multicast command
-                        eJIP_UnlockNode(psNode);
-                        return E_JIP_ERROR_FAILED;
-                    }
-                    
-                    if (psJIP_Context->iMulticastSendCount > 0)
-                    {
-                        /* Retransmit delay - 200ms */
-                        usleep(200000);
-                    }
-                }
-            }
-            eJIP_UnlockNode(psNode);
+            eStatus = eJIP_MulticastSend(psJIP_Context, psAddress, iMaxHops, E_JIP_COMMAND_SET_MIB_REQUEST, buffer, u32CommandLen);
         }
     }
-    return E_JIP_OK;
+    
+    eJIP_UnlockNode(psNode);
+    return eStatus;
 }
 
 
-teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
+teJIP_Status eJIP_SetVarUnacked(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvNewData, uint32_t u32Size)
 {
     PRIVATE_CONTEXT(psJIP_Context);
     char buffer[255];
-    uint32_t u32ResponseLen = 255;
-    tsJIP_Msg_GetMibRequest *psJIP_Msg_GetMibRequest = (tsJIP_Msg_GetMibRequest *)buffer;
-    tsJIP_Msg_VarDescriptionHeader *psJIP_Msg_VarDescriptionHeader;
+    uint32_t u32CommandLen = sizeof(tsJIP_Msg_SetUnackedRequest);
+    tsJIP_Msg_SetUnackedRequest *psSetRequest = (tsJIP_Msg_SetUnackedRequest *)buffer;
     tsMib *psMib = psVar->psOwnerMib;
     tsNode *psNode = psMib->psOwnerNode;
-
+    teJIP_Status eStatus;
+    
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-
+    
     if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
     {
         return E_JIP_ERROR_WRONG_CONTEXT;
     }
     
-    switch (psVar->eVarType)
+    eJIP_LockNode(psNode, True);
+    
+    if (!psJIP_VarExt(psVar))
     {
-        case(E_JIP_VAR_TYPE_TABLE_BLOB):
-            return eJIP_GetTableVar(psJIP_Context, psVar);
-            break;
-        default:
-            break;
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_NO_MEM;
     }
     
-    eJIP_LockNode(psNode, True);
+    psSetRequest->u32MibId                  = htonl(psMib->u32MibId);
+    psSetRequest->u16Sequence               = htons(++psVar->psExt->u16SetSequence);
+    psSetRequest->sRequest.u8VarIndex       = psVar->u8Index;
+    psSetRequest->sRequest.sVar.eVarType    = psVar->eVarType;
     
-    psJIP_Msg_GetMibRequest->u32MibId = htonl(psVar->psOwnerMib->u32MibId);
-    psJIP_Msg_GetMibRequest->sRequest.u8VarIndex = psVar->u8Index;
-    psJIP_Msg_GetMibRequest->sRequest.u8VarCount = 1;
+    DBG_vPrintf(DBG_JIP_CLIENT, "Unacknowledged set of Mib 0x%08x, variable %d, sequence %d\n", 
+                psMib->u32MibId, psVar->u8Index, psVar->psExt->u16SetSequence);
     
-    DBG_vPrintf(DBG_JIP_CLIENT, "Get variable %d, MiB 0x%08x, Node:", psVar->u8Index, psVar->psOwnerMib->u32MibId);
-    DBG_vPrintf_IPv6Address(DBG_JIP_CLIENT, psNode->sNode_Address.sin6_addr);
-
-    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psVar->psOwnerMib->psOwnerNode, 3, EXCHANGE_FLAG_NONE,
-                            E_JIP_COMMAND_GET_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_GetMibRequest) - 2, 
-                            E_JIP_COMMAND_GET_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
+    eStatus = eJIP_EncodeSetData(psVar, pvNewData, &u32Size, buffer, &u32CommandLen, sizeof(buffer));
+    if (eStatus == E_JIP_OK)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Error\n");
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_FAILED;
+        if (Network_SendJIP(&psJIP_Private->sNetworkContext, &psNode->sNode_Address,
+                            E_JIP_COMMAND_SET_UNACKED_REQUEST, buffer, u32CommandLen) != E_NETWORK_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Error sending unacknowledged set\n");
+            eStatus = E_JIP_ERROR_NETWORK;
+        }
+        else
+        {
+            /* Update local copy, as eJIP_SetVar does once the node has accepted the value */
+            eStatus = eJIP_SetVarValue(psVar, pvNewData, u32Size);
+        }
     }
     
-    psJIP_Msg_VarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)buffer;
+    eJIP_UnlockNode(psNode);
+    return eStatus;
+}
 
-    if (psJIP_Msg_VarDescriptionHeader->eStatus == E_JIP_ERROR_DISABLED)
+
+teJIP_Status eJIP_MulticastSetVars(tsJIP_Context *psJIP_Context, tsSetVarEntry *psEntries, uint32_t u32NumEntries, tsJIPAddress *psAddress, int iMaxHops)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    char buffer[PACKET_BUFFER_SIZE];
+    uint32_t u32ResponseLen = PACKET_BUFFER_SIZE, u32CommandLen;
+    uint32_t au32Sizes[UINT8_MAX];
+    tsJIP_Msg_SetMultiRequest *psSetRequest = (tsJIP_Msg_SetMultiRequest *)buffer;
+    tsMib *psMib;
+    tsNode *psNode;
+    teJIP_Status eStatus;
+    uint32_t i;
+     
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d vars)\n", __FUNCTION__, u32NumEntries);   
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Variable is disabled\n");
-        psVar->eEnable = E_JIP_VAR_DISABLED;
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_DISABLED;
+        return E_JIP_ERROR_WRONG_CONTEXT;
     }
-    else if (psJIP_Msg_VarDescriptionHeader->eStatus != E_JIP_OK)
+    
+    if ((u32NumEntries == 0) || (u32NumEntries > UINT8_MAX))
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Error reading (status 0x%02x)\n", psJIP_Msg_VarDescriptionHeader->eStatus);
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_FAILED;
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
     }
     
-    if (psJIP_Msg_VarDescriptionHeader->eVarType != psVar->eVarType)
+    psMib = psEntries[0].psVar->psOwnerMib;
+    psNode = psMib->psOwnerNode;
+    
+    for (i = 0; i < u32NumEntries; i++)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Type mismatch (got %d, expected %d)\n", psJIP_Msg_VarDescriptionHeader->eVarType, psVar->eVarType);
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_FAILED;
+        psEntries[i].eStatus = E_JIP_ERROR_FAILED;
+        if (psEntries[i].psVar->psOwnerMib != psMib)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Variable %d is not in MIB 0x%08x\n", i, psMib->u32MibId);
+            return E_JIP_ERROR_BAD_MIB_INDEX;
+        }
     }
     
-    // Set the variable as enabled
-    psVar->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_LockNode(psNode, True);
     
+    psSetRequest->u32MibId  = htonl(psMib->u32MibId);
+    psSetRequest->u8NumVars = u32NumEntries;
+    u32CommandLen = sizeof(tsJIP_Msg_SetMultiRequest);
+    
+    for (i = 0; i < u32NumEntries; i++)
     {
-        teJIP_Status eStatus = eJIP_SetVarFromPacket(psVar, (uint8_t *)buffer);
+        tsJIP_Msg_SetRequest *psRequest = (tsJIP_Msg_SetRequest *)&buffer[u32CommandLen];
+        tsVar *psVar = psEntries[i].psVar;
+        
+        DBG_vPrintf(DBG_JIP_CLIENT, "Setting Mib 0x%08x, variable %d, type %d\n", 
+                    psMib->u32MibId, psVar->u8Index, psVar->eVarType);
+        
+        if (u32CommandLen + sizeof(tsJIP_Msg_SetRequest) > sizeof(buffer))
+        {
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_BAD_BUFFER_SIZE;
+        }
+        psRequest->u8VarIndex       = psVar->u8Index;
+        psRequest->sVar.eVarType    = psVar->eVarType;
+        u32CommandLen += sizeof(tsJIP_Msg_SetRequest);
+        
+        au32Sizes[i] = psEntries[i].u32Size;
+        eStatus = eJIP_EncodeSetData(psVar, psEntries[i].pvData, &au32Sizes[i], buffer, &u32CommandLen, sizeof(buffer));
+        if (eStatus != E_JIP_OK)
+        {
+            psEntries[i].eStatus = eStatus;
+            eJIP_UnlockNode(psNode);
+            return eStatus;
+        }
+    }
+    
+    if (psAddress)
+    {
+        eStatus = eJIP_MulticastSend(psJIP_Context, psAddress, iMaxHops, E_JIP_COMMAND_SET_MULTI_REQUEST, buffer, u32CommandLen);
+        for (i = 0; i < u32NumEntries; i++)
+        {
+            psEntries[i].eStatus = eStatus;
+        }
         eJIP_UnlockNode(psNode);
         return eStatus;
     }
-}
- 
-
-teJIP_Status eJIP_TrapEvent(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, char *pcPacket)
-{
-    //PRIVATE_CONTEXT(psJIP_Context);
-    tsJIP_Msg_VarDescriptionHeader *psJIP_Msg_VarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)pcPacket;
-    tsNode *psNode;
-    tsMib *psMib;
-    tsVar *psVar;
     
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s Mib %d, Var %d\n", __FUNCTION__, psJIP_Msg_VarDescriptionHeader->u8MibIndex, psJIP_Msg_VarDescriptionHeader->u8VarIndex); 
-
-    psNode = psJIP_LookupNode(psJIP_Context, psAddress);
+    eStatus = eJIP_ExchangeStatus(Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                                                      E_JIP_COMMAND_SET_MULTI_REQUEST, buffer, u32CommandLen, 
+                                                      E_JIP_COMMAND_SET_MULTI_RESPONSE, buffer, &u32ResponseLen));
+    if (eStatus != E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error setting variables\n");
+        eJIP_UnlockNode(psNode);
+        return eStatus;
+    }
     
-    if (psNode)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Got Node\n");
-         
-        psMib = psNode->psMibs;
-        while (psMib)
+        tsJIP_Msg_SetMultiResponseHeader *psResponse = (tsJIP_Msg_SetMultiResponseHeader *)buffer;
+        tsJIP_Msg_SetMultiResponseEntry *psResponseEntries = (tsJIP_Msg_SetMultiResponseEntry *)&buffer[sizeof(tsJIP_Msg_SetMultiResponseHeader)];
+        
+        if ((u32ResponseLen < sizeof(tsJIP_Msg_SetMultiResponseHeader)) ||
+            (u32ResponseLen < sizeof(tsJIP_Msg_SetMultiResponseHeader) + psResponse->u8NumVars * sizeof(tsJIP_Msg_SetMultiResponseEntry)))
         {
-            if (psMib->u8Index == psJIP_Msg_VarDescriptionHeader->u8MibIndex)
+            DBG_vPrintf(DBG_JIP_CLIENT, "Short response to multi set\n");
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_FAILED;
+        }
+        
+        /* Entries come back in the order they were sent */
+        for (i = 0; (i < u32NumEntries) && (i < psResponse->u8NumVars); i++)
+        {
+            psEntries[i].eStatus = psResponseEntries[i].eStatus;
+            if (psEntries[i].eStatus == E_JIP_OK)
             {
-                DBG_vPrintf(DBG_JIP_CLIENT, "Got Mib\n");
-                 
-                psVar = psMib->psVars;
-                while (psVar)
-                {
-                    if (psVar->u8Index == psJIP_Msg_VarDescriptionHeader->u8VarIndex)
-                    {
-                        DBG_vPrintf(DBG_JIP_CLIENT, "Got Var\n");
-                        eJIP_SetVarFromPacket(psVar, (uint8_t*)pcPacket);
-                        
-                        if (psVar->prCbVarTrap)
-                        {
-                            DBG_vPrintf(DBG_JIP_CLIENT, "Calling Var Trap Callback\n");
-                            psVar->prCbVarTrap(psVar);
-                        }
-                        break;
-                    }
-
-                    psVar = psVar->psNext;
-                }
-                break;
+                // Update local copy 
+                psEntries[i].eStatus = eJIP_SetVarValue(psEntries[i].psVar, psEntries[i].pvData, au32Sizes[i]);
+            }
+            else
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Node reported error setting variable %d (%d)\n", 
+                            psResponseEntries[i].u8VarIndex, psResponseEntries[i].eStatus);
             }
-            psMib = psMib->psNext;
         }
-        eJIP_UnlockNode(psNode);
+        
+        eStatus = psResponse->eStatus;
+        for (i = 0; (eStatus == E_JIP_OK) && (i < u32NumEntries); i++)
+        {
+            eStatus = psEntries[i].eStatus;
+        }
     }
-    return E_JIP_OK;
+    
+    eJIP_UnlockNode(psNode);
+    return eStatus;
 }
 
 
-teJIP_Status eJIP_TrapVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t u8NotificationHandle, tprCbVarTrap prCbVarTrap)
+static teJIP_Status eJIP_ExchangeStatus(teNetworkStatus eNetStatus)
 {
-    PRIVATE_CONTEXT(psJIP_Context);
-    tsJIP_Msg_TrapRequest *psJIP_Msg_TrapRequest;
-    tsJIP_Msg_VarStatus   *psJIP_Msg_VarStatus;
-    tsNode *psNode;
-    tsMib *psMib;
-
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
-
-    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    switch (eNetStatus)
     {
-        return E_JIP_ERROR_WRONG_CONTEXT;
-    }
-
-    psMib = psVar->psOwnerMib;
-    psNode = psMib->psOwnerNode;
-    
-    eJIP_LockNode(psNode, True);
-    
-    char buffer[255];
-    uint32_t u32ResponseLen = 255;
-    
-    psJIP_Msg_TrapRequest = (tsJIP_Msg_TrapRequest *)buffer;
-    
-    psJIP_Msg_TrapRequest->u8NotificationHandle = u8NotificationHandle;
-    psJIP_Msg_TrapRequest->u8MibIndex = psMib->u8Index;
-    psJIP_Msg_TrapRequest->u8VarIndex = psVar->u8Index;
-
-    DBG_vPrintf(DBG_JIP_CLIENT, "Requesting trap on Mib %d, variable %d\n", psJIP_Msg_TrapRequest->u8MibIndex, psJIP_Msg_TrapRequest->u8VarIndex);
-
-    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
-                            E_JIP_COMMAND_TRAP_REQUEST, buffer, sizeof(tsJIP_Msg_TrapRequest), 
-                            E_JIP_COMMAND_TRAP_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
-    {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Error requesting trap on variable\n");
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_FAILED;
-    }
-    
-    psJIP_Msg_VarStatus = (tsJIP_Msg_VarStatus *)buffer;
-    DBG_vPrintf(DBG_JIP_CLIENT, "Status: %d \n", psJIP_Msg_VarStatus->eStatus);
-    
-    if (psJIP_Msg_VarStatus->eStatus == E_JIP_OK)
-    {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Trap set up ok, setting callback\n");
-        psVar->u8TrapHandle = u8NotificationHandle;
-        psVar->prCbVarTrap = prCbVarTrap;
-        eJIP_UnlockNode(psNode);
-        return E_JIP_OK;
-    }
-    else
-    {
-        eJIP_UnlockNode(psNode);
-        return psJIP_Msg_VarStatus->eStatus;
+        case (E_NETWORK_OK):
+            return E_JIP_OK;
+        case (E_NETWORK_ERROR_TIMEOUT):
+            return E_JIP_ERROR_TIMEOUT;
+        case (E_NETWORK_ERROR_NO_MEM):
+            return E_JIP_ERROR_NO_MEM;
+        default:
+            return E_JIP_ERROR_FAILED;
     }
 }
 
 
-teJIP_Status eJIP_UntrapVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t u8NotificationHandle)
+/** Append the value pointed to by pvData to a set request in pcBuffer at *pu32Offset, advancing the offset.
+ *  *pu32Size is updated to the size of the local copy of the value.
+ */
+static teJIP_Status eJIP_EncodeSetData(tsVar *psVar, void *pvData, uint32_t *pu32Size, char *pcBuffer, uint32_t *pu32Offset, uint32_t u32BufferSize)
 {
-    PRIVATE_CONTEXT(psJIP_Context);
-    tsJIP_Msg_TrapRequest *psJIP_Msg_TrapRequest;
-    tsJIP_Msg_VarStatus   *psJIP_Msg_VarStatus;
-    tsNode *psNode;
-    tsMib *psMib;
-    
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
-
-    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
-    {
-        return E_JIP_ERROR_WRONG_CONTEXT;
-    }
-
-    psMib = psVar->psOwnerMib;
-    psNode = psMib->psOwnerNode;
-    
-    eJIP_LockNode(psNode, True);
-    
-    /* Remove callback function pointer */
-    psVar->prCbVarTrap = NULL;
-    
-    char buffer[255];
-    uint32_t u32ResponseLen = 255;
-    
-    psJIP_Msg_TrapRequest = (tsJIP_Msg_TrapRequest *)buffer;
-    
-    psJIP_Msg_TrapRequest->u8NotificationHandle = u8NotificationHandle;
-    psJIP_Msg_TrapRequest->u8MibIndex = psMib->u8Index;
-    psJIP_Msg_TrapRequest->u8VarIndex = psVar->u8Index;
-    
-    DBG_vPrintf(DBG_JIP_CLIENT, "Requesting removal of trap on Mib %d, variable %d\n", psJIP_Msg_TrapRequest->u8MibIndex, psJIP_Msg_TrapRequest->u8VarIndex);
-    
-    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
-                            E_JIP_COMMAND_UNTRAP_REQUEST, buffer, sizeof(tsJIP_Msg_TrapRequest), 
-                            E_JIP_COMMAND_TRAP_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
-    {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Error requesting removal of trap on variable\n");
-        eJIP_UnlockNode(psNode);
-        return E_JIP_ERROR_FAILED;
-    }
+    uint32_t u32CommandLen = *pu32Offset;
+    uint32_t u32Size = *pu32Size;
     
-    psJIP_Msg_VarStatus = (tsJIP_Msg_VarStatus *)buffer;
-    DBG_vPrintf(DBG_JIP_CLIENT, "Status: %d \n", psJIP_Msg_VarStatus->eStatus);
-    
-    if (psJIP_Msg_VarStatus->eStatus == E_JIP_OK)
-    {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Trap removed ok\n");
-        psVar->prCbVarTrap = NULL;
-        eJIP_UnlockNode(psNode);
-        return E_JIP_OK;
-    }
-    else
+    switch (psVar->eVarType)
     {
-        eJIP_UnlockNode(psNode);
-        return psJIP_Msg_VarStatus->eStatus;
+        case (E_JIP_VAR_TYPE_STR):
+        case (E_JIP_VAR_TYPE_BLOB):
+            if ((u32Size > UINT8_MAX) || (u32CommandLen + sizeof(uint8_t) + u32Size > u32BufferSize))
+            {
+                return E_JIP_ERROR_BAD_BUFFER_SIZE;
+            }
+            break;
+        
+        default:
+            if (u32CommandLen + u32JIP_VarDataSize(psVar->eVarType, NULL) > u32BufferSize)
+            {
+                return E_JIP_ERROR_BAD_BUFFER_SIZE;
+            }
+            break;
     }
-}
-
-
-static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer)
-{
-    tsJIP_Msg_VarDescriptionHeader *psVarDescriptionHeader;
-    void *pvNewData;
-    
-    psVarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)buffer;
- 
-    DBG_vPrintf(DBG_JIP_CLIENT, "Set var type %d\n", psVar->eVarType);
     
     switch (psVar->eVarType)
     {
-        case(E_JIP_VAR_TYPE_INT8):
-        case(E_JIP_VAR_TYPE_UINT8):
-        {
-            tsJIP_Msg_VarDescription_Int8 *VarDescription_Int8 = (tsJIP_Msg_VarDescription_Int8 *)buffer;
-            return eJIP_SetVarValue(psVar, &VarDescription_Int8->u8Val, sizeof(int8_t));
-        }
-        
-        case(E_JIP_VAR_TYPE_INT16):
-        case(E_JIP_VAR_TYPE_UINT16):
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            u32Size = sizeof(uint8_t);
+            pcBuffer[u32CommandLen] = *((uint8_t *)pvData);
+            u32CommandLen += sizeof(uint8_t);
+            break;
+
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
         {
-            tsJIP_Msg_VarDescription_Int16 *VarDescription_Int16 = (tsJIP_Msg_VarDescription_Int16 *)buffer;
-            VarDescription_Int16->u16Val = ntohs(VarDescription_Int16->u16Val);
-            return eJIP_SetVarValue(psVar, &VarDescription_Int16->u16Val, sizeof(int16_t));
+            uint16_t u16Var = htons(*((uint16_t *)pvData));
+            u32Size = sizeof(uint16_t);
+            memcpy(&pcBuffer[u32CommandLen], &u16Var, sizeof(uint16_t));
+            u32CommandLen += sizeof(uint16_t);
+            break;
         }
-        
+            
         case (E_JIP_VAR_TYPE_INT32):
         case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
         {
-            tsJIP_Msg_VarDescription_Int32 *VarDescription_Int32 = (tsJIP_Msg_VarDescription_Int32 *)buffer;
-            VarDescription_Int32->u32Val = ntohl(VarDescription_Int32->u32Val);
-            return eJIP_SetVarValue(psVar, &VarDescription_Int32->u32Val, sizeof(int32_t));
+            uint32_t u32Var = htonl(*((uint32_t *)pvData));
+            u32Size = sizeof(uint32_t);
+            memcpy(&pcBuffer[u32CommandLen], &u32Var, sizeof(uint32_t));
+            u32CommandLen += sizeof(uint32_t);
+            break;
         }
-
+        
         case (E_JIP_VAR_TYPE_INT64):
         case (E_JIP_VAR_TYPE_UINT64):
-        {
-            tsJIP_Msg_VarDescription_Int64 *VarDescription_Int64 = (tsJIP_Msg_VarDescription_Int64 *)buffer;
-            VarDescription_Int64->u64Val = be64toh(VarDescription_Int64->u64Val);
-            return eJIP_SetVarValue(psVar, &VarDescription_Int64->u64Val, sizeof(int64_t));
-        }
-        
-        case (E_JIP_VAR_TYPE_FLT):
-        {
-            tsJIP_Msg_VarDescription_Int32 *VarDescription_Int32 = (tsJIP_Msg_VarDescription_Int32 *)buffer;
-            VarDescription_Int32->u32Val = ntohl(VarDescription_Int32->u32Val);
-            return eJIP_SetVarValue(psVar, &VarDescription_Int32->u32Val, sizeof(int32_t));
-        }
         case (E_JIP_VAR_TYPE_DBL):
         {
-            tsJIP_Msg_VarDescription_Int64 *VarDescription_Int64 = (tsJIP_Msg_VarDescription_Int64 *)buffer;
-            VarDescription_Int64->u64Val = be64toh(VarDescription_Int64->u64Val);
-            return eJIP_SetVarValue(psVar, &VarDescription_Int64->u64Val, sizeof(int64_t));
+            uint64_t u64Var = htobe64(*((uint64_t *)pvData));
+            u32Size = sizeof(uint64_t);
+            memcpy(&pcBuffer[u32CommandLen], &u64Var, sizeof(uint64_t));
+            u32CommandLen += sizeof(uint64_t);
+            break;
         }
-        
-        case (E_JIP_VAR_TYPE_STR):
+
+        case(E_JIP_VAR_TYPE_STR):
         {
-            /* Special case for string due to incoming packet missing the NULL terminator */
-            tsJIP_Msg_VarDescription_Str *VarDescription_Str = (tsJIP_Msg_VarDescription_Str *)buffer;
-            pvNewData = realloc(psVar->pcData, VarDescription_Str->u8StringLen + 1);
-            if (!pvNewData) 
-            {
-                return E_JIP_ERROR_NO_MEM;
-            }
-            psVar->pcData = pvNewData;
-            memcpy(psVar->pcData, VarDescription_Str->acString, VarDescription_Str->u8StringLen);
-            psVar->pcData[VarDescription_Str->u8StringLen] = '\0';
-            psVar->u8Size = VarDescription_Str->u8StringLen + 1;
+            pcBuffer[u32CommandLen++] = u32Size;
+            memcpy(&pcBuffer[u32CommandLen], (uint8_t *)pvData, u32Size);
+            u32CommandLen += u32Size;
+            /* Increment size to include NULL terminator when local copy is updated */
+            u32Size++;
             break;
         }
         
-        case (E_JIP_VAR_TYPE_BLOB):
+        case(E_JIP_VAR_TYPE_BLOB):
         {
-            tsJIP_Msg_VarDescription_Blob *VarDescription_Blob = (tsJIP_Msg_VarDescription_Blob *)buffer;
-            return eJIP_SetVarValue(psVar, VarDescription_Blob->au8Blob, VarDescription_Blob->u8Len);
+            pcBuffer[u32CommandLen++] = u32Size;
+            memcpy(&pcBuffer[u32CommandLen], (uint8_t *)pvData, u32Size);
+            u32CommandLen += u32Size;
+            break;
         }
+        
         default:
-            DBG_vPrintf(DBG_JIP_CLIENT, "WARNING Unknown variable type (%d)\n", psVarDescriptionHeader->eVarType);
+            DBG_vPrintf(DBG_JIP_CLIENT, "Set not supported for this type\n");
+            return E_JIP_ERROR_FAILED;
     }
+    
+    *pu32Offset = u32CommandLen;
+    *pu32Size = u32Size;
     return E_JIP_OK;
 }
+
+
+/** Send one copy of a multicast request on the job's interface, or on every interface.
+ *  Must be called with the context locked.
+ */
+static teJIP_Status eJIP_MulticastSendCopy(tsJIP_Context *psJIP_Context, tsMulticastJob *psJob)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    // For Mcast needs to be at least 2 Hops for now - enough to go across the border router from the local network
+    if (Network_SendJIPMulticast(&psJIP_Private->sNetworkContext, &psJob->sAddress, psJob->iInterface, psJob->iMaxHops,
+                                 psJob->eCommand, psJob->acBuffer, psJob->u32Length) != E_NETWORK_OK)
+    {
+        // There is no response to a multicast command
+        return E_JIP_ERROR_FAILED;
+    }
     
+    return E_JIP_OK;
+}
 
-teJIP_Status eJIPService_MonitorNetwork(tsJIP_Context *psJIP_Context, tprCbNetworkChange prCbNetworkChange)
+
+/** Send a request to a multicast address, on every interface if no multicast interface has been chosen.
+ *  There is no response to a multicast request.
+ *  The first copy is sent before returning. Any further copies (\ref tsJIP_Context::iMulticastSendCount)
+ *  are handed to the retransmission thread, so no locks are held while they are spaced out.
+ */
+static teJIP_Status eJIP_MulticastSend(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, int iMaxHops, 
+                                       teJIP_Command eCommand, char *pcBuffer, uint32_t u32Length)
 {
     PRIVATE_CONTEXT(psJIP_Context);
+    tsMulticastJob *psJob;
+    teJIP_Status eStatus;
+    bool_t bWake = False;
     
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
+    if (u32Length > sizeof(psJob->acBuffer))
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
     
-    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    psJob = malloc(sizeof(tsMulticastJob));
+    if (!psJob)
     {
-        return E_JIP_ERROR_WRONG_CONTEXT;
+        return E_JIP_ERROR_NO_MEM;
+    }
+    memset(psJob, 0, offsetof(tsMulticastJob, acBuffer));
+    
+    psJob->sAddress     = *psAddress;
+    psJob->iMaxHops     = iMaxHops;
+    psJob->eCommand     = eCommand;
+    psJob->u32Length    = u32Length;
+    psJob->iInterface   = psJIP_Context->iMulticastInterface;
+    psJob->iCopiesLeft  = psJIP_Context->iMulticastSendCount;
+    memcpy(psJob->acBuffer, pcBuffer, u32Length);
+    
+    if (psJob->iCopiesLeft <= 0)
+    {
+        free(psJob);
+        return E_JIP_OK;
     }
     
     eJIP_Lock(psJIP_Context);
     
-    /* Set up callback function */
-    psJIP_Private->prCbNetworkChange = prCbNetworkChange;
+    eStatus = eJIP_MulticastSendCopy(psJIP_Context, psJob);
+    psJob->iCopiesLeft--;
     
-    /* Thread data is the JIP context pointer */
-    psJIP_Private->sNetworkChangeMonitor.pvThreadData = psJIP_Context;
-    if (eThreadStart(pvNetworkChangeMonitorThread, &psJIP_Private->sNetworkChangeMonitor, E_THREAD_JOINABLE) != E_THREAD_OK)
+    if ((eStatus == E_JIP_OK) && (psJob->iCopiesLeft > 0))
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Failed to start network monitor thread\n");
-        eJIP_Unlock(psJIP_Context);
-        return E_NETWORK_ERROR_FAILED;
+        if (psJIP_Private->sMulticastThread.eState == E_THREAD_STOPPED)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Starting multicast retransmission thread\n");
+            
+            if (eQueueCreate(&psJIP_Private->sMulticastQueue, 1) != E_QUEUE_OK)
+            {
+                eStatus = E_JIP_ERROR_NO_MEM;
+            }
+            else
+            {
+                /* Mark it running now so that no other caller starts a second one */
+                psJIP_Private->sMulticastThread.eState = E_THREAD_RUNNING;
+                psJIP_Private->sMulticastThread.pvThreadData = psJIP_Context;
+                if (eThreadStart(pvMulticastThread, &psJIP_Private->sMulticastThread, E_THREAD_JOINABLE) != E_THREAD_OK)
+                {
+                    DBG_vPrintf(DBG_JIP_CLIENT, "Failed to start multicast retransmission thread\n");
+                    psJIP_Private->sMulticastThread.eState = E_THREAD_STOPPED;
+                    psJIP_Private->sMulticastThread.pvThreadData = NULL;
+                    eQueueDestroy(&psJIP_Private->sMulticastQueue);
+                    eStatus = E_JIP_ERROR_FAILED;
+                }
+            }
+        }
+        
+        if (eStatus == E_JIP_OK)
+        {
+            psJob->u32Due = u32TimeMillis() + psJIP_Context->iMulticastSendIntervalMs;
+            psJob->psNext = psJIP_Private->psMulticastJobs;
+            psJIP_Private->psMulticastJobs = psJob;
+            psJob = NULL;
+            
+            if (!psJIP_Private->bMulticastWoken)
+            {
+                psJIP_Private->bMulticastWoken = True;
+                bWake = True;
+            }
+        }
     }
     
     eJIP_Unlock(psJIP_Context);
-    return E_JIP_OK;
-}
-
-
-teJIP_Status eJIPService_MonitorNetworkStop(tsJIP_Context *psJIP_Context)
-{
-    PRIVATE_CONTEXT(psJIP_Context);
-    
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
     
-    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    if (bWake)
     {
-        return E_JIP_ERROR_WRONG_CONTEXT;
+        /* Only one wake up is ever queued, so this does not block */
+        eQueueQueue(&psJIP_Private->sMulticastQueue, NULL);
     }
     
-    if ((volatile void *)psJIP_Private->sNetworkChangeMonitor.pvThreadData)
+    if (psJob)
     {
-        /* Monitor thread is running */
-        DBG_vPrintf(DBG_JIP_CLIENT, "Stopping network monitor thread\n");
-
-        if (eThreadStop(&psJIP_Private->sNetworkChangeMonitor) != E_THREAD_OK)
+        /* Finished with the first copy */
+        free(psJob);
+        if (psJIP_Context->prCbMulticastComplete)
         {
-            DBG_vPrintf(DBG_JIP_CLIENT, "Failed to stop network monitor thread\n");
-            return E_JIP_ERROR_FAILED;
+            psJIP_Context->prCbMulticastComplete(psAddress, eStatus);
         }
-        eJIP_Lock(psJIP_Context);
-        psJIP_Private->prCbNetworkChange = NULL;
-        psJIP_Private->sNetworkChangeMonitor.pvThreadData = NULL;
-        eJIP_Unlock(psJIP_Context);
     }
-    
-    return E_JIP_OK;
+    return eStatus;
 }
 
 
-static void NetworkChangeTreeVersionTrap(tsVar *psVersionVar)
+teJIP_Status eJIP_MulticastStop(tsJIP_Context *psJIP_Context)
 {
-    tsJIP_Context *psJIP_Context;
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    PRIVATE_CONTEXT(psJIP_Context);
     
-    /* Get pointer to the JIP context from the Variable */
-    psJIP_Context = psVersionVar->psOwnerMib->psOwnerNode->psOwnerNetwork->psOwnerContext;
-
-    DBG_vPrintf(DBG_JIP_CLIENT, "TreeVersion Trap - Calling DiscoverNetwork()\n");
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
-    if (eJIPService_DiscoverNetwork(psJIP_Context) != E_JIP_OK)
+    if ((volatile void *)psJIP_Private->sMulticastThread.pvThreadData)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+        DBG_vPrintf(DBG_JIP_CLIENT, "Stopping multicast retransmission thread\n");
+        
+        if (eThreadStop(&psJIP_Private->sMulticastThread) != E_THREAD_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Failed to stop multicast retransmission thread\n");
+            return E_JIP_ERROR_FAILED;
+        }
+        eQueueDestroy(&psJIP_Private->sMulticastQueue);
+        
+        eJIP_Lock(psJIP_Context);
+        psJIP_Private->sMulticastThread.pvThreadData = NULL;
+        psJIP_Private->bMulticastWoken = False;
+        eJIP_Unlock(psJIP_Context);
     }
-    
-    return;
+    return E_JIP_OK;
 }
 
 
-static void *pvNetworkChangeMonitorThread(void *psThreadInfoVoid)
+/** Thread that sends the remaining copies of multicast requests as they fall due.
+ *  When nothing is due it sleeps on the queue until a new request is added or the next copy is due.
+ */
+static void *pvMulticastThread(void *psThreadInfoVoid)
 {
     tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
     tsJIP_Context *psJIP_Context = (tsJIP_Context *)psThreadInfo->pvThreadData;
     PRIVATE_CONTEXT(psJIP_Context);
-    uint32_t u32TrapRegistered = 0;
-    tsNode *psNode = NULL;
-    tsMib *psMib = NULL;
-    tsVar *psVar = NULL;
-    const uint8_t u8TreeVersionTrapHandle = 0x12;
-    
-    psThreadInfo->eState = E_THREAD_RUNNING;
+    tsMulticastJob *psJob, **ppsJob, *psFinished;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-
-    /* Ensure that at least the coordinator exists in the network representation before starting thread to monitor it */
-    if (psJIP_Context->sNetwork.u32NumNodes == 0)
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
     {
-        /* Run first discovery before starting to monitor */
-        DBG_vPrintf(DBG_JIP_CLIENT, "Running discovery before registering trap\n");
+        uint32_t u32Wait = 1000, u32Now;
+        void *pvWake;
+        
+        psFinished = NULL;
+        
+        eJIP_Lock(psJIP_Context);
+        u32Now = u32TimeMillis();
+        
+        ppsJob = &psJIP_Private->psMulticastJobs;
+        while ((psJob = *ppsJob) != NULL)
+        {
+            teJIP_Status eStatus = E_JIP_OK;
+            
+            if ((int32_t)(psJob->u32Due - u32Now) <= 0)
+            {
+                eStatus = eJIP_MulticastSendCopy(psJIP_Context, psJob);
+                psJob->iCopiesLeft--;
+                psJob->u32Due = u32Now + psJIP_Context->iMulticastSendIntervalMs;
+            }
+            
+            if ((eStatus != E_JIP_OK) || (psJob->iCopiesLeft <= 0))
+            {
+                /* Done - report it once the lock has been released. The status is kept in iCopiesLeft. */
+                psJob->iCopiesLeft = (eStatus == E_JIP_OK) ? 0 : -1;
+                *ppsJob = psJob->psNext;
+                psJob->psNext = psFinished;
+                psFinished = psJob;
+                continue;
+            }
+            
+            if (psJob->u32Due - u32Now < u32Wait)
+            {
+                u32Wait = psJob->u32Due - u32Now;
+            }
+            ppsJob = &psJob->psNext;
+        }
+        eJIP_Unlock(psJIP_Context);
+        
+        while (psFinished)
+        {
+            psJob = psFinished;
+            psFinished = psFinished->psNext;
+            if (psJIP_Context->prCbMulticastComplete)
+            {
+                psJIP_Context->prCbMulticastComplete(&psJob->sAddress, (psJob->iCopiesLeft == 0) ? E_JIP_OK : E_JIP_ERROR_FAILED);
+            }
+            free(psJob);
+        }
+        
+        if (eQueueDequeueTimed(&psJIP_Private->sMulticastQueue, u32Wait, &pvWake) == E_QUEUE_OK)
+        {
+            eJIP_Lock(psJIP_Context);
+            psJIP_Private->bMulticastWoken = False;
+            eJIP_Unlock(psJIP_Context);
+        }
+    }
+    
+    /* Drop anything that has not been sent */
+    eJIP_Lock(psJIP_Context);
+    psFinished = psJIP_Private->psMulticastJobs;
+    psJIP_Private->psMulticastJobs = NULL;
+    eJIP_Unlock(psJIP_Context);
+    
+    while (psFinished)
+    {
+        psJob = psFinished;
+        psFinished = psFinished->psNext;
+        free(psJob);
+    }
+    
+    eThreadFinish(psThreadInfo);
+    
+    return NULL;
+}
+
+
+teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNode *psNode = psVar->psOwnerMib->psOwnerNode;
+    tsGetInFlight *psInFlight;
+    teJIP_Status eStatus;
+
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    switch (psVar->eVarType)
+    {
+        case(E_JIP_VAR_TYPE_TABLE_BLOB):
+            return eJIP_GetTableVar(psJIP_Context, psVar);
+            break;
+        default:
+            break;
+    }
+    
+    /* If the same variable is already being read, share the result of that request */
+    eJIP_Lock(psJIP_Context);
+    for (psInFlight = psJIP_Private->psGetsInFlight; psInFlight; psInFlight = psInFlight->psNext)
+    {
+        if (psInFlight->psVar == psVar)
+        {
+            break;
+        }
+    }
+    
+    if (psInFlight)
+    {
+        psInFlight->u32Waiters++;
+        eJIP_Unlock(psJIP_Context);
+        
+        DBG_vPrintf(DBG_JIP_CLIENT, "Waiting for GET of %s in progress\n", psVar->pcName);
+        
+        /* The request in progress holds the node lock until its result is in */
+        eJIP_LockNode(psNode, True);
+        eJIP_Lock(psJIP_Context);
+        eStatus = psInFlight->eStatus;
+        if (--psInFlight->u32Waiters == 0)
+        {
+            free(psInFlight);
+        }
+        eJIP_Unlock(psJIP_Context);
+        eJIP_UnlockNode(psNode);
+        return eStatus;
+    }
+    eJIP_Unlock(psJIP_Context);
+    
+    /* If this fails the request just goes ahead without being shared */
+    psInFlight = malloc(sizeof(tsGetInFlight));
+    
+    eJIP_LockNode(psNode, True);
+    
+    if (psInFlight)
+    {
+        memset(psInFlight, 0, sizeof(tsGetInFlight));
+        psInFlight->psVar = psVar;
+        
+        eJIP_Lock(psJIP_Context);
+        psInFlight->psNext = psJIP_Private->psGetsInFlight;
+        psJIP_Private->psGetsInFlight = psInFlight;
+        eJIP_Unlock(psJIP_Context);
+    }
+    
+    eStatus = eJIP_GetVarExchange(psJIP_Context, psVar);
+    
+    if (psInFlight)
+    {
+        tsGetInFlight **ppsInFlight;
+        
+        eJIP_Lock(psJIP_Context);
+        for (ppsInFlight = &psJIP_Private->psGetsInFlight; *ppsInFlight; ppsInFlight = &(*ppsInFlight)->psNext)
+        {
+            if (*ppsInFlight == psInFlight)
+            {
+                *ppsInFlight = psInFlight->psNext;
+                break;
+            }
+        }
+        
+        /* Waiters pick the result up once the node is unlocked, and the last one frees it */
+        psInFlight->eStatus = eStatus;
+        if (psInFlight->u32Waiters == 0)
+        {
+            free(psInFlight);
+        }
+        eJIP_Unlock(psJIP_Context);
+    }
+    
+    eJIP_UnlockNode(psNode);
+    return eStatus;
+}
+
+
+/** Read a single non-table variable from the node.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param psVar                Pointer to the variable to read
+ *  \return E_JIP_OK on success
+ */
+static teJIP_Status eJIP_GetVarExchange(tsJIP_Context *psJIP_Context, tsVar *psVar)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    char buffer[255];
+    uint32_t u32ResponseLen = 255;
+    tsJIP_Msg_GetMibRequest *psJIP_Msg_GetMibRequest = (tsJIP_Msg_GetMibRequest *)buffer;
+    tsJIP_Msg_VarDescriptionHeader *psJIP_Msg_VarDescriptionHeader;
+    tsMib *psMib = psVar->psOwnerMib;
+    tsNode *psNode = psMib->psOwnerNode;
+    
+    eJIP_LockNode(psNode, True);
+    
+    psJIP_Msg_GetMibRequest->u32MibId = htonl(psVar->psOwnerMib->u32MibId);
+    psJIP_Msg_GetMibRequest->sRequest.u8VarIndex = psVar->u8Index;
+    psJIP_Msg_GetMibRequest->sRequest.u8VarCount = 1;
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Get variable %d, MiB 0x%08x, Node:", psVar->u8Index, psVar->psOwnerMib->u32MibId);
+    DBG_vPrintf_IPv6Address(DBG_JIP_CLIENT, psNode->sNode_Address.sin6_addr);
+
+    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psVar->psOwnerMib->psOwnerNode, 3, EXCHANGE_FLAG_NONE,
+                            E_JIP_COMMAND_GET_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_GetMibRequest) - 2, 
+                            E_JIP_COMMAND_GET_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error\n");
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    psJIP_Msg_VarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)buffer;
+
+    if (psJIP_Msg_VarDescriptionHeader->eStatus == E_JIP_ERROR_DISABLED)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Variable is disabled\n");
+        psVar->eEnable = E_JIP_VAR_DISABLED;
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_DISABLED;
+    }
+    else if (psJIP_Msg_VarDescriptionHeader->eStatus != E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error reading (status 0x%02x)\n", psJIP_Msg_VarDescriptionHeader->eStatus);
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    if (psJIP_Msg_VarDescriptionHeader->eVarType != psVar->eVarType)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Type mismatch (got %d, expected %d)\n", psJIP_Msg_VarDescriptionHeader->eVarType, psVar->eVarType);
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    // Set the variable as enabled
+    psVar->eEnable = E_JIP_VAR_ENABLED;
+    
+    {
+        teJIP_Status eStatus = eJIP_SetVarFromPacket(psVar, (uint8_t *)buffer);
+        eJIP_UnlockNode(psNode);
+        return eStatus;
+    }
+}
+
+
+teJIP_Status eJIP_GetVarCached(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u32MaxAgeMs)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNode *psNode = psVar->psOwnerMib->psOwnerNode;
+    bool_t bFresh = False;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%s, %dms)\n", __FUNCTION__, psVar->pcName, u32MaxAgeMs);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if (psVar->eVarType != E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        eJIP_LockNode(psNode, True);
+        
+        if (psVar->pvData && (psVar->eEnable == E_JIP_VAR_ENABLED) && 
+            psVar->psExt && (psVar->psExt->u32LastUpdated != 0) &&
+            ((uint32_t)(u32TimeMillis() - psVar->psExt->u32LastUpdated) <= u32MaxAgeMs))
+        {
+            bFresh = True;
+        }
+        else
+        {
+            /* Make sure the time of the read below is recorded. If this fails the read still goes ahead */
+            (void)psJIP_VarExt(psVar);
+        }
+        
+        eJIP_UnlockNode(psNode);
+    }
+    
+    if (bFresh)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Cache hit for %s\n", psVar->pcName);
+        u32AtomicAdd(&psJIP_Private->u32VarCacheHits, 1);
+        return E_JIP_OK;
+    }
+    
+    u32AtomicAdd(&psJIP_Private->u32VarCacheMisses, 1);
+    return eJIP_GetVar(psJIP_Context, psVar);
+}
+
+
+teJIP_Status eJIP_GetVarCacheStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Hits, uint32_t *pu32Misses)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    if (pu32Hits)
+    {
+        *pu32Hits = u32AtomicGet(&psJIP_Private->u32VarCacheHits);
+    }
+    if (pu32Misses)
+    {
+        *pu32Misses = u32AtomicGet(&psJIP_Private->u32VarCacheMisses);
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_GetVars(tsJIP_Context *psJIP_Context, tsMib *psMib, const uint8_t *pu8VarIndices, uint32_t u32NumVars)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    uint8_t au8Wanted[(UINT8_MAX + 1) / 8];
+    tsNode *psNode = psMib->psOwnerNode;
+    tsVar *psVar;
+    teJIP_Status eStatus = E_JIP_OK, eRangeStatus;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib 0x%08x, %d vars)\n", __FUNCTION__, psMib->u32MibId, u32NumVars);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    /* Bitmap of the variable indices that have been asked for */
+    memset(au8Wanted, pu8VarIndices ? 0x00 : 0xFF, sizeof(au8Wanted));
+    for (i = 0; pu8VarIndices && (i < u32NumVars); i++)
+    {
+        au8Wanted[pu8VarIndices[i] / 8] |= 1 << (pu8VarIndices[i] % 8);
+    }
+#define VAR_WANTED(psVar) (au8Wanted[(psVar)->u8Index / 8] & (1 << ((psVar)->u8Index % 8)))
+    
+    eJIP_LockNode(psNode, True);
+    
+    psVar = psMib->psVars;
+    while (psVar)
+    {
+        tsVar *psFirstVar, *psLastVar, *psRangeVar;
+        uint32_t u32ResponseSize, u32RangeCount, u32VarCount;
+        
+        if (!VAR_WANTED(psVar) || (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB))
+        {
+            /* Tables are read row by row after the plain variables */
+            psVar = psVar->psNext;
+            continue;
+        }
+        
+        /* Grow the range over consecutive variables while the worst case response still fits in a packet.
+         * Unwanted variables in gaps between wanted ones are read too, as that costs no extra round trip.
+         */
+        psFirstVar = psLastVar = psVar;
+        u32VarCount = 1;
+        u32ResponseSize = (sizeof(tsJIP_Msg_VarDescriptionHeader) - sizeof(tsJIP_Msg_VarDescriptionEntry)) + 
+                          sizeof(tsJIP_Msg_VarDescriptionEntry) + u32JIP_VarDataSize(psVar->eVarType, NULL);
+        
+        for (psRangeVar = psVar->psNext, u32RangeCount = 2;
+             psRangeVar && (u32RangeCount <= UINT8_MAX);
+             psRangeVar = psRangeVar->psNext, u32RangeCount++)
+        {
+            if ((psRangeVar->u8Index != psFirstVar->u8Index + u32RangeCount - 1) ||
+                (psRangeVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB))
+            {
+                break;
+            }
+            
+            u32ResponseSize += sizeof(tsJIP_Msg_VarDescriptionEntry) + u32JIP_VarDataSize(psRangeVar->eVarType, NULL);
+            if (u32ResponseSize > PACKET_BUFFER_SIZE)
+            {
+                break;
+            }
+            
+            if (VAR_WANTED(psRangeVar))
+            {
+                psLastVar = psRangeVar;
+                u32VarCount = u32RangeCount;
+            }
+        }
+        
+        eRangeStatus = eJIP_GetVarRange(psJIP_Context, psFirstVar, u32VarCount);
+        if ((eStatus == E_JIP_OK) && (eRangeStatus != E_JIP_OK))
+        {
+            eStatus = eRangeStatus;
+        }
+        
+        psVar = psLastVar->psNext;
+    }
+    
+    eJIP_UnlockNode(psNode);
+    
+    for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+    {
+        if (VAR_WANTED(psVar) && (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB))
+        {
+            eRangeStatus = eJIP_GetTableVar(psJIP_Context, psVar);
+            if ((eStatus == E_JIP_OK) && (eRangeStatus != E_JIP_OK))
+            {
+                eStatus = eRangeStatus;
+            }
+        }
+    }
+#undef VAR_WANTED
+    
+    return eStatus;
+}
+
+
+teJIP_Status eJIP_GetNodeSnapshot(tsJIP_Context *psJIP_Context, tsNode *psNode)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    char buffer[PACKET_BUFFER_SIZE];
+    tsVarRange *psRanges;
+    uint32_t u32NumRanges = 0, u32MaxRanges = 0, u32NextRange = 0;
+    tsMib *psMib;
+    tsVar *psVar;
+    teJIP_Status eStatus = E_JIP_OK, eExchangeStatus, eTableStatus;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    eJIP_LockNode(psNode, True);
+    
+    /* Worst case is one range per variable */
+    for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        u32MaxRanges += psMib->u32NumVars;
+    }
+    
+    psRanges = malloc(u32MaxRanges * sizeof(tsVarRange));
+    if (!psRanges && (u32MaxRanges > 0))
+    {
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    /* Group the variables of every MIB into runs of consecutive indices. Tables are read separately */
+    for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        tsVarRange *psLastRange = NULL;
+        
+        for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+        {
+            if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+            {
+                psLastRange = NULL;
+                continue;
+            }
+            
+            if (psLastRange && (psLastRange->psFirstVar->u8Index + psLastRange->u8VarCount == psVar->u8Index) &&
+                (psLastRange->u8VarCount < UINT8_MAX))
+            {
+                psLastRange->u8VarCount++;
+            }
+            else
+            {
+                psLastRange = &psRanges[u32NumRanges++];
+                psLastRange->psFirstVar = psVar;
+                psLastRange->u8VarCount = 1;
+            }
+        }
+    }
+    
+    while (u32NextRange < u32NumRanges)
+    {
+        tsJIP_Msg_GetMultiRequest *psRequest = (tsJIP_Msg_GetMultiRequest *)buffer;
+        tsJIP_Msg_GetMultiRequestRange *psRequestRanges = (tsJIP_Msg_GetMultiRequestRange *)&buffer[sizeof(tsJIP_Msg_GetMultiRequest)];
+        tsJIP_Msg_GetMultiResponseHeader *psResponse = (tsJIP_Msg_GetMultiResponseHeader *)buffer;
+        uint32_t u32ResponseLen = PACKET_BUFFER_SIZE, u32Offset, u32NumRequested, i;
+        bool_t bMalformed = False, bPartial = False;
+        
+        u32NumRequested = u32NumRanges - u32NextRange;
+        if (u32NumRequested > (PACKET_BUFFER_SIZE - sizeof(tsJIP_Msg_GetMultiRequest)) / sizeof(tsJIP_Msg_GetMultiRequestRange))
+        {
+            u32NumRequested = (PACKET_BUFFER_SIZE - sizeof(tsJIP_Msg_GetMultiRequest)) / sizeof(tsJIP_Msg_GetMultiRequestRange);
+        }
+        
+        psRequest->u8NumRanges = u32NumRequested;
+        for (i = 0; i < u32NumRequested; i++)
+        {
+            tsVarRange *psRange = &psRanges[u32NextRange + i];
+            psRequestRanges[i].u32MibId     = htonl(psRange->psFirstVar->psOwnerMib->u32MibId);
+            psRequestRanges[i].u8VarIndex   = psRange->psFirstVar->u8Index;
+            psRequestRanges[i].u8VarCount   = psRange->u8VarCount;
+        }
+        
+        DBG_vPrintf(DBG_JIP_CLIENT, "Get %d variable ranges, Node:", u32NumRequested);
+        DBG_vPrintf_IPv6Address(DBG_JIP_CLIENT, psNode->sNode_Address.sin6_addr);
+        
+        eExchangeStatus = eJIP_ExchangeStatus(Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                                                                  E_JIP_COMMAND_GET_MULTI_REQUEST, buffer, 
+                                                                  sizeof(tsJIP_Msg_GetMultiRequest) + u32NumRequested * sizeof(tsJIP_Msg_GetMultiRequestRange), 
+                                                                  E_JIP_COMMAND_GET_MULTI_RESPONSE, buffer, &u32ResponseLen));
+        if (eExchangeStatus != E_JIP_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Error\n");
+            eStatus = eExchangeStatus;
+            break;
+        }
+        
+        if ((u32ResponseLen < sizeof(tsJIP_Msg_GetMultiResponseHeader)) || (psResponse->eStatus != E_JIP_OK) ||
+            (psResponse->u8NumRanges == 0) || (psResponse->u8NumRanges > u32NumRequested))
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Bad multi get response\n");
+            eStatus = E_JIP_ERROR_FAILED;
+            break;
+        }
+        
+        u32Offset = sizeof(tsJIP_Msg_GetMultiResponseHeader);
+        for (i = 0; (i < psResponse->u8NumRanges) && !bMalformed; i++)
+        {
+            tsVarRange *psRange = &psRanges[u32NextRange + i];
+            tsJIP_Msg_GetMultiResponseRange *psResponseRange = (tsJIP_Msg_GetMultiResponseRange *)&buffer[u32Offset];
+            
+            if (u32Offset + sizeof(tsJIP_Msg_GetMultiResponseRange) > u32ResponseLen)
+            {
+                bMalformed = True;
+                break;
+            }
+            u32Offset += sizeof(tsJIP_Msg_GetMultiResponseRange);
+            
+            if (psResponseRange->eStatus != E_JIP_OK)
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Error reading MIB 0x%08x (status 0x%02x)\n", 
+                            psRange->psFirstVar->psOwnerMib->u32MibId, psResponseRange->eStatus);
+                if (eStatus == E_JIP_OK)
+                {
+                    eStatus = E_JIP_ERROR_FAILED;
+                }
+                continue;
+            }
+            
+            if ((psResponseRange->u8NumVars > psRange->u8VarCount) ||
+                (eJIP_ParseVarEntries(psRange->psFirstVar, psResponseRange->u8NumVars, buffer, &u32Offset, u32ResponseLen, &eStatus) != E_JIP_OK))
+            {
+                bMalformed = True;
+                break;
+            }
+            
+            if ((i == psResponse->u8NumRanges - 1u) && (psResponse->u8NumRangesOutstanding > 0) && 
+                (psResponseRange->u8NumVars < psRange->u8VarCount))
+            {
+                /* The packet filled up part way through this range - carry on from where it stopped */
+                uint8_t j;
+                
+                if ((psResponseRange->u8NumVars == 0) && (psResponse->u8NumRanges == 1))
+                {
+                    /* Not making any progress */
+                    bMalformed = True;
+                    break;
+                }
+                
+                for (j = 0; j < psResponseRange->u8NumVars; j++)
+                {
+                    psRange->psFirstVar = psRange->psFirstVar->psNext;
+                }
+                psRange->u8VarCount -= psResponseRange->u8NumVars;
+                bPartial = True;
+            }
+        }
+        
+        if (bMalformed)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Malformed multi get response\n");
+            eStatus = E_JIP_ERROR_FAILED;
+            break;
+        }
+        
+        u32NextRange += psResponse->u8NumRanges - (bPartial ? 1 : 0);
+    }
+    
+    eJIP_UnlockNode(psNode);
+    free(psRanges);
+    
+    for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+        {
+            if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+            {
+                eTableStatus = eJIP_GetTableVar(psJIP_Context, psVar);
+                if ((eStatus == E_JIP_OK) && (eTableStatus != E_JIP_OK))
+                {
+                    eStatus = eTableStatus;
+                }
+            }
+        }
+    }
+    
+    return eStatus;
+}
+
+
+/** Read u8VarCount consecutive variables starting at psFirstVar with a single GET request.
+ *  The owning node must be locked.
+ *  \return E_JIP_OK if every variable in the range was read, otherwise the status of the first one that wasn't.
+ */
+static teJIP_Status eJIP_GetVarRange(tsJIP_Context *psJIP_Context, tsVar *psFirstVar, uint8_t u8VarCount)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    char buffer[PACKET_BUFFER_SIZE];
+    uint32_t u32ResponseLen = PACKET_BUFFER_SIZE;
+    uint32_t u32Offset;
+    tsJIP_Msg_GetMibRequest *psJIP_Msg_GetMibRequest = (tsJIP_Msg_GetMibRequest *)buffer;
+    tsNode *psNode = psFirstVar->psOwnerMib->psOwnerNode;
+    teJIP_Status eStatus = E_JIP_OK;
+    
+    psJIP_Msg_GetMibRequest->u32MibId = htonl(psFirstVar->psOwnerMib->u32MibId);
+    psJIP_Msg_GetMibRequest->sRequest.u8VarIndex = psFirstVar->u8Index;
+    psJIP_Msg_GetMibRequest->sRequest.u8VarCount = u8VarCount;
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Get variables %d-%d, MiB 0x%08x, Node:", psFirstVar->u8Index, psFirstVar->u8Index + u8VarCount - 1, 
+                psFirstVar->psOwnerMib->u32MibId);
+    DBG_vPrintf_IPv6Address(DBG_JIP_CLIENT, psNode->sNode_Address.sin6_addr);
+
+    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                            E_JIP_COMMAND_GET_MIB_REQUEST, buffer, sizeof(tsJIP_Msg_GetMibRequest) - 2, 
+                            E_JIP_COMMAND_GET_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error\n");
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    /* The response is the MIB and first variable index followed by one entry per variable */
+    u32Offset = sizeof(tsJIP_Msg_VarDescriptionHeader) - sizeof(tsJIP_Msg_VarDescriptionEntry);
+    
+    if (eJIP_ParseVarEntries(psFirstVar, u8VarCount, buffer, &u32Offset, u32ResponseLen, &eStatus) != E_JIP_OK)
+    {
+        return (eStatus == E_JIP_OK) ? E_JIP_ERROR_FAILED : eStatus;
+    }
+    
+    return eStatus;
+}
+
+
+/** Parse u32VarCount GET response entries at *pu32Offset in buffer into the variables starting at psFirstVar.
+ *  *pu32Offset is advanced past the entries. *peVarStatus is set to the status of the first variable that
+ *  couldn't be read, if it is still E_JIP_OK.
+ *  \return E_JIP_OK if the entries could be parsed, E_JIP_ERROR_BAD_BUFFER_SIZE if the response is truncated or malformed.
+ */
+static teJIP_Status eJIP_ParseVarEntries(tsVar *psFirstVar, uint32_t u32VarCount, char *buffer, uint32_t *pu32Offset, 
+                                         uint32_t u32ResponseLen, teJIP_Status *peVarStatus)
+{
+    uint32_t u32Offset = *pu32Offset;
+    tsVar *psVar;
+    uint32_t i;
+    
+    for (i = 0, psVar = psFirstVar; (i < u32VarCount) && psVar; i++, psVar = psVar->psNext)
+    {
+        tsJIP_Msg_VarDescriptionEntry *psEntry = (tsJIP_Msg_VarDescriptionEntry *)&buffer[u32Offset];
+        teJIP_Status eVarStatus;
+        
+        if (u32Offset + sizeof(tsJIP_Msg_VarDescriptionEntryError) > u32ResponseLen)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Response ends before variable %d\n", psVar->u8Index);
+            return E_JIP_ERROR_BAD_BUFFER_SIZE;
+        }
+        
+        if (psEntry->eStatus != E_JIP_OK)
+        {
+            u32Offset += sizeof(tsJIP_Msg_VarDescriptionEntryError);
+            
+            if (psEntry->eStatus == E_JIP_ERROR_DISABLED)
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Variable %d is disabled\n", psVar->u8Index);
+                psVar->eEnable = E_JIP_VAR_DISABLED;
+                eVarStatus = E_JIP_ERROR_DISABLED;
+            }
+            else
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Error reading variable %d (status 0x%02x)\n", psVar->u8Index, psEntry->eStatus);
+                eVarStatus = E_JIP_ERROR_FAILED;
+            }
+        }
+        else
+        {
+            uint32_t u32DataSize;
+            
+            /* Check there is room for the type and any length byte before sizing the data */
+            u32DataSize = 0;
+            if (u32Offset + sizeof(tsJIP_Msg_VarDescriptionEntry) + sizeof(uint8_t) <= u32ResponseLen)
+            {
+                u32DataSize = u32JIP_VarDataSize(psEntry->eVarType, psEntry->au8Data);
+            }
+            
+            if ((u32DataSize == 0) || (u32Offset + sizeof(tsJIP_Msg_VarDescriptionEntry) + u32DataSize > u32ResponseLen))
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Malformed response at variable %d\n", psVar->u8Index);
+                return E_JIP_ERROR_BAD_BUFFER_SIZE;
+            }
+            u32Offset += sizeof(tsJIP_Msg_VarDescriptionEntry) + u32DataSize;
+            
+            if (psEntry->eVarType != psVar->eVarType)
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Type mismatch (got %d, expected %d)\n", psEntry->eVarType, psVar->eVarType);
+                eVarStatus = E_JIP_ERROR_FAILED;
+            }
+            else
+            {
+                psVar->eEnable = E_JIP_VAR_ENABLED;
+                eVarStatus = eJIP_SetVarFromData(psVar, psEntry->au8Data);
+            }
+        }
+        
+        if ((*peVarStatus == E_JIP_OK) && (eVarStatus != E_JIP_OK))
+        {
+            *peVarStatus = eVarStatus;
+        }
+    }
+    
+    *pu32Offset = u32Offset;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_TrapEvent(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, char *pcPacket)
+{
+    //PRIVATE_CONTEXT(psJIP_Context);
+    tsJIP_Msg_VarDescriptionHeader *psJIP_Msg_VarDescriptionHeader = (tsJIP_Msg_VarDescriptionHeader *)pcPacket;
+    tsNode *psNode;
+    tsMib *psMib;
+    tsVar *psVar;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s Mib %d, Var %d\n", __FUNCTION__, psJIP_Msg_VarDescriptionHeader->u8MibIndex, psJIP_Msg_VarDescriptionHeader->u8VarIndex); 
+
+    psNode = psJIP_LookupNode(psJIP_Context, psAddress);
+    
+    if (psNode)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Got Node\n");
+         
+        psMib = psNode->psMibs;
+        while (psMib)
+        {
+            if (psMib->u8Index == psJIP_Msg_VarDescriptionHeader->u8MibIndex)
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Got Mib\n");
+                 
+                psVar = psMib->psVars;
+                while (psVar)
+                {
+                    if (psVar->u8Index == psJIP_Msg_VarDescriptionHeader->u8VarIndex)
+                    {
+                        DBG_vPrintf(DBG_JIP_CLIENT, "Got Var\n");
+                        eJIP_SetVarFromPacket(psVar, (uint8_t*)pcPacket);
+                        
+                        if (psVar->psExt && psVar->psExt->prCbVarTrap)
+                        {
+                            DBG_vPrintf(DBG_JIP_CLIENT, "Calling Var Trap Callback\n");
+                            psVar->psExt->prCbVarTrap(psVar);
+                        }
+                        break;
+                    }
+
+                    psVar = psVar->psNext;
+                }
+                break;
+            }
+            psMib = psMib->psNext;
+        }
+        eJIP_UnlockNode(psNode);
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_TrapVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t u8NotificationHandle, tprCbVarTrap prCbVarTrap)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsJIP_Msg_TrapRequest *psJIP_Msg_TrapRequest;
+    tsJIP_Msg_VarStatus   *psJIP_Msg_VarStatus;
+    tsNode *psNode;
+    tsMib *psMib;
+
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
+
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+
+    psMib = psVar->psOwnerMib;
+    psNode = psMib->psOwnerNode;
+    
+    eJIP_LockNode(psNode, True);
+    
+    char buffer[255];
+    uint32_t u32ResponseLen = 255;
+    
+    psJIP_Msg_TrapRequest = (tsJIP_Msg_TrapRequest *)buffer;
+    
+    psJIP_Msg_TrapRequest->u8NotificationHandle = u8NotificationHandle;
+    psJIP_Msg_TrapRequest->u8MibIndex = psMib->u8Index;
+    psJIP_Msg_TrapRequest->u8VarIndex = psVar->u8Index;
+
+    DBG_vPrintf(DBG_JIP_CLIENT, "Requesting trap on Mib %d, variable %d\n", psJIP_Msg_TrapRequest->u8MibIndex, psJIP_Msg_TrapRequest->u8VarIndex);
+
+    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                            E_JIP_COMMAND_TRAP_REQUEST, buffer, sizeof(tsJIP_Msg_TrapRequest), 
+                            E_JIP_COMMAND_TRAP_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error requesting trap on variable\n");
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    psJIP_Msg_VarStatus = (tsJIP_Msg_VarStatus *)buffer;
+    DBG_vPrintf(DBG_JIP_CLIENT, "Status: %d \n", psJIP_Msg_VarStatus->eStatus);
+    
+    if (psJIP_Msg_VarStatus->eStatus == E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Trap set up ok, setting callback\n");
+        if (!psJIP_VarExt(psVar))
+        {
+            eJIP_UnlockNode(psNode);
+            return E_JIP_ERROR_NO_MEM;
+        }
+        psVar->psExt->u8TrapHandle = u8NotificationHandle;
+        psVar->psExt->prCbVarTrap = prCbVarTrap;
+        eJIP_UnlockNode(psNode);
+        return E_JIP_OK;
+    }
+    else
+    {
+        eJIP_UnlockNode(psNode);
+        return psJIP_Msg_VarStatus->eStatus;
+    }
+}
+
+
+teJIP_Status eJIP_UntrapVar(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t u8NotificationHandle)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsJIP_Msg_TrapRequest *psJIP_Msg_TrapRequest;
+    tsJIP_Msg_VarStatus   *psJIP_Msg_VarStatus;
+    tsNode *psNode;
+    tsMib *psMib;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);   
+
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+
+    psMib = psVar->psOwnerMib;
+    psNode = psMib->psOwnerNode;
+    
+    eJIP_LockNode(psNode, True);
+    
+    /* Remove callback function pointer */
+    if (psVar->psExt)
+    {
+        psVar->psExt->prCbVarTrap = NULL;
+    }
+    
+    char buffer[255];
+    uint32_t u32ResponseLen = 255;
+    
+    psJIP_Msg_TrapRequest = (tsJIP_Msg_TrapRequest *)buffer;
+    
+    psJIP_Msg_TrapRequest->u8NotificationHandle = u8NotificationHandle;
+    psJIP_Msg_TrapRequest->u8MibIndex = psMib->u8Index;
+    psJIP_Msg_TrapRequest->u8VarIndex = psVar->u8Index;
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Requesting removal of trap on Mib %d, variable %d\n", psJIP_Msg_TrapRequest->u8MibIndex, psJIP_Msg_TrapRequest->u8VarIndex);
+    
+    if (Network_ExchangeJIP(&psJIP_Private->sNetworkContext, psNode, 3, EXCHANGE_FLAG_NONE,
+                            E_JIP_COMMAND_UNTRAP_REQUEST, buffer, sizeof(tsJIP_Msg_TrapRequest), 
+                            E_JIP_COMMAND_TRAP_RESPONSE, buffer, &u32ResponseLen) != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error requesting removal of trap on variable\n");
+        eJIP_UnlockNode(psNode);
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    psJIP_Msg_VarStatus = (tsJIP_Msg_VarStatus *)buffer;
+    DBG_vPrintf(DBG_JIP_CLIENT, "Status: %d \n", psJIP_Msg_VarStatus->eStatus);
+    
+    if (psJIP_Msg_VarStatus->eStatus == E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Trap removed ok\n");
+        eJIP_UnlockNode(psNode);
+        return E_JIP_OK;
+    }
+    else
+    {
+        eJIP_UnlockNode(psNode);
+        return psJIP_Msg_VarStatus->eStatus;
+    }
+}
+
+
+static teJIP_Status eJIP_SetVarFromPacket(tsVar *psVar, uint8_t *buffer)
+{
+    return eJIP_SetVarFromData(psVar, buffer + sizeof(tsJIP_Msg_VarDescriptionHeader));
+}
+
+
+static teJIP_Status eJIP_SetVarFromData(tsVar *psVar, uint8_t *pu8Data)
+{
+    void *pvNewData;
+    teJIP_Status eStatus = E_JIP_OK;
+ 
+    DBG_vPrintf(DBG_JIP_CLIENT, "Set var type %d\n", psVar->eVarType);
+    
+    switch (psVar->eVarType)
+    {
+        case(E_JIP_VAR_TYPE_INT8):
+        case(E_JIP_VAR_TYPE_UINT8):
+        {
+            eStatus = eJIP_SetVarValue(psVar, pu8Data, sizeof(int8_t));
+            break;
+        }
+        
+        case(E_JIP_VAR_TYPE_INT16):
+        case(E_JIP_VAR_TYPE_UINT16):
+        {
+            uint16_t u16Val;
+            memcpy(&u16Val, pu8Data, sizeof(uint16_t));
+            u16Val = ntohs(u16Val);
+            eStatus = eJIP_SetVarValue(psVar, &u16Val, sizeof(int16_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+        {
+            uint32_t u32Val;
+            memcpy(&u32Val, pu8Data, sizeof(uint32_t));
+            u32Val = ntohl(u32Val);
+            eStatus = eJIP_SetVarValue(psVar, &u32Val, sizeof(int32_t));
+            break;
+        }
+
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+        {
+            uint64_t u64Val;
+            memcpy(&u64Val, pu8Data, sizeof(uint64_t));
+            u64Val = be64toh(u64Val);
+            eStatus = eJIP_SetVarValue(psVar, &u64Val, sizeof(int64_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_STR):
+        {
+            /* Special case for string due to incoming packet missing the NULL terminator */
+            uint8_t u8StringLen = pu8Data[0];
+            pvNewData = realloc(psVar->pcData, u8StringLen + 1);
+            if (!pvNewData) 
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
+            psVar->pcData = pvNewData;
+            memcpy(psVar->pcData, &pu8Data[1], u8StringLen);
+            psVar->pcData[u8StringLen] = '\0';
+            psVar->u8Size = u8StringLen + 1;
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_BLOB):
+        {
+            eStatus = eJIP_SetVarValue(psVar, &pu8Data[1], pu8Data[0]);
+            break;
+        }
+        default:
+            DBG_vPrintf(DBG_JIP_CLIENT, "WARNING Unknown variable type (%d)\n", psVar->eVarType);
+    }
+    
+    if ((eStatus == E_JIP_OK) && psVar->psExt)
+    {
+        /* Record when the value arrived for eJIP_GetVarCached. 0 is reserved for "never" */
+        uint32_t u32Now = u32TimeMillis();
+        psVar->psExt->u32LastUpdated = u32Now ? u32Now : 1;
+    }
+    return eStatus;
+}
+
+
+teJIP_Status eJIPService_MonitorNetwork(tsJIP_Context *psJIP_Context, tprCbNetworkChange prCbNetworkChange)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    eJIP_Lock(psJIP_Context);
+    
+    /* Set up callback function */
+    psJIP_Private->prCbNetworkChange = prCbNetworkChange;
+    
+    /* Thread data is the JIP context pointer */
+    psJIP_Private->sNetworkChangeMonitor.pvThreadData = psJIP_Context;
+    if (eThreadStart(pvNetworkChangeMonitorThread, &psJIP_Private->sNetworkChangeMonitor, E_THREAD_JOINABLE) != E_THREAD_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Failed to start network monitor thread\n");
+        eJIP_Unlock(psJIP_Context);
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
+    eJIP_Unlock(psJIP_Context);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIPService_MonitorNetworkStop(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if ((volatile void *)psJIP_Private->sNetworkChangeMonitor.pvThreadData)
+    {
+        /* Monitor thread is running */
+        DBG_vPrintf(DBG_JIP_CLIENT, "Stopping network monitor thread\n");
+
+        if (eThreadStop(&psJIP_Private->sNetworkChangeMonitor) != E_THREAD_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Failed to stop network monitor thread\n");
+            return E_JIP_ERROR_FAILED;
+        }
+        eJIP_Lock(psJIP_Context);
+        psJIP_Private->prCbNetworkChange = NULL;
+        psJIP_Private->sNetworkChangeMonitor.pvThreadData = NULL;
+        eJIP_Unlock(psJIP_Context);
+    }
+    
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SetVarCoalesced(tsJIP_Context *psJIP_Context, tsVar *psVar, const void *pvNewData, uint32_t u32Size)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsPendingSet *psPendingSet, **ppsPendingSet;
+    bool_t bWake = False;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%s)\n", __FUNCTION__, psVar->pcName);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if (u32Size > sizeof(psPendingSet->au8Data))
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    eJIP_Lock(psJIP_Context);
+    
+    if (psJIP_Private->sSetCoalescer.eState == E_THREAD_STOPPED)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Starting set coalescer thread\n");
+        
+        if (eQueueCreate(&psJIP_Private->sSetCoalescerQueue, 1) != E_QUEUE_OK)
+        {
+            eJIP_Unlock(psJIP_Context);
+            return E_JIP_ERROR_NO_MEM;
+        }
+        
+        /* Mark it running now so that no other caller starts a second one */
+        psJIP_Private->sSetCoalescer.eState = E_THREAD_RUNNING;
+        psJIP_Private->sSetCoalescer.pvThreadData = psJIP_Context;
+        if (eThreadStart(pvSetCoalescerThread, &psJIP_Private->sSetCoalescer, E_THREAD_JOINABLE) != E_THREAD_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Failed to start set coalescer thread\n");
+            psJIP_Private->sSetCoalescer.eState = E_THREAD_STOPPED;
+            eQueueDestroy(&psJIP_Private->sSetCoalescerQueue);
+            eJIP_Unlock(psJIP_Context);
+            return E_JIP_ERROR_FAILED;
+        }
+    }
+    
+    for (ppsPendingSet = &psJIP_Private->psPendingSets; (psPendingSet = *ppsPendingSet) != NULL; ppsPendingSet = &psPendingSet->psNext)
+    {
+        if (psPendingSet->psVar == psVar)
+        {
+            break;
+        }
+    }
+    
+    if (!psPendingSet)
+    {
+        psPendingSet = malloc(sizeof(tsPendingSet));
+        if (!psPendingSet)
+        {
+            eJIP_Unlock(psJIP_Context);
+            return E_JIP_ERROR_NO_MEM;
+        }
+        memset(psPendingSet, 0, sizeof(tsPendingSet));
+        
+        /* Keep the node allocated until the value has been sent */
+        eJIP_AcquireNodeHandle(psVar->psOwnerMib->psOwnerNode);
+        psPendingSet->psVar = psVar;
+        psPendingSet->u32LastSent = u32TimeMillis() - psJIP_Private->u32SetCoalescerIntervalMs;
+        
+        /* At the end of the list, behind the variables already waiting */
+        *ppsPendingSet = psPendingSet;
+    }
+    
+    if (psPendingSet->bPending)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Superseding unsent value of %s\n", psVar->pcName);
+        u32AtomicAdd(&psJIP_Private->u32CoalescedSetsSuperseded, 1);
+    }
+    
+    memcpy(psPendingSet->au8Data, pvNewData, u32Size);
+    psPendingSet->u32Size = u32Size;
+    psPendingSet->bPending = True;
+    
+    if (!psJIP_Private->bSetCoalescerWoken)
+    {
+        psJIP_Private->bSetCoalescerWoken = True;
+        bWake = True;
+    }
+    
+    eJIP_Unlock(psJIP_Context);
+    
+    if (bWake)
+    {
+        /* Only one wake up is ever queued, so this does not block */
+        eQueueQueue(&psJIP_Private->sSetCoalescerQueue, NULL);
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SetCoalescerInterval(tsJIP_Context *psJIP_Context, uint32_t u32MinIntervalMs)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%dms)\n", __FUNCTION__, u32MinIntervalMs);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    eJIP_Lock(psJIP_Context);
+    psJIP_Private->u32SetCoalescerIntervalMs = u32MinIntervalMs;
+    eJIP_Unlock(psJIP_Context);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SetCoalescerStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Sent, uint32_t *pu32Superseded)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    if (pu32Sent)
+    {
+        *pu32Sent = u32AtomicGet(&psJIP_Private->u32CoalescedSetsSent);
+    }
+    if (pu32Superseded)
+    {
+        *pu32Superseded = u32AtomicGet(&psJIP_Private->u32CoalescedSetsSuperseded);
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SetCoalescerStop(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if ((volatile void *)psJIP_Private->sSetCoalescer.pvThreadData)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Stopping set coalescer thread\n");
+        
+        if (eThreadStop(&psJIP_Private->sSetCoalescer) != E_THREAD_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Failed to stop set coalescer thread\n");
+            return E_JIP_ERROR_FAILED;
+        }
+        eQueueDestroy(&psJIP_Private->sSetCoalescerQueue);
+        
+        eJIP_Lock(psJIP_Context);
+        psJIP_Private->sSetCoalescer.pvThreadData = NULL;
+        psJIP_Private->bSetCoalescerWoken = False;
+        eJIP_Unlock(psJIP_Context);
+    }
+    return E_JIP_OK;
+}
+
+
+static void NetworkChangeTreeVersionTrap(tsVar *psVersionVar)
+{
+    tsJIP_Context *psJIP_Context;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    /* Get pointer to the JIP context from the Variable */
+    psJIP_Context = psVersionVar->psOwnerMib->psOwnerNode->psOwnerNetwork->psOwnerContext;
+
+    DBG_vPrintf(DBG_JIP_CLIENT, "TreeVersion Trap - Calling DiscoverNetwork()\n");
+    
+    if (eJIPService_DiscoverNetwork(psJIP_Context) != E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+    }
+    
+    return;
+}
+
+
+static void *pvNetworkChangeMonitorThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsJIP_Context *psJIP_Context = (tsJIP_Context *)psThreadInfo->pvThreadData;
+    PRIVATE_CONTEXT(psJIP_Context);
+    uint32_t u32TrapRegistered = 0;
+    tsNode *psNode = NULL;
+    tsMib *psMib = NULL;
+    tsVar *psVar = NULL;
+    const uint8_t u8TreeVersionTrapHandle = 0x12;
+    
+    psThreadInfo->eState = E_THREAD_RUNNING;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    /* Ensure that at least the coordinator exists in the network representation before starting thread to monitor it */
+    if (psJIP_Context->sNetwork.u32NumNodes == 0)
+    {
+        /* Run first discovery before starting to monitor */
+        DBG_vPrintf(DBG_JIP_CLIENT, "Running discovery before registering trap\n");
+        if (eJIPService_DiscoverNetwork(psJIP_Context) != E_JIP_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+        }
+    }
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Register trap on TreeVersion");
+
+    psNode = psJIP_LookupNode(psJIP_Context, &psJIP_Private->sNetworkContext.sBorder_Router_IPv6_Address);
+    if (psNode)
+    {
+        psMib = psJIP_LookupMib(psNode, NULL, "JenNet");
+        
+        if (psMib)
+        {
+            psVar = psJIP_LookupVar(psMib, NULL, "TreeVersion");
+            
+            if (psVar)
+            {
+                if (eJIP_TrapVar(psJIP_Context, psVar, u8TreeVersionTrapHandle, NetworkChangeTreeVersionTrap) == E_JIP_OK)
+                {
+                    DBG_vPrintf(DBG_JIP_CLIENT, "Trap registered\n");
+                    u32TrapRegistered = 1;
+                }
+            }
+        }
+        eJIP_UnlockNode(psNode);
+    }
+
+    if (!u32TrapRegistered)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Trap registration failed, falling back to polling\n");
+    }
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        /* This thread can now spin here and rediscover every 60s to catch any changes
+         * that haven't been picked up by the trap
+         */
+#define DISCOVERY_TIME (60)
         if (eJIPService_DiscoverNetwork(psJIP_Context) != E_JIP_OK)
         {
-            DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+            DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+        }
+        sleep(DISCOVERY_TIME);
+#undef DISCOVERY_TIME
+    }
+    
+    if (u32TrapRegistered)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Untrapping tree version\n");
+        
+        if (eJIP_UntrapVar(psJIP_Context, psVar, u8TreeVersionTrapHandle) != E_JIP_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Error untrapping tree version\n");
+        }
+    }
+    
+    eThreadFinish(psThreadInfo);
+    
+    return NULL;
+}
+
+
+/** Thread that sends the values queued by \ref eJIP_SetVarCoalesced.
+ *  Each pass sends the first pending value in the list that is due, and frees entries that have 
+ *  nothing to send once their interval has passed. The entry sent goes to the end of the list, so 
+ *  variables take turns, and one written continuously can't keep the others from being sent.
+ *  When nothing is due the thread sleeps on the queue until a new value arrives or the next entry 
+ *  becomes due.
+ */
+static void *pvSetCoalescerThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsJIP_Context *psJIP_Context = (tsJIP_Context *)psThreadInfo->pvThreadData;
+    PRIVATE_CONTEXT(psJIP_Context);
+    uint8_t au8Data[UINT8_MAX + 1];
+    tsPendingSet *psPendingSet, **ppsPendingSet, **ppsSend, *psFinished;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        tsPendingSet *psSend = NULL;
+        uint32_t u32Size = 0, u32Wait = 1000, u32Now, u32Age;
+        void *pvWake;
+        
+        psFinished = NULL;
+        
+        eJIP_Lock(psJIP_Context);
+        u32Now = u32TimeMillis();
+        
+        ppsPendingSet = &psJIP_Private->psPendingSets;
+        while ((psPendingSet = *ppsPendingSet) != NULL)
+        {
+            u32Age = u32Now - psPendingSet->u32LastSent;
+            
+            if (u32Age < psJIP_Private->u32SetCoalescerIntervalMs)
+            {
+                /* Too soon after the last set of this variable */
+                if (psJIP_Private->u32SetCoalescerIntervalMs - u32Age < u32Wait)
+                {
+                    u32Wait = psJIP_Private->u32SetCoalescerIntervalMs - u32Age;
+                }
+            }
+            else if (psPendingSet->bPending)
+            {
+                /* Ready. If there are others they are picked up on the next pass */
+                if (!psSend)
+                {
+                    psSend = psPendingSet;
+                    ppsSend = ppsPendingSet;
+                }
+            }
+            else
+            {
+                /* Nothing more to send */
+                *ppsPendingSet = psPendingSet->psNext;
+                psPendingSet->psNext = psFinished;
+                psFinished = psPendingSet;
+                continue;
+            }
+            ppsPendingSet = &psPendingSet->psNext;
+        }
+        
+        if (psSend)
+        {
+            /* Take the value, so that anything arriving during the set waits for the next one */
+            u32Size = psSend->u32Size;
+            memcpy(au8Data, psSend->au8Data, u32Size);
+            psSend->bPending = False;
+            psSend->u32LastSent = u32Now;
+            
+            if (psSend->psNext)
+            {
+                /* Behind the others for its next turn. ppsPendingSet is left at the end of the list */
+                *ppsSend = psSend->psNext;
+                psSend->psNext = NULL;
+                *ppsPendingSet = psSend;
+            }
+        }
+        eJIP_Unlock(psJIP_Context);
+        
+        while (psFinished)
+        {
+            psPendingSet = psFinished;
+            psFinished = psFinished->psNext;
+            eJIP_ReleaseNode(psPendingSet->psVar->psOwnerMib->psOwnerNode);
+            free(psPendingSet);
+        }
+        
+        if (psSend)
+        {
+            /* Only this thread removes entries, so psSend stays valid */
+            DBG_vPrintf(DBG_JIP_CLIENT, "Coalesced set of %s\n", psSend->psVar->pcName);
+            if (eJIP_SetVar(psJIP_Context, psSend->psVar, au8Data, u32Size) != E_JIP_OK)
+            {
+                DBG_vPrintf(DBG_JIP_CLIENT, "Coalesced set of %s failed\n", psSend->psVar->pcName);
+            }
+            else
+            {
+                u32AtomicAdd(&psJIP_Private->u32CoalescedSetsSent, 1);
+            }
+            continue;
+        }
+        
+        if (eQueueDequeueTimed(&psJIP_Private->sSetCoalescerQueue, u32Wait, &pvWake) == E_QUEUE_OK)
+        {
+            eJIP_Lock(psJIP_Context);
+            psJIP_Private->bSetCoalescerWoken = False;
+            eJIP_Unlock(psJIP_Context);
+        }
+    }
+    
+    /* Drop anything that has not been sent */
+    eJIP_Lock(psJIP_Context);
+    psFinished = psJIP_Private->psPendingSets;
+    psJIP_Private->psPendingSets = NULL;
+    eJIP_Unlock(psJIP_Context);
+    
+    while (psFinished)
+    {
+        psPendingSet = psFinished;
+        psFinished = psFinished->psNext;
+        eJIP_ReleaseNode(psPendingSet->psVar->psOwnerMib->psOwnerNode);
+        free(psPendingSet);
+    }
+    
+    eThreadFinish(psThreadInfo);
+    
+    return NULL;
+}
+
+
+teJIP_Status eJIP_SceneCreate(tsJIP_Context *psJIP_Context, const tsSceneEntry *pasEntries, uint32_t u32NumEntries, 
+                              int iMaxHops, tsScene **ppsScene)
+{
+    return eJIP_SceneCompile(psJIP_Context, pasEntries, u32NumEntries, iMaxHops, True, ppsScene);
+}
+
+
+/** Compile a scene, as \ref eJIP_SceneCreate.
+ *  \param bUseGroups           If False, unicast settings are never merged into multicasts
+ */
+static teJIP_Status eJIP_SceneCompile(tsJIP_Context *psJIP_Context, const tsSceneEntry *pasEntries, uint32_t u32NumEntries, 
+                                      int iMaxHops, bool_t bUseGroups, tsScene **ppsScene)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsScene *psScene;
+    tsGroupMembership *pasMembers = NULL;
+    uint32_t u32NumMembers = 0, u32NumNodes = 0, u32NumUnicast = 0, i, j;
+    teJIP_Status eStatus;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d entries)\n", __FUNCTION__, u32NumEntries);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if (u32NumEntries == 0)
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    psScene = malloc(sizeof(tsScene));
+    if (!psScene)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    memset(psScene, 0, sizeof(tsScene));
+    psScene->iMaxHops = iMaxHops;
+    
+    psScene->pasEntries = malloc(sizeof(tsSceneEntryPlan) * u32NumEntries);
+    if (!psScene->pasEntries)
+    {
+        free(psScene);
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    for (i = 0; i < u32NumEntries; i++)
+    {
+        tsSceneEntryPlan *psPlan = &psScene->pasEntries[i];
+        tsJIP_Msg_SetRequest *psRequest = (tsJIP_Msg_SetRequest *)psPlan->au8Encoded;
+        tsVar *psVar = pasEntries[i].psVar;
+        
+        memset(psPlan, 0, offsetof(tsSceneEntryPlan, au8Data));
+        psPlan->psVar       = psVar;
+        psPlan->u32MibId    = psVar->psOwnerMib->u32MibId;
+        psPlan->u32Size     = pasEntries[i].u32Size;
+        
+        psRequest->u8VarIndex       = psVar->u8Index;
+        psRequest->sVar.eVarType    = psVar->eVarType;
+        psPlan->u32EncodedLength    = sizeof(tsJIP_Msg_SetRequest);
+        
+        eStatus = eJIP_EncodeSetData(psVar, pasEntries[i].pvData, &psPlan->u32Size, (char *)psPlan->au8Encoded, 
+                                     &psPlan->u32EncodedLength, sizeof(psPlan->au8Encoded));
+        if (eStatus != E_JIP_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Could not encode scene entry %d\n", i);
+            psScene->u32NumEntries = i;
+            eJIP_SceneDestroy(psJIP_Context, psScene);
+            return eStatus;
+        }
+        
+        if (psVar->eVarType == E_JIP_VAR_TYPE_STR)
+        {
+            /* The local copy includes a terminator that the caller's data need not have */
+            memcpy(psPlan->au8Data, pasEntries[i].pvData, psPlan->u32Size - 1);
+            psPlan->au8Data[psPlan->u32Size - 1] = '\0';
+        }
+        else
+        {
+            memcpy(psPlan->au8Data, pasEntries[i].pvData, psPlan->u32Size);
+        }
+        
+        if (pasEntries[i].psGroupAddress)
+        {
+            psPlan->bMulticast      = True;
+            psPlan->sGroupAddress   = *pasEntries[i].psGroupAddress;
+        }
+        else
+        {
+            psPlan->psNode = psVar->psOwnerMib->psOwnerNode;
+            eJIP_AcquireNodeHandle(psPlan->psNode);
+            vJIP_SceneUnicastCost(psPlan);
+            psScene->u32UnicastCost += psPlan->u32UnicastCost;
+            u32NumUnicast++;
+        }
+        
+        /* Find the first entry setting the same variable of the same MIB to the same value, to the same kind of destination */
+        for (j = 0; j < i; j++)
+        {
+            if ((psScene->pasEntries[j].bMulticast == psPlan->bMulticast) &&
+                (psScene->pasEntries[j].u32MibId == psPlan->u32MibId) &&
+                (psScene->pasEntries[j].u32EncodedLength == psPlan->u32EncodedLength) &&
+                (memcmp(psScene->pasEntries[j].au8Encoded, psPlan->au8Encoded, psPlan->u32EncodedLength) == 0))
+            {
+                break;
+            }
+        }
+        psPlan->u32Class = j;
+        
+        psScene->u32NumEntries = i + 1;
+    }
+    
+    psScene->u32Cost = psScene->u32UnicastCost;
+    
+    if (bUseGroups && (u32NumUnicast > 1))
+    {
+        if (eJIP_SceneGroupMembership(psJIP_Context, &pasMembers, &u32NumMembers, &u32NumNodes, False) == E_JIP_OK)
+        {
+            /* Every node in the network passes each copy of a multicast on */
+            psScene->u32MulticastCost = psJIP_Context->iMulticastSendCount * u32NumNodes * 1000;
+            vJIP_SceneMergeGroups(psScene, pasMembers, u32NumMembers);
+            free(pasMembers);
+        }
+        else
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Group membership not known - scene will not use multicasts\n");
+        }
+    }
+    
+    eStatus = eJIP_ScenePacketise(psScene);
+    if (eStatus != E_JIP_OK)
+    {
+        eJIP_SceneDestroy(psJIP_Context, psScene);
+        return eStatus;
+    }
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Scene of %d entries compiled to %d requests\n", psScene->u32NumEntries, psScene->u32NumPackets);
+    *ppsScene = psScene;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SceneApply(tsJIP_Context *psJIP_Context, tsScene *psScene, teJIP_Status *paeStatus)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNetworkExchange *pasExchanges;
+    teJIP_Status *paePacketStatus;
+    teJIP_Status eStatus = E_JIP_OK, eEntryStatus;
+    uint32_t *pau32Exchange;
+    uint32_t u32NumExchanges = 0, i;
+    char *pcResponses;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    /* One block for the status and exchange of each request and a buffer for each response */
+    pasExchanges = malloc(psScene->u32NumPackets * (sizeof(tsNetworkExchange) + sizeof(teJIP_Status) + sizeof(uint32_t) + PACKET_BUFFER_SIZE));
+    if (!pasExchanges)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    paePacketStatus = (teJIP_Status *)&pasExchanges[psScene->u32NumPackets];
+    pau32Exchange = (uint32_t *)&paePacketStatus[psScene->u32NumPackets];
+    pcResponses = (char *)&pau32Exchange[psScene->u32NumPackets];
+    
+    /* Multicasts first, as they get no response to wait for */
+    for (i = 0; i < psScene->u32NumPackets; i++)
+    {
+        tsScenePacket *psPacket = &psScene->pasPackets[i];
+        
+        pau32Exchange[i] = psScene->u32NumPackets;
+        if (psPacket->psNode)
+        {
+            continue;
+        }
+        paePacketStatus[i] = eJIP_MulticastSend(psJIP_Context, &psPacket->sAddress, psScene->iMaxHops, 
+                                                psPacket->eCommand, psPacket->acBuffer, psPacket->u32Length);
+    }
+    
+    for (i = 0; i < psScene->u32NumPackets; i++)
+    {
+        tsScenePacket *psPacket = &psScene->pasPackets[i];
+        tsNetworkExchange *psExchange = &pasExchanges[u32NumExchanges];
+        
+        if (!psPacket->psNode)
+        {
+            continue;
+        }
+        
+        eJIP_LockNode(psPacket->psNode, True);
+        if (psPacket->psNode->bRemoved)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Scene node has left the network\n");
+            paePacketStatus[i] = E_JIP_ERROR_FAILED;
+            eJIP_UnlockNode(psPacket->psNode);
+            continue;
+        }
+        psExchange->sAddress    = psPacket->psNode->sNode_Address;
+        psExchange->u32DeviceId = psPacket->psNode->u32DeviceId;
+        psExchange->psLinkStats = psPacket->psNode->pvPriv ? &((tsNode_Private *)psPacket->psNode->pvPriv)->sLinkStats : NULL;
+        eJIP_UnlockNode(psPacket->psNode);
+        
+        psExchange->eSendCommand        = psPacket->eCommand;
+        psExchange->pcSendData          = psPacket->acBuffer;
+        psExchange->iSendDataLength     = psPacket->u32Length;
+        psExchange->eReceiveCommand     = (psPacket->eCommand == E_JIP_COMMAND_SET_MULTI_REQUEST) ? 
+                                            E_JIP_COMMAND_SET_MULTI_RESPONSE : E_JIP_COMMAND_SET_RESPONSE;
+        psExchange->pcReceiveData       = &pcResponses[u32NumExchanges * PACKET_BUFFER_SIZE];
+        psExchange->iReceiveDataLength  = PACKET_BUFFER_SIZE;
+        
+        pau32Exchange[i] = u32NumExchanges++;
+    }
+    
+    if (u32NumExchanges > 0)
+    {
+        Network_ExchangeJIPBatch(&psJIP_Private->sNetworkContext, pasExchanges, u32NumExchanges, 3);
+    }
+    
+    for (i = 0; i < psScene->u32NumEntries; i++)
+    {
+        tsSceneEntryPlan *psPlan = &psScene->pasEntries[i];
+        tsScenePacket *psPacket = &psScene->pasPackets[psPlan->u32Packet];
+        tsNetworkExchange *psExchange;
+        
+        if (pau32Exchange[psPlan->u32Packet] == psScene->u32NumPackets)
+        {
+            /* Multicast, or not sent */
+            eEntryStatus = paePacketStatus[psPlan->u32Packet];
+        }
+        else if ((psExchange = &pasExchanges[pau32Exchange[psPlan->u32Packet]])->eStatus != E_NETWORK_OK)
+        {
+            eEntryStatus = eJIP_ExchangeStatus(psExchange->eStatus);
+        }
+        else if (psPacket->eCommand == E_JIP_COMMAND_SET_MIB_REQUEST)
+        {
+            eEntryStatus = (psExchange->iReceiveDataLength < sizeof(tsJIP_Msg_VarStatus)) ? E_JIP_ERROR_FAILED :
+                            ((tsJIP_Msg_VarStatus *)psExchange->pcReceiveData)->eStatus;
+        }
+        else
+        {
+            tsJIP_Msg_SetMultiResponseHeader *psResponse = (tsJIP_Msg_SetMultiResponseHeader *)psExchange->pcReceiveData;
+            tsJIP_Msg_SetMultiResponseEntry *psResponseEntries = 
+                (tsJIP_Msg_SetMultiResponseEntry *)&psExchange->pcReceiveData[sizeof(tsJIP_Msg_SetMultiResponseHeader)];
+            
+            if ((psExchange->iReceiveDataLength < sizeof(tsJIP_Msg_SetMultiResponseHeader)) ||
+                (psExchange->iReceiveDataLength < sizeof(tsJIP_Msg_SetMultiResponseHeader) + 
+                                                  psResponse->u8NumVars * sizeof(tsJIP_Msg_SetMultiResponseEntry)))
+            {
+                eEntryStatus = E_JIP_ERROR_FAILED;
+            }
+            else if (psPlan->u32Slot < psResponse->u8NumVars)
+            {
+                eEntryStatus = psResponseEntries[psPlan->u32Slot].eStatus;
+            }
+            else
+            {
+                eEntryStatus = (psResponse->eStatus != E_JIP_OK) ? psResponse->eStatus : E_JIP_ERROR_FAILED;
+            }
+        }
+        
+        if ((eEntryStatus == E_JIP_OK) && psPacket->psNode)
+        {
+            // Update local copy 
+            eJIP_LockNode(psPlan->psNode, True);
+            eEntryStatus = eJIP_SetVarValue(psPlan->psVar, psPlan->au8Data, psPlan->u32Size);
+            eJIP_UnlockNode(psPlan->psNode);
+        }
+        else if (eEntryStatus != E_JIP_OK)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "Scene entry %d failed (%d)\n", i, eEntryStatus);
+        }
+        
+        if (paeStatus)
+        {
+            paeStatus[i] = eEntryStatus;
+        }
+        if (eStatus == E_JIP_OK)
+        {
+            eStatus = eEntryStatus;
+        }
+    }
+    
+    free(pasExchanges);
+    return eStatus;
+}
+
+
+teJIP_Status eJIP_SceneGetPacketCounts(tsScene *psScene, uint32_t *pu32Unicasts, uint32_t *pu32Multicasts)
+{
+    uint32_t u32Unicasts = 0, i;
+    
+    for (i = 0; i < psScene->u32NumPackets; i++)
+    {
+        if (psScene->pasPackets[i].psNode)
+        {
+            u32Unicasts++;
+        }
+    }
+    
+    if (pu32Unicasts)
+    {
+        *pu32Unicasts = u32Unicasts;
+    }
+    if (pu32Multicasts)
+    {
+        *pu32Multicasts = psScene->u32NumPackets - u32Unicasts;
+    }
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SceneDestroy(tsJIP_Context *psJIP_Context, tsScene *psScene)
+{
+    uint32_t i;
+    
+    /* Scenes are not held by the context, so there is nothing of it to update */
+    (void)psJIP_Context;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    for (i = 0; i < psScene->u32NumEntries; i++)
+    {
+        if (psScene->pasEntries[i].psNode)
+        {
+            eJIP_ReleaseNode(psScene->pasEntries[i].psNode);
+        }
+    }
+    free(psScene->pasEntries);
+    free(psScene->pasPackets);
+    free(psScene);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_SetVarFanout(tsJIP_Context *psJIP_Context, tsVar **papsVars, uint32_t u32NumTargets, void *pvData, uint32_t u32Size, 
+                               int iMaxHops, teJIP_Status *paeStatus, tsFanoutReport *psReport)
+{
+    tsSceneEntry *pasEntries;
+    tsScene *psScene;
+    teJIP_Status eStatus;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d targets)\n", __FUNCTION__, u32NumTargets);
+    
+    if (u32NumTargets == 0)
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    pasEntries = malloc(sizeof(tsSceneEntry) * u32NumTargets);
+    if (!pasEntries)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    for (i = 0; i < u32NumTargets; i++)
+    {
+        pasEntries[i].psVar             = papsVars[i];
+        pasEntries[i].psGroupAddress    = NULL;
+        pasEntries[i].pvData            = pvData;
+        pasEntries[i].u32Size           = u32Size;
+    }
+    
+    eStatus = eJIP_SceneCreate(psJIP_Context, pasEntries, u32NumTargets, iMaxHops, &psScene);
+    free(pasEntries);
+    if (eStatus != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    
+    if (psReport)
+    {
+        memset(psReport, 0, sizeof(tsFanoutReport));
+        eJIP_SceneGetPacketCounts(psScene, NULL, &psReport->u32Multicasts);
+        for (i = 0; i < psScene->u32NumEntries; i++)
+        {
+            if (psScene->pasEntries[i].bMulticast)
+            {
+                psReport->u32MulticastNodes++;
+            }
+            else
+            {
+                psReport->u32Unicasts++;
+            }
+        }
+        psReport->u32Cost           = (psScene->u32Cost + 500) / 1000;
+        psReport->u32UnicastCost    = (psScene->u32UnicastCost + 500) / 1000;
+        
+        DBG_vPrintf(DBG_JIP_CLIENT, "Fan out to %d nodes: %d unicasts, %d multicasts reaching %d nodes (cost %d, all unicast %d)\n", 
+                    u32NumTargets, psReport->u32Unicasts, psReport->u32Multicasts, psReport->u32MulticastNodes,
+                    psReport->u32Cost, psReport->u32UnicastCost);
+    }
+    
+    eStatus = eJIP_SceneApply(psJIP_Context, psScene, paeStatus);
+    eJIP_SceneDestroy(psJIP_Context, psScene);
+    return eStatus;
+}
+
+
+teJIP_Status eJIP_MulticastGetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psAddress, int iMaxHops, uint32_t u32JitterMs,
+                                  tsGroupGetResult *pasResults, uint32_t u32MaxResults, uint32_t *pu32NumResults)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNetworkResponse *pasResponses;
+    uint32_t u32NumResponses = 0, u32MibId, i;
+    uint8_t u8VarIndex;
+    teJIP_Status eStatus;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    *pu32NumResults = 0;
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if (u32MaxResults == 0)
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    pasResponses = malloc(u32MaxResults * sizeof(tsNetworkResponse));
+    if (!pasResponses)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    eStatus = eJIP_GroupGet(psJIP_Context, psVar, psAddress, iMaxHops, u32JitterMs, pasResponses, u32MaxResults, &u32NumResponses);
+    if (eStatus != E_JIP_OK)
+    {
+        free(pasResponses);
+        return eStatus;
+    }
+    
+    eJIP_LockNode(psVar->psOwnerMib->psOwnerNode, True);
+    u32MibId    = psVar->psOwnerMib->u32MibId;
+    u8VarIndex  = psVar->u8Index;
+    eJIP_UnlockNode(psVar->psOwnerMib->psOwnerNode);
+    
+    for (i = 0; i < u32NumResponses; i++)
+    {
+        tsNetworkResponse *psResponse = &pasResponses[i];
+        tsJIP_Msg_VarDescriptionHeader *psHeader = (tsJIP_Msg_VarDescriptionHeader *)psResponse->acData;
+        tsGroupGetResult *psResult = &pasResults[i];
+        tsNode *psFound;
+        
+        psResult->sAddress  = psResponse->sAddress;
+        psResult->bUpdated  = False;
+        
+        if (psResponse->iLength < sizeof(tsJIP_Msg_VarDescriptionHeader))
+        {
+            psResult->eStatus = E_JIP_ERROR_FAILED;
+            continue;
+        }
+        psResult->eStatus = psHeader->eStatus;
+        
+        /* Responses come from the node's address, on whatever port the server uses */
+        psFound = psJIP_AcquireNodeByIn6(psJIP_Context, &psResponse->sAddress.sin6_addr);
+        
+        if (!psFound)
+        {
+            continue;
+        }
+        
+        eJIP_LockNode(psFound, True);
+        if (!psFound->bRemoved)
+        {
+            tsMib *psMib = psJIP_LookupMibId(psFound, NULL, u32MibId);
+            tsVar *psMemberVar = psMib ? psJIP_LookupVarIndex(psMib, u8VarIndex) : NULL;
+            
+            if (psMemberVar && (psResult->eStatus == E_JIP_OK))
+            {
+                if (psHeader->eVarType != psMemberVar->eVarType)
+                {
+                    DBG_vPrintf(DBG_JIP_CLIENT, "Type mismatch (got %d, expected %d)\n", psHeader->eVarType, psMemberVar->eVarType);
+                    psResult->eStatus = E_JIP_ERROR_WRONG_TYPE;
+                }
+                else
+                {
+                    psMemberVar->eEnable = E_JIP_VAR_ENABLED;
+                    psResult->eStatus = eJIP_SetVarFromPacket(psMemberVar, (uint8_t *)psResponse->acData);
+                    psResult->bUpdated = (psResult->eStatus == E_JIP_OK);
+                }
+            }
+            else if (psMemberVar && (psResult->eStatus == E_JIP_ERROR_DISABLED))
+            {
+                psMemberVar->eEnable = E_JIP_VAR_DISABLED;
+            }
+        }
+        eJIP_UnlockNode(psFound);
+        eJIP_ReleaseNode(psFound);
+    }
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Group read got %d responses\n", u32NumResponses);
+    
+    *pu32NumResults = u32NumResponses;
+    free(pasResponses);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_MulticastSetVarVerified(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvData, uint32_t u32Size, 
+                                          tsJIPAddress *psAddress, int iMaxHops, tsGroupSetResult *pasResults, 
+                                          uint32_t u32MaxResults, tsGroupSetReport *psReport)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsVar **papsMembers = NULL;
+    bool_t *pabConverged = NULL;
+    tsSceneEntry *pasRepairs = NULL;
+    teJIP_Status *paeRepairStatus = NULL;
+    tsScene *psScene;
+    tsGroupSetReport sReport;
+    uint8_t au8Value[256];
+    uint32_t u32ValueLength = 0, u32ValueSize = u32Size, u32NumMembers = 0, u32NumRepairs = 0, u32Settle, i, j;
+    teJIP_Status eStatus, eMemberStatus;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_CLIENT)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        /* A table is not read back as the value it was set with */
+        return E_JIP_ERROR_WRONG_TYPE;
+    }
+    
+    /* The value as a member reports it when read */
+    eStatus = eJIP_EncodeSetData(psVar, pvData, &u32ValueSize, (char *)au8Value, &u32ValueLength, sizeof(au8Value));
+    if (eStatus != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    
+    eStatus = eJIP_GroupMemberVars(psJIP_Context, psAddress, psVar->psOwnerMib->u32MibId, psVar->u8Index, &papsMembers, &u32NumMembers);
+    if (eStatus != E_JIP_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Members of group are not known\n");
+        return eStatus;
+    }
+    
+    memset(&sReport, 0, sizeof(tsGroupSetReport));
+    sReport.u32Members = u32NumMembers;
+    
+    eStatus = eJIP_MulticastSetVar(psJIP_Context, psVar, pvData, u32Size, psAddress, iMaxHops);
+    if (eStatus != E_JIP_OK)
+    {
+        /* Carry on - the members will all be repaired */
+        DBG_vPrintf(DBG_JIP_CLIENT, "Multicast set failed (%d)\n", eStatus);
+    }
+    
+    if (u32NumMembers > 0)
+    {
+        pabConverged    = malloc(u32NumMembers * (sizeof(bool_t) + sizeof(teJIP_Status)));
+        pasRepairs      = malloc(u32NumMembers * sizeof(tsSceneEntry));
+        if (!pabConverged || !pasRepairs)
+        {
+            eStatus = E_JIP_ERROR_NO_MEM;
+            goto done;
+        }
+        paeRepairStatus = (teJIP_Status *)&pabConverged[u32NumMembers];
+        
+        /* Wait for the retransmissions of the multicast to be sent and to cross the network */
+        u32Settle = JIP_VERIFY_SETTLE_TIME;
+        if (psJIP_Context->iMulticastSendCount > 1)
+        {
+            u32Settle += (psJIP_Context->iMulticastSendCount - 1) * psJIP_Context->iMulticastSendIntervalMs;
+        }
+        usleep(u32Settle * 1000);
+        
+        eStatus = eJIP_ReadBackVars(psJIP_Context, psAddress, iMaxHops, papsMembers, u32NumMembers, au8Value, u32ValueLength, pabConverged);
+        if (eStatus != E_JIP_OK)
+        {
+            goto done;
+        }
+        
+        for (i = 0; i < u32NumMembers; i++)
+        {
+            if (pabConverged[i])
+            {
+                sReport.u32Converged++;
+                continue;
+            }
+            pasRepairs[u32NumRepairs].psVar             = papsMembers[i];
+            pasRepairs[u32NumRepairs].psGroupAddress    = NULL;
+            pasRepairs[u32NumRepairs].pvData            = pvData;
+            pasRepairs[u32NumRepairs].u32Size           = u32Size;
+            u32NumRepairs++;
+        }
+        
+        if (u32NumRepairs > 0)
+        {
+            DBG_vPrintf(DBG_JIP_CLIENT, "%d of %d members missed the multicast\n", u32NumRepairs, u32NumMembers);
+            
+            /* Only the members that missed it - never multicast again */
+            eStatus = eJIP_SceneCompile(psJIP_Context, pasRepairs, u32NumRepairs, iMaxHops, False, &psScene);
+            if (eStatus != E_JIP_OK)
+            {
+                goto done;
+            }
+            eJIP_SceneApply(psJIP_Context, psScene, paeRepairStatus);
+            eJIP_SceneDestroy(psJIP_Context, psScene);
+        }
+        
+        eStatus = E_JIP_OK;
+        for (i = 0, j = 0; i < u32NumMembers; i++)
+        {
+            tsNode *psNode = papsMembers[i]->psOwnerMib->psOwnerNode;
+            
+            if (pabConverged[i])
+            {
+                eMemberStatus = E_JIP_OK;
+            }
+            else
+            {
+                eMemberStatus = paeRepairStatus[j++];
+                if (eMemberStatus == E_JIP_OK)
+                {
+                    sReport.u32Repaired++;
+                }
+                else
+                {
+                    sReport.u32Failed++;
+                    if (eStatus == E_JIP_OK)
+                    {
+                        eStatus = eMemberStatus;
+                    }
+                }
+            }
+            
+            if (pasResults && (i < u32MaxResults))
+            {
+                eJIP_LockNode(psNode, True);
+                pasResults[i].sAddress  = psNode->sNode_Address;
+                eJIP_UnlockNode(psNode);
+                pasResults[i].eStatus   = eMemberStatus;
+                pasResults[i].bRepaired = (!pabConverged[i] && (eMemberStatus == E_JIP_OK));
+            }
+        }
+    }
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Verified multicast to %d members: %d converged, %d repaired, %d failed\n", 
+                sReport.u32Members, sReport.u32Converged, sReport.u32Repaired, sReport.u32Failed);
+    
+done:
+    if (psReport)
+    {
+        *psReport = sReport;
+    }
+    for (i = 0; i < u32NumMembers; i++)
+    {
+        eJIP_ReleaseNode(papsMembers[i]->psOwnerMib->psOwnerNode);
+    }
+    free(papsMembers);
+    free(pabConverged);
+    free(pasRepairs);
+    return eStatus;
+}
+
+
+/** Read which multicast groups every node in the network belongs to from the node's Groups MIB.
+ *  The number of nodes in the network is returned in *pu32NumNodes.
+ *  \param bHold                If True, a handle is taken on the node of each membership returned,
+ *                              which the caller must release.
+ *  \return E_JIP_OK if the membership of every node is known
+ */
+static teJIP_Status eJIP_SceneGroupMembership(tsJIP_Context *psJIP_Context, tsGroupMembership **ppasMembers, uint32_t *pu32NumMembers,
+                                              uint32_t *pu32NumNodes, bool_t bHold)
+{
+    tsGroupMembership *pasMembers = NULL;
+    uint32_t u32NumMembers = 0, u32NumNodes = 0, i, j;
+    tsNode **apsNodes, *psNode;
+    teJIP_Status eStatus = E_JIP_OK;
+    
+    /* Take handles on every node so that each can be locked in turn without the context lock */
+    eJIP_Lock(psJIP_Context);
+    for (psNode = psJIP_Context->sNetwork.psNodes; psNode; psNode = psNode->psNext)
+    {
+        u32NumNodes++;
+    }
+    apsNodes = malloc(sizeof(tsNode *) * (u32NumNodes ? u32NumNodes : 1));
+    if (!apsNodes)
+    {
+        eJIP_Unlock(psJIP_Context);
+        return E_JIP_ERROR_NO_MEM;
+    }
+    for (i = 0, psNode = psJIP_Context->sNetwork.psNodes; psNode; psNode = psNode->psNext, i++)
+    {
+        eJIP_AcquireNodeHandle(psNode);
+        apsNodes[i] = psNode;
+    }
+    eJIP_Unlock(psJIP_Context);
+    
+    for (i = 0; i < u32NumNodes; i++)
+    {
+        psNode = apsNodes[i];
+        
+        if (eStatus == E_JIP_OK)
+        {
+            eJIP_LockNode(psNode, True);
+            if (!psNode->bRemoved)
+            {
+                tsMib *psMib = psJIP_LookupMibId(psNode, NULL, JIP_GROUPS_MIB_ID);
+                tsVar *psVar = psMib ? psJIP_LookupVarIndex(psMib, 0) : NULL;
+                
+                if (psVar && !psVar->ptData)
+                {
+                    DBG_vPrintf(DBG_JIP_CLIENT, "Groups of a node have not been read\n");
+                    eStatus = E_JIP_ERROR_FAILED;
+                }
+                else if (psVar)
+                {
+                    tsGroupMembership *pasNewMembers = realloc(pasMembers, sizeof(tsGroupMembership) * (u32NumMembers + psVar->ptData->u32NumRows + 1));
+                    
+                    if (!pasNewMembers)
+                    {
+                        eStatus = E_JIP_ERROR_NO_MEM;
+                    }
+                    else
+                    {
+                        pasMembers = pasNewMembers;
+                        for (j = 0; j < psVar->ptData->u32NumRows; j++)
+                        {
+                            tsTableRow *psRow = &psVar->ptData->psRows[j];
+                            
+                            /* Compressed addresses are a scope byte and up to 15 address bytes */
+                            if ((psRow->u32Length > 0) && (psRow->u32Length <= sizeof(struct in6_addr)))
+                            {
+                                pasMembers[u32NumMembers].psNode = psNode;
+                                vJIPserver_GroupMibCompressedAddressToIn6(&pasMembers[u32NumMembers].sGroup, psRow->pbData, psRow->u32Length);
+                                u32NumMembers++;
+                                if (bHold)
+                                {
+                                    eJIP_AcquireNodeHandle(psNode);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            eJIP_UnlockNode(psNode);
         }
+        eJIP_ReleaseNode(psNode);
     }
+    free(apsNodes);
     
-    DBG_vPrintf(DBG_JIP_CLIENT, "Register trap on TreeVersion");
+    if (eStatus != E_JIP_OK)
+    {
+        for (i = 0; bHold && (i < u32NumMembers); i++)
+        {
+            eJIP_ReleaseNode(pasMembers[i].psNode);
+        }
+        free(pasMembers);
+        return eStatus;
+    }
+    
+    *ppasMembers = pasMembers;
+    *pu32NumMembers = u32NumMembers;
+    *pu32NumNodes = u32NumNodes;
+    return E_JIP_OK;
+}
 
-    psNode = psJIP_LookupNode(psJIP_Context, &psJIP_Private->sNetworkContext.sBorder_Router_IPv6_Address);
-    if (psNode)
+
+/** Find an entry of a scene in class u32Class that sets the variable on psNode.
+ *  \param bUnicastOnly     Only consider entries that are still to be sent by unicast
+ *  \return Index of the entry, or u32NumEntries if there is none
+ */
+static uint32_t u32JIP_SceneFindTarget(tsScene *psScene, uint32_t u32Class, tsNode *psNode, bool_t bUnicastOnly)
+{
+    uint32_t i;
+    
+    for (i = u32Class; i < psScene->u32NumEntries; i++)
     {
-        psMib = psJIP_LookupMib(psNode, NULL, "JenNet");
+        tsSceneEntryPlan *psPlan = &psScene->pasEntries[i];
         
-        if (psMib)
+        if ((psPlan->u32Class == u32Class) && (psPlan->psNode == psNode) && !(bUnicastOnly && psPlan->bMulticast))
         {
-            psVar = psJIP_LookupVar(psMib, NULL, "TreeVersion");
+            break;
+        }
+    }
+    return i;
+}
+
+
+/** Estimate the cost of setting a scene entry on its node by unicast, from what has been seen of the node.
+ *  A request and its response each cross every hop, and are sent again as often as they have been lost.
+ */
+static void vJIP_SceneUnicastCost(tsSceneEntryPlan *psPlan)
+{
+    tsNode_Private *psNode_Private = (tsNode_Private *)psPlan->psNode->pvPriv;
+    uint32_t u32Hops = JIP_COST_DEFAULT_HOPS;
+    uint32_t u32Loss = 0;
+    
+    if (psNode_Private)
+    {
+        uint32_t u32Requests  = u32AtomicGet(&psNode_Private->sLinkStats.u32Requests);
+        uint32_t u32Responses = u32AtomicGet(&psNode_Private->sLinkStats.u32Responses);
+        
+        if (psNode_Private->sLinkStats.u32Hops)
+        {
+            u32Hops = psNode_Private->sLinkStats.u32Hops;
+        }
+        if (u32Requests > u32Responses)
+        {
+            /* The extra one in the divisor keeps a single lost request from writing the node off */
+            u32Loss = (u32Requests - u32Responses) * 1000 / (u32Requests + 1);
+        }
+        if (u32Loss > JIP_COST_MAX_LOSS)
+        {
+            u32Loss = JIP_COST_MAX_LOSS;
+        }
+    }
+    
+    psPlan->u32LossPermille = u32Loss;
+    psPlan->u32UnicastCost  = 2 * u32Hops * 1000 * 1000 / (1000 - u32Loss);
+}
+
+
+/** Replace unicasts with multicasts where that is expected to be cheaper.
+ *  A group may be used for a value if every member of it is to be set to that value. Its cost is 
+ *  that of flooding the network with the multicast, plus the unicasts expected to be needed for 
+ *  members that miss it, which is what loss has cost each of them so far. Against that is the cost 
+ *  of the unicasts it saves. For each value, the group saving the most is chosen, until none saves anything.
+ */
+static void vJIP_SceneMergeGroups(tsScene *psScene, tsGroupMembership *pasMembers, uint32_t u32NumMembers)
+{
+    uint32_t u32Class, u32Best, u32BestSaving, u32Saved, u32Cost, u32Target, i, j;
+    
+    for (u32Class = 0; u32Class < psScene->u32NumEntries; u32Class++)
+    {
+        if ((psScene->pasEntries[u32Class].u32Class != u32Class) || (psScene->pasEntries[u32Class].bMulticast))
+        {
+            /* Not the first entry of a value set by unicast */
+            continue;
+        }
+        
+        do
+        {
+            u32Best = u32NumMembers;
+            u32BestSaving = 0;
             
-            if (psVar)
+            for (i = 0; i < u32NumMembers; i++)
             {
-                if (eJIP_TrapVar(psJIP_Context, psVar, u8TreeVersionTrapHandle, NetworkChangeTreeVersionTrap) == E_JIP_OK)
+                if (u32JIP_SceneFindTarget(psScene, u32Class, pasMembers[i].psNode, True) == psScene->u32NumEntries)
                 {
-                    DBG_vPrintf(DBG_JIP_CLIENT, "Trap registered\n");
-                    u32TrapRegistered = 1;
+                    continue;
+                }
+                
+                /* Every member of the group must be having this value set */
+                u32Saved = 0;
+                u32Cost = psScene->u32MulticastCost;
+                for (j = 0; j < u32NumMembers; j++)
+                {
+                    if (memcmp(&pasMembers[j].sGroup, &pasMembers[i].sGroup, sizeof(struct in6_addr)) != 0)
+                    {
+                        continue;
+                    }
+                    u32Target = u32JIP_SceneFindTarget(psScene, u32Class, pasMembers[j].psNode, False);
+                    if (u32Target == psScene->u32NumEntries)
+                    {
+                        break;
+                    }
+                    u32Cost += psScene->pasEntries[u32Target].u32UnicastCost / 1000 * psScene->pasEntries[u32Target].u32LossPermille;
+                    
+                    u32Target = u32JIP_SceneFindTarget(psScene, u32Class, pasMembers[j].psNode, True);
+                    if (u32Target != psScene->u32NumEntries)
+                    {
+                        u32Saved += psScene->pasEntries[u32Target].u32UnicastCost;
+                    }
+                }
+                
+                if ((j == u32NumMembers) && (u32Saved > u32Cost) && (u32Saved - u32Cost > u32BestSaving))
+                {
+                    u32Best = i;
+                    u32BestSaving = u32Saved - u32Cost;
                 }
             }
-        }
-        eJIP_UnlockNode(psNode);
+            
+            if (u32Best == u32NumMembers)
+            {
+                break;
+            }
+            
+            DBG_vPrintf(DBG_JIP_CLIENT, "Scene entry %d sent by multicast, saving %d\n", u32Class, u32BestSaving);
+            psScene->u32Cost -= u32BestSaving;
+            
+            for (j = 0; j < u32NumMembers; j++)
+            {
+                if (memcmp(&pasMembers[j].sGroup, &pasMembers[u32Best].sGroup, sizeof(struct in6_addr)) == 0)
+                {
+                    for (i = u32Class; i < psScene->u32NumEntries; i++)
+                    {
+                        tsSceneEntryPlan *psPlan = &psScene->pasEntries[i];
+                        
+                        if ((psPlan->u32Class == u32Class) && (psPlan->psNode == pasMembers[j].psNode) && !psPlan->bMulticast)
+                        {
+                            psPlan->bMulticast = True;
+                            psPlan->sGroupAddress = psPlan->psNode->sNode_Address;
+                            psPlan->sGroupAddress.sin6_addr = pasMembers[u32Best].sGroup;
+                        }
+                    }
+                }
+            }
+        } while (1);
     }
+}
 
-    if (!u32TrapRegistered)
+
+/** Build the requests that apply a scene. Entries for the same node, or the same multicast group,
+ *  and MIB share a request. Entries sent to a group that set the same value share a variable in it.
+ */
+static teJIP_Status eJIP_ScenePacketise(tsScene *psScene)
+{
+    uint32_t u32Slot, i, j, k;
+    
+    psScene->pasPackets = malloc(sizeof(tsScenePacket) * psScene->u32NumEntries);
+    if (!psScene->pasPackets)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Trap registration failed, falling back to polling\n");
+        return E_JIP_ERROR_NO_MEM;
     }
     
-    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    for (i = 0; i < psScene->u32NumEntries; i++)
     {
-        /* This thread can now spin here and rediscover every 60s to catch any changes
-         * that haven't been picked up by the trap
-         */
-#define DISCOVERY_TIME (60)
-        if (eJIPService_DiscoverNetwork(psJIP_Context) != E_JIP_OK)
+        psScene->pasEntries[i].u32Packet = psScene->u32NumEntries;
+    }
+    
+    for (i = 0; i < psScene->u32NumEntries; i++)
+    {
+        tsSceneEntryPlan *psFirst = &psScene->pasEntries[i];
+        tsScenePacket *psPacket = &psScene->pasPackets[psScene->u32NumPackets];
+        tsJIP_Msg_SetMultiRequest *psRequest = (tsJIP_Msg_SetMultiRequest *)psPacket->acBuffer;
+        
+        if (psFirst->u32Packet != psScene->u32NumEntries)
         {
-            DBG_vPrintf(DBG_JIP_CLIENT, "Error discovering network\n");
+            continue;
         }
-        sleep(DISCOVERY_TIME);
-#undef DISCOVERY_TIME
+        
+        psPacket->psNode        = psFirst->bMulticast ? NULL : psFirst->psNode;
+        psPacket->sAddress      = psFirst->sGroupAddress;
+        psPacket->u32NumVars    = 0;
+        psPacket->u32Length     = sizeof(tsJIP_Msg_SetMultiRequest);
+        
+        for (j = i; j < psScene->u32NumEntries; j++)
+        {
+            tsSceneEntryPlan *psPlan = &psScene->pasEntries[j];
+            
+            if ((psPlan->u32Packet != psScene->u32NumEntries) ||
+                (psPlan->u32MibId != psFirst->u32MibId) ||
+                (psPlan->bMulticast != psFirst->bMulticast) ||
+                (psPlan->bMulticast ? (memcmp(&psPlan->sGroupAddress, &psFirst->sGroupAddress, sizeof(tsJIPAddress)) != 0) :
+                                      (psPlan->psNode != psFirst->psNode)))
+            {
+                continue;
+            }
+            
+            u32Slot = psPacket->u32NumVars;
+            if (psPlan->bMulticast)
+            {
+                /* One copy of a value reaches every member of the group */
+                for (k = i; k < j; k++)
+                {
+                    if ((psScene->pasEntries[k].u32Packet == psScene->u32NumPackets) &&
+                        (psScene->pasEntries[k].u32Class == psPlan->u32Class))
+                    {
+                        u32Slot = psScene->pasEntries[k].u32Slot;
+                        break;
+                    }
+                }
+            }
+            
+            if (u32Slot == psPacket->u32NumVars)
+            {
+                if ((psPacket->u32NumVars == UINT8_MAX) || 
+                    (psPacket->u32Length + psPlan->u32EncodedLength > sizeof(psPacket->acBuffer)))
+                {
+                    /* Full - this goes in another request */
+                    continue;
+                }
+                memcpy(&psPacket->acBuffer[psPacket->u32Length], psPlan->au8Encoded, psPlan->u32EncodedLength);
+                psPacket->u32Length += psPlan->u32EncodedLength;
+                psPacket->u32NumVars++;
+            }
+            
+            psPlan->u32Packet   = psScene->u32NumPackets;
+            psPlan->u32Slot     = u32Slot;
+        }
+        
+        psRequest->u32MibId     = htonl(psFirst->u32MibId);
+        psRequest->u8NumVars    = psPacket->u32NumVars;
+        psPacket->eCommand      = E_JIP_COMMAND_SET_MULTI_REQUEST;
+        
+        if (psPacket->u32NumVars == 1)
+        {
+            /* A single variable is sent as a plain set, which every node understands */
+            memmove(&psPacket->acBuffer[offsetof(tsJIP_Msg_SetMibRequest, sRequest)], 
+                    &psPacket->acBuffer[sizeof(tsJIP_Msg_SetMultiRequest)], 
+                    psPacket->u32Length - sizeof(tsJIP_Msg_SetMultiRequest));
+            psPacket->u32Length -= sizeof(tsJIP_Msg_SetMultiRequest) - offsetof(tsJIP_Msg_SetMibRequest, sRequest);
+            psPacket->eCommand   = E_JIP_COMMAND_SET_MIB_REQUEST;
+        }
+        
+        psScene->u32NumPackets++;
     }
+    return E_JIP_OK;
+}
+
+
+/** Find the copy of a variable on every member of a multicast group, from the nodes' Groups MIBs.
+ *  A handle is held on the node of each variable returned, which the caller must release.
+ *  \return E_JIP_OK if the membership of every node is known
+ */
+static teJIP_Status eJIP_GroupMemberVars(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, uint32_t u32MibId, uint8_t u8VarIndex,
+                                         tsVar ***ppapsVars, uint32_t *pu32NumVars)
+{
+    tsGroupMembership *pasMembers;
+    uint32_t u32NumMembers, u32NumNodes, u32NumVars = 0, i;
+    tsVar **papsVars;
+    teJIP_Status eStatus;
     
-    if (u32TrapRegistered)
+    eStatus = eJIP_SceneGroupMembership(psJIP_Context, &pasMembers, &u32NumMembers, &u32NumNodes, True);
+    if (eStatus != E_JIP_OK)
     {
-        DBG_vPrintf(DBG_JIP_CLIENT, "Untrapping tree version\n");
+        return eStatus;
+    }
+    
+    papsVars = malloc(sizeof(tsVar *) * (u32NumMembers ? u32NumMembers : 1));
+    
+    for (i = 0; i < u32NumMembers; i++)
+    {
+        tsNode *psNode = pasMembers[i].psNode;
+        tsVar *psVar = NULL;
         
-        if (eJIP_UntrapVar(psJIP_Context, psVar, u8TreeVersionTrapHandle) != E_JIP_OK)
+        if (papsVars && (memcmp(&pasMembers[i].sGroup, &psAddress->sin6_addr, sizeof(struct in6_addr)) == 0) &&
+            ((u32NumVars == 0) || (papsVars[u32NumVars - 1]->psOwnerMib->psOwnerNode != psNode)))
         {
-            DBG_vPrintf(DBG_JIP_CLIENT, "Error untrapping tree version\n");
+            eJIP_LockNode(psNode, True);
+            if (!psNode->bRemoved)
+            {
+                tsMib *psMib = psJIP_LookupMibId(psNode, NULL, u32MibId);
+                psVar = psMib ? psJIP_LookupVarIndex(psMib, u8VarIndex) : NULL;
+            }
+            eJIP_UnlockNode(psNode);
+        }
+        
+        if (psVar)
+        {
+            /* Keep the handle taken for the membership */
+            papsVars[u32NumVars++] = psVar;
+        }
+        else
+        {
+            eJIP_ReleaseNode(psNode);
         }
     }
+    free(pasMembers);
     
-    eThreadFinish(psThreadInfo);
+    if (!papsVars)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
     
-    return NULL;
+    *ppapsVars = papsVars;
+    *pu32NumVars = u32NumVars;
+    return E_JIP_OK;
+}
+
+
+/** Read a variable back from the members of a group with one multicast read, and compare each with the
+ *  value it was set to. Members that do not answer are taken not to have the value.
+ *  The local copy of each variable that is read is updated.
+ *  \param pu8Value             The value, encoded as in a set request
+ *  \param pabConverged[out]    Set for each variable to whether the node had the value
+ *  \return E_JIP_OK unless the read could not be made at all
+ */
+static teJIP_Status eJIP_ReadBackVars(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, int iMaxHops, tsVar **papsVars, uint32_t u32NumVars, 
+                                      const uint8_t *pu8Value, uint32_t u32ValueLength, bool_t *pabConverged)
+{
+    tsNetworkResponse *pasResponses;
+    struct in6_addr *pasAddresses;
+    uint32_t u32NumResponses = 0, i, j;
+    teJIP_Status eStatus;
+    
+    /* A buffer for each member's response and its address to match the response to it */
+    pasResponses = malloc(u32NumVars * (sizeof(tsNetworkResponse) + sizeof(struct in6_addr)));
+    if (!pasResponses)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    pasAddresses = (struct in6_addr *)&pasResponses[u32NumVars];
+    
+    for (i = 0; i < u32NumVars; i++)
+    {
+        tsNode *psNode = papsVars[i]->psOwnerMib->psOwnerNode;
+        
+        eJIP_LockNode(psNode, True);
+        pasAddresses[i] = psNode->sNode_Address.sin6_addr;
+        eJIP_UnlockNode(psNode);
+        pabConverged[i] = False;
+    }
+    
+    eStatus = eJIP_GroupGet(psJIP_Context, papsVars[0], psAddress, iMaxHops, JIP_VERIFY_JITTER, 
+                            pasResponses, u32NumVars, &u32NumResponses);
+    if (eStatus != E_JIP_OK)
+    {
+        free(pasResponses);
+        return eStatus;
+    }
+    
+    for (j = 0; j < u32NumResponses; j++)
+    {
+        tsNetworkResponse *psResponse = &pasResponses[j];
+        tsJIP_Msg_VarDescriptionHeader *psHeader = (tsJIP_Msg_VarDescriptionHeader *)psResponse->acData;
+        tsVar *psVar;
+        tsNode *psNode;
+        
+        for (i = 0; i < u32NumVars; i++)
+        {
+            if (memcmp(&pasAddresses[i], &psResponse->sAddress.sin6_addr, sizeof(struct in6_addr)) == 0)
+            {
+                break;
+            }
+        }
+        
+        if ((i == u32NumVars) ||
+            (psResponse->iLength < sizeof(tsJIP_Msg_VarDescriptionHeader) + u32ValueLength) ||
+            (psHeader->eStatus != E_JIP_OK) || (psHeader->eVarType != papsVars[i]->eVarType))
+        {
+            continue;
+        }
+        psVar = papsVars[i];
+        psNode = psVar->psOwnerMib->psOwnerNode;
+        
+        pabConverged[i] = (memcmp(&psResponse->acData[sizeof(tsJIP_Msg_VarDescriptionHeader)], pu8Value, u32ValueLength) == 0);
+        
+        eJIP_LockNode(psNode, True);
+        psVar->eEnable = E_JIP_VAR_ENABLED;
+        eJIP_SetVarFromPacket(psVar, (uint8_t *)psResponse->acData);
+        eJIP_UnlockNode(psNode);
+    }
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "%d of %d members answered the read back\n", u32NumResponses, u32NumVars);
+    free(pasResponses);
+    return E_JIP_OK;
 }
 
+
+/** Read a variable from every member of a multicast group that has it, as \ref eJIP_MulticastGetVar.
+ *  \param psVar                Variable on any node, giving the MIB and index to read
+ *  \return E_JIP_OK if the request was sent
+ */
+static teJIP_Status eJIP_GroupGet(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psAddress, int iMaxHops, uint32_t u32JitterMs,
+                                  tsNetworkResponse *pasResponses, uint32_t u32MaxResponses, uint32_t *pu32NumResponses)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsJIP_Msg_GetGroupRequest sRequest;
+    tsNode *psNode = psVar->psOwnerMib->psOwnerNode;
+    
+    if (u32JitterMs > UINT16_MAX)
+    {
+        u32JitterMs = UINT16_MAX;
+    }
+    
+    eJIP_LockNode(psNode, True);
+    sRequest.u32MibId       = htonl(psVar->psOwnerMib->u32MibId);
+    sRequest.u8VarIndex     = psVar->u8Index;
+    sRequest.u16JitterMs    = htons(u32JitterMs);
+    eJIP_UnlockNode(psNode);
+    
+    DBG_vPrintf(DBG_JIP_CLIENT, "Group read of Mib 0x%08x, variable %d, jitter %dms\n", ntohl(sRequest.u32MibId), sRequest.u8VarIndex, u32JitterMs);
+    
+    if (Network_ExchangeJIPMulticast(&psJIP_Private->sNetworkContext, psAddress, psJIP_Context->iMulticastInterface, iMaxHops,
+                                     E_JIP_COMMAND_GET_GROUP_REQUEST, (char *)&sRequest, sizeof(tsJIP_Msg_GetGroupRequest),
+                                     E_JIP_COMMAND_GET_RESPONSE, u32JitterMs + JIP_GROUP_GET_MARGIN,
+                                     pasResponses, u32MaxResponses, pu32NumResponses) != E_NETWORK_OK)
+    {
+        DBG_vPrintf(DBG_JIP_CLIENT, "Could not send group read\n");
+        return E_JIP_ERROR_NETWORK;
+    }
+    return E_JIP_OK;
+}
@@ -125,7 +125,7 @@ static teJIP_Status Cache_Add_Node_Impl(tsDeviceIDCacheEntry **psNewEntry, tsNod
 
     NewNode->u32DeviceId    = psNode->u32DeviceId;
     
-    eLockCreate(&NewNode->sLock);
+    /* Cached nodes are only templates that are never locked, so they don't need a lock */
     
     (*psNewEntry)->psNode = NewNode;
     
@@ -1,434 +1,560 @@
-/****************************************************************************
- *
- * MODULE:             libJIP
- *
- * COMPONENT:          JIP_Packets.h
- *
- * REVISION:           $Revision: 56798 $
- *
- * DATED:              $Date: 2013-09-23 14:53:10 +0100 (Mon, 23 Sep 2013) $
- *
- * AUTHOR:             Matt Redfearn
- *
- ****************************************************************************
- *
- * This software is owned by NXP B.V. and/or its supplier and is protected
- * under applicable copyright laws. All rights are reserved. We grant You,
- * and any third parties, a license to use this software solely and
- * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
- * You, and any third parties must reproduce the copyright and warranty notice
- * and any other legend of ownership on each copy or partial copy of the 
- * software.
- *
- * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
- * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
- * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
- * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
- * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
- * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
- * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
- * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
- * POSSIBILITY OF SUCH DAMAGE.
-
- * Copyright NXP B.V. 2012. All rights reserved
- *
- ***************************************************************************/
-
-#ifndef JIP_PACKETS_H_
-#define JIP_PACKETS_H_
-
-#if defined __cplusplus
-extern "C" {
-#endif
-
-/****************************************************************************/
-/***        Include Files                                                 ***/
-/****************************************************************************/
-
-#include <stdint.h>
-#include <JIP.h>
-
-/****************************************************************************/
-/***        Macro Definitions                                             ***/
-/****************************************************************************/
-
-#define COMPILE_TIME_ASSERT(NAME, A) \
-    typedef uint8_t __u8Assert_ ## NAME [(A) ? 1 : -1]
-
-#define JIP_VERSION 0
-
-/****************************************************************************/
-/***        Type Definitions                                              ***/
-/****************************************************************************/
-
-typedef enum _eJIP_Command
-{
-    E_JIP_COMMAND_GET_REQUEST = 0x10,      /* Request to get the value of a variable */
-    E_JIP_COMMAND_GET_RESPONSE,            /* Response to a previous get request */
-
-    E_JIP_COMMAND_SET_REQUEST,             /* Request to set the value of a variable */
-    E_JIP_COMMAND_SET_RESPONSE,            /* Response to a previous set request */
-
-    E_JIP_COMMAND_QUERY_MIB_REQUEST,       /* Request to query the JIP database for a list of available MIBs */
-    E_JIP_COMMAND_QUERY_MIB_RESPONSE,      /* Response to a previous query request */
-
-    E_JIP_COMMAND_QUERY_VAR_REQUEST,       /* Request to query the JIP database for a list of available variables */
-    E_JIP_COMMAND_QUERY_VAR_RESPONSE,      /* Response to a previous query request */
-
-    E_JIP_COMMAND_TRAP_REQUEST,            /* Request to generate a notification when a variable changes value */
-    E_JIP_COMMAND_UNTRAP_REQUEST,          /* Request to stop generate a notification when a variable changes value */
-    E_JIP_COMMAND_TRAP_RESPONSE,           /* Response to a previous trap request*/
-    E_JIP_COMMAND_TRAP_NOTIFY,             /* Notify of a change in a previously trapped variable */
-
-    E_JIP_COMMAND_GET_MIB_REQUEST,         /* Request to get the value of a variable using MiB Id */
-    E_JIP_COMMAND_SET_MIB_REQUEST,         /* Request to set the value of a variable using MiB Id */
-
-    E_JIP_COMMAND_LAST
-
-} PACK teJIP_Command;
-
-COMPILE_TIME_ASSERT(CheckSizeofJIPVarType,    sizeof(teJIP_VarType)    == 1);
-COMPILE_TIME_ASSERT(CheckSizeofJIPAccessType, sizeof(teJIP_AccessType) == 1);
-COMPILE_TIME_ASSERT(CheckSizeofJIPSecurity,   sizeof(teJIP_Security)   == 1);
-
-#ifdef WIN32
-#pragma pack(push, 1)
-#endif
-
-typedef struct
-{
-	uint8_t                             u8Version;
-	teJIP_Command                       eCommand;
-	uint8_t                             u8Handle;
-
-#ifndef WIN32
-	uint8_t                             au8Payload[0];
-#endif
-} PACK tsJIP_MsgHeader;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_MsgHeader, sizeof(tsJIP_MsgHeader) == 3);
-
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	uint8_t                             u8MibIndex;
-	uint8_t                             u8VarIndex;
-	teJIP_Status                        eStatus;
-} PACK tsJIP_Msg_VarStatus;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarStatus, sizeof(tsJIP_Msg_VarStatus) == 6);
-
-
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-
-    uint8_t                             u8MibIndex;
-    uint8_t                             u8VarIndex;
-    teJIP_Status                        eStatus;
-} PACK tsJIP_Msg_VarDescriptionHeaderError;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescriptionHeaderError,
-                    sizeof(tsJIP_Msg_VarDescriptionHeaderError) == 6);
-
-
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	uint8_t                             u8MibIndex;
-	uint8_t                             u8VarIndex;
-	teJIP_Status                        eStatus;
-	teJIP_VarType                       eVarType;
-
-#ifndef WIN32
-	uint8_t                             au8Payload[0];
-#endif
-} PACK tsJIP_Msg_VarDescriptionHeader;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescriptionHeader,
-					sizeof(tsJIP_Msg_VarDescriptionHeader) == 7);
-
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint32_t                            u32Val;
-} PACK tsJIP_Msg_VarDescription_Int32;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int32,
-					sizeof(tsJIP_Msg_VarDescription_Int32) == 11);
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint32_t                            u32Val;
-} PACK tsJIP_Msg_VarDescription_Flt;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Flt,
-					sizeof(tsJIP_Msg_VarDescription_Flt) == 11);
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint64_t                            u64Val;
-} PACK tsJIP_Msg_VarDescription_Int64;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int64,
-					sizeof(tsJIP_Msg_VarDescription_Int64) == 15);
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint64_t                            u64Val;
-} PACK tsJIP_Msg_VarDescription_Dbl;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Dbl,
-					sizeof(tsJIP_Msg_VarDescription_Dbl) == 15);
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint8_t                             u8StringLen;
-
-#ifndef WIN32
-	char                                acString[0]; /* arbitrary length, up to 255 */
-#endif
-} PACK tsJIP_Msg_VarDescription_Str;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Str,
-					sizeof(tsJIP_Msg_VarDescription_Str) == 8);
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint8_t                             u8Val;
-} PACK tsJIP_Msg_VarDescription_Int8;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int8,
-					sizeof(tsJIP_Msg_VarDescription_Int8) == 8);
-
-typedef struct
-{
-    tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-    uint16_t                            u16Val;
-} PACK tsJIP_Msg_VarDescription_Int16;
-COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int16,
-                    sizeof(tsJIP_Msg_VarDescription_Int16) == 9);
-
-typedef struct
-{
-    teJIP_Status                        eStatus;
-} PACK tsJIP_Msg_VarDescriptionEntryError;
-
-typedef struct
-{
-    teJIP_Status                        eStatus;
-    teJIP_VarType                       eVarType;
-
-    uint8_t                             au8Data[0];
-} PACK tsJIP_Msg_VarDescriptionEntry;
-
-typedef struct
-{
-	tsJIP_Msg_VarDescriptionHeader      sHeader;
-
-	uint8_t                             u8Len;
-#ifndef WIN32
-	uint8_t                             au8Blob[0]; /* arbitrary length, up to 255 */
-#endif
-} PACK tsJIP_Msg_VarDescription_Blob;
-
-/* JIP Get table response packet */
-typedef struct
-{
-    tsJIP_Msg_VarDescriptionHeader      sHeader;
-    
-    uint16_t                            u16Remaining;
-    uint16_t                            u16TableVersion;
-#ifndef WIN32
-    uint8_t                             au8Table[0]; /* arbitrary length, up to 255 */
-#endif
-} PACK tsJIP_Msg_VarDescription_Table;
-
-/* A list of these come after the tsJIP_Msg_VarDescription_Table header */
-typedef struct
-{
-    uint16_t                            u16Entry;
-    uint8_t                             u8Len;
-#ifndef WIN32
-    uint8_t                             au8Blob[0]; /* arbitrary length, up to 255 */
-#endif
-} PACK tsJIP_Msg_VarDescription_Table_Entry;
-
-typedef struct
-{
-    uint8_t                             u8VarIndex;
-
-    union {
-        uint8_t                         u8VarCount;
-
-        struct 
-        {
-            uint16_t                    u16FirstEntry;
-            uint8_t                     u8EntryCount;
-        } PACK;
-    } PACK;
-} PACK tsJIP_Msg_GetRequest;
-
-/* E_JIP_COMMAND_GET_REQUEST */
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-
-    uint8_t                             u8MibIndex;
-
-    tsJIP_Msg_GetRequest                sRequest;
-
-} PACK tsJIP_Msg_GetIndexRequest;
-
-/* E_JIP_COMMAND_GET_MIB_REQUEST */
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-
-    uint32_t                            u32MibId;
-
-    tsJIP_Msg_GetRequest                sRequest;
-} PACK tsJIP_Msg_GetMibRequest;
-
-typedef struct
-{
-    uint8_t                             u8VarIndex;
-
-    tsJIP_Msg_VarDescriptionEntry       sVar;
-} PACK tsJIP_Msg_SetRequest;
-
-/* E_JIP_COMMAND_SET_REQUEST */
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-
-    uint8_t                             u8MibIndex;
-
-    tsJIP_Msg_SetRequest                sRequest;
-} PACK tsJIP_Msg_SetIndexRequest;
-
-/* E_JIP_COMMAND_SET_MIB_REQUEST */
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-
-    uint32_t                            u32MibId;
-
-    tsJIP_Msg_SetRequest                sRequest;
-} PACK tsJIP_Msg_SetMibRequest;
-
-/* E_JIP_COMMAND_QUERY_MIB_REQUEST */
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	uint8_t                             u8MibStartIndex;
-	uint8_t                             u8NumMibs;
-} PACK tsJIP_Msg_QueryMibRequest;
-
-/* E_JIP_COMMAND_QUERY_MIB_RESPONSE */
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	teJIP_Status                        eStatus;
-
-	uint8_t                             u8NumMibsReturned;
-	uint8_t                             u8NumMibsOutstanding;
-} PACK tsJIP_Msg_QueryMibResponseHeader;
-
-typedef struct
-{
-	uint8_t                             u8MibIndex;
-    uint32_t                            u32MibID;
-	uint8_t                             u8NameLen;
-#ifndef WIN32
-	char                                acName[0];
-#endif
-} PACK tsJIP_Msg_QueryMibResponseListEntryHeader;
-
-/* E_JIP_COMMAND_QUERY_VAR_REQUEST */
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	uint8_t                             u8MibIndex;
-
-	uint8_t                             u8VarStartIndex;
-	uint8_t                             u8NumVars;
-} PACK tsJIP_Msg_QueryVarRequest;
-
-/* E_JIP_COMMAND_QUERY_VAR_RESPONSE */
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	teJIP_Status                        eStatus;
-
-	uint8_t                             u8MibIndex;
-
-	uint8_t                             u8NumVarsReturned;
-	uint8_t                             u8NumVarsOutstanding;
-} PACK tsJIP_Msg_QueryVarResponseHeader;
-
-typedef struct
-{
-	uint8_t                             u8VarIndex;
-	uint8_t                             u8NameLen;
-#ifndef WIN32
-	char                                acName[0];
-#endif
-} PACK tsJIP_Msg_QueryVarResponseListEntryHeader;
-
-typedef struct
-{
-    teJIP_VarType                       eVarType;
-    teJIP_AccessType                    eAccessType;
-    teJIP_Security                      eSecurity;
-} PACK tsJIP_Msg_QueryVarResponseListEntryFooter;
-
-/* E_JIP_COMMAND_TRAP_REQUEST */
-typedef struct
-{
-	tsJIP_MsgHeader                     sHeader;
-
-	uint8_t                             u8NotificationHandle;
-	uint8_t                             u8MibIndex;
-	uint8_t                             u8VarIndex;
-} PACK tsJIP_Msg_TrapRequest;
-
-typedef struct
-{
-    tsJIP_MsgHeader                     sHeader;
-    uint8_t                             u8Join;
-    uint32_t                            u32TreeVersion;
-} PACK tsJIP_Msg_TreeVersion;
-
-#ifdef WIN32
-#pragma pack(pop)
-#endif
-
-/****************************************************************************/
-/***        Exported Functions                                            ***/
-/****************************************************************************/
-
-/****************************************************************************/
-/***        Exported Variables                                            ***/
-/****************************************************************************/
-
-#if defined __cplusplus
-}
-#endif
-
-#endif /*JIP_PACKETS_H_*/
-
-/****************************************************************************/
-/***        END OF FILE                                                   ***/
-/****************************************************************************/
+/****************************************************************************
+ *
+ * MODULE:             libJIP
+ *
+ * COMPONENT:          JIP_Packets.h
+ *
+ * REVISION:           $Revision: 56798 $
+ *
+ * DATED:              $Date: 2013-09-23 14:53:10 +0100 (Mon, 23 Sep 2013) $
+ *
+ * AUTHOR:             Matt Redfearn
+ *
+ ****************************************************************************
+ *
+ * This software is owned by NXP B.V. and/or its supplier and is protected
+ * under applicable copyright laws. All rights are reserved. We grant You,
+ * and any third parties, a license to use this software solely and
+ * exclusively on NXP products [NXP Microcontrollers such as JN5148, JN5142, JN5139]. 
+ * You, and any third parties must reproduce the copyright and warranty notice
+ * and any other legend of ownership on each copy or partial copy of the 
+ * software.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+
+ * Copyright NXP B.V. 2012. All rights reserved
+ *
+ ***************************************************************************/
+
+#ifndef JIP_PACKETS_H_
+#define JIP_PACKETS_H_
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/****************************************************************************/
+/***        Include Files                                                 ***/
+/****************************************************************************/
+
+#include <stdint.h>
+#include <JIP.h>
+
+/****************************************************************************/
+/***        Macro Definitions                                             ***/
+/****************************************************************************/
+
+#define COMPILE_TIME_ASSERT(NAME, A) \
+    typedef uint8_t __u8Assert_ ## NAME [(A) ? 1 : -1]
+
+#define JIP_VERSION 0
+
+/****************************************************************************/
+/***        Type Definitions                                              ***/
+/****************************************************************************/
+
+typedef enum _eJIP_Command
+{
+    E_JIP_COMMAND_GET_REQUEST = 0x10,      /* Request to get the value of a variable */
+    E_JIP_COMMAND_GET_RESPONSE,            /* Response to a previous get request */
+
+    E_JIP_COMMAND_SET_REQUEST,             /* Request to set the value of a variable */
+    E_JIP_COMMAND_SET_RESPONSE,            /* Response to a previous set request */
+
+    E_JIP_COMMAND_QUERY_MIB_REQUEST,       /* Request to query the JIP database for a list of available MIBs */
+    E_JIP_COMMAND_QUERY_MIB_RESPONSE,      /* Response to a previous query request */
+
+    E_JIP_COMMAND_QUERY_VAR_REQUEST,       /* Request to query the JIP database for a list of available variables */
+    E_JIP_COMMAND_QUERY_VAR_RESPONSE,      /* Response to a previous query request */
+
+    E_JIP_COMMAND_TRAP_REQUEST,            /* Request to generate a notification when a variable changes value */
+    E_JIP_COMMAND_UNTRAP_REQUEST,          /* Request to stop generate a notification when a variable changes value */
+    E_JIP_COMMAND_TRAP_RESPONSE,           /* Response to a previous trap request*/
+    E_JIP_COMMAND_TRAP_NOTIFY,             /* Notify of a change in a previously trapped variable */
+
+    E_JIP_COMMAND_GET_MIB_REQUEST,         /* Request to get the value of a variable using MiB Id */
+    E_JIP_COMMAND_SET_MIB_REQUEST,         /* Request to set the value of a variable using MiB Id */
+
+    E_JIP_COMMAND_SET_MULTI_REQUEST,       /* Request to set the values of several variables of one MiB Id */
+    E_JIP_COMMAND_SET_MULTI_RESPONSE,      /* Response to a previous multi set request */
+
+    E_JIP_COMMAND_GET_MULTI_REQUEST,       /* Request to get ranges of variables from several MiB Ids */
+    E_JIP_COMMAND_GET_MULTI_RESPONSE,      /* Response to a previous multi get request */
+
+    E_JIP_COMMAND_SET_UNACKED_REQUEST,     /* Request to set the value of a variable using MiB Id, without a response */
+
+    E_JIP_COMMAND_GET_GROUP_REQUEST,       /* Request to a multicast group to get the value of a variable from every member */
+
+    E_JIP_COMMAND_LAST
+
+} PACK teJIP_Command;
+
+COMPILE_TIME_ASSERT(CheckSizeofJIPVarType,    sizeof(teJIP_VarType)    == 1);
+COMPILE_TIME_ASSERT(CheckSizeofJIPAccessType, sizeof(teJIP_AccessType) == 1);
+COMPILE_TIME_ASSERT(CheckSizeofJIPSecurity,   sizeof(teJIP_Security)   == 1);
+
+#ifdef WIN32
+#pragma pack(push, 1)
+#endif
+
+typedef struct
+{
+	uint8_t                             u8Version;
+	teJIP_Command                       eCommand;
+	uint8_t                             u8Handle;
+
+#ifndef WIN32
+	uint8_t                             au8Payload[0];
+#endif
+} PACK tsJIP_MsgHeader;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_MsgHeader, sizeof(tsJIP_MsgHeader) == 3);
+
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	uint8_t                             u8MibIndex;
+	uint8_t                             u8VarIndex;
+	teJIP_Status                        eStatus;
+} PACK tsJIP_Msg_VarStatus;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarStatus, sizeof(tsJIP_Msg_VarStatus) == 6);
+
+
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8MibIndex;
+    uint8_t                             u8VarIndex;
+    teJIP_Status                        eStatus;
+} PACK tsJIP_Msg_VarDescriptionHeaderError;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescriptionHeaderError,
+                    sizeof(tsJIP_Msg_VarDescriptionHeaderError) == 6);
+
+
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	uint8_t                             u8MibIndex;
+	uint8_t                             u8VarIndex;
+	teJIP_Status                        eStatus;
+	teJIP_VarType                       eVarType;
+
+#ifndef WIN32
+	uint8_t                             au8Payload[0];
+#endif
+} PACK tsJIP_Msg_VarDescriptionHeader;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescriptionHeader,
+					sizeof(tsJIP_Msg_VarDescriptionHeader) == 7);
+
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint32_t                            u32Val;
+} PACK tsJIP_Msg_VarDescription_Int32;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int32,
+					sizeof(tsJIP_Msg_VarDescription_Int32) == 11);
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint32_t                            u32Val;
+} PACK tsJIP_Msg_VarDescription_Flt;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Flt,
+					sizeof(tsJIP_Msg_VarDescription_Flt) == 11);
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint64_t                            u64Val;
+} PACK tsJIP_Msg_VarDescription_Int64;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int64,
+					sizeof(tsJIP_Msg_VarDescription_Int64) == 15);
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint64_t                            u64Val;
+} PACK tsJIP_Msg_VarDescription_Dbl;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Dbl,
+					sizeof(tsJIP_Msg_VarDescription_Dbl) == 15);
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint8_t                             u8StringLen;
+
+#ifndef WIN32
+	char                                acString[0]; /* arbitrary length, up to 255 */
+#endif
+} PACK tsJIP_Msg_VarDescription_Str;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Str,
+					sizeof(tsJIP_Msg_VarDescription_Str) == 8);
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint8_t                             u8Val;
+} PACK tsJIP_Msg_VarDescription_Int8;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int8,
+					sizeof(tsJIP_Msg_VarDescription_Int8) == 8);
+
+typedef struct
+{
+    tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+    uint16_t                            u16Val;
+} PACK tsJIP_Msg_VarDescription_Int16;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_VarDescription_Int16,
+                    sizeof(tsJIP_Msg_VarDescription_Int16) == 9);
+
+typedef struct
+{
+    teJIP_Status                        eStatus;
+} PACK tsJIP_Msg_VarDescriptionEntryError;
+
+typedef struct
+{
+    teJIP_Status                        eStatus;
+    teJIP_VarType                       eVarType;
+
+    uint8_t                             au8Data[0];
+} PACK tsJIP_Msg_VarDescriptionEntry;
+
+typedef struct
+{
+	tsJIP_Msg_VarDescriptionHeader      sHeader;
+
+	uint8_t                             u8Len;
+#ifndef WIN32
+	uint8_t                             au8Blob[0]; /* arbitrary length, up to 255 */
+#endif
+} PACK tsJIP_Msg_VarDescription_Blob;
+
+/* JIP Get table response packet */
+typedef struct
+{
+    tsJIP_Msg_VarDescriptionHeader      sHeader;
+    
+    uint16_t                            u16Remaining;
+    uint16_t                            u16TableVersion;
+#ifndef WIN32
+    uint8_t                             au8Table[0]; /* arbitrary length, up to 255 */
+#endif
+} PACK tsJIP_Msg_VarDescription_Table;
+
+/* A list of these come after the tsJIP_Msg_VarDescription_Table header */
+typedef struct
+{
+    uint16_t                            u16Entry;
+    uint8_t                             u8Len;
+#ifndef WIN32
+    uint8_t                             au8Blob[0]; /* arbitrary length, up to 255 */
+#endif
+} PACK tsJIP_Msg_VarDescription_Table_Entry;
+
+typedef struct
+{
+    uint8_t                             u8VarIndex;
+
+    union {
+        uint8_t                         u8VarCount;
+
+        struct 
+        {
+            uint16_t                    u16FirstEntry;
+            uint8_t                     u8EntryCount;
+        } PACK;
+    } PACK;
+} PACK tsJIP_Msg_GetRequest;
+
+/* E_JIP_COMMAND_GET_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8MibIndex;
+
+    tsJIP_Msg_GetRequest                sRequest;
+
+} PACK tsJIP_Msg_GetIndexRequest;
+
+/* E_JIP_COMMAND_GET_MIB_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint32_t                            u32MibId;
+
+    tsJIP_Msg_GetRequest                sRequest;
+} PACK tsJIP_Msg_GetMibRequest;
+
+typedef struct
+{
+    uint8_t                             u8VarIndex;
+
+    tsJIP_Msg_VarDescriptionEntry       sVar;
+} PACK tsJIP_Msg_SetRequest;
+
+/* E_JIP_COMMAND_SET_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8MibIndex;
+
+    tsJIP_Msg_SetRequest                sRequest;
+} PACK tsJIP_Msg_SetIndexRequest;
+
+/* E_JIP_COMMAND_SET_MIB_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint32_t                            u32MibId;
+
+    tsJIP_Msg_SetRequest                sRequest;
+} PACK tsJIP_Msg_SetMibRequest;
+
+/* E_JIP_COMMAND_SET_MULTI_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint32_t                            u32MibId;
+    uint8_t                             u8NumVars;
+
+#ifndef WIN32
+    uint8_t                             au8Payload[0]; /* u8NumVars tsJIP_Msg_SetRequest entries */
+#endif
+} PACK tsJIP_Msg_SetMultiRequest;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_SetMultiRequest, sizeof(tsJIP_Msg_SetMultiRequest) == 8);
+
+/* E_JIP_COMMAND_SET_MULTI_RESPONSE */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8MibIndex;
+    teJIP_Status                        eStatus;
+    uint8_t                             u8NumVars;
+
+#ifndef WIN32
+    uint8_t                             au8Payload[0]; /* u8NumVars tsJIP_Msg_SetMultiResponseEntry entries */
+#endif
+} PACK tsJIP_Msg_SetMultiResponseHeader;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_SetMultiResponseHeader, sizeof(tsJIP_Msg_SetMultiResponseHeader) == 6);
+
+typedef struct
+{
+    uint8_t                             u8VarIndex;
+    teJIP_Status                        eStatus;
+} PACK tsJIP_Msg_SetMultiResponseEntry;
+
+/* E_JIP_COMMAND_GET_MULTI_REQUEST */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint8_t                             u8NumRanges;
+
+#ifndef WIN32
+    uint8_t                             au8Payload[0]; /* u8NumRanges tsJIP_Msg_GetMultiRequestRange entries */
+#endif
+} PACK tsJIP_Msg_GetMultiRequest;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_GetMultiRequest, sizeof(tsJIP_Msg_GetMultiRequest) == 4);
+
+typedef struct
+{
+    uint32_t                            u32MibId;
+    uint8_t                             u8VarIndex;
+    uint8_t                             u8VarCount;
+} PACK tsJIP_Msg_GetMultiRequestRange;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_GetMultiRequestRange, sizeof(tsJIP_Msg_GetMultiRequestRange) == 6);
+
+/* E_JIP_COMMAND_GET_MULTI_RESPONSE.
+ * The ranges are answered in the order they were requested. When the packet fills up, the last range returned
+ * may be short, and u8NumRangesOutstanding counts it along with the ranges that weren't returned at all.
+ */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    teJIP_Status                        eStatus;
+    uint8_t                             u8NumRanges;
+    uint8_t                             u8NumRangesOutstanding;
+
+#ifndef WIN32
+    uint8_t                             au8Payload[0]; /* u8NumRanges tsJIP_Msg_GetMultiResponseRange entries */
+#endif
+} PACK tsJIP_Msg_GetMultiResponseHeader;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_GetMultiResponseHeader, sizeof(tsJIP_Msg_GetMultiResponseHeader) == 6);
+
+typedef struct
+{
+    uint8_t                             u8MibIndex;
+    uint8_t                             u8VarIndex;
+    teJIP_Status                        eStatus;
+    uint8_t                             u8NumVars;
+
+#ifndef WIN32
+    uint8_t                             au8Payload[0]; /* u8NumVars tsJIP_Msg_VarDescriptionEntry entries */
+#endif
+} PACK tsJIP_Msg_GetMultiResponseRange;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_GetMultiResponseRange, sizeof(tsJIP_Msg_GetMultiResponseRange) == 4);
+
+/* E_JIP_COMMAND_SET_UNACKED_REQUEST.
+ * As E_JIP_COMMAND_SET_MIB_REQUEST, but the server never responds. u16Sequence is incremented by the
+ * client for each request to a variable. The server drops a request whose sequence number is not
+ * newer than the last one it applied, so reordered packets cannot overwrite a later value. */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint32_t                            u32MibId;
+    uint16_t                            u16Sequence;
+
+    tsJIP_Msg_SetRequest                sRequest;
+} PACK tsJIP_Msg_SetUnackedRequest;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_SetUnackedRequest, sizeof(tsJIP_Msg_SetUnackedRequest) == 12);
+
+/* E_JIP_COMMAND_GET_GROUP_REQUEST.
+ * As E_JIP_COMMAND_GET_MIB_REQUEST for one variable, but answered even when sent to a multicast group. Each
+ * member sends its E_JIP_COMMAND_GET_RESPONSE back to the requester after a random delay of up to u16JitterMs
+ * milliseconds, so that the responses of a large group are spread out rather than all arriving at once. */
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+
+    uint32_t                            u32MibId;
+    uint8_t                             u8VarIndex;
+    uint16_t                            u16JitterMs;
+} PACK tsJIP_Msg_GetGroupRequest;
+COMPILE_TIME_ASSERT(CheckSizeof_tsJIP_Msg_GetGroupRequest, sizeof(tsJIP_Msg_GetGroupRequest) == 10);
+
+/* E_JIP_COMMAND_QUERY_MIB_REQUEST */
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	uint8_t                             u8MibStartIndex;
+	uint8_t                             u8NumMibs;
+} PACK tsJIP_Msg_QueryMibRequest;
+
+/* E_JIP_COMMAND_QUERY_MIB_RESPONSE */
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	teJIP_Status                        eStatus;
+
+	uint8_t                             u8NumMibsReturned;
+	uint8_t                             u8NumMibsOutstanding;
+} PACK tsJIP_Msg_QueryMibResponseHeader;
+
+typedef struct
+{
+	uint8_t                             u8MibIndex;
+    uint32_t                            u32MibID;
+	uint8_t                             u8NameLen;
+#ifndef WIN32
+	char                                acName[0];
+#endif
+} PACK tsJIP_Msg_QueryMibResponseListEntryHeader;
+
+/* E_JIP_COMMAND_QUERY_VAR_REQUEST */
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	uint8_t                             u8MibIndex;
+
+	uint8_t                             u8VarStartIndex;
+	uint8_t                             u8NumVars;
+} PACK tsJIP_Msg_QueryVarRequest;
+
+/* E_JIP_COMMAND_QUERY_VAR_RESPONSE */
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	teJIP_Status                        eStatus;
+
+	uint8_t                             u8MibIndex;
+
+	uint8_t                             u8NumVarsReturned;
+	uint8_t                             u8NumVarsOutstanding;
+} PACK tsJIP_Msg_QueryVarResponseHeader;
+
+typedef struct
+{
+	uint8_t                             u8VarIndex;
+	uint8_t                             u8NameLen;
+#ifndef WIN32
+	char                                acName[0];
+#endif
+} PACK tsJIP_Msg_QueryVarResponseListEntryHeader;
+
+typedef struct
+{
+    teJIP_VarType                       eVarType;
+    teJIP_AccessType                    eAccessType;
+    teJIP_Security                      eSecurity;
+} PACK tsJIP_Msg_QueryVarResponseListEntryFooter;
+
+/* E_JIP_COMMAND_TRAP_REQUEST */
+typedef struct
+{
+	tsJIP_MsgHeader                     sHeader;
+
+	uint8_t                             u8NotificationHandle;
+	uint8_t                             u8MibIndex;
+	uint8_t                             u8VarIndex;
+} PACK tsJIP_Msg_TrapRequest;
+
+typedef struct
+{
+    tsJIP_MsgHeader                     sHeader;
+    uint8_t                             u8Join;
+    uint32_t                            u32TreeVersion;
+} PACK tsJIP_Msg_TreeVersion;
+
+#ifdef WIN32
+#pragma pack(pop)
+#endif
+
+/****************************************************************************/
+/***        Exported Functions                                            ***/
+/****************************************************************************/
+
+/****************************************************************************/
+/***        Exported Variables                                            ***/
+/****************************************************************************/
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /*JIP_PACKETS_H_*/
+
+/****************************************************************************/
+/***        END OF FILE                                                   ***/
+/****************************************************************************/
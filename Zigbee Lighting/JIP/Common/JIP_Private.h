@@ -45,6 +45,19 @@
 
 #define JIP_DEVICE_MAX_GROUPS 16
 
+/** ID of the Groups MIB. Variable 0 is a table of the multicast groups the node belongs to */
+#define JIP_GROUPS_MIB_ID 0xffffff02
+
+/** Number of buckets in the device ID index of nodes. Must be a power of 2 */
+#define JIP_DEVICEID_INDEX_BUCKETS 32
+
+/** Number of buckets in the address index of nodes. Must be a power of 2.
+ *  Sized for servers hosting thousands of nodes. */
+#define JIP_ADDRESS_INDEX_BUCKETS 1024
+
+/** Number of locks the buckets of the address index are shared out between. Must be a power of 2 */
+#define JIP_ADDRESS_INDEX_LOCKS 32
+
 
 #define PRIVATE_CONTEXT(context) tsJIP_Private *psJIP_Private = (tsJIP_Private*)context->pvPriv;
 
@@ -76,6 +89,149 @@ uint64_t bswap_64(uint64_t x);
 
 #endif /* __UCLIBC__ */
 
+/** The latest value written to a variable with eJIP_SetVarCoalesced, waiting for the set sender */
+typedef struct _tsPendingSet
+{
+    tsVar*                  psVar;          /**< Variable to set. A handle is held on its node */
+    uint8_t                 au8Data[UINT8_MAX + 1]; /**< Latest value */
+    uint32_t                u32Size;        /**< Size of the latest value */
+    bool_t                  bPending;       /**< au8Data holds a value that has not been sent yet */
+    uint32_t                u32LastSent;    /**< Time the last value was sent, from u32TimeMillis */
+    struct _tsPendingSet*   psNext;         /**< Next in the context's list */
+} tsPendingSet;
+
+
+/** A multicast request with copies still to be sent by the retransmission thread */
+typedef struct _tsMulticastJob
+{
+    tsJIPAddress            sAddress;       /**< Multicast address */
+    int                     iMaxHops;       /**< Hop limit for the multicast */
+    teJIP_Command           eCommand;       /**< Command being sent */
+    int                     iInterface;     /**< Interface to send on, or -1 for every interface */
+    int                     iCopiesLeft;    /**< Number of copies still to send on each interface */
+    uint32_t                u32Due;         /**< Time the next copy is due, from u32TimeMillis */
+    uint32_t                u32Length;      /**< Length of the request in acBuffer */
+    struct _tsMulticastJob* psNext;         /**< Next in the context's list */
+    char                    acBuffer[PACKET_BUFFER_SIZE]; /**< The request, including its header */
+} tsMulticastJob;
+
+
+/** Hops assumed to a node whose distance has not been seen yet */
+#define JIP_COST_DEFAULT_HOPS 2
+
+/** Highest loss rate, in parts per thousand, that the cost model will assume for a node */
+#define JIP_COST_MAX_LOSS 900
+
+/** Time in milliseconds allowed for the last copy of a multicast to cross the network before it is verified */
+#define JIP_VERIFY_SETTLE_TIME 200
+
+/** Window in milliseconds over which the members of a group spread their responses when a multicast set is read back */
+#define JIP_VERIFY_JITTER 250
+
+/** Time in milliseconds allowed beyond the jitter window of a group read for the last response to arrive */
+#define JIP_GROUP_GET_MARGIN 500
+
+
+/** One setting of a \ref tsScene, with its value already encoded as it is sent */
+typedef struct
+{
+    tsVar*                  psVar;          /**< Variable to set */
+    tsNode*                 psNode;         /**< Node owning psVar, with a handle held on it. NULL if the entry named a group */
+    uint32_t                u32MibId;       /**< ID of the MIB owning psVar */
+    bool_t                  bMulticast;     /**< Sent to sGroupAddress rather than to psNode */
+    tsJIPAddress            sGroupAddress;  /**< Multicast group the entry is sent to */
+    uint32_t                u32Class;       /**< Index of the first entry setting the same MIB, variable and value */
+    uint32_t                u32Packet;      /**< Index of the packet carrying the entry */
+    uint32_t                u32Slot;        /**< Position of the entry's variable in that packet */
+    uint32_t                u32UnicastCost; /**< Expected cost of a unicast set on psNode, in thousandths of a packet-hop */
+    uint32_t                u32LossPermille;/**< Share of requests to psNode that have gone unanswered, in parts per thousand */
+    uint32_t                u32Size;        /**< Size of the local copy of the value */
+    uint8_t                 au8Data[UINT8_MAX + 1]; /**< Value, to update the local copy with */
+    uint32_t                u32EncodedLength; /**< Length of au8Encoded */
+    uint8_t                 au8Encoded[sizeof(tsJIP_Msg_SetRequest) + UINT8_MAX + 1]; /**< Set request entry for the value */
+} tsSceneEntryPlan;
+
+
+/** A pre-encoded request of a \ref tsScene */
+typedef struct
+{
+    tsNode*                 psNode;         /**< Node the request is sent to, or NULL for a multicast */
+    tsJIPAddress            sAddress;       /**< Multicast address when psNode is NULL */
+    teJIP_Command           eCommand;       /**< E_JIP_COMMAND_SET_MIB_REQUEST, or E_JIP_COMMAND_SET_MULTI_REQUEST for several variables */
+    uint32_t                u32NumVars;     /**< Number of variables set by the request */
+    uint32_t                u32Length;      /**< Length of the request in acBuffer */
+    char                    acBuffer[PACKET_BUFFER_SIZE]; /**< The request, including space for its header */
+} tsScenePacket;
+
+
+/** A scene compiled by \ref eJIP_SceneCreate */
+struct _tsScene
+{
+    int                     iMaxHops;       /**< Hop limit for the multicasts */
+    uint32_t                u32MulticastCost; /**< Cost of flooding one multicast through the network, in thousandths of a packet-hop */
+    uint32_t                u32UnicastCost; /**< Expected cost of making every node's settings by unicast */
+    uint32_t                u32Cost;        /**< Expected cost of the chosen mix of unicasts and multicasts */
+    uint32_t                u32NumEntries;  /**< Number of entries in pasEntries */
+    tsSceneEntryPlan*       pasEntries;     /**< The settings, in the order they were given */
+    uint32_t                u32NumPackets;  /**< Number of entries in pasPackets */
+    tsScenePacket*          pasPackets;     /**< The requests that apply the scene */
+};
+
+
+/** A GET in progress on a variable. Other requests for the same variable wait for it and share
+ *  its result rather than making their own exchange.
+ */
+typedef struct _tsGetInFlight
+{
+    tsVar*                  psVar;          /**< Variable being read */
+    teJIP_Status            eStatus;        /**< Result of the read, valid once the node is unlocked */
+    uint32_t                u32Waiters;     /**< Number of requests waiting for the result */
+    struct _tsGetInFlight*  psNext;         /**< Next in the context's list */
+} tsGetInFlight;
+
+
+/** A server request waiting for a callback that returned E_JIP_PENDING, until \ref eJIPserver_CompleteVar */
+typedef struct _tsServerPendingRequest
+{
+    tsVar*                  psVar;          /**< Variable the request is waiting on */
+    tsNode*                 psNode;         /**< Node owning psVar */
+    teJIP_Command           eCommand;       /**< Response to send, E_JIP_COMMAND_GET_RESPONSE or E_JIP_COMMAND_SET_RESPONSE */
+    uint8_t                 u8Handle;       /**< Handle of the request */
+    uint16_t                u16FirstEntry;  /**< First row requested, for reads of a table */
+    uint8_t                 u8EntryCount;   /**< Number of rows requested, for reads of a table */
+    tsJIPAddress            sClientAddress; /**< Address the request came from */
+    struct in6_addr         sNodeAddress;   /**< Address the response is sent from */
+    int                     iInterface;     /**< Interface the request arrived on */
+    struct _tsServerPendingRequest* psNext; /**< Next in the context's list */
+} tsServerPendingRequest;
+
+
+/** The QUERY_VAR entries of one MIB of a \ref tsServerSchema */
+typedef struct
+{
+    uint32_t                u32NumVars;     /**< Number of variables in the MIB */
+    uint32_t*               pau32VarOffsets;/**< Offset in pu8Entries of each variable's entry, then of the end of the last */
+} tsServerSchemaMib;
+
+
+/** The QUERY_MIB and QUERY_VAR response entries of a server node, encoded once and shared by every node
+ *  with the same MIBs and variables. A discovery response is then its header and a copy of a range of entries.
+ */
+typedef struct _tsServerSchema
+{
+    uint32_t                u32DeviceId;    /**< Device ID of the nodes using it */
+    uint32_t                u32NumMibs;     /**< Number of MIBs */
+    uint32_t*               pau32MibOffsets;/**< Offset in pu8Entries of each MIB's entry, then of the end of the last */
+    tsServerSchemaMib*      pasMibs;        /**< Variables of each MIB, in list order */
+    uint32_t                u32NumVarOffsets; /**< Number of entries in pau32VarOffsets */
+    uint32_t*               pau32VarOffsets;/**< Storage for the variable offsets of every MIB */
+    uint32_t                u32Size;        /**< Size of pu8Entries */
+    uint8_t*                pu8Entries;     /**< Encoded MIB entries, followed by the variable entries of each MIB */
+    uint32_t                u32RefCount;    /**< Number of nodes using it */
+    struct _tsServerSchema* psNext;         /**< Next in the context's bucket for the device ID */
+} tsServerSchema;
+
+
 /** Private structure used by the library */
 typedef struct
 {
@@ -90,6 +246,49 @@ typedef struct
     tsThread            sNetworkChangeMonitor;
     tprCbNetworkChange  prCbNetworkChange;
     
+    /* Nodes in the network, hashed by device ID and chained through tsNode.psNextDeviceId.
+     * Protected by the context lock along with the main node list. */
+    tsNode*             apsDeviceIdIndex[JIP_DEVICEID_INDEX_BUCKETS];
+    
+    /* Nodes in the network, hashed by IPv6 address and chained through tsNode.psNextAddress.
+     * Changed with the context lock held, and the bucket's lock from asAddressIndexLocks as well, so that
+     * looking up a node by address only needs the bucket's lock. Nothing else is locked while holding one. */
+    tsNode*             apsAddressIndex[JIP_ADDRESS_INDEX_BUCKETS];
+    tsLock              asAddressIndexLocks[JIP_ADDRESS_INDEX_LOCKS];
+    
+    /* GETs in progress, so that identical requests can share one exchange. Protected by the context lock. */
+    tsGetInFlight*      psGetsInFlight;
+    
+    /* Set sender thread for eJIP_SetVarCoalesced. It is started on first use and woken through the queue.
+     * The list of pending sets and the flags are protected by the context lock. */
+    tsThread            sSetCoalescer;
+    tsQueue             sSetCoalescerQueue;
+    tsPendingSet*       psPendingSets;
+    bool_t              bSetCoalescerWoken;
+    uint32_t            u32SetCoalescerIntervalMs;
+    volatile uint32_t   u32CoalescedSetsSent;
+    volatile uint32_t   u32CoalescedSetsSuperseded;
+    
+    /* Multicast retransmission thread. Started on first use and woken through the queue.
+     * The list of jobs and the flag are protected by the context lock, which also serialises
+     * use of the socket's multicast options. */
+    tsThread            sMulticastThread;
+    tsQueue             sMulticastQueue;
+    tsMulticastJob*     psMulticastJobs;
+    bool_t              bMulticastWoken;
+    
+    /* Server requests waiting for callbacks to complete them. Protected by the context lock. */
+    tsServerPendingRequest* psServerPending;
+    uint32_t            u32NumServerPending;
+    
+    /* Encoded discovery responses of server nodes, hashed by device ID. Protected by the context lock.
+     * Each is freed when the last node using it drops it, so a node can read its own without the lock. */
+    tsServerSchema*     apsServerSchemas[JIP_DEVICEID_INDEX_BUCKETS];
+    
+    /* Counts of eJIP_GetVarCached reads answered from memory / the node. Updated atomically. */
+    volatile uint32_t   u32VarCacheHits;
+    volatile uint32_t   u32VarCacheMisses;
+    
     /* Lock for all library structures */
     tsLock              sLock;
 } tsJIP_Private;
@@ -99,14 +298,40 @@ typedef struct
 typedef struct
 {
     struct in6_addr     asGroupAddresses[JIP_DEVICE_MAX_GROUPS];
+    tsNodeLinkStats     sLinkStats;         /**< Client context: what is known about the path to the node */
+    tsServerSchema*     psSchema;           /**< Server context: the node's encoded discovery responses. NULL until
+                                             *   they are encoded, and again after the MIBs or vars change */
 } tsNode_Private;
 
 
+/** Bucket of a device ID in the device ID indexes of the context */
+static inline uint32_t u32JIP_DeviceIdBucket(uint32_t u32DeviceId)
+{
+    return (u32DeviceId ^ (u32DeviceId >> 16)) & (JIP_DEVICEID_INDEX_BUCKETS - 1);
+}
+
+
 teJIP_Status eJIP_TrapEvent(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, char *pcPacket);
 
 
 teJIP_Status eJIP_GetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar);
 
+
+/** Stop the set sender thread used by \ref eJIP_SetVarCoalesced if it is running.
+ *  Values that have not been sent yet are dropped.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \return E_JIP_OK on success
+ */
+teJIP_Status eJIP_SetCoalescerStop(tsJIP_Context *psJIP_Context);
+
+
+/** Stop the multicast retransmission thread if it is running.
+ *  Copies that have not been sent yet are dropped.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \return E_JIP_OK on success
+ */
+teJIP_Status eJIP_MulticastStop(tsJIP_Context *psJIP_Context);
+
 teJIP_Status eJIPserver_HandleGetTableVar(tsJIP_Context *psJIP_Context, tsVar *psVar, 
                                           uint16_t u16FirstEntry, uint8_t u8EntryCount,
                                           uint8_t *pcSendData, unsigned int *piSendDataLength);
@@ -139,9 +364,11 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
 
 /** Remove a node from the network tree.
  *  Removes the node from the network.
- *  If the node is found in the network, it is removed from the network tree.
- *  It's storage is not free'd, that is done by \ref JIP_Net_FreeNode. A pointer to the node can be
- *  returned in ppsNode for passing to this.
+ *  If the node is found in the network, it is removed from the network tree and marked as removed.
+ *  It's storage is not free'd. The network's handle on the node is passed to the caller, who must 
+ *  release it using \ref eJIP_ReleaseNode once finished. The node is then free'd as soon as no other 
+ *  handles are held on it. A pointer to the node can be returned in ppsNode for passing to this.
+ *  The node is returned locked.
  *  \param psJIP_Context        Pointer to the JIP Context
  *  \param psAddress            Pointer to IPv6 Address structure
  *  \param ppsNode              [out]Pointer to location to store the node that has been removed.
@@ -150,7 +377,20 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
 teJIP_Status eJIP_NetRemoveNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress, tsNode **ppsNode);
 
 
+/** Get a handle to the node with an IPv6 address, whatever its port.
+ *  This is how the server finds the destination of a unicast packet. As \ref psJIP_AcquireNode, the 
+ *  node is not locked and the handle must be released with \ref eJIP_ReleaseNode.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param psAddress            Pointer to the IPv6 address
+ *  \return NULL if no node has the address, otherwise a handle to it
+ */
+tsNode *psJIP_AcquireNodeByIn6(tsJIP_Context *psJIP_Context, const struct in6_addr *psAddress);
+
+
 /** Free all storage associated with a node
+ *  This is used directly only for nodes that were never added to the network. Nodes that have been
+ *  added are free'd by \ref eJIP_ReleaseNode when the last handle on them is released.
+ *  The node must not be locked. A striped node lock is shared with other nodes, and would stay held.
  *  All Mibs are free'd.
  *  All traps are unregistered (packets are sent out, which may fail if the node has already left the network.
  *  \param psJIP_Context        Pointer to the JIP Context
@@ -175,6 +415,33 @@ tsMib *psJIP_NodeAddMib(tsNode *psNode, uint32_t u32MibId, uint8_t u8Index, cons
 tsVar *psJIP_MibAddVar(tsMib *psMib, uint8_t u8Index, const char *pcName, teJIP_VarType eVarType, 
                        teJIP_AccessType eAccessType, teJIP_Security eSecurity);
 
+/** Get the number of bytes a variable value of type eVarType occupies in a packet.
+ *  \param eVarType             Type of the variable
+ *  \param pu8Data              Pointer to the value in the packet, used to read the length of strings and blobs.
+ *                              If NULL, the largest size the type can have is returned.
+ *  \return Number of bytes, or 0 for types that have no fixed encoding
+ */
+uint32_t u32JIP_VarDataSize(teJIP_VarType eVarType, const uint8_t *pu8Data);
+
+/** Get the extension of a variable, allocating it if the variable doesn't have one yet.
+ *  \param psVar                Pointer to variable
+ *  \return Pointer to the extension, or NULL if it could not be allocated
+ */
+tsVarExt *psJIP_VarExt(tsVar *psVar);
+
+/** Free the encoded GET response entry a server keeps for a variable, if it has one.
+ *  Called whenever the variable's data changes.
+ *  \param psVar                Pointer to variable
+ */
+void vJIP_VarDropEncoded(tsVar *psVar);
+
+/** Forget the encoded discovery responses a server node uses, so that they are encoded again on the next
+ *  discovery request. Called whenever a MIB or variable is added to or freed from the node, and when the
+ *  node is freed. The schema is freed too if no other node uses it.
+ *  \param psNode               Pointer to node. NULL for the MIBs of the caches, which are not on a node
+ */
+void vJIP_NodeDropSchema(tsNode *psNode);
+
 
 
 /** Utility function to add a node stucture to a linked list of nodes.
@@ -194,10 +461,28 @@ tsNode *psJIP_NodeListRemove(tsNode **ppsNodeListHead, tsNode *psNode);
 
 
 
+/** Handle a request to a node of a server.
+ *  \param psDstAddress         Address the request was sent to, with the interface it arrived on as its scope
+ *  \return E_JIP_OK if the response in pcSendData should be sent
+ */
 teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
                                      teJIP_Command eReceiveCommand, uint8_t *pcReceiveData, unsigned int iReceiveDataLength,
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength);
 
+/** Drop the server requests waiting on callbacks of a node, of the variables of a MIB, or of every node if 
+ *  psNode and psMib are both NULL.
+ *  Takes the context lock.
+ */
+void vJIPserver_DropPending(tsJIP_Context *psJIP_Context, tsNode *psNode, tsMib *psMib);
+
+/** Drop a node's reference to a schema, and free the schema if it was the last.
+ *  Takes the context lock.
+ */
+void vJIPserver_ReleaseSchema(tsJIP_Context *psJIP_Context, tsServerSchema *psSchema);
+
+/** Free the encoded discovery responses of a server once no nodes remain to use them */
+void vJIPserver_FreeSchemas(tsJIP_Context *psJIP_Context);
+
 
 teJIP_Status eGroups_Init(tsNode *psNode);
 
@@ -49,6 +49,11 @@
 #include <netdb.h>
 #include <errno.h>
 
+#if defined(__linux__)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif /* __linux__ */
+
 #include <JIP.h>
 #include <JIP_Private.h>
 #include <JIP_Packets.h>
@@ -56,7 +61,19 @@
 #include <Trace.h>
 #include <Threads.h>
 
+/* Darwin receives packet info with the RFC 2292 option. Linux has the RFC 3542 one, 
+ * where IPV6_PKTINFO would instead set the source of outgoing packets. */
+#if !defined(__linux__)
+#undef IPV6_RECVPKTINFO
 #define IPV6_RECVPKTINFO    IPV6_PKTINFO
+#endif /* __linux__ */
+
+/** Socket option to receive the hop limit of incoming packets. Older stacks only have the RFC 2292 name */
+#ifdef IPV6_RECVHOPLIMIT
+#define JIP_IPV6_RECVHOPLIMIT   IPV6_RECVHOPLIMIT
+#else
+#define JIP_IPV6_RECVHOPLIMIT   IPV6_HOPLIMIT
+#endif /* IPV6_RECVHOPLIMIT */
 
 #define DBG_FUNCTION_CALLS 0
 #define DBG_NETWORK 0
@@ -71,6 +88,38 @@
 #define MAX_SERVER_EVENTS 100
 
 
+/** Maximum age (ms) of the cached interface table on platforms without interface change notifications */
+#define JIP_INTERFACE_REFRESH_TIME      5000
+
+
+/** Longest time (ms) a server will hold back its response to a group read, whatever the request asks for */
+#define JIP_GROUP_GET_MAX_JITTER        10000
+
+/** Largest number of server worker threads */
+#define JIP_SERVER_MAX_THREADS          32
+
+/** Number of datagrams that may wait for each server worker thread */
+#define JIP_SERVER_SHARD_QUEUE_SIZE     256
+
+/** Space for the control messages of a received datagram. IPv4 mapped packets may carry IPv4 packet info too */
+#define JIP_SERVER_CONTROL_SIZE         128
+
+/** A datagram received by the server listener, and the buffers for its response */
+typedef struct
+{
+    volatile uint32_t       u32RefCount;        /**< Shards still to handle the datagram, once passed to them */
+    int                     iLength;            /**< Length of the datagram */
+    struct sockaddr_in6     sSrcAddress;
+    struct in6_pktinfo      sPacketInfo;
+    struct iovec            sInIO;
+    struct iovec            sOutIO;
+    char                    acInMsgControl[JIP_SERVER_CONTROL_SIZE];
+    char                    acOutMsgControl[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    char                    acInBuf[PACKET_BUFFER_SIZE];
+    char                    acOutBuf[PACKET_BUFFER_SIZE];
+} tsServerDatagram;
+
+
 /** If this is defined, then the source port of UDP datagrams from libJIP will be
  *  bound to JIP_DEFAULT_PORT.
  *  This has the advantage that any registered traps will make it to this process
@@ -97,6 +146,38 @@ static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNo
  */
 static int iNetwork_NodeInterface(tsNode *psNode);
 
+static teNetworkStatus eNetwork_LockInterfaces(tsNetworkContext *psNetworkContext);
+static void vNetwork_UnlockInterfaces(tsNetworkContext *psNetworkContext);
+static void *pvInterfaceMonitorThread(void *psThreadInfoVoid);
+static void vNetwork_RecordResponse(tsNodeLinkStats *psLinkStats, int iHopLimit);
+static teNetworkStatus eNetwork_DeferResponse(tsNetworkContext *psNetworkContext, struct sockaddr_in6 *psDstAddress, struct in6_addr *psSrcAddress,
+                                              int iInterface, const char *pcData, unsigned int iLength, uint32_t u32DelayMs);
+static void *pvResponseSenderThread(void *psThreadInfoVoid);
+static void *pvServerShardThread(void *psThreadInfoVoid);
+
+
+/** Note a response from a node in its link statistics.
+ *  Nodes start packets with a hop limit of 64, 128 or 255, so the number of hops is estimated
+ *  from how far below the next of those the hop limit has fallen.
+ */
+static void vNetwork_RecordResponse(tsNodeLinkStats *psLinkStats, int iHopLimit)
+{
+    if (!psLinkStats)
+    {
+        return;
+    }
+    u32AtomicAdd(&psLinkStats->u32Responses, 1);
+    if (iHopLimit > 0)
+    {
+        int iInitial = (iHopLimit <= 64) ? 64 : ((iHopLimit <= 128) ? 128 : 255);
+        psLinkStats->u32Hops = iInitial - iHopLimit + 1;
+    }
+}
+
+
+/** Handle of the last request sent by \ref Network_ExchangeJIP or \ref Network_ExchangeJIPBatch */
+static uint8_t u8ExchangeHandle = 0;
+
 
 tsJIPAddress   Network_MAC_to_IPv6(tsNetworkContext *psNetworkContext, uint64_t u64MAC_Address)
 {
@@ -143,6 +224,20 @@ teNetworkStatus Network_Init(tsNetworkContext *psNetworkContext, tsJIP_Context *
     /* Initialise number of trap threads */
     psNetworkContext->u32NumTrapThreads = 0;
     
+    /* The interface table is built on first use */
+    psNetworkContext->iInterfaceMonitorSocket = -1;
+    if (eLockCreate(&psNetworkContext->sInterfaceLock) != E_LOCK_OK)
+    {
+        DBG_vPrintf(DBG_NETWORK, "Failed to create interface lock\n");
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
+    if (eLockCreate(&psNetworkContext->sResponseLock) != E_LOCK_OK)
+    {
+        DBG_vPrintf(DBG_NETWORK, "Failed to create response lock\n");
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
     return E_NETWORK_OK;
 }
 
@@ -152,7 +247,64 @@ teNetworkStatus Network_Destroy(tsNetworkContext *psNetworkContext)
     eThreadStop(&psNetworkContext->sSocketListener);
     eQueueDestroy(&psNetworkContext->sSocketQueue);
     
-    free(psNetworkContext->pasServerGroups);
+    /* With the listener gone nothing more is queued for the shards */
+    if (psNetworkContext->pasShards)
+    {
+        uint32_t i;
+        for (i = 0; i < psNetworkContext->u32NumShards; i++)
+        {
+            tsServerShard *psShard = &psNetworkContext->pasShards[i];
+            void *pvDatagram;
+            
+            if (psShard->sWorker.pvThreadData)
+            {
+                /* Wake the worker up with an empty entry so that it sees it is stopping */
+                psShard->sWorker.eState = E_THREAD_STOPPING;
+                eQueueQueue(&psShard->sQueue, NULL);
+                eThreadStop(&psShard->sWorker);
+            }
+            while (eQueueDequeueTimed(&psShard->sQueue, 0, &pvDatagram) == E_QUEUE_OK)
+            {
+                if (pvDatagram && (u32AtomicAdd(&((tsServerDatagram *)pvDatagram)->u32RefCount, (uint32_t)-1) == 0))
+                {
+                    free(pvDatagram);
+                }
+            }
+            eQueueDestroy(&psShard->sQueue);
+        }
+        free(psNetworkContext->pasShards);
+        psNetworkContext->pasShards = NULL;
+        psNetworkContext->u32NumShards = 0;
+    }
+    
+    /* Nothing more can be deferred now that the listener has gone */
+    if (psNetworkContext->sResponseSender.pvThreadData)
+    {
+        eThreadStop(&psNetworkContext->sResponseSender);
+        eQueueDestroy(&psNetworkContext->sResponseQueue);
+    }
+    while (psNetworkContext->psDeferredResponses)
+    {
+        tsDeferredResponse *psResponse = psNetworkContext->psDeferredResponses;
+        psNetworkContext->psDeferredResponses = psResponse->psNext;
+        free(psResponse);
+    }
+    psNetworkContext->u32NumDeferredResponses = 0;
+    eLockDestroy(&psNetworkContext->sResponseLock);
+    
+    {
+        uint32_t i;
+        for (i = 0; i < JIP_SERVER_GROUP_BUCKETS; i++)
+        {
+            while (psNetworkContext->apsServerGroups[i])
+            {
+                tsServerGroups *psGroup = psNetworkContext->apsServerGroups[i];
+                psNetworkContext->apsServerGroups[i] = psGroup->psNext;
+                free(psGroup->apsMembers);
+                free(psGroup);
+            }
+        }
+    }
     
     while (u32AtomicGet(&psNetworkContext->u32NumTrapThreads) > 0)
     {
@@ -165,161 +317,218 @@ teNetworkStatus Network_Destroy(tsNetworkContext *psNetworkContext)
         close(psNetworkContext->iSocket);
     }
     
+    if (psNetworkContext->sInterfaceMonitor.pvThreadData)
+    {
+        eThreadStop(&psNetworkContext->sInterfaceMonitor);
+    }
+    if (psNetworkContext->iInterfaceMonitorSocket >= 0)
+    {
+        close(psNetworkContext->iInterfaceMonitorSocket);
+    }
+    {
+        uint32_t i;
+        for (i = 0; i < psNetworkContext->u32NumInterfaces; i++)
+        {
+            if (psNetworkContext->pasInterfaces[i].iMulticastSocket >= 0)
+            {
+                close(psNetworkContext->pasInterfaces[i].iMulticastSocket);
+            }
+        }
+        free(psNetworkContext->pasInterfaces);
+    }
+    eLockDestroy(&psNetworkContext->sInterfaceLock);
+    
     return E_NETWORK_OK;
 }
 
 
-teNetworkStatus Network_ServerGroupJoin(tsNetworkContext *psNetworkContext, tsNode *psNode, struct in6_addr *psMulticastAddress)
+static inline uint32_t u32Network_AddressHash(const struct in6_addr *psAddress)
+{
+    uint32_t au32Words[4];
+    
+    memcpy(au32Words, psAddress, sizeof(au32Words));
+    au32Words[0] ^= au32Words[1] ^ au32Words[2] ^ au32Words[3];
+    return au32Words[0] ^ (au32Words[0] >> 16);
+}
+
+
+static inline uint32_t u32Network_GroupBucket(const struct in6_addr *psMulticastAddress)
 {
-    tsServerGroups      *psNewGroups;
-    int i;
+    return u32Network_AddressHash(psMulticastAddress) & (JIP_SERVER_GROUP_BUCKETS - 1);
+}
+
 
-    for (i = 0; i < psNetworkContext->u32NumGroups; i++)
+/** Find a group in the server's index. Must be called with the JIP context lock held.
+ *  \param pppsPosition[out]    If not NULL, set to the link pointing at the group, or the end of its bucket
+ *  \return The group, or NULL if the server is not a member of it
+ */
+static tsServerGroups *psNetwork_FindGroup(tsNetworkContext *psNetworkContext, const struct in6_addr *psMulticastAddress, tsServerGroups ***pppsPosition)
+{
+    tsServerGroups **ppsPosition = &psNetworkContext->apsServerGroups[u32Network_GroupBucket(psMulticastAddress)];
+    
+    while (*ppsPosition)
     {
-        if (memcmp(&psNetworkContext->pasServerGroups[i].sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
+        if (memcmp(&(*ppsPosition)->sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
         {
-            psNetworkContext->pasServerGroups[i].u32NumMembers++;
-            DBG_vPrintf(DBG_NETWORK, "Server is already in group - now %d members.\n", psNetworkContext->pasServerGroups[i].u32NumMembers);
-            return E_NETWORK_OK;
+            break;
         }
+        ppsPosition = &(*ppsPosition)->psNext;
+    }
+    if (pppsPosition)
+    {
+        *pppsPosition = ppsPosition;
     }
+    return *ppsPosition;
+}
+
+
+/** Join or leave a multicast group on every interface */
+static teNetworkStatus eNetwork_GroupMembership(tsNetworkContext *psNetworkContext, struct in6_addr *psMulticastAddress, bool_t bJoin)
+{
+    struct ipv6_mreq    sRequest;
+    uint32_t            u32Interface;
     
-    /* New group */
-    DBG_vPrintf(DBG_NETWORK, "Add server to new group - now %d groups.\n", psNetworkContext->u32NumGroups + 1);
+    if (eNetwork_LockInterfaces(psNetworkContext) != E_NETWORK_OK)
+    {
+        return E_NETWORK_ERROR_FAILED;
+    }
     
-    psNewGroups = realloc(psNetworkContext->pasServerGroups, sizeof(tsServerGroups) * (psNetworkContext->u32NumGroups + 1));
-    if (!psNewGroups)
+    sRequest.ipv6mr_multiaddr = *psMulticastAddress;
+
+    for (u32Interface = 0; u32Interface < psNetworkContext->u32NumInterfaces; u32Interface++)
     {
-        return E_NETWORK_ERROR_NO_MEM;
+        sRequest.ipv6mr_interface = psNetworkContext->pasInterfaces[u32Interface].iIndex;
+        DBG_vPrintf(DBG_NETWORK, "%s group on interface %d\n", bJoin ? "Join" : "Leave", sRequest.ipv6mr_interface);
+        
+        if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, bJoin ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, 
+                       &sRequest, sizeof(struct ipv6_mreq)) < 0)
+        {
+            /* If the socket is already a member of the group, or was not a member, that is ok. */
+            if (errno != (bJoin ? EADDRINUSE : EADDRNOTAVAIL))
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: setsockopt failed (%s)\n", __FUNCTION__, strerror(errno));
+                vNetwork_UnlockInterfaces(psNetworkContext);
+                return E_NETWORK_ERROR_FAILED;
+            }
+        }
     }
-    psNetworkContext->pasServerGroups = psNewGroups;
+    vNetwork_UnlockInterfaces(psNetworkContext);
+    return E_NETWORK_OK;
+}
+
+
+teNetworkStatus Network_ServerGroupJoin(tsNetworkContext *psNetworkContext, tsNode *psNode, struct in6_addr *psMulticastAddress)
+{
+    tsJIP_Context *psJIP_Context = psNetworkContext->psJIP_Context;
+    tsServerGroups *psGroup, **ppsPosition;
+    teNetworkStatus eStatus = E_NETWORK_OK;
+    
+    eJIP_Lock(psJIP_Context);
     
+    psGroup = psNetwork_FindGroup(psNetworkContext, psMulticastAddress, &ppsPosition);
+    if (!psGroup)
     {
-        struct ipv6_mreq    sRequest;
-        struct ifaddrs *ifp, *ifs;
+        /* New group */
+        DBG_vPrintf(DBG_NETWORK, "Add server to new group - now %d groups.\n", psNetworkContext->u32NumGroups + 1);
         
-        if (getifaddrs(&ifs) < 0) 
+        psGroup = malloc(sizeof(tsServerGroups));
+        if (!psGroup)
         {
-            DBG_vPrintf(DBG_NETWORK, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
-            return E_NETWORK_ERROR_FAILED;
+            eJIP_Unlock(psJIP_Context);
+            return E_NETWORK_ERROR_NO_MEM;
         }
+        memset(psGroup, 0, sizeof(tsServerGroups));
+        psGroup->sMulticastAddress = *psMulticastAddress;
         
-        sRequest.ipv6mr_multiaddr = *psMulticastAddress;
-
-        for (ifp = ifs; ifp; ifp = ifp->ifa_next)
+        eStatus = eNetwork_GroupMembership(psNetworkContext, psMulticastAddress, True);
+        if (eStatus != E_NETWORK_OK)
         {
-            if (ifp->ifa_addr != NULL && ifp->ifa_addr->sa_family == AF_INET6)
-            {
-                char acAddr[INET6_ADDRSTRLEN] = "Could not determine address\n";
-                DBG_vPrintf(DBG_NETWORK, "Interface %5s: [%s]\n", ifp->ifa_name,
-                    inet_ntop(AF_INET6, &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr, acAddr, INET6_ADDRSTRLEN));
-                
-                sRequest.ipv6mr_interface = if_nametoindex(ifp->ifa_name);
-                DBG_vPrintf(DBG_NETWORK, "Join group on interface %d\n", sRequest.ipv6mr_interface);
-                
-                // Now we join the group
-                if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_JOIN_GROUP, &sRequest, sizeof(struct ipv6_mreq)) < 0)
-                {
-                    /* If the socket is already a member of the group, that is ok. */
-                    if (errno != EADDRINUSE)
-                    {
-                        DBG_vPrintf(DBG_NETWORK, "%s: setsockopt failed (%s)\n", __FUNCTION__, strerror(errno));
-                        return E_NETWORK_ERROR_FAILED;
-                    }
-                }
-            }
+            free(psGroup);
+            eJIP_Unlock(psJIP_Context);
+            return eStatus;
         }
-        freeifaddrs(ifs);
+        
+        *ppsPosition = psGroup;
+        psNetworkContext->u32NumGroups++;
     }
-
-    psNewGroups = &psNetworkContext->pasServerGroups[psNetworkContext->u32NumGroups];
-    psNetworkContext->u32NumGroups++;
     
-    psNewGroups->sMulticastAddress = *psMulticastAddress;
-    psNewGroups->u32NumMembers = 1;
+    if (psGroup->u32NumMembers == psGroup->u32MaxMembers)
+    {
+        uint32_t u32MaxMembers = psGroup->u32MaxMembers ? psGroup->u32MaxMembers * 2 : 4;
+        tsNode **apsNewMembers = realloc(psGroup->apsMembers, sizeof(tsNode *) * u32MaxMembers);
+        
+        if (!apsNewMembers)
+        {
+            eStatus = E_NETWORK_ERROR_NO_MEM;
+        }
+        else
+        {
+            psGroup->apsMembers = apsNewMembers;
+            psGroup->u32MaxMembers = u32MaxMembers;
+        }
+    }
     
-    return E_NETWORK_OK;
+    if (eStatus == E_NETWORK_OK)
+    {
+        psGroup->apsMembers[psGroup->u32NumMembers++] = psNode;
+        DBG_vPrintf(DBG_NETWORK, "Server group now has %d members.\n", psGroup->u32NumMembers);
+    }
+    else if (psGroup->u32NumMembers == 0)
+    {
+        /* The group was only just added */
+        *ppsPosition = psGroup->psNext;
+        psNetworkContext->u32NumGroups--;
+        (void)eNetwork_GroupMembership(psNetworkContext, psMulticastAddress, False);
+        free(psGroup);
+    }
+    
+    eJIP_Unlock(psJIP_Context);
+    return eStatus;
 }
 
 
 teNetworkStatus Network_ServerGroupLeave(tsNetworkContext *psNetworkContext, tsNode *psNode, struct in6_addr *psMulticastAddress)
 {
-    int i;
-    int iGroupAddressSlot = 0;
+    tsJIP_Context *psJIP_Context = psNetworkContext->psJIP_Context;
+    tsServerGroups *psGroup, **ppsPosition;
+    teNetworkStatus eStatus = E_NETWORK_OK;
+    uint32_t i;
     
-    for (i = 0; i < psNetworkContext->u32NumGroups; i++)
+    eJIP_Lock(psJIP_Context);
+    
+    psGroup = psNetwork_FindGroup(psNetworkContext, psMulticastAddress, &ppsPosition);
+    for (i = 0; psGroup && (i < psGroup->u32NumMembers); i++)
     {
-        if (memcmp(&psNetworkContext->pasServerGroups[i].sMulticastAddress, psMulticastAddress, sizeof(struct in6_addr)) == 0)
+        if (psGroup->apsMembers[i] == psNode)
         {
-            psNetworkContext->pasServerGroups[i].u32NumMembers--;
-            DBG_vPrintf(DBG_NETWORK, "Server is in group - now %d members.\n", psNetworkContext->pasServerGroups[i].u32NumMembers);
-            
-            if (psNetworkContext->pasServerGroups[i].u32NumMembers == 0)
-            {
-                /* break from the loop if we are going to remove the group */
-                iGroupAddressSlot = i;
-                break;
-            }
-            
-            return E_NETWORK_OK;
+            break;
         }
     }
     
-    if (i == psNetworkContext->u32NumGroups)
+    if (!psGroup || (i == psGroup->u32NumMembers))
     {
-        /* If we get to the end of the table then the group did not exist */
-        DBG_vPrintf(DBG_NETWORK, "Server is not in group\n");
+        DBG_vPrintf(DBG_NETWORK, "Node is not in server group\n");
+        eJIP_Unlock(psJIP_Context);
         return E_NETWORK_ERROR_FAILED;
     }
     
+    /* Order of members does not matter */
+    psGroup->apsMembers[i] = psGroup->apsMembers[--psGroup->u32NumMembers];
+    DBG_vPrintf(DBG_NETWORK, "Server group now has %d members.\n", psGroup->u32NumMembers);
+    
+    if (psGroup->u32NumMembers == 0)
     {
-        struct ipv6_mreq    sRequest;
-        struct ifaddrs *ifp, *ifs;
+        eStatus = eNetwork_GroupMembership(psNetworkContext, psMulticastAddress, False);
         
-        if (getifaddrs(&ifs) < 0) 
-        {
-            DBG_vPrintf(DBG_NETWORK, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
-            return E_NETWORK_ERROR_FAILED;
-        }
-        
-        sRequest.ipv6mr_multiaddr = *psMulticastAddress;
-
-        for (ifp = ifs; ifp; ifp = ifp->ifa_next)
-        {
-            if (ifp->ifa_addr != NULL && ifp->ifa_addr->sa_family == AF_INET6)
-            {
-                char acAddr[INET6_ADDRSTRLEN] = "Could not determine address\n";
-                DBG_vPrintf(DBG_NETWORK, "Interface %5s: [%s]\n", ifp->ifa_name,
-                    inet_ntop(AF_INET6, &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr, acAddr, INET6_ADDRSTRLEN));
-                
-                sRequest.ipv6mr_interface = if_nametoindex(ifp->ifa_name);
-                DBG_vPrintf(DBG_NETWORK, "Leave group on interface %d\n", sRequest.ipv6mr_interface);
-                
-                // Now we leave the group
-                if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_LEAVE_GROUP, &sRequest, sizeof(struct ipv6_mreq)) < 0)
-                {
-                    /* If the socket was not a member of the group, that is ok. */
-                    if (errno != EADDRNOTAVAIL)
-                    {
-                        DBG_vPrintf(DBG_NETWORK, "%s: setsockopt failed (%s)\n", __FUNCTION__, strerror(errno));
-                        return E_NETWORK_ERROR_FAILED;
-                    }
-                }
-            }
-        }
-        freeifaddrs(ifs);
+        *ppsPosition = psGroup->psNext;
+        psNetworkContext->u32NumGroups--;
+        DBG_vPrintf(DBG_NETWORK, "Remove server from group - now %d groups.\n", psNetworkContext->u32NumGroups);
+        free(psGroup->apsMembers);
+        free(psGroup);
     }
-
-    // Now remove the entry from the server groups table.
-    psNetworkContext->u32NumGroups--;
-    DBG_vPrintf(DBG_NETWORK, "Remove server from group - now %d groups.\n", psNetworkContext->u32NumGroups);
-    
-    // Shuffle remaining groups down the table.
-    memmove(&psNetworkContext->pasServerGroups[iGroupAddressSlot], 
-            &psNetworkContext->pasServerGroups[iGroupAddressSlot + 1],
-            sizeof(tsServerGroups) * (psNetworkContext->u32NumGroups - iGroupAddressSlot));
     
-    return E_NETWORK_OK;
+    eJIP_Unlock(psJIP_Context);
+    return eStatus;
 }
 
 
@@ -446,6 +655,15 @@ teNetworkStatus Network_Connect(tsNetworkContext *psNetworkContext, const char *
     psNetworkContext->eProtocol = E_NETWORK_PROTO_IPV6;
     psNetworkContext->eLink = E_NETWORK_LINK_UDP;
     
+    {
+        /* The hop limit of responses tells us how far away each node is */
+        int on = 1;
+        if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, JIP_IPV6_RECVHOPLIMIT, &on, sizeof(on)) < 0)
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Could not enable hop limit reception (%s)\n", __FUNCTION__, strerror(errno));
+        }
+    }
+    
     /* Set up socket listener thread and queue */
     if (eQueueCreate(&psNetworkContext->sSocketQueue, 3) != E_QUEUE_OK)
     {
@@ -643,6 +861,46 @@ teNetworkStatus Network_Listen(tsNetworkContext *psNetworkContext)
     
     freeaddrinfo(res);  
     
+    if ((eStatus == E_NETWORK_OK) && (psNetworkContext->psJIP_Context->iServerThreads > 1))
+    {
+        // Start the worker threads that the listener will pass datagrams to
+        uint32_t u32NumShards = psNetworkContext->psJIP_Context->iServerThreads;
+        uint32_t i;
+        
+        if (u32NumShards > JIP_SERVER_MAX_THREADS)
+        {
+            u32NumShards = JIP_SERVER_MAX_THREADS;
+        }
+        
+        psNetworkContext->pasShards = calloc(u32NumShards, sizeof(tsServerShard));
+        if (!psNetworkContext->pasShards)
+        {
+            eStatus = E_NETWORK_ERROR_NO_MEM;
+        }
+        
+        for (i = 0; (eStatus == E_NETWORK_OK) && (i < u32NumShards); i++)
+        {
+            tsServerShard *psShard = &psNetworkContext->pasShards[i];
+            
+            psShard->psNetworkContext = psNetworkContext;
+            psShard->u32Index = i;
+            if (eQueueCreate(&psShard->sQueue, JIP_SERVER_SHARD_QUEUE_SIZE) != E_QUEUE_OK)
+            {
+                eStatus = E_NETWORK_ERROR_NO_MEM;
+                break;
+            }
+            psNetworkContext->u32NumShards++;
+            
+            psShard->sWorker.pvThreadData = psShard;
+            if (eThreadStart(pvServerShardThread, &psShard->sWorker, E_THREAD_JOINABLE) != E_THREAD_OK)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Failed to start server worker thread\n");
+                psShard->sWorker.pvThreadData = NULL;
+                eStatus = E_NETWORK_ERROR_FAILED;
+            }
+        }
+    }
+    
     if (eStatus == E_NETWORK_OK)
     {
         // Start the server listening threads
@@ -722,8 +980,8 @@ teNetworkStatus Network_Send(tsNetworkContext *psNetworkContext, tsJIPAddress *p
 typedef struct
 {
     ssize_t             iBytesRecieved;
+    int                 iHopLimit;              /**< Hop limit the packet arrived with, or -1 if not known */
     struct sockaddr_in6 sRecv_addr;
-#define PACKET_BUFFER_SIZE 1024
     char                acBuffer[PACKET_BUFFER_SIZE];
 } tsReceivedPacket;
 
@@ -758,6 +1016,7 @@ static void *pvClientSocketListenerThread(void *psThreadInfoVoid)
         }
         
         DBG_vPrintf(DBG_NETWORK, "Ready to get packet\n");
+        psReceivedPacket->iHopLimit = -1;
         
         if (psNetworkContext->eLink == E_NETWORK_LINK_TCP)
         {
@@ -777,11 +1036,35 @@ static void *pvClientSocketListenerThread(void *psThreadInfoVoid)
         }
         else if (psNetworkContext->eLink == E_NETWORK_LINK_UDP)
         {
+            struct iovec sIov;
+            struct msghdr sMsg;
+            struct cmsghdr *psCmsg;
+            char acControl[CMSG_SPACE(sizeof(int))];
+            
+            sIov.iov_base       = psReceivedPacket->acBuffer;
+            sIov.iov_len        = PACKET_BUFFER_SIZE;
+            memset(&sMsg, 0, sizeof(struct msghdr));
+            sMsg.msg_name       = &psReceivedPacket->sRecv_addr;
+            sMsg.msg_namelen    = AddressSize;
+            sMsg.msg_iov        = &sIov;
+            sMsg.msg_iovlen     = 1;
+            sMsg.msg_control    = acControl;
+            sMsg.msg_controllen = sizeof(acControl);
+            
             DBG_vPrintf(DBG_NETWORK, "recv()\n");
-            psReceivedPacket->iBytesRecieved = recvfrom(psNetworkContext->iSocket, &psReceivedPacket->acBuffer, 
-                                                    PACKET_BUFFER_SIZE, 0,
-                                                    (struct sockaddr*)&psReceivedPacket->sRecv_addr, &AddressSize);
+            psReceivedPacket->iBytesRecieved = recvmsg(psNetworkContext->iSocket, &sMsg, 0);
             DBG_vPrintf(DBG_NETWORK, "Got %d bytes\n", (int)psReceivedPacket->iBytesRecieved);
+            
+            if (psReceivedPacket->iBytesRecieved > 0)
+            {
+                for (psCmsg = CMSG_FIRSTHDR(&sMsg); psCmsg; psCmsg = CMSG_NXTHDR(&sMsg, psCmsg))
+                {
+                    if ((psCmsg->cmsg_level == IPPROTO_IPV6) && (psCmsg->cmsg_type == IPV6_HOPLIMIT))
+                    {
+                        memcpy(&psReceivedPacket->iHopLimit, CMSG_DATA(psCmsg), sizeof(int));
+                    }
+                }
+            }
         }
         else
         {
@@ -929,225 +1212,337 @@ static void *pvTrapHandlerThread(void *psThreadInfoVoid)
 }
 
 
-static void *pvServerSocketListenerThread(void *psThreadInfoVoid)
+/** Handle a datagram received by the server, passing it to the node it is addressed to, or each member of the 
+ *  multicast group it was sent to.
+ *  When the server has shards, only the nodes of one shard are handled.
+ *  \param psDatagram           The datagram, with its packet info
+ *  \param psShard              The shard handling the datagram, or NULL to handle it for all nodes
+ *  \param pcOutBuf             Buffer of PACKET_BUFFER_SIZE for the response
+ *  \param papsCandidates       Array used to hold handles to the nodes it is for, grown as required
+ *  \param pu32MaxCandidates    Size of *papsCandidates
+ *  \param piRandSeed           Random number seed of the calling thread, for rand_r
+ *  \return Length of the response to send back in pcOutBuf, or 0 for none
+ */
+static unsigned int iNetwork_ServerHandleDatagram(tsNetworkContext *psNetworkContext, tsServerDatagram *psDatagram, tsServerShard *psShard,
+                                                  char *pcOutBuf, tsNode ***papsCandidates, uint32_t *pu32MaxCandidates,
+                                                  unsigned int *piRandSeed)
 {
-    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
-    tsNetworkContext *psNetworkContext = (tsNetworkContext *)psThreadInfo->pvThreadData;
     tsJIP_Context *psJIP_Context = psNetworkContext->psJIP_Context;
+    tsNode **apsCandidates = *papsCandidates;
+    uint32_t u32NumCandidates = 0;
+    unsigned int iOutLen = 0;
+    struct in6_pktinfo *psInPacketInfo = &psDatagram->sPacketInfo;
+    int iInLen = psDatagram->iLength;
+    bool_t bIsMulticast = False;
+    tsJIPAddress sDstAddress;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_NETWORK, "%s: Got %d bytes from: ", __FUNCTION__, iInLen);
+    DBG_vPrintf_IPv6Address(DBG_NETWORK, psDatagram->sSrcAddress.sin6_addr);
+    DBG_vPrintf(DBG_NETWORK, "%s: Packet destination: ", __FUNCTION__);
+    DBG_vPrintf_IPv6Address(DBG_NETWORK, psInPacketInfo->ipi6_addr);
 
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-
-    psThreadInfo->eState = E_THREAD_RUNNING;
+    if (psInPacketInfo->ipi6_addr.s6_addr[0] == 0xFF)
+    {
+        DBG_vPrintf(DBG_NETWORK, "Multicast packet\n");
+        bIsMulticast = True;
+    }
 
-    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    // Look up which node has that unicast address / which nodes are members of the multicast group.
+    // Handles are taken on the candidates with the context locked, and each node is then locked in turn
+    // once the context has been released. That way a handler holding a node lock for a long time only 
+    // delays packets for that node, and we never wait for a node lock while holding the context lock.
+    if (bIsMulticast)
     {
-        uint32_t u32Attempts = 0;
-        int iInLen = 0;
-        unsigned int iOutLen = 0;
-        struct msghdr           sMsgInfo;
-        struct iovec            sIO;
-        struct sockaddr_in6     sSrcAddress;
-        struct in6_pktinfo*     psInPacketInfo = NULL;
-        struct cmsghdr*         psControlMessage;
-        
-        char acInMsgControl[1024];
-        char acOutMsgControl[1024];
-        char acInBuf[PACKET_BUFFER_SIZE];
-        char acOutBuf[PACKET_BUFFER_SIZE];
-        
-        bool_t bIsMulticast = False;
-        
-        memset(&sMsgInfo, 0, sizeof(struct msghdr));
-        memset(&sIO, 0, sizeof(struct iovec));
-        memset(acInMsgControl, 0, sizeof(acInMsgControl));
+        tsServerGroups *psGroup;
         
-        sIO.iov_base = acInBuf;
-        sIO.iov_len  = PACKET_BUFFER_SIZE;
+        eJIP_Lock(psJIP_Context);
         
-        sMsgInfo.msg_name = &sSrcAddress;
-        sMsgInfo.msg_namelen = sizeof(sSrcAddress);
-        sMsgInfo.msg_iov = &sIO;
-        sMsgInfo.msg_iovlen = 1;
-        sMsgInfo.msg_control = acInMsgControl;
-        sMsgInfo.msg_controllen = sizeof(acInMsgControl);
-
-        iInLen = recvmsg(psNetworkContext->iSocket, &sMsgInfo, 0);
+        /* Only the members of the group are candidates */
+        psGroup = psNetwork_FindGroup(psNetworkContext, &psInPacketInfo->ipi6_addr, NULL);
+        if (psGroup && (psGroup->u32NumMembers > *pu32MaxCandidates))
+        {
+            tsNode **apsNewCandidates = realloc(apsCandidates, sizeof(tsNode *) * psGroup->u32NumMembers);
+            if (!apsNewCandidates)
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Could not allocate node list, dropping packet\n", __FUNCTION__);
+                eJIP_Unlock(psJIP_Context);
+                return 0;
+            }
+            *papsCandidates = apsCandidates = apsNewCandidates;
+            *pu32MaxCandidates = psGroup->u32NumMembers;
+        }
         
-        if (iInLen <= 0)
+        for (i = 0; psGroup && (i < psGroup->u32NumMembers); i++)
         {
-            DBG_vPrintf(DBG_NETWORK, "%s: Error in recvmsg (%s)\n", __FUNCTION__, strerror(errno));
-            continue;
-        }   
+            tsNode *psNode = psGroup->apsMembers[i];
             
-        DBG_vPrintf(DBG_NETWORK, "%s: Got %d bytes from: ", __FUNCTION__, iInLen);
-        DBG_vPrintf_IPv6Address(DBG_NETWORK, sSrcAddress.sin6_addr);
-
-        for (psControlMessage = CMSG_FIRSTHDR(&sMsgInfo); 
-             psControlMessage != 0; 
-             psControlMessage = CMSG_NXTHDR(&sMsgInfo, psControlMessage))
-        {
-            if (psControlMessage->cmsg_level == IPPROTO_IPV6 && psControlMessage->cmsg_type == IPV6_PKTINFO)
+            if (psShard && 
+                ((u32Network_AddressHash(&psNode->sNode_Address.sin6_addr) % psNetworkContext->u32NumShards) != psShard->u32Index))
             {
-                psInPacketInfo = (struct in6_pktinfo*)CMSG_DATA(psControlMessage);
+                /* Another shard handles this member */
+                continue;
             }
+            (void)eJIP_AcquireNodeHandle(psNode);
+            apsCandidates[u32NumCandidates++] = psNode;
         }
         
-        if (!psInPacketInfo)
+        eJIP_Unlock(psJIP_Context);
+    }
+    else
+    {
+        /* A unicast address belongs to one node, found through the address index */
+        tsNode *psNode = psJIP_AcquireNodeByIn6(psJIP_Context, &psInPacketInfo->ipi6_addr);
+        
+        if (psNode)
         {
-            // Without the packet info we have no idea of the destination address - discard it.
-            continue;
+            if (*pu32MaxCandidates == 0)
+            {
+                tsNode **apsNewCandidates = realloc(apsCandidates, sizeof(tsNode *));
+                if (!apsNewCandidates)
+                {
+                    DBG_vPrintf(DBG_NETWORK, "%s: Could not allocate node list, dropping packet\n", __FUNCTION__);
+                    (void)eJIP_ReleaseNode(psNode);
+                    return 0;
+                }
+                *papsCandidates = apsCandidates = apsNewCandidates;
+                *pu32MaxCandidates = 1;
+            }
+            apsCandidates[u32NumCandidates++] = psNode;
         }
-
-        DBG_vPrintf(DBG_NETWORK, "%s: Packet destination: ", __FUNCTION__);
-        DBG_vPrintf_IPv6Address(DBG_NETWORK, psInPacketInfo->ipi6_addr);
-
-        if (psInPacketInfo->ipi6_addr.s6_addr[0] == 0xFF)
+    }
+    
+    memset(&sDstAddress, 0, sizeof(tsJIPAddress));
+    memcpy(&sDstAddress.sin6_addr, &psInPacketInfo->ipi6_addr, sizeof(struct in6_addr));
+    sDstAddress.sin6_scope_id = psInPacketInfo->ipi6_ifindex;
+    
+    for (i = 0; i < u32NumCandidates; i++)
+    {
+        tsNode *psNode = apsCandidates[i];
+        
+        eJIP_LockNode(psNode, True);
+        
+        if (psNode->bRemoved)
         {
-            DBG_vPrintf(DBG_NETWORK, "Multicast packet\n");
-            bIsMulticast = True;
+            /* Node left the network while we waited for it */
         }
-
-        // Look up which node(s) have that unicast address / are members of the multicast group
-start_lock:
-        eJIP_Lock(psJIP_Context);
+        else if (bIsMulticast)
         {
-            tsNode *psNode = psJIP_Context->sNetwork.psNodes;
-            tsJIPAddress sDstAddress;
-            
-            memset(&sDstAddress, 0, sizeof(tsJIPAddress));
+            /* This was a multicast packet and the node is a member of the group */
+            DBG_vPrintf(DBG_NETWORK, "%s: Node is in the multicast group\n", __FUNCTION__);
             
-            memcpy(&sDstAddress.sin6_addr, &psInPacketInfo->ipi6_addr, sizeof(struct in6_addr));
-            
-            while (psNode)
+            if (Network_ServerExchange(psJIP_Context, psNode, &psDatagram->sSrcAddress, &sDstAddress,
+                    psDatagram->acInBuf, iInLen,
+                    pcOutBuf, &iOutLen) == E_NETWORK_OK)
             {
-                if (bIsMulticast)
+                /* Command handled */
+                if ((iOutLen > 0) && (((tsJIP_MsgHeader *)psDatagram->acInBuf)->eCommand == E_JIP_COMMAND_GET_GROUP_REQUEST))
                 {
-                    /* This was a multicast packet so look through each nodes goup membership */
-                    int iGroupAddressSlot;
-                    tsNode_Private *psNode_Private;
+                    /* Group reads are answered, each member after a random delay 
+                     * so that they do not all reply at once */
+                    uint32_t u32Jitter = ntohs(((tsJIP_Msg_GetGroupRequest *)psDatagram->acInBuf)->u16JitterMs);
                     
-                    if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
+                    if (u32Jitter > JIP_GROUP_GET_MAX_JITTER)
                     {
-                        DBG_vPrintf(DBG_NETWORK, "Locking node %p would block\n", psNode);
-                        eJIP_Unlock(psJIP_Context);
-                        if (++u32Attempts > 10)
-                        {
-                            DBG_vPrintf(DBG_NETWORK, "Error locking node:");
-                            DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                            
-                            /* Give up on this node */
-                            u32Attempts = 0;
-                            continue;
-                        }
-                        eThreadYield();
-                        goto start_lock;
+                        u32Jitter = JIP_GROUP_GET_MAX_JITTER;
                     }
-                    eJIP_Unlock(psJIP_Context);
-
-                    // We've got a lock on the node at this point
-                    psNode_Private = (tsNode_Private *)psNode->pvPriv;
-                    
-                    /* Check if the node is already in the group */
-                    for (iGroupAddressSlot = 0; 
-                        iGroupAddressSlot < JIP_DEVICE_MAX_GROUPS; 
-                        iGroupAddressSlot++)
-                    {
-                        if (memcmp(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &psInPacketInfo->ipi6_addr, sizeof(struct in6_addr)) == 0)
-                        {
-                            DBG_vPrintf(DBG_NETWORK, "%s: Node is in the multicast group\n", __FUNCTION__);
-                            
-                            if (Network_ServerExchange(psJIP_Context, psNode, &sSrcAddress, &sDstAddress,
-                                    acInBuf, iInLen,
-                                    acOutBuf, &iOutLen) == E_NETWORK_OK)
-                            {
-                                /* Command handled */
-                            }
-                            
-                            // Discard the response - we don't reply to multicasts.
-                            iOutLen = 0;
-                        }
-                    }
-                    
-                    // Unlock the node again
-                    eJIP_UnlockNode(psNode);
-                }
-                else
-                {
-                    if (memcmp(&psInPacketInfo->ipi6_addr, &psNode->sNode_Address.sin6_addr, sizeof(struct in6_addr)) == 0)
-                    {
-                        DBG_vPrintf(DBG_NETWORK, "Found node ");
-                        DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                        
-                        if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
-                        {
-                            DBG_vPrintf(DBG_NETWORK, "Locking node %p would block\n", psNode);
-                            eJIP_Unlock(psJIP_Context);
-                            if (++u32Attempts > 10)
-                            {
-                                DBG_vPrintf(DBG_NETWORK, "Error locking node:");
-                                DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
-                                sleep(1);
-                                u32Attempts = 0;
-                            }
-                            eThreadYield();
-                            goto start_lock;
-                        }
-                        eJIP_Unlock(psJIP_Context);
-                        
-                        if (Network_ServerExchange(psJIP_Context, psNode, &sSrcAddress, &sDstAddress,
-                                        acInBuf, iInLen,
-                                        acOutBuf, &iOutLen) == E_NETWORK_OK)
-                        {
-                            /* Send response */
-                            DBG_vPrintf(DBG_NETWORK, "%s: send %d bytes to ", __FUNCTION__, iOutLen);
-                            DBG_vPrintf_IPv6Address(DBG_NETWORK, (sSrcAddress.sin6_addr));
-                        }
-                        else
-                        {
-                            iOutLen = 0;
-                        }
-                    }
-                    // Unlock the node again
-                    eJIP_UnlockNode(psNode);
+                    eNetwork_DeferResponse(psNetworkContext, &psDatagram->sSrcAddress, &psNode->sNode_Address.sin6_addr, 
+                                           psInPacketInfo->ipi6_ifindex, pcOutBuf, iOutLen, rand_r(piRandSeed) % (u32Jitter + 1));
                 }
-                psNode = psNode->psNext;
             }
+            
+            // Discard the response - other multicasts are not replied to.
+            iOutLen = 0;
         }
-        eJIP_Unlock(psJIP_Context);
-        
-        if (iOutLen && !bIsMulticast)
+        else
         {
-            // Send the response packet (but not if this was a multicast
-            memset(&sMsgInfo, 0, sizeof(struct msghdr));
-            memset(&sIO, 0, sizeof(struct iovec));
-            memset(acOutMsgControl, 0, sizeof(acOutMsgControl));
+            DBG_vPrintf(DBG_NETWORK, "Found node ");
+            DBG_vPrintf_IPv6Address(DBG_NETWORK, psNode->sNode_Address.sin6_addr);
             
-            sIO.iov_base = acOutBuf;
-            sIO.iov_len  = iOutLen;
+            if (Network_ServerExchange(psJIP_Context, psNode, &psDatagram->sSrcAddress, &sDstAddress,
+                            psDatagram->acInBuf, iInLen,
+                            pcOutBuf, &iOutLen) == E_NETWORK_OK)
+            {
+                /* Send response */
+                DBG_vPrintf(DBG_NETWORK, "%s: send %d bytes to ", __FUNCTION__, iOutLen);
+                DBG_vPrintf_IPv6Address(DBG_NETWORK, (psDatagram->sSrcAddress.sin6_addr));
+            }
+            else
+            {
+                iOutLen = 0;
+            }
+        }
+        
+        // Unlock the node again and drop our handle on it
+        eJIP_UnlockNode(psNode);
+        (void)eJIP_ReleaseNode(psNode);
+    }
+    
+    return iOutLen;
+}
 
-            sMsgInfo.msg_name = &sSrcAddress;
-            sMsgInfo.msg_namelen = sizeof(sSrcAddress);
-            sMsgInfo.msg_iov = &sIO;
-            sMsgInfo.msg_iovlen = 1;
-            sMsgInfo.msg_control = acOutMsgControl;
-            sMsgInfo.msg_controllen = sizeof(acOutMsgControl);
 
-            psControlMessage = CMSG_FIRSTHDR(&sMsgInfo);
+/** Point a message at a datagram's receive buffers, ready for the next datagram */
+static void vNetwork_ServerReceiveInto(struct msghdr *psMsgInfo, tsServerDatagram *psDatagram)
+{
+    psDatagram->sInIO.iov_base  = psDatagram->acInBuf;
+    psDatagram->sInIO.iov_len   = PACKET_BUFFER_SIZE;
+    psMsgInfo->msg_name         = &psDatagram->sSrcAddress;
+    psMsgInfo->msg_iov          = &psDatagram->sInIO;
+    psMsgInfo->msg_iovlen       = 1;
+    psMsgInfo->msg_control      = psDatagram->acInMsgControl;
+}
 
-            psControlMessage->cmsg_level = IPPROTO_IPV6;
-            psControlMessage->cmsg_type = IPV6_PKTINFO;
-            memcpy(CMSG_DATA(psControlMessage), psInPacketInfo, sizeof(struct in6_pktinfo));
-            psControlMessage->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
-            sMsgInfo.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
 
-            if (sendmsg(psNetworkContext->iSocket, &sMsgInfo, 0) != iOutLen)
+/** Set up a message to send a response back to the source of a datagram, from the address it was sent to */
+static void vNetwork_ServerRespondTo(struct msghdr *psMsgInfo, tsServerDatagram *psDatagram, char *pcOutBuf, unsigned int iOutLen)
+{
+    struct cmsghdr *psControlMessage;
+    
+    psDatagram->sOutIO.iov_base = pcOutBuf;
+    psDatagram->sOutIO.iov_len  = iOutLen;
+    
+    memset(psMsgInfo, 0, sizeof(struct msghdr));
+    psMsgInfo->msg_name = &psDatagram->sSrcAddress;
+    psMsgInfo->msg_namelen = sizeof(struct sockaddr_in6);
+    psMsgInfo->msg_iov = &psDatagram->sOutIO;
+    psMsgInfo->msg_iovlen = 1;
+    psMsgInfo->msg_control = psDatagram->acOutMsgControl;
+    psMsgInfo->msg_controllen = sizeof(psDatagram->acOutMsgControl);
+
+    psControlMessage = CMSG_FIRSTHDR(psMsgInfo);
+    psControlMessage->cmsg_level = IPPROTO_IPV6;
+    psControlMessage->cmsg_type = IPV6_PKTINFO;
+    psControlMessage->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+    memcpy(CMSG_DATA(psControlMessage), &psDatagram->sPacketInfo, sizeof(struct in6_pktinfo));
+}
+
+
+/** Pass a datagram to the shards that handle the nodes it is for: the shard of the destination node for a 
+ *  unicast, or every shard for a multicast, as the group's members are spread between them.
+ *  The shards own the datagram afterwards, and the last to finish with it frees it.
+ */
+static void vNetwork_ServerDispatch(tsNetworkContext *psNetworkContext, tsServerDatagram *psDatagram)
+{
+    uint32_t i;
+    
+    if (psDatagram->sPacketInfo.ipi6_addr.s6_addr[0] == 0xFF)
+    {
+        psDatagram->u32RefCount = psNetworkContext->u32NumShards;
+        for (i = 0; i < psNetworkContext->u32NumShards; i++)
+        {
+            eQueueQueue(&psNetworkContext->pasShards[i].sQueue, psDatagram);
+        }
+    }
+    else
+    {
+        i = u32Network_AddressHash(&psDatagram->sPacketInfo.ipi6_addr) % psNetworkContext->u32NumShards;
+        psDatagram->u32RefCount = 1;
+        eQueueQueue(&psNetworkContext->pasShards[i].sQueue, psDatagram);
+    }
+}
+
+
+static void *pvServerSocketListenerThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsNetworkContext *psNetworkContext = (tsNetworkContext *)psThreadInfo->pvThreadData;
+    tsNode **apsCandidates = NULL;
+    uint32_t u32MaxCandidates = 0;
+    unsigned int iRandSeed = u32TimeMillis();
+    tsServerDatagram *psDatagram;
+    struct msghdr sInMsgInfo, sOutMsgInfo;
+
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    /* The datagram is allocated separately, as it is handed on to the shards if there are any */
+    memset(&sInMsgInfo, 0, sizeof(struct msghdr));
+    psDatagram = malloc(sizeof(tsServerDatagram));
+    if (!psDatagram)
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: Could not allocate datagram buffer\n", __FUNCTION__);
+        psThreadInfo->eState = E_THREAD_STOPPING;
+    }
+    else
+    {
+        vNetwork_ServerReceiveInto(&sInMsgInfo, psDatagram);
+        psThreadInfo->eState = E_THREAD_RUNNING;
+    }
+
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        struct cmsghdr *psControlMessage;
+        bool_t bHavePacketInfo = False;
+        unsigned int iOutLen;
+        int iInLen;
+        
+        /* The kernel shortens these to what it returned last time */
+        sInMsgInfo.msg_namelen      = sizeof(struct sockaddr_in6);
+        sInMsgInfo.msg_controllen   = sizeof(psDatagram->acInMsgControl);
+        sInMsgInfo.msg_flags        = 0;
+
+        iInLen = recvmsg(psNetworkContext->iSocket, &sInMsgInfo, 0);
+        
+        if (iInLen <= 0)
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Error in recvmsg (%s)\n", __FUNCTION__, strerror(errno));
+            continue;
+        }
+        psDatagram->iLength = iInLen;
+
+        for (psControlMessage = CMSG_FIRSTHDR(&sInMsgInfo); 
+             psControlMessage != 0; 
+             psControlMessage = CMSG_NXTHDR(&sInMsgInfo, psControlMessage))
+        {
+            if (psControlMessage->cmsg_level == IPPROTO_IPV6 && psControlMessage->cmsg_type == IPV6_PKTINFO)
+            {
+                memcpy(&psDatagram->sPacketInfo, CMSG_DATA(psControlMessage), sizeof(struct in6_pktinfo));
+                bHavePacketInfo = True;
+            }
+        }
+        
+        if (!bHavePacketInfo)
+        {
+            // Without the packet info we have no idea of the destination address - discard it.
+            continue;
+        }
+        
+        if (psNetworkContext->u32NumShards)
+        {
+            /* Receive the next datagram into a new buffer. If there's no memory for one this datagram is dropped 
+             * for the client to retry, as handling it here could overtake those queued for its node's shard */
+            tsServerDatagram *psNewDatagram = malloc(sizeof(tsServerDatagram));
+            
+            if (psNewDatagram)
+            {
+                vNetwork_ServerDispatch(psNetworkContext, psDatagram);
+                psDatagram = psNewDatagram;
+                vNetwork_ServerReceiveInto(&sInMsgInfo, psDatagram);
+            }
+            else
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Could not allocate datagram buffer, dropping datagram\n", __FUNCTION__);
+                u32AtomicAdd(&psNetworkContext->u32ServerDropped, 1);
+            }
+            continue;
+        }
+        
+        iOutLen = iNetwork_ServerHandleDatagram(psNetworkContext, psDatagram, NULL, psDatagram->acOutBuf,
+                                                &apsCandidates, &u32MaxCandidates, &iRandSeed);
+        if (iOutLen)
+        {
+            vNetwork_ServerRespondTo(&sOutMsgInfo, psDatagram, psDatagram->acOutBuf, iOutLen);
+            if (sendmsg(psNetworkContext->iSocket, &sOutMsgInfo, 0) != iOutLen)
             {
-                DBG_vPrintf(DBG_NETWORK, "%s: Could not send response message (%s) ", __FUNCTION__, strerror(errno));
+                DBG_vPrintf(DBG_NETWORK, "%s: Could not send response message (%s)\n", __FUNCTION__, strerror(errno));
             }
         }
     }
     
     DBG_vPrintf(DBG_NETWORK, "%s: exit\n", __FUNCTION__);
+    
+    free(apsCandidates);
+    free(psDatagram);
 
     /* Return from thread clearing resources */
     eThreadFinish(psThreadInfo);
@@ -1155,6 +1550,59 @@ start_lock:
 }
 
 
+static void *pvServerShardThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsServerShard *psShard = (tsServerShard *)psThreadInfo->pvThreadData;
+    tsNetworkContext *psNetworkContext = psShard->psNetworkContext;
+    tsNode **apsCandidates = NULL;
+    uint32_t u32MaxCandidates = 0;
+    char acOutBuf[PACKET_BUFFER_SIZE];
+    /* Each shard has its own seed, as rand() is not safe to call from several threads */
+    unsigned int iRandSeed = u32TimeMillis() + psShard->u32Index;
+
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s: %d\n", __FUNCTION__, psShard->u32Index);
+
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        tsServerDatagram *psDatagram;
+        unsigned int iOutLen;
+        
+        if ((eQueueDequeue(&psShard->sQueue, (void **)&psDatagram) != E_QUEUE_OK) || !psDatagram)
+        {
+            /* Woken up to stop */
+            continue;
+        }
+        
+        /* Multicasts are shared with the other shards, so the response is built in our own buffer */
+        iOutLen = iNetwork_ServerHandleDatagram(psNetworkContext, psDatagram, psShard, acOutBuf,
+                                                &apsCandidates, &u32MaxCandidates, &iRandSeed);
+        if (iOutLen)
+        {
+            struct msghdr sMsgInfo;
+            
+            vNetwork_ServerRespondTo(&sMsgInfo, psDatagram, acOutBuf, iOutLen);
+            if (sendmsg(psNetworkContext->iSocket, &sMsgInfo, 0) != iOutLen)
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Could not send response message (%s)\n", __FUNCTION__, strerror(errno));
+            }
+        }
+        
+        if (u32AtomicAdd(&psDatagram->u32RefCount, (uint32_t)-1) == 0)
+        {
+            free(psDatagram);
+        }
+    }
+    
+    DBG_vPrintf(DBG_NETWORK, "%s: exit\n", __FUNCTION__);
+    
+    free(apsCandidates);
+    
+    eThreadFinish(psThreadInfo);
+    return NULL;
+}
+
+
 static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
                                         char *pcReceiveData, unsigned int iReceiveDataLength,
                                         const char *pcSendData, unsigned int *piSendDataLength)
@@ -1202,7 +1650,7 @@ static teNetworkStatus Network_ServerExchange(tsJIP_Context* psJIP_Context, tsNo
 
 
 
-teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32Timeout, tsJIPAddress *psAddress, char *pcData, unsigned int *iDataLength)
+teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32Timeout, tsJIPAddress *psAddress, char *pcData, unsigned int *iDataLength, int *piHopLimit)
 {
     tsReceivedPacket *psReceivedPacket;
     
@@ -1242,9 +1690,16 @@ teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32
         
         DBG_vPrintf(DBG_NETWORK, "  Packet OK");
         
-        /* Copy the data from the queue, and free the structure */
-        *iDataLength = psReceivedPacket->iBytesRecieved;
-        memcpy(pcData, psReceivedPacket->acBuffer, psReceivedPacket->iBytesRecieved);
+        /* Copy the data from the queue, and free the structure. Anything that doesn't fit the buffer is dropped */
+        if ((unsigned int)psReceivedPacket->iBytesRecieved < *iDataLength)
+        {
+            *iDataLength = psReceivedPacket->iBytesRecieved;
+        }
+        memcpy(pcData, psReceivedPacket->acBuffer, *iDataLength);
+        if (piHopLimit)
+        {
+            *piHopLimit = psReceivedPacket->iHopLimit;
+        }
         free(psReceivedPacket);
     
         return E_NETWORK_OK;
@@ -1260,8 +1715,10 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
     uint32_t i;
     tsJIP_MsgHeader *psSendHeader;
     tsJIP_MsgHeader *psReceiveHeader;
-    static uint8_t u8Handle = 0;
     uint8_t u8MatchHandle = 0;
+    unsigned int iReceiveBufferLength = *piReceiveDataLength;
+    tsNodeLinkStats *psLinkStats = psNode->pvPriv ? &((tsNode_Private *)psNode->pvPriv)->sLinkStats : NULL;
+    int iHopLimit;
     
     uint32_t u32Timeout;
         
@@ -1272,8 +1729,8 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
     psSendHeader->u8Version = JIP_VERSION;
     psSendHeader->eCommand  = eSendCommand;
     
-    u8Handle = (u8Handle + 1) & 0x7f;
-    psSendHeader->u8Handle  = u8Handle;
+    u8ExchangeHandle = (u8ExchangeHandle + 1) & 0x7f;
+    psSendHeader->u8Handle  = u8ExchangeHandle;
 
     if (u32Flags & EXCHANGE_FLAG_STAY_AWAKE)
     {
@@ -1303,10 +1760,15 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
             DBG_vPrintf(DBG_NETWORK, "Error sending data (%d) on attempt %d\n", eStatus, i);
             continue;
         }
+        if (psLinkStats)
+        {
+            u32AtomicAdd(&psLinkStats->u32Requests, 1);
+        }
         
         while (eStatus == E_NETWORK_OK)
         {
-            eStatus = Network_Recieve(psNetworkContext, u32Timeout, &psNode->sNode_Address, pcReceiveData, piReceiveDataLength);
+            *piReceiveDataLength = iReceiveBufferLength;
+            eStatus = Network_Recieve(psNetworkContext, u32Timeout, &psNode->sNode_Address, pcReceiveData, piReceiveDataLength, &iHopLimit);
             if (eStatus == E_NETWORK_OK)
             {
                 /* We got a packet - see if it matches what we expect */
@@ -1333,6 +1795,7 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
                 }
 
                 DBG_vPrintf(DBG_NETWORK, "Packet OK\n");
+                vNetwork_RecordResponse(psLinkStats, iHopLimit);
                 /* Return the packet */
                 return E_NETWORK_OK;
             }
@@ -1347,72 +1810,815 @@ teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *
     return E_NETWORK_ERROR_TIMEOUT;
 }
 
-teNetworkStatus Network_SendJIP(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress,
-                                     teJIP_Command eCommand, const char *pcSendData, int iDataLength)
-{
-    tsJIP_MsgHeader *psSendHeader;
-        
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-    
-    psSendHeader = (tsJIP_MsgHeader *)pcSendData;
-    
-    psSendHeader->u8Version = JIP_VERSION;
-    psSendHeader->eCommand  = eCommand;
-    psSendHeader->u8Handle  = rand() * 255; /* Probably not the best way of generating a handle ever */
-    
-    return Network_Send(psNetworkContext, psAddress, pcSendData, iDataLength);
-}
-
 
-
-#if defined USE_INTERNAL_BYTESWAP_64
-
-uint64_t bswap_64(uint64_t x)
+teNetworkStatus Network_ExchangeJIPBatch(tsNetworkContext *psNetworkContext, tsNetworkExchange *pasExchanges, 
+                                         uint32_t u32NumExchanges, uint32_t u32Retries)
 {
-    uint64_t y;
-    
-    y = ((((uint64_t)__bswap_32(x) & 0x00000000FFFFFFFFL) << 32) | (((uint64_t)__bswap_32(x >> 32) & 0x00000000FFFFFFFFL)));
+    teNetworkStatus eStatus = E_NETWORK_OK;
+    uint32_t u32Attempt, u32Outstanding, i;
     
-    return y;
-}
-
-#endif /* _UCLIBC_ */
-
-
-static int iNetwork_NodeInterface(tsNode *psNode)
-{
-    struct ifaddrs *ifp, *ifs;
-    int iInterfaceIndex = -1;
-    char acAddr[INET6_ADDRSTRLEN] = "Could not determine address\n";
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d exchanges)\n", __FUNCTION__, u32NumExchanges);
     
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-
-    if (getifaddrs(&ifs) < 0) 
+    for (i = 0; i < u32NumExchanges; i++)
     {
-        DBG_vPrintf(DBG_NETWORK, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
-        return -1;
+        tsJIP_MsgHeader *psSendHeader = (tsJIP_MsgHeader *)pasExchanges[i].pcSendData;
+        
+        psSendHeader->u8Version = JIP_VERSION;
+        psSendHeader->eCommand  = pasExchanges[i].eSendCommand;
+        u8ExchangeHandle = (u8ExchangeHandle + 1) & 0x7f;
+        psSendHeader->u8Handle  = u8ExchangeHandle;
+        
+        pasExchanges[i].u8Handle = u8ExchangeHandle;
+        pasExchanges[i].eStatus  = E_NETWORK_ERROR_TIMEOUT;
     }
-
-    for (ifp = ifs; ifp; ifp = ifp->ifa_next)
+    u32Outstanding = u32NumExchanges;
+    
+    for (u32Attempt = 0; (u32Attempt < u32Retries) && (u32Outstanding > 0); u32Attempt++)
     {
-        if (ifp->ifa_addr != NULL && ifp->ifa_addr->sa_family == AF_INET6)
+        uint32_t u32Timeout = 0, u32ExchangeTimeout, u32Start;
+        
+        /* Send every request that is still waiting for its response */
+        for (i = 0; i < u32NumExchanges; i++)
         {
-            DBG_vPrintf(DBG_NETWORK, "Interface %5s: [%s]\n", ifp->ifa_name,
-                inet_ntop(AF_INET6, &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr, acAddr, INET6_ADDRSTRLEN));
+            if (pasExchanges[i].eStatus != E_NETWORK_ERROR_TIMEOUT)
+            {
+                continue;
+            }
+            if (Network_Send(psNetworkContext, &pasExchanges[i].sAddress, pasExchanges[i].pcSendData, 
+                             pasExchanges[i].iSendDataLength) != E_NETWORK_OK)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Error sending exchange %d on attempt %d\n", i, u32Attempt);
+                continue;
+            }
+            if (pasExchanges[i].psLinkStats)
+            {
+                u32AtomicAdd(&pasExchanges[i].psLinkStats->u32Requests, 1);
+            }
             
-            if (memcmp(&psNode->sNode_Address.sin6_addr,
-                       &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr,
-                       sizeof(struct in6_addr)) == 0)
+            // Most significant bit of device ID marks a node as a sleeping device
+            u32ExchangeTimeout = (pasExchanges[i].u32DeviceId & 0x80000000) ? JIP_CLIENT_TIMEOUT_SLEEPING : JIP_CLIENT_TIMEOUT_POWERED;
+            if (u32ExchangeTimeout > u32Timeout)
             {
-                DBG_vPrintf(DBG_NETWORK, "%s: Found matching interface: %s\n", __FUNCTION__, ifp->ifa_name);
-                iInterfaceIndex = if_nametoindex(ifp->ifa_name);
+                u32Timeout = u32ExchangeTimeout;
+            }
+        }
+        
+        /* Collect responses until they are all in or the longest timeout has passed */
+        u32Start = u32TimeMillis();
+        while (u32Outstanding > 0)
+        {
+            tsReceivedPacket *psReceivedPacket;
+            tsJIP_MsgHeader *psReceiveHeader;
+            uint32_t u32Elapsed = u32TimeMillis() - u32Start;
+            
+            if ((u32Elapsed >= u32Timeout) ||
+                (eQueueDequeueTimed(&psNetworkContext->sSocketQueue, u32Timeout - u32Elapsed, (void **)&psReceivedPacket) != E_QUEUE_OK))
+            {
+                DBG_vPrintf(DBG_NETWORK, "%d exchanges unanswered after attempt %d\n", u32Outstanding, u32Attempt);
                 break;
             }
+            
+            psReceiveHeader = (tsJIP_MsgHeader *)psReceivedPacket->acBuffer;
+            
+            for (i = 0; i < u32NumExchanges; i++)
+            {
+                if ((pasExchanges[i].eStatus == E_NETWORK_ERROR_TIMEOUT) &&
+                    (psReceivedPacket->iBytesRecieved >= (ssize_t)sizeof(tsJIP_MsgHeader)) &&
+                    (psReceiveHeader->u8Version == JIP_VERSION) &&
+                    (psReceiveHeader->eCommand  == pasExchanges[i].eReceiveCommand) &&
+                    (psReceiveHeader->u8Handle  == pasExchanges[i].u8Handle) &&
+                    (memcmp(&psReceivedPacket->sRecv_addr.sin6_addr, &pasExchanges[i].sAddress.sin6_addr, sizeof(struct in6_addr)) == 0))
+                {
+                    break;
+                }
+            }
+            
+            if (i == u32NumExchanges)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Unexpected packet during batch exchange\n");
+            }
+            else
+            {
+                /* Anything that doesn't fit the buffer is dropped */
+                if ((unsigned int)psReceivedPacket->iBytesRecieved < pasExchanges[i].iReceiveDataLength)
+                {
+                    pasExchanges[i].iReceiveDataLength = psReceivedPacket->iBytesRecieved;
+                }
+                memcpy(pasExchanges[i].pcReceiveData, psReceivedPacket->acBuffer, pasExchanges[i].iReceiveDataLength);
+                vNetwork_RecordResponse(pasExchanges[i].psLinkStats, psReceivedPacket->iHopLimit);
+                pasExchanges[i].eStatus = E_NETWORK_OK;
+                u32Outstanding--;
+            }
+            free(psReceivedPacket);
         }
     }
-
-    freeifaddrs(ifs);
     
-    return iInterfaceIndex;
+    if (u32Outstanding > 0)
+    {
+        eStatus = E_NETWORK_ERROR_TIMEOUT;
+    }
+    return eStatus;
 }
 
+
+teNetworkStatus Network_ExchangeJIPMulticast(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress, int iInterfaceIndex, int iMaxHops,
+                                             teJIP_Command eSendCommand, char *pcSendData, int iSendDataLength,
+                                             teJIP_Command eReceiveCommand, uint32_t u32WaitMs,
+                                             tsNetworkResponse *pasResponses, uint32_t u32MaxResponses, uint32_t *pu32NumResponses)
+{
+    tsJIP_MsgHeader *psSendHeader = (tsJIP_MsgHeader *)pcSendData;
+    uint32_t u32NumResponses = 0, u32Start, i;
+    bool_t bSent = False;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    *pu32NumResponses = 0;
+    
+    psSendHeader->u8Version = JIP_VERSION;
+    psSendHeader->eCommand  = eSendCommand;
+    u8ExchangeHandle = (u8ExchangeHandle + 1) & 0x7f;
+    psSendHeader->u8Handle  = u8ExchangeHandle;
+    
+    if (psNetworkContext->eProtocol != E_NETWORK_PROTO_IPV6)
+    {
+        /* The gateway does the multicast */
+        bSent = (Network_Send(psNetworkContext, psAddress, pcSendData, iSendDataLength) == E_NETWORK_OK);
+    }
+    else
+    {
+        if (eNetwork_LockInterfaces(psNetworkContext) != E_NETWORK_OK)
+        {
+            return E_NETWORK_ERROR_FAILED;
+        }
+        
+        if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &iMaxHops, sizeof(int)) < 0)
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Error setting number of hops (%s)\n", __FUNCTION__, strerror(errno));
+        }
+        else
+        {
+            for (i = 0; i < psNetworkContext->u32NumInterfaces; i++)
+            {
+                tsNetworkInterface *psInterface = &psNetworkContext->pasInterfaces[i];
+                
+                if ((iInterfaceIndex == -1) ? psInterface->bLoopback : (psInterface->iIndex != iInterfaceIndex))
+                {
+                    continue;
+                }
+                
+                if (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF, &psInterface->iIndex, sizeof(int)) < 0)
+                {
+                    DBG_vPrintf(DBG_NETWORK, "%s: Error setting interface %d (%s)\n", __FUNCTION__, psInterface->iIndex, strerror(errno));
+                    continue;
+                }
+                if (Network_Send(psNetworkContext, psAddress, pcSendData, iSendDataLength) == E_NETWORK_OK)
+                {
+                    bSent = True;
+                }
+            }
+            
+            if (!bSent && (iInterfaceIndex != -1) &&
+                (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF, &iInterfaceIndex, sizeof(int)) == 0))
+            {
+                /* Not a known interface (e.g. 0 for the default) - let the socket choose */
+                bSent = (Network_Send(psNetworkContext, psAddress, pcSendData, iSendDataLength) == E_NETWORK_OK);
+            }
+        }
+        vNetwork_UnlockInterfaces(psNetworkContext);
+    }
+    
+    if (!bSent)
+    {
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
+    u32Start = u32TimeMillis();
+    while (u32NumResponses < u32MaxResponses)
+    {
+        tsReceivedPacket *psReceivedPacket;
+        tsJIP_MsgHeader *psReceiveHeader;
+        uint32_t u32Elapsed = u32TimeMillis() - u32Start;
+        
+        if ((u32Elapsed >= u32WaitMs) ||
+            (eQueueDequeueTimed(&psNetworkContext->sSocketQueue, u32WaitMs - u32Elapsed, (void **)&psReceivedPacket) != E_QUEUE_OK))
+        {
+            break;
+        }
+        
+        psReceiveHeader = (tsJIP_MsgHeader *)psReceivedPacket->acBuffer;
+        
+        if ((psReceivedPacket->iBytesRecieved >= (ssize_t)sizeof(tsJIP_MsgHeader)) &&
+            (psReceiveHeader->u8Version == JIP_VERSION) &&
+            (psReceiveHeader->eCommand  == eReceiveCommand) &&
+            (psReceiveHeader->u8Handle  == u8ExchangeHandle))
+        {
+            /* Only the first response from each node counts */
+            for (i = 0; i < u32NumResponses; i++)
+            {
+                if (memcmp(&pasResponses[i].sAddress.sin6_addr, &psReceivedPacket->sRecv_addr.sin6_addr, sizeof(struct in6_addr)) == 0)
+                {
+                    break;
+                }
+            }
+            if (i == u32NumResponses)
+            {
+                tsNetworkResponse *psResponse = &pasResponses[u32NumResponses++];
+                
+                psResponse->sAddress    = psReceivedPacket->sRecv_addr;
+                psResponse->iHopLimit   = psReceivedPacket->iHopLimit;
+                psResponse->iLength     = psReceivedPacket->iBytesRecieved;
+                memcpy(psResponse->acData, psReceivedPacket->acBuffer, psResponse->iLength);
+            }
+        }
+        else
+        {
+            DBG_vPrintf(DBG_NETWORK, "Unexpected packet during multicast exchange\n");
+        }
+        free(psReceivedPacket);
+    }
+    
+    DBG_vPrintf(DBG_NETWORK, "%s: %d responses in %dms\n", __FUNCTION__, u32NumResponses, u32TimeMillis() - u32Start);
+    *pu32NumResponses = u32NumResponses;
+    return E_NETWORK_OK;
+}
+
+
+teNetworkStatus Network_SendJIP(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress,
+                                     teJIP_Command eCommand, const char *pcSendData, int iDataLength)
+{
+    tsJIP_MsgHeader *psSendHeader;
+        
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    psSendHeader = (tsJIP_MsgHeader *)pcSendData;
+    
+    psSendHeader->u8Version = JIP_VERSION;
+    psSendHeader->eCommand  = eCommand;
+    psSendHeader->u8Handle  = rand() * 255; /* Probably not the best way of generating a handle ever */
+    
+    return Network_Send(psNetworkContext, psAddress, pcSendData, iDataLength);
+}
+
+
+teNetworkStatus Network_SendJIPMulticast(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress, int iInterfaceIndex, int iMaxHops,
+                                         teJIP_Command eCommand, const char *pcSendData, int iDataLength)
+{
+    tsJIP_MsgHeader *psSendHeader;
+    teNetworkStatus eStatus = E_NETWORK_OK;
+    bool_t bSent = False;
+    uint32_t i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psNetworkContext->eProtocol != E_NETWORK_PROTO_IPV6)
+    {
+        /* The gateway does the multicast */
+        return Network_SendJIP(psNetworkContext, psAddress, eCommand, pcSendData, iDataLength);
+    }
+    
+    psSendHeader = (tsJIP_MsgHeader *)pcSendData;
+    psSendHeader->u8Version = JIP_VERSION;
+    psSendHeader->eCommand  = eCommand;
+    psSendHeader->u8Handle  = rand() * 255;
+    
+    if (eNetwork_LockInterfaces(psNetworkContext) != E_NETWORK_OK)
+    {
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
+    for (i = 0; i < psNetworkContext->u32NumInterfaces; i++)
+    {
+        tsNetworkInterface *psInterface = &psNetworkContext->pasInterfaces[i];
+        
+        if ((iInterfaceIndex == -1) ? psInterface->bLoopback : (psInterface->iIndex != iInterfaceIndex))
+        {
+            continue;
+        }
+        
+        if (psInterface->iMulticastSocket < 0)
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: No socket for interface %d\n", __FUNCTION__, psInterface->iIndex);
+            eStatus = E_NETWORK_ERROR_FAILED;
+            continue;
+        }
+        
+        if (psInterface->iMulticastHops != iMaxHops)
+        {
+            if (setsockopt(psInterface->iMulticastSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &iMaxHops, sizeof(int)) < 0)
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Error setting number of hops (%s)\n", __FUNCTION__, strerror(errno));
+                eStatus = E_NETWORK_ERROR_FAILED;
+                continue;
+            }
+            psInterface->iMulticastHops = iMaxHops;
+        }
+        
+        DBG_vPrintf(DBG_NETWORK, "Multicast on interface %d\n", psInterface->iIndex);
+        if (sendto(psInterface->iMulticastSocket, pcSendData, iDataLength, 0, 
+                   (struct sockaddr*)psAddress, sizeof(struct sockaddr_in6)) != iDataLength)
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Failed to send on interface %d (%s)\n", __FUNCTION__, psInterface->iIndex, strerror(errno));
+            
+            /* The interface may have gone - look again next time */
+            psNetworkContext->bInterfacesValid = False;
+            eStatus = E_NETWORK_ERROR_FAILED;
+            continue;
+        }
+        bSent = True;
+    }
+    
+    if (!bSent && (iInterfaceIndex != -1))
+    {
+        /* Not a known interface (e.g. 0 for the default) - let the main socket choose */
+        if ((setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &iMaxHops, sizeof(int)) < 0) ||
+            (setsockopt(psNetworkContext->iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF, &iInterfaceIndex, sizeof(int)) < 0))
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Error setting multicast options (%s)\n", __FUNCTION__, strerror(errno));
+            eStatus = E_NETWORK_ERROR_FAILED;
+        }
+        else
+        {
+            eStatus = Network_Send(psNetworkContext, psAddress, pcSendData, iDataLength);
+        }
+    }
+    
+    vNetwork_UnlockInterfaces(psNetworkContext);
+    return eStatus;
+}
+
+
+/** Rebuild the cached interface table from getifaddrs.
+ *  Multicast sockets of interfaces that are still present are kept. Others are closed,
+ *  and new interfaces get a socket with IPV6_MULTICAST_IF set.
+ *  Must be called with sInterfaceLock held.
+ */
+static teNetworkStatus eNetwork_RefreshInterfaces(tsNetworkContext *psNetworkContext)
+{
+    struct ifaddrs *ifp, *ifs;
+    tsNetworkInterface *pasInterfaces;
+    uint32_t u32NumInterfaces = 0, u32MaxInterfaces = 0, i, j;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (getifaddrs(&ifs) < 0) 
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
+        return E_NETWORK_ERROR_FAILED;
+    }
+    
+    for (ifp = ifs; ifp; ifp = ifp->ifa_next)
+    {
+        u32MaxInterfaces++;
+    }
+    
+    pasInterfaces = malloc(sizeof(tsNetworkInterface) * (u32MaxInterfaces ? u32MaxInterfaces : 1));
+    if (!pasInterfaces)
+    {
+        freeifaddrs(ifs);
+        return E_NETWORK_ERROR_NO_MEM;
+    }
+    
+    for (ifp = ifs; ifp; ifp = ifp->ifa_next)
+    {
+        int iIndex;
+        
+        if ((ifp->ifa_addr == NULL) || (ifp->ifa_addr->sa_family != AF_INET6))
+        {
+            continue;
+        }
+        
+        iIndex = if_nametoindex(ifp->ifa_name);
+        for (i = 0; i < u32NumInterfaces; i++)
+        {
+            if (pasInterfaces[i].iIndex == iIndex)
+            {
+                break;
+            }
+        }
+        if (i < u32NumInterfaces)
+        {
+            /* Another address on an interface we already have */
+            continue;
+        }
+        
+        DBG_vPrintf(DBG_NETWORK, "Interface %5s: index %d\n", ifp->ifa_name, iIndex);
+        
+        pasInterfaces[u32NumInterfaces].iIndex              = iIndex;
+        pasInterfaces[u32NumInterfaces].bLoopback           = (ifp->ifa_flags & IFF_LOOPBACK) ? True : False;
+        pasInterfaces[u32NumInterfaces].iMulticastSocket    = -1;
+        pasInterfaces[u32NumInterfaces].iMulticastHops      = -1;
+        
+        /* Keep the socket from the old table if the interface is still there */
+        for (j = 0; j < psNetworkContext->u32NumInterfaces; j++)
+        {
+            if (psNetworkContext->pasInterfaces[j].iIndex == iIndex)
+            {
+                pasInterfaces[u32NumInterfaces].iMulticastSocket = psNetworkContext->pasInterfaces[j].iMulticastSocket;
+                pasInterfaces[u32NumInterfaces].iMulticastHops   = psNetworkContext->pasInterfaces[j].iMulticastHops;
+                psNetworkContext->pasInterfaces[j].iMulticastSocket = -1;
+                break;
+            }
+        }
+        
+        if (!pasInterfaces[u32NumInterfaces].bLoopback && (pasInterfaces[u32NumInterfaces].iMulticastSocket < 0))
+        {
+            int iSocket = socket(AF_INET6, SOCK_DGRAM, 0);
+            
+            if ((iSocket >= 0) && 
+                (setsockopt(iSocket, IPPROTO_IPV6, IPV6_MULTICAST_IF, &iIndex, sizeof(int)) < 0))
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: setsockopt IPV6_MULTICAST_IF failed (%s)\n", __FUNCTION__, strerror(errno));
+                close(iSocket);
+                iSocket = -1;
+            }
+            pasInterfaces[u32NumInterfaces].iMulticastSocket = iSocket;
+        }
+        u32NumInterfaces++;
+    }
+    freeifaddrs(ifs);
+    
+    /* Close sockets of interfaces that have gone */
+    for (j = 0; j < psNetworkContext->u32NumInterfaces; j++)
+    {
+        if (psNetworkContext->pasInterfaces[j].iMulticastSocket >= 0)
+        {
+            close(psNetworkContext->pasInterfaces[j].iMulticastSocket);
+        }
+    }
+    free(psNetworkContext->pasInterfaces);
+    
+    psNetworkContext->pasInterfaces     = pasInterfaces;
+    psNetworkContext->u32NumInterfaces  = u32NumInterfaces;
+    return E_NETWORK_OK;
+}
+
+
+/** Lock the cached interface table, bringing it up to date first if needed.
+ *  The interface monitor is started the first time.
+ *  \return E_NETWORK_OK with sInterfaceLock held, otherwise the lock is not held
+ */
+static teNetworkStatus eNetwork_LockInterfaces(tsNetworkContext *psNetworkContext)
+{
+    uint32_t u32Changes;
+    teNetworkStatus eStatus;
+    
+    eJIPLockLock(&psNetworkContext->sInterfaceLock);
+    
+    u32Changes = u32AtomicGet(&psNetworkContext->u32InterfaceChanges);
+    
+    if (psNetworkContext->bInterfacesValid && 
+        (psNetworkContext->u32InterfacesVersion == u32Changes) &&
+        (psNetworkContext->sInterfaceMonitor.pvThreadData ||
+         ((uint32_t)(u32TimeMillis() - psNetworkContext->u32InterfacesTime) < JIP_INTERFACE_REFRESH_TIME)))
+    {
+        /* Up to date */
+        return E_NETWORK_OK;
+    }
+    
+#if defined(__linux__)
+    if (psNetworkContext->iInterfaceMonitorSocket < 0)
+    {
+        struct sockaddr_nl sAddress;
+        int iSocket = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+        
+        memset(&sAddress, 0, sizeof(struct sockaddr_nl));
+        sAddress.nl_family = AF_NETLINK;
+        sAddress.nl_groups = RTMGRP_LINK | RTMGRP_IPV6_IFADDR;
+        
+        if ((iSocket >= 0) && (bind(iSocket, (struct sockaddr *)&sAddress, sizeof(struct sockaddr_nl)) == 0))
+        {
+            psNetworkContext->iInterfaceMonitorSocket = iSocket;
+            psNetworkContext->sInterfaceMonitor.pvThreadData = psNetworkContext;
+            if (eThreadStart(pvInterfaceMonitorThread, &psNetworkContext->sInterfaceMonitor, E_THREAD_JOINABLE) != E_THREAD_OK)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Failed to start interface monitor thread\n");
+                psNetworkContext->sInterfaceMonitor.pvThreadData = NULL;
+            }
+        }
+        else
+        {
+            DBG_vPrintf(DBG_NETWORK, "%s: Could not open netlink socket (%s)\n", __FUNCTION__, strerror(errno));
+            if (iSocket >= 0)
+            {
+                close(iSocket);
+            }
+        }
+    }
+#endif /* __linux__ */
+    
+    eStatus = eNetwork_RefreshInterfaces(psNetworkContext);
+    if (eStatus != E_NETWORK_OK)
+    {
+        eJIPLockUnlock(&psNetworkContext->sInterfaceLock);
+        return eStatus;
+    }
+    
+    psNetworkContext->bInterfacesValid      = True;
+    psNetworkContext->u32InterfacesVersion  = u32Changes;
+    psNetworkContext->u32InterfacesTime     = u32TimeMillis();
+    return E_NETWORK_OK;
+}
+
+
+static void vNetwork_UnlockInterfaces(tsNetworkContext *psNetworkContext)
+{
+    eJIPLockUnlock(&psNetworkContext->sInterfaceLock);
+}
+
+
+/** Thread that counts interface and address changes reported on iInterfaceMonitorSocket,
+ *  so that the next user of the interface table rebuilds it.
+ */
+static void *pvInterfaceMonitorThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsNetworkContext *psNetworkContext = (tsNetworkContext *)psThreadInfo->pvThreadData;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    psThreadInfo->eState = E_THREAD_RUNNING;
+    
+#if defined(__linux__)
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        char acBuffer[4096];
+        struct nlmsghdr *psMsg;
+        int iLength = recv(psNetworkContext->iInterfaceMonitorSocket, acBuffer, sizeof(acBuffer), 0);
+        
+        if (iLength < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            DBG_vPrintf(DBG_NETWORK, "%s: recv failed (%s)\n", __FUNCTION__, strerror(errno));
+            
+            /* Messages may have been lost */
+            u32AtomicAdd(&psNetworkContext->u32InterfaceChanges, 1);
+            continue;
+        }
+        
+        for (psMsg = (struct nlmsghdr *)acBuffer; NLMSG_OK(psMsg, (unsigned int)iLength); psMsg = NLMSG_NEXT(psMsg, iLength))
+        {
+            switch (psMsg->nlmsg_type)
+            {
+                case (RTM_NEWLINK):
+                case (RTM_DELLINK):
+                case (RTM_NEWADDR):
+                case (RTM_DELADDR):
+                    DBG_vPrintf(DBG_NETWORK, "Interface change (%d)\n", psMsg->nlmsg_type);
+                    u32AtomicAdd(&psNetworkContext->u32InterfaceChanges, 1);
+                    break;
+                
+                default:
+                    break;
+            }
+        }
+    }
+#endif /* __linux__ */
+    
+    eThreadFinish(psThreadInfo);
+    
+    return NULL;
+}
+
+
+
+#if defined USE_INTERNAL_BYTESWAP_64
+
+uint64_t bswap_64(uint64_t x)
+{
+    uint64_t y;
+    
+    y = ((((uint64_t)__bswap_32(x) & 0x00000000FFFFFFFFL) << 32) | (((uint64_t)__bswap_32(x >> 32) & 0x00000000FFFFFFFFL)));
+    
+    return y;
+}
+
+#endif /* _UCLIBC_ */
+
+
+static int iNetwork_NodeInterface(tsNode *psNode)
+{
+    struct ifaddrs *ifp, *ifs;
+    int iInterfaceIndex = -1;
+    char acAddr[INET6_ADDRSTRLEN] = "Could not determine address\n";
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+
+    if (getifaddrs(&ifs) < 0) 
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: getifaddrs failed (%s)\n", __FUNCTION__, strerror(errno));
+        return -1;
+    }
+
+    for (ifp = ifs; ifp; ifp = ifp->ifa_next)
+    {
+        if (ifp->ifa_addr != NULL && ifp->ifa_addr->sa_family == AF_INET6)
+        {
+            DBG_vPrintf(DBG_NETWORK, "Interface %5s: [%s]\n", ifp->ifa_name,
+                inet_ntop(AF_INET6, &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr, acAddr, INET6_ADDRSTRLEN));
+            
+            if (memcmp(&psNode->sNode_Address.sin6_addr,
+                       &((struct sockaddr_in6 *)(ifp->ifa_addr))->sin6_addr,
+                       sizeof(struct in6_addr)) == 0)
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Found matching interface: %s\n", __FUNCTION__, ifp->ifa_name);
+                iInterfaceIndex = if_nametoindex(ifp->ifa_name);
+                break;
+            }
+        }
+    }
+
+    freeifaddrs(ifs);
+    
+    return iInterfaceIndex;
+}
+
+
+/** Hold back a response of a server until u32DelayMs from now, starting the sender thread if it is not running.
+ *  The response is dropped if \ref tsJIP_Context::iServerMaxDeferred are already waiting.
+ *  \param psSrcAddress         Address of the node that is responding, which the response is sent from
+ *  \param iInterface           Interface to send the response on
+ */
+static teNetworkStatus eNetwork_DeferResponse(tsNetworkContext *psNetworkContext, struct sockaddr_in6 *psDstAddress, struct in6_addr *psSrcAddress,
+                                              int iInterface, const char *pcData, unsigned int iLength, uint32_t u32DelayMs)
+{
+    tsDeferredResponse *psResponse, **ppsPosition;
+    teNetworkStatus eStatus = E_NETWORK_OK;
+    bool_t bWake = False;
+    
+    psResponse = malloc(sizeof(tsDeferredResponse));
+    if (!psResponse)
+    {
+        return E_NETWORK_ERROR_NO_MEM;
+    }
+    
+    psResponse->u32Due      = u32TimeMillis() + u32DelayMs;
+    psResponse->sDstAddress = *psDstAddress;
+    psResponse->sSrcAddress = *psSrcAddress;
+    psResponse->iInterface  = iInterface;
+    psResponse->iLength     = iLength;
+    memcpy(psResponse->acBuffer, pcData, iLength);
+    
+    eJIPLockLock(&psNetworkContext->sResponseLock);
+    
+    if ((int)psNetworkContext->u32NumDeferredResponses >= psNetworkContext->psJIP_Context->iServerMaxDeferred)
+    {
+        DBG_vPrintf(DBG_NETWORK, "%s: %d responses already waiting, dropping response\n", __FUNCTION__, 
+                    psNetworkContext->u32NumDeferredResponses);
+        u32AtomicAdd(&psNetworkContext->u32ServerDropped, 1);
+        eStatus = E_NETWORK_ERROR_FAILED;
+    }
+    else if (!psNetworkContext->sResponseSender.pvThreadData)
+    {
+        DBG_vPrintf(DBG_NETWORK, "Starting deferred response thread\n");
+        
+        if (eQueueCreate(&psNetworkContext->sResponseQueue, 1) != E_QUEUE_OK)
+        {
+            eStatus = E_NETWORK_ERROR_NO_MEM;
+        }
+        else
+        {
+            psNetworkContext->sResponseSender.pvThreadData = psNetworkContext;
+            if (eThreadStart(pvResponseSenderThread, &psNetworkContext->sResponseSender, E_THREAD_JOINABLE) != E_THREAD_OK)
+            {
+                DBG_vPrintf(DBG_NETWORK, "Failed to start deferred response thread\n");
+                psNetworkContext->sResponseSender.pvThreadData = NULL;
+                eQueueDestroy(&psNetworkContext->sResponseQueue);
+                eStatus = E_NETWORK_ERROR_FAILED;
+            }
+        }
+    }
+    
+    if (eStatus == E_NETWORK_OK)
+    {
+        /* Keep the list in order of send time */
+        for (ppsPosition = &psNetworkContext->psDeferredResponses; *ppsPosition; ppsPosition = &(*ppsPosition)->psNext)
+        {
+            if ((int32_t)((*ppsPosition)->u32Due - psResponse->u32Due) > 0)
+            {
+                break;
+            }
+        }
+        psResponse->psNext = *ppsPosition;
+        *ppsPosition = psResponse;
+        psResponse = NULL;
+        psNetworkContext->u32NumDeferredResponses++;
+        
+        if ((ppsPosition == &psNetworkContext->psDeferredResponses) && !psNetworkContext->bResponseSenderWoken)
+        {
+            /* New first response - the sender may be waiting for a later one */
+            psNetworkContext->bResponseSenderWoken = True;
+            bWake = True;
+        }
+    }
+    
+    eJIPLockUnlock(&psNetworkContext->sResponseLock);
+    
+    if (bWake)
+    {
+        /* Only one wake up is ever queued, so this does not block */
+        eQueueQueue(&psNetworkContext->sResponseQueue, NULL);
+    }
+    free(psResponse);
+    return eStatus;
+}
+
+
+teNetworkStatus Network_ServerSendResponse(tsNetworkContext *psNetworkContext, tsJIPAddress *psDstAddress, struct in6_addr *psSrcAddress,
+                                           int iInterface, const char *pcData, unsigned int iLength)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    return eNetwork_DeferResponse(psNetworkContext, psDstAddress, psSrcAddress, iInterface, pcData, iLength, 0);
+}
+
+
+/** Thread sending the responses held back by \ref eNetwork_DeferResponse once they are due */
+static void *pvResponseSenderThread(void *psThreadInfoVoid)
+{
+    tsThread *psThreadInfo = (tsThread *)psThreadInfoVoid;
+    tsNetworkContext *psNetworkContext = (tsNetworkContext *)psThreadInfo->pvThreadData;
+    tsDeferredResponse *psDue, **ppsDueTail, *psResponse;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    while (psThreadInfo->eState == E_THREAD_RUNNING)
+    {
+        uint32_t u32Wait = 1000, u32Now;
+        void *pvWake;
+        
+        psDue = NULL;
+        ppsDueTail = &psDue;
+        
+        eJIPLockLock(&psNetworkContext->sResponseLock);
+        u32Now = u32TimeMillis();
+        while (((psResponse = psNetworkContext->psDeferredResponses) != NULL) && ((int32_t)(psResponse->u32Due - u32Now) <= 0))
+        {
+            psNetworkContext->psDeferredResponses = psResponse->psNext;
+            psNetworkContext->u32NumDeferredResponses--;
+            psResponse->psNext = NULL;
+            *ppsDueTail = psResponse;
+            ppsDueTail = &psResponse->psNext;
+        }
+        if (psResponse && (psResponse->u32Due - u32Now < u32Wait))
+        {
+            u32Wait = psResponse->u32Due - u32Now;
+        }
+        eJIPLockUnlock(&psNetworkContext->sResponseLock);
+        
+        while (psDue)
+        {
+            struct msghdr       sMsgInfo;
+            struct iovec        sIO;
+            struct cmsghdr      *psControlMessage;
+            struct in6_pktinfo  sPacketInfo;
+            char                acMsgControl[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+            
+            psResponse = psDue;
+            psDue = psDue->psNext;
+            
+            memset(&sMsgInfo, 0, sizeof(struct msghdr));
+            memset(acMsgControl, 0, sizeof(acMsgControl));
+            
+            sIO.iov_base = psResponse->acBuffer;
+            sIO.iov_len  = psResponse->iLength;
+            
+            sMsgInfo.msg_name = &psResponse->sDstAddress;
+            sMsgInfo.msg_namelen = sizeof(struct sockaddr_in6);
+            sMsgInfo.msg_iov = &sIO;
+            sMsgInfo.msg_iovlen = 1;
+            sMsgInfo.msg_control = acMsgControl;
+            sMsgInfo.msg_controllen = sizeof(acMsgControl);
+            
+            /* Send from the node's own address, as a response to a unicast would be */
+            sPacketInfo.ipi6_addr       = psResponse->sSrcAddress;
+            sPacketInfo.ipi6_ifindex    = psResponse->iInterface;
+            
+            psControlMessage = CMSG_FIRSTHDR(&sMsgInfo);
+            psControlMessage->cmsg_level = IPPROTO_IPV6;
+            psControlMessage->cmsg_type = IPV6_PKTINFO;
+            psControlMessage->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
+            memcpy(CMSG_DATA(psControlMessage), &sPacketInfo, sizeof(struct in6_pktinfo));
+            
+            if (sendmsg(psNetworkContext->iSocket, &sMsgInfo, 0) != (ssize_t)psResponse->iLength)
+            {
+                DBG_vPrintf(DBG_NETWORK, "%s: Could not send deferred response (%s)\n", __FUNCTION__, strerror(errno));
+            }
+            free(psResponse);
+        }
+        
+        if (eQueueDequeueTimed(&psNetworkContext->sResponseQueue, u32Wait, &pvWake) == E_QUEUE_OK)
+        {
+            eJIPLockLock(&psNetworkContext->sResponseLock);
+            psNetworkContext->bResponseSenderWoken = False;
+            eJIPLockUnlock(&psNetworkContext->sResponseLock);
+        }
+    }
+    
+    DBG_vPrintf(DBG_NETWORK, "%s: exit\n", __FUNCTION__);
+    
+    eThreadFinish(psThreadInfo);
+    return NULL;
+}
@@ -45,6 +45,10 @@
 #include <Threads.h>
 
 
+/** Size of the buffers used to receive and build JIP packets */
+#define PACKET_BUFFER_SIZE          1024
+
+
 /** Placeholder for no Flags passed to \ref Network_ExchangeJIP 
  */
 #define EXCHANGE_FLAG_NONE          0x00000000
@@ -79,13 +83,84 @@ typedef enum
     E_NETWORK_LINK_TCP,
 } teLink;
 
-typedef struct
+/** Number of buckets in a server's index of multicast groups. Must be a power of 2 */
+#define JIP_SERVER_GROUP_BUCKETS    32
+
+/** A multicast group that nodes of a server belong to */
+typedef struct _tsServerGroups
 {
     struct in6_addr     sMulticastAddress;      /**< Multicast group address */
     uint32_t            u32NumMembers;          /**< How many nodes are a member of the group */
+    uint32_t            u32MaxMembers;          /**< Size of apsMembers */
+    tsNode              **apsMembers;           /**< The member nodes */
+    struct _tsServerGroups *psNext;             /**< Next group in the same bucket */
 } tsServerGroups;
 
+/** A local network interface, cached from getifaddrs */
+typedef struct
+{
+    int                 iIndex;                 /**< Interface index */
+    bool_t              bLoopback;              /**< Loopback interface - multicasts are not sent on it */
+    int                 iMulticastSocket;       /**< Socket with IPV6_MULTICAST_IF set to this interface, or -1 */
+    int                 iMulticastHops;         /**< Hop limit last set on iMulticastSocket, or -1 */
+} tsNetworkInterface;
+
+/** What has been seen of the path to a node, from the exchanges made with it. Updated atomically */
+typedef struct
+{
+    volatile uint32_t   u32Requests;            /**< Requests sent, including retries */
+    volatile uint32_t   u32Responses;           /**< Responses received */
+    volatile uint32_t   u32Hops;                /**< Hops taken by the last response, estimated from its hop limit. 0 if unknown */
+} tsNodeLinkStats;
+
+/** One request/response pair of a \ref Network_ExchangeJIPBatch */
+typedef struct
+{
+    tsJIPAddress        sAddress;               /**< Node to send the request to */
+    uint32_t            u32DeviceId;            /**< Device ID of the node, which decides how long to wait for the response */
+    teJIP_Command       eSendCommand;           /**< Request command */
+    char                *pcSendData;            /**< Request, including space for the JIP header */
+    int                 iSendDataLength;        /**< Length of the request */
+    teJIP_Command       eReceiveCommand;        /**< Expected response command */
+    char                *pcReceiveData;         /**< Buffer for the response */
+    unsigned int        iReceiveDataLength;     /**< Size of pcReceiveData. Set to the length of the response */
+    teNetworkStatus     eStatus;                /**< Result of this exchange */
+    tsNodeLinkStats     *psLinkStats;           /**< Statistics of the node to update, or NULL */
+    uint8_t             u8Handle;               /**< Handle the response is matched on. Internal use only */
+} tsNetworkExchange;
+
+/** A response collected by \ref Network_ExchangeJIPMulticast */
+typedef struct
+{
+    tsJIPAddress        sAddress;               /**< Node the response came from */
+    int                 iHopLimit;              /**< Hop limit the response arrived with, or -1 if not known */
+    unsigned int        iLength;                /**< Length of the response in acData */
+    char                acData[PACKET_BUFFER_SIZE]; /**< The response, including its header */
+} tsNetworkResponse;
+
+/** A response to a multicast request, held back by a server until its randomly delayed send time */
+typedef struct _tsDeferredResponse
+{
+    uint32_t            u32Due;                 /**< Time to send it, from u32TimeMillis */
+    struct sockaddr_in6 sDstAddress;            /**< The requester */
+    struct in6_addr     sSrcAddress;            /**< Address of the node that is responding */
+    int                 iInterface;             /**< Interface the request arrived on */
+    unsigned int        iLength;                /**< Length of the response in acBuffer */
+    struct _tsDeferredResponse *psNext;         /**< Next in order of send time */
+    char                acBuffer[PACKET_BUFFER_SIZE]; /**< The response, including its header */
+} tsDeferredResponse;
+
+/** A shard of a server: a worker thread handling the packets for the nodes whose addresses hash to it.
+ *  Each node is only ever handled by its own shard, so packets to a node are handled in the order they arrived. */
 typedef struct
+{
+    struct _tsNetworkContext *psNetworkContext;
+    uint32_t            u32Index;               /**< Which shard this is */
+    tsQueue             sQueue;                 /**< Received datagrams for the shard's nodes */
+    tsThread            sWorker;                /**< Thread handling the datagrams */
+} tsServerShard;
+
+typedef struct _tsNetworkContext
 {
     int                 iSocket;
     
@@ -103,10 +178,41 @@ typedef struct
     tsThread            sSocketListener;
     tsQueue             sSocketQueue;
     
+    /* Worker threads of a server, when it has more than one. The listener then only receives datagrams,
+     * and passes each to the shard of the node it is for. */
+    uint32_t            u32NumShards;           /**< Number of shards, 0 if the listener handles datagrams itself */
+    tsServerShard       *pasShards;             /**< The shards */
+    volatile uint32_t   u32ServerDropped;       /**< Count of requests a server did not answer as it was out of memory
+                                                 *   or at a limit. Updated atomically */
+    
     uint32_t            u32NumTrapThreads;      /**< Count of the number of currently spawned trap threads */
     
+    /* Multicast groups the server is a member of, hashed by address, with the member nodes of each
+     * so that a multicast packet only touches its members. Protected by the JIP context lock. */
     uint32_t            u32NumGroups;           /**< How many groups the server is a member of */
-    tsServerGroups      *pasServerGroups;       /**< Track which multicast groups the server is a member of */
+    tsServerGroups      *apsServerGroups[JIP_SERVER_GROUP_BUCKETS];
+    
+    /* Cached table of local interfaces, protected by sInterfaceLock. It is rebuilt when the
+     * interface monitor has counted a change since it was built, or when it is too old if
+     * there is no monitor on this platform. */
+    tsLock              sInterfaceLock;
+    tsNetworkInterface  *pasInterfaces;         /**< Interface table */
+    uint32_t            u32NumInterfaces;       /**< Number of entries in pasInterfaces */
+    bool_t              bInterfacesValid;       /**< pasInterfaces has been built */
+    uint32_t            u32InterfacesVersion;   /**< Value of u32InterfaceChanges when the table was built */
+    uint32_t            u32InterfacesTime;      /**< Time the table was built, from u32TimeMillis */
+    volatile uint32_t   u32InterfaceChanges;    /**< Count of interface changes seen by the monitor */
+    int                 iInterfaceMonitorSocket;/**< Socket receiving interface change notifications, or -1 */
+    tsThread            sInterfaceMonitor;      /**< Thread reading iInterfaceMonitorSocket */
+    
+    /* Responses of a server to multicast requests that are waiting for their send time, 
+     * protected by sResponseLock. The sender thread is started when the first is deferred. */
+    tsLock              sResponseLock;
+    tsDeferredResponse  *psDeferredResponses;   /**< Waiting responses, in order of send time */
+    uint32_t            u32NumDeferredResponses;/**< Number of entries on psDeferredResponses */
+    bool_t              bResponseSenderWoken;   /**< A wake up is already queued on sResponseQueue */
+    tsQueue             sResponseQueue;         /**< Wakes the sender when an earlier response is added */
+    tsThread            sResponseSender;        /**< Thread sending deferred responses. pvThreadData is set while it runs */
 
 #ifdef LOCK_NETWORK
     tsLock   sNetworkLock;
@@ -126,18 +232,85 @@ teNetworkStatus Network_Listen(tsNetworkContext *psNetworkContext);
 teNetworkStatus Network_ClientGroupJoin(tsNetworkContext *psNetworkContext, const char *pcMulticastAddress);
 teNetworkStatus Network_ClientGroupLeave(tsNetworkContext *psNetworkContext, const char *pcMulticastAddress);
 
+/** Add a node to a multicast group, joining the group on every interface if it is the first member.
+ *  Takes the JIP context lock, so must be called without it.
+ */
 teNetworkStatus Network_ServerGroupJoin(tsNetworkContext *psNetworkContext, tsNode *psNode, struct in6_addr *psMulticastAddress);
+
+/** Remove a node from a multicast group, leaving the group on every interface if it was the last member.
+ *  Takes the JIP context lock, so must be called without it.
+ */
 teNetworkStatus Network_ServerGroupLeave(tsNetworkContext *psNetworkContext, tsNode *psNode, struct in6_addr *psMulticastAddress);
 
 
+/** Send a response of a server from the address of the node psSrcAddress, as a response to a unicast
+ *  request would be. It is sent by the deferred response thread, so this does not wait for the socket.
+ */
+teNetworkStatus Network_ServerSendResponse(tsNetworkContext *psNetworkContext, tsJIPAddress *psDstAddress, struct in6_addr *psSrcAddress,
+                                           int iInterface, const char *pcData, unsigned int iLength);
+
+
 teNetworkStatus Network_Send(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress, const char *pcData, int iDataLength);
-teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32Timeout, tsJIPAddress *psAddress, char *pcData, unsigned int *iDataLength);
+teNetworkStatus Network_Recieve(tsNetworkContext *psNetworkContext, uint32_t u32Timeout, tsJIPAddress *psAddress, char *pcData, unsigned int *iDataLength, int *piHopLimit);
 
 teNetworkStatus Network_ExchangeJIP(tsNetworkContext *psNetworkContext, tsNode *psNode, uint32_t u32Retries, uint32_t u32Flags,
                                     teJIP_Command eSendCommand, const char *pcSendData, int iSendDataLength, 
                                     teJIP_Command eReceiveCommand, char *pcReceiveData, unsigned int *piReceiveDataLength);
 
+/** Carry out several exchanges with different nodes at once.
+ *  Every request is sent before waiting for any response, and responses are matched to requests
+ *  by source address and handle in whatever order they arrive. Requests that have not been answered
+ *  within their timeout are sent again, up to u32Retries times in all.
+ *  \param psNetworkContext     Pointer to network context
+ *  \param pasExchanges         Array of exchanges. The eStatus member of each is set to its result
+ *  \param u32NumExchanges      Number of entries in pasExchanges
+ *  \param u32Retries           Number of times to send each request
+ *  \return E_NETWORK_OK if every exchange got a response
+ */
+teNetworkStatus Network_ExchangeJIPBatch(tsNetworkContext *psNetworkContext, tsNetworkExchange *pasExchanges, 
+                                         uint32_t u32NumExchanges, uint32_t u32Retries);
+
+/** Send a request to a multicast group and collect the responses of its members.
+ *  The request is sent once on every non-loopback interface, or only on iInterfaceIndex if that is not -1.
+ *  Unlike \ref Network_SendJIPMulticast, it is sent from the context's main socket, so that the responses
+ *  reach the listener thread. Responses with eReceiveCommand and the request's handle are collected, one 
+ *  from each node, until u32WaitMs has passed or u32MaxResponses have arrived.
+ *  \param psNetworkContext     Pointer to network context
+ *  \param psAddress            Multicast address
+ *  \param iInterfaceIndex      Interface to send on, or -1 for all interfaces
+ *  \param iMaxHops             Hop limit for the multicast
+ *  \param eSendCommand         Request command
+ *  \param pcSendData           Request, including space for the JIP header
+ *  \param iSendDataLength      Length of the request
+ *  \param eReceiveCommand      Expected response command
+ *  \param u32WaitMs            Time to collect responses for
+ *  \param pasResponses         Array to store the responses in
+ *  \param u32MaxResponses      Number of entries in pasResponses
+ *  \param pu32NumResponses[out] Number of responses collected
+ *  \return E_NETWORK_OK if the request was sent
+ */
+teNetworkStatus Network_ExchangeJIPMulticast(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress, int iInterfaceIndex, int iMaxHops,
+                                             teJIP_Command eSendCommand, char *pcSendData, int iSendDataLength,
+                                             teJIP_Command eReceiveCommand, uint32_t u32WaitMs,
+                                             tsNetworkResponse *pasResponses, uint32_t u32MaxResponses, uint32_t *pu32NumResponses);
+
 teNetworkStatus Network_SendJIP(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress,
                                 teJIP_Command eCommand, const char *pcData, int iDataLength);
+
+/** Send a JIP packet to a multicast address.
+ *  Over IPv6 it is sent on every non-loopback interface, or only on iInterfaceIndex if that is not -1,
+ *  using a socket kept open for each interface. Once the cached interface table is up to date this
+ *  makes no system calls other than the sends. Over IPv4 it is sent to the gateway as \ref Network_SendJIP.
+ *  \param psNetworkContext     Pointer to network context
+ *  \param psAddress            Multicast address
+ *  \param iInterfaceIndex      Interface to send on, or -1 for all interfaces
+ *  \param iMaxHops             Hop limit for the multicast
+ *  \param eCommand             JIP command
+ *  \param pcData               Packet, including space for the JIP header
+ *  \param iDataLength          Length of the packet
+ *  \return E_NETWORK_OK if it was sent on every interface
+ */
+teNetworkStatus Network_SendJIPMulticast(tsNetworkContext *psNetworkContext, tsJIPAddress *psAddress, int iInterfaceIndex, int iMaxHops,
+                                         teJIP_Command eCommand, const char *pcData, int iDataLength);
 #endif /* __NETWORK_H__ */
                             
\ No newline at end of file
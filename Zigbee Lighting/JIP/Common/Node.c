@@ -39,7 +39,6 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <unistd.h>
 
 #include <JIP.h>
 #include <JIP_Private.h>
@@ -91,6 +90,91 @@ tsNode *psJIP_NodeListAdd(tsNode **ppsNodeListHead, tsNode *psNode)
 }
 
 
+static void vJIP_DeviceIdIndexAdd(tsJIP_Private *psJIP_Private, tsNode *psNode)
+{
+    tsNode **ppsBucket = &psJIP_Private->apsDeviceIdIndex[u32JIP_DeviceIdBucket(psNode->u32DeviceId)];
+    
+    /* Order within a bucket doesn't matter, so insert at the head rather than walking a crowded bucket */
+    psNode->psNextDeviceId = *ppsBucket;
+    *ppsBucket = psNode;
+}
+
+
+static void vJIP_DeviceIdIndexRemove(tsJIP_Private *psJIP_Private, tsNode *psNode)
+{
+    tsNode **ppsllPosition = &psJIP_Private->apsDeviceIdIndex[u32JIP_DeviceIdBucket(psNode->u32DeviceId)];
+    
+    while (*ppsllPosition)
+    {
+        if (*ppsllPosition == psNode)
+        {
+            *ppsllPosition = psNode->psNextDeviceId;
+            psNode->psNextDeviceId = NULL;
+            break;
+        }
+        ppsllPosition = &(*ppsllPosition)->psNextDeviceId;
+    }
+}
+
+
+static inline uint32_t u32JIP_AddressBucket(const struct in6_addr *psAddress)
+{
+    uint32_t au32Words[4];
+    
+    /* Nodes on one network share the prefix, so all of the address is folded in */
+    memcpy(au32Words, psAddress, sizeof(au32Words));
+    au32Words[0] ^= au32Words[1] ^ au32Words[2] ^ au32Words[3];
+    return (au32Words[0] ^ (au32Words[0] >> 16)) & (JIP_ADDRESS_INDEX_BUCKETS - 1);
+}
+
+
+static inline tsLock *psJIP_AddressBucketLock(tsJIP_Private *psJIP_Private, uint32_t u32Bucket)
+{
+    return &psJIP_Private->asAddressIndexLocks[u32Bucket & (JIP_ADDRESS_INDEX_LOCKS - 1)];
+}
+
+
+static void vJIP_AddressIndexAdd(tsJIP_Private *psJIP_Private, tsNode *psNode)
+{
+    uint32_t u32Bucket = u32JIP_AddressBucket(&psNode->sNode_Address.sin6_addr);
+    tsNode **ppsllPosition = &psJIP_Private->apsAddressIndex[u32Bucket];
+    
+    eJIPLockLock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    /* Append so that the index keeps the same order as the main node list */
+    while (*ppsllPosition)
+    {
+        ppsllPosition = &(*ppsllPosition)->psNextAddress;
+    }
+    psNode->psNextAddress = NULL;
+    *ppsllPosition = psNode;
+    
+    eJIPLockUnlock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+}
+
+
+static void vJIP_AddressIndexRemove(tsJIP_Private *psJIP_Private, tsNode *psNode)
+{
+    uint32_t u32Bucket = u32JIP_AddressBucket(&psNode->sNode_Address.sin6_addr);
+    tsNode **ppsllPosition = &psJIP_Private->apsAddressIndex[u32Bucket];
+    
+    eJIPLockLock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    while (*ppsllPosition)
+    {
+        if (*ppsllPosition == psNode)
+        {
+            *ppsllPosition = psNode->psNextAddress;
+            psNode->psNextAddress = NULL;
+            break;
+        }
+        ppsllPosition = &(*ppsllPosition)->psNextAddress;
+    }
+    
+    eJIPLockUnlock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+}
+
+
 tsNode *psJIP_NodeListRemove(tsNode **ppsNodeListHead, tsNode *psNode)
 {
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s Remove Node %p from list head %p\n", __FUNCTION__, psNode, *ppsNodeListHead);
@@ -145,7 +229,14 @@ tsNode *psJIP_NetAllocateNode(tsNetwork *psNet, tsJIPAddress *psAddress, uint32_
     }
     psNewNode->u32DeviceId = u32DeviceId;
     
-    eLockCreate(&psNewNode->sLock);
+    if (psNet->psOwnerContext->eNodeLockType == E_JIP_NODE_LOCK_STRIPED)
+    {
+        eLockCreateStriped(&psNewNode->sLock, psNewNode);
+    }
+    else
+    {
+        eLockCreate(&psNewNode->sLock);
+    }
     eJIPLockLock(&psNewNode->sLock);
 
     DBG_vPrintf(DBG_NODES, "New Node allocated at %p\n", psNewNode);
@@ -170,13 +261,14 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
         return E_JIP_ERROR_NO_MEM;
     }
     
-    if (psJIP_Private->eJIP_ContextType == E_JIP_CONTEXT_SERVER)
+    /* Servers keep the node's group membership here, clients its link statistics */
     {
         tsNode_Private *psNode_Private;
         psNode_Private = malloc(sizeof(tsNode_Private));
         if (!psNode_Private)
         {
             DBG_vPrintf(DBG_NODES, "Failed allocate private node data\n");
+            eJIP_UnlockNode(psNewNode);
             if (eJIP_NetFreeNode(psJIP_Context, psNewNode) != E_JIP_OK)
             {
                 DBG_vPrintf(DBG_NODES, "Could not free node!\n");
@@ -197,6 +289,7 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
         {
             /* Only populate the node if we are running as a client, otherwise we can't populate this node */
             DBG_vPrintf(DBG_NODES, "Failed to populate node - unknown device id\n");
+            eJIP_UnlockNode(psNewNode);
             if (eJIP_NetFreeNode(psJIP_Context, psNewNode) != E_JIP_OK)
             {
                 DBG_vPrintf(DBG_NODES, "Could not free node!\n");
@@ -217,6 +310,7 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
                 * another attempt at populating it.
                 */
 
+                eJIP_UnlockNode(psNewNode);
                 if (eJIP_NetFreeNode(psJIP_Context, psNewNode) != E_JIP_OK)
                 {
                     DBG_vPrintf(DBG_NODES, "Could not free node!\n");
@@ -230,6 +324,11 @@ teJIP_Status eJIP_NetAddNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddre
     
     /* Insert the new node into the linked list of nodes */
     (void)psJIP_NodeListAdd(&psJIP_Context->sNetwork.psNodes, psNewNode);
+    vJIP_DeviceIdIndexAdd(psJIP_Private, psNewNode);
+    vJIP_AddressIndexAdd(psJIP_Private, psNewNode);
+    
+    /* The network's node list holds the first handle on the node */
+    psNewNode->u32RefCount = 1;
     
     psJIP_Context->sNetwork.u32NumNodes++;
     
@@ -259,6 +358,7 @@ teJIP_Status eJIP_NetRemoveNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAd
 {
     tsNode* psNode;
     tsNetwork *psNet = &psJIP_Context->sNetwork;
+    PRIVATE_CONTEXT(psJIP_Context);
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     teJIP_Status eStatus = E_JIP_ERROR_FAILED;
 
@@ -270,18 +370,26 @@ teJIP_Status eJIP_NetRemoveNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAd
         /* Got pointer to the node, lock the linked list now so that we can remove it. */
         eJIP_Lock(psJIP_Context);
         (void)psJIP_NodeListRemove(&psJIP_Context->sNetwork.psNodes, psNode);
+        vJIP_DeviceIdIndexRemove(psJIP_Private, psNode);
+        vJIP_AddressIndexRemove(psJIP_Private, psNode);
+        psNode->bRemoved = True;
         
         /* Decrement count of nodes */
         psNet->u32NumNodes--;
         eStatus = E_JIP_OK;
         
+        eJIP_Unlock(psJIP_Context);
+        
         if (ppsNode)
         {
-            /* Return pointer to node if we were passed a location */
+            /* Return pointer to node if we were passed a location. The caller now owns the network's handle. */
             *ppsNode = psNode;
         }
-        
-        eJIP_Unlock(psJIP_Context);
+        else
+        {
+            eJIP_UnlockNode(psNode);
+            (void)eJIP_ReleaseNode(psNode);
+        }
     }  
     return eStatus;
 }
@@ -294,16 +402,29 @@ teJIP_Status eJIP_FreeMib(tsJIP_Context *psJIP_Context, tsMib *psMib)
     
     DBG_vPrintf(DBG_MIBS, "Freeing Mib ID 0x%08x at %p (%s)\n", psMib->u32MibId, psMib, psMib->pcName ? psMib->pcName: "?");
     
+    vJIP_NodeDropSchema(psMib->psOwnerNode);
+    
+    if (psMib->psOwnerNode)
+    {
+        /* A server's requests waiting on the variables would be answered from freed memory */
+        vJIPserver_DropPending(psJIP_Context, NULL, psMib);
+    }
+    
     while(psVar)
     {
         /* Run length of Vars, freeing each one */
         
         DBG_vPrintf(DBG_VARS, "Freeing Var at %p (%s)\n", psVar, psVar->pcName ? psVar->pcName: "?");
         
-        if (psVar->prCbVarTrap)
+        if (psVar->psExt)
         {
-            DBG_vPrintf(DBG_VARS, "Removing trap on variable at %p (%s)\n", psVar, psVar->pcName ? psVar->pcName: "?");
-            eJIP_UntrapVar(psJIP_Context, psVar, psVar->u8TrapHandle);
+            if (psVar->psExt->prCbVarTrap)
+            {
+                DBG_vPrintf(DBG_VARS, "Removing trap on variable at %p (%s)\n", psVar, psVar->pcName ? psVar->pcName: "?");
+                eJIP_UntrapVar(psJIP_Context, psVar, psVar->psExt->u8TrapHandle);
+            }
+            vJIP_VarDropEncoded(psVar);
+            free(psVar->psExt);
         }
         
         switch (psVar->eVarType)
@@ -359,7 +480,6 @@ teJIP_Status eJIP_FreeMib(tsJIP_Context *psJIP_Context, tsMib *psMib)
 
 teJIP_Status eJIP_NetFreeNode(tsJIP_Context *psJIP_Context, tsNode *psNode)
 {
-    PRIVATE_CONTEXT(psJIP_Context);
     if (psNode)
     {
         /* We found the node to be deleted. Now it all needs freeing */
@@ -375,13 +495,10 @@ teJIP_Status eJIP_NetFreeNode(tsJIP_Context *psJIP_Context, tsNode *psNode)
             psMib = psNextMib;
         }
         
-        if (psJIP_Private->eJIP_ContextType == E_JIP_CONTEXT_SERVER)
-        {
-            if (psNode->pvPriv)
-            {
-                free(psNode->pvPriv);
-            }
-        }
+        /* Both context types allocate the private data. The node's reference to its schema
+         * went with its last MIB, but a server node may have been freed without any. */
+        vJIP_NodeDropSchema(psNode);
+        free(psNode->pvPriv);
         
         eLockDestroy(&psNode->sLock);
         free(psNode);
@@ -394,6 +511,93 @@ teJIP_Status eJIP_NetFreeNode(tsJIP_Context *psJIP_Context, tsNode *psNode)
 }
 
 
+tsNode *psJIP_AcquireNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress)
+{
+    tsNode *psNode;
+    uint32_t u32Bucket = u32JIP_AddressBucket(&psAddress->sin6_addr);
+    PRIVATE_CONTEXT(psJIP_Context);
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIPLockLock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    psNode = psJIP_Private->apsAddressIndex[u32Bucket];
+    while (psNode)
+    {
+        if (memcmp(&psNode->sNode_Address, psAddress, sizeof(tsJIPAddress)) == 0)
+        {
+            /* Node can't be taken out of the index while the bucket is locked, so it is safe to take the handle */
+            (void)u32AtomicAdd(&psNode->u32RefCount, 1);
+            break;
+        }
+        psNode = psNode->psNextAddress;
+    }
+    
+    eJIPLockUnlock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    return psNode;
+}
+
+
+tsNode *psJIP_AcquireNodeByIn6(tsJIP_Context *psJIP_Context, const struct in6_addr *psAddress)
+{
+    tsNode *psNode;
+    uint32_t u32Bucket = u32JIP_AddressBucket(psAddress);
+    PRIVATE_CONTEXT(psJIP_Context);
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIPLockLock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    psNode = psJIP_Private->apsAddressIndex[u32Bucket];
+    while (psNode)
+    {
+        if (memcmp(&psNode->sNode_Address.sin6_addr, psAddress, sizeof(struct in6_addr)) == 0)
+        {
+            (void)u32AtomicAdd(&psNode->u32RefCount, 1);
+            break;
+        }
+        psNode = psNode->psNextAddress;
+    }
+    
+    eJIPLockUnlock(psJIP_AddressBucketLock(psJIP_Private, u32Bucket));
+    
+    return psNode;
+}
+
+
+teJIP_Status eJIP_AcquireNodeHandle(tsNode *psNode)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s: %p\n", __FUNCTION__, psNode);
+    
+    if (!psNode)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    (void)u32AtomicAdd(&psNode->u32RefCount, 1);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_ReleaseNode(tsNode *psNode)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s: %p\n", __FUNCTION__, psNode);
+    
+    if (!psNode)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    if (u32AtomicAdd(&psNode->u32RefCount, (uint32_t)-1) == 0)
+    {
+        /* Last handle gone. The network list holds a handle until the node is removed, 
+         * so nothing else can reach this node any more. */
+        DBG_vPrintf(DBG_NODES, "Last handle released on node %p\n", psNode);
+        return eJIP_NetFreeNode(psNode->psOwnerNetwork->psOwnerContext, psNode);
+    }
+    return E_JIP_OK;
+}
+
+
 teJIP_Status eJIP_LockNode(tsNode *psNode, bool_t bWait)
 {
     if (bWait)
@@ -421,97 +625,203 @@ teJIP_Status eJIP_UnlockNode(tsNode *psNode)
 }
 
 
-teJIP_Status eJIP_GetNodeAddressList(tsJIP_Context *psJIP_Context, const uint32_t u32DeviceIdFilter, tsJIPAddress **ppsAddresses, uint32_t *pu32NumAddresses)
+/* Visit the nodes matching any of the device ID filters. Must be called with the context locked. */
+static teJIP_Status eJIP_VisitNodes(tsJIP_Context *psJIP_Context, const uint32_t *pau32DeviceIdFilters, uint32_t u32NumFilters,
+                                    tprCbNodeVisit prCbNodeVisit, void *pvUser)
 {
+    PRIVATE_CONTEXT(psJIP_Context);
     tsNode *psNode;
-    teJIP_Status eStatus = E_JIP_OK;
-    tsJIPAddress *psAddresses = NULL;
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
-    
-    eJIP_Lock(psJIP_Context);
+    teJIP_Status eStatus;
+    uint32_t i, j;
     
-    *pu32NumAddresses = 0;
-    
-    DBG_vPrintf(DBG_NODES, "Currently %d nodes in network\n", psJIP_Context->sNetwork.u32NumNodes);
-    
-    // Malloc enough space to hold every device, if we had to return everything.
-    psAddresses = malloc(sizeof(tsJIPAddress) * (psJIP_Context->sNetwork.u32NumNodes));
+    if (pau32DeviceIdFilters)
+    {
+        for (i = 0; i < u32NumFilters; i++)
+        {
+            if (pau32DeviceIdFilters[i] == JIP_DEVICEID_ALL)
+            {
+                break;
+            }
+        }
+    }
     
-    if (psAddresses)
+    if ((pau32DeviceIdFilters == NULL) || (i < u32NumFilters))
     {
-        uint32_t i = 0;
+        /* Every node matches - walk the whole list */
         psNode = psJIP_Context->sNetwork.psNodes;
-        
         while (psNode)
         {
-            if ((u32DeviceIdFilter == JIP_DEVICEID_ALL) || (psNode->u32DeviceId == u32DeviceIdFilter))
+            if ((eStatus = prCbNodeVisit(psNode, pvUser)) != E_JIP_OK)
             {
-                memcpy(&psAddresses[i], &psNode->sNode_Address, sizeof(tsJIPAddress));
-                DBG_vPrintf(DBG_NODES, "Adding node ");
-                DBG_vPrintf_IPv6Address(DBG_NODES, psNode->sNode_Address.sin6_addr);
-                i++;
-                (*pu32NumAddresses)++;
+                return eStatus;
             }
             psNode = psNode->psNext;
         }
-        *ppsAddresses = psAddresses;
+        return E_JIP_OK;
     }
-    else
+    
+    for (i = 0; i < u32NumFilters; i++)
     {
-        DBG_vPrintf(DBG_NODES, "Could not malloc space for node list\n");
-        eStatus = E_JIP_ERROR_NO_MEM;
+        /* Skip filters that have already been visited so that each node is only visited once */
+        for (j = 0; j < i; j++)
+        {
+            if (pau32DeviceIdFilters[j] == pau32DeviceIdFilters[i])
+            {
+                break;
+            }
+        }
+        if (j < i)
+        {
+            continue;
+        }
+        
+        psNode = psJIP_Private->apsDeviceIdIndex[u32JIP_DeviceIdBucket(pau32DeviceIdFilters[i])];
+        while (psNode)
+        {
+            if (psNode->u32DeviceId == pau32DeviceIdFilters[i])
+            {
+                if ((eStatus = prCbNodeVisit(psNode, pvUser)) != E_JIP_OK)
+                {
+                    return eStatus;
+                }
+            }
+            psNode = psNode->psNextDeviceId;
+        }
     }
+    return E_JIP_OK;
+}
 
+
+teJIP_Status eJIP_ForEachNode(tsJIP_Context *psJIP_Context, const uint32_t *pau32DeviceIdFilters, uint32_t u32NumFilters,
+                              tprCbNodeVisit prCbNodeVisit, void *pvUser)
+{
+    teJIP_Status eStatus;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (!prCbNodeVisit)
+    {
+        return E_JIP_ERROR_FAILED;
+    }
+    
+    eJIP_Lock(psJIP_Context);
+    eStatus = eJIP_VisitNodes(psJIP_Context, pau32DeviceIdFilters, u32NumFilters, prCbNodeVisit, pvUser);
+    eJIP_Unlock(psJIP_Context);
+    
+    return eStatus;
+}
+
+
+/** State used while building a node address list */
+typedef struct
+{
+    tsJIPAddress   *psAddresses;
+    uint32_t        u32NumAddresses;
+} tsNodeAddressList;
+
+
+static teJIP_Status eJIP_CountNodeCb(tsNode *psNode, void *pvUser)
+{
+    tsNodeAddressList *psList = (tsNodeAddressList *)pvUser;
+    (void)psNode;
+    psList->u32NumAddresses++;
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIP_CopyNodeAddressCb(tsNode *psNode, void *pvUser)
+{
+    tsNodeAddressList *psList = (tsNodeAddressList *)pvUser;
+    
+    memcpy(&psList->psAddresses[psList->u32NumAddresses], &psNode->sNode_Address, sizeof(tsJIPAddress));
+    DBG_vPrintf(DBG_NODES, "Adding node ");
+    DBG_vPrintf_IPv6Address(DBG_NODES, psNode->sNode_Address.sin6_addr);
+    psList->u32NumAddresses++;
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIP_GetNodeAddressListMulti(tsJIP_Context *psJIP_Context, const uint32_t *pau32DeviceIdFilters, uint32_t u32NumFilters,
+                                          tsJIPAddress **ppsAddresses, uint32_t *pu32NumAddresses)
+{
+    tsNodeAddressList sList = { NULL, 0 };
+    teJIP_Status eStatus = E_JIP_OK;
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIP_Lock(psJIP_Context);
+    
+    DBG_vPrintf(DBG_NODES, "Currently %d nodes in network\n", psJIP_Context->sNetwork.u32NumNodes);
+    
+    /* Count the matching nodes first so that the list is allocated at exactly the right size */
+    (void)eJIP_VisitNodes(psJIP_Context, pau32DeviceIdFilters, u32NumFilters, eJIP_CountNodeCb, &sList);
+    
+    if (sList.u32NumAddresses > 0)
+    {
+        sList.psAddresses = malloc(sizeof(tsJIPAddress) * sList.u32NumAddresses);
+        if (sList.psAddresses)
+        {
+            sList.u32NumAddresses = 0;
+            (void)eJIP_VisitNodes(psJIP_Context, pau32DeviceIdFilters, u32NumFilters, eJIP_CopyNodeAddressCb, &sList);
+        }
+        else
+        {
+            DBG_vPrintf(DBG_NODES, "Could not malloc space for node list\n");
+            sList.u32NumAddresses = 0;
+            eStatus = E_JIP_ERROR_NO_MEM;
+        }
+    }
+    
     eJIP_Unlock(psJIP_Context);
     
+    if (eStatus == E_JIP_OK)
+    {
+        *ppsAddresses = sList.psAddresses;
+        *pu32NumAddresses = sList.u32NumAddresses;
+    }
+    else
+    {
+        *pu32NumAddresses = 0;
+    }
     return eStatus;
 }
 
 
+teJIP_Status eJIP_GetNodeAddressList(tsJIP_Context *psJIP_Context, const uint32_t u32DeviceIdFilter, tsJIPAddress **ppsAddresses, uint32_t *pu32NumAddresses)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    return eJIP_GetNodeAddressListMulti(psJIP_Context, &u32DeviceIdFilter, 1, ppsAddresses, pu32NumAddresses);
+}
+
+
 tsNode *psJIP_LookupNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress)
 {
     tsNode *psNode;
-    tsNetwork *psNet;
-    uint32_t u32Attempts = 0;
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
  
     DBG_vPrintf(DBG_NODES, "Looking for ");
     DBG_vPrintf_IPv6Address(DBG_NODES, psAddress->sin6_addr);
-start:
-    eJIP_Lock(psJIP_Context);
-
-    psNet = &psJIP_Context->sNetwork;
-
-    psNode = psNet->psNodes;
-
-    while (psNode)
+    
+    /* Lock ordering is node before context. So the node is found and a handle taken on it with the 
+     * context locked, then the context is released before waiting for the node lock. The handle keeps
+     * the node allocated while we wait, even if it is removed in the meantime.
+     */
+    while ((psNode = psJIP_AcquireNode(psJIP_Context, psAddress)) != NULL)
     {
-        DBG_vPrintf(DBG_NODES, "Looking at ");
-        DBG_vPrintf_IPv6Address(DBG_NODES, psNode->sNode_Address.sin6_addr);
-        if (memcmp(&psNode->sNode_Address, psAddress, sizeof(tsJIPAddress)) == 0)
+        eJIP_LockNode(psNode, True);
+        
+        if (!psNode->bRemoved)
         {
-            if (eJIP_LockNode(psNode, False) == E_JIP_ERROR_WOULD_BLOCK)
-            {
-                DBG_vPrintf(DBG_NODES, "Locking node %p would block\n", psNode);
-                eJIP_Unlock(psJIP_Context);
-                if (++u32Attempts > 10)
-                {
-                    DBG_vPrintf(DBG_NODES, "Error locking node:");
-                    DBG_vPrintf_IPv6Address(DBG_NODES, psNode->sNode_Address.sin6_addr);
-                    sleep(1);
-                    u32Attempts = 0;
-                }
-                eThreadYield();
-                goto start;
-            }
-            eJIP_Unlock(psJIP_Context);
+            /* Still in the network, so the list's handle keeps it alive once ours is dropped */
+            (void)eJIP_ReleaseNode(psNode);
             return psNode;
         }
-        psNode = psNode->psNext;
+        
+        /* Node was removed while we waited for it. Look again in case the address has been re-added. */
+        DBG_vPrintf(DBG_NODES, "Node %p removed while waiting for lock\n", psNode);
+        eJIP_UnlockNode(psNode);
+        (void)eJIP_ReleaseNode(psNode);
     }
     
-    eJIP_Unlock(psJIP_Context);
-
     return NULL;
 }
 
@@ -537,6 +847,7 @@ tsMib *psJIP_NodeAddMib(tsNode *psNode, uint32_t u32MibId, uint8_t u8Index, cons
     NewMib->psOwnerNode = psNode;
     
     psNode->u32NumMibs++;
+    vJIP_NodeDropSchema(psNode);
     
     DBG_vPrintf(DBG_MIBS, "New Mib allocated at %p, name at %p\n", NewMib, NewMib->pcName);
 
@@ -648,6 +959,7 @@ tsVar *psJIP_MibAddVar(tsMib *psMib, uint8_t u8Index, const char *pcName, teJIP_
     NewVar->eEnable = E_JIP_VAR_ENABLED; /* All vars enabled by default */
 
     psMib->u32NumVars++;
+    vJIP_NodeDropSchema(psMib->psOwnerNode);
     
     DBG_vPrintf(DBG_VARS, "New Var allocated at %p, name at %p\n", NewVar, NewVar->pcName);
 
@@ -682,6 +994,65 @@ tsVar *psJIP_MibAddVar(tsMib *psMib, uint8_t u8Index, const char *pcName, teJIP_
 }
 
 
+tsVarExt *psJIP_VarExt(tsVar *psVar)
+{
+    if (!psVar->psExt)
+    {
+        psVar->psExt = malloc(sizeof(tsVarExt));
+        if (!psVar->psExt)
+        {
+            DBG_vPrintf(DBG_VARS, "Error allocating space for Var extension\n");
+            return NULL;
+        }
+        memset(psVar->psExt, 0, sizeof(tsVarExt));
+    }
+    return psVar->psExt;
+}
+
+
+void vJIP_VarDropEncoded(tsVar *psVar)
+{
+    if (psVar->psExt && psVar->psExt->pu8Encoded)
+    {
+        free(psVar->psExt->pu8Encoded);
+        psVar->psExt->pu8Encoded    = NULL;
+        psVar->psExt->pvEncodedData = NULL;
+        psVar->psExt->u32EncodedSize = 0;
+    }
+}
+
+
+void vJIP_NodeDropSchema(tsNode *psNode)
+{
+    tsNode_Private *psNode_Private;
+    
+    if (psNode && psNode->pvPriv)
+    {
+        psNode_Private = (tsNode_Private *)psNode->pvPriv;
+        if (psNode_Private->psSchema)
+        {
+            vJIPserver_ReleaseSchema(psNode->psOwnerNetwork->psOwnerContext, psNode_Private->psSchema);
+            psNode_Private->psSchema = NULL;
+        }
+    }
+}
+
+
+teJIP_Status eJIP_SetVarCallbacks(tsVar *psVar, tprCbVarGet prCbVarGet, tprCbVarSet prCbVarSet)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%s)\n", __FUNCTION__, psVar->pcName);
+    
+    if (!psJIP_VarExt(psVar))
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    psVar->psExt->prCbVarGet = prCbVarGet;
+    psVar->psExt->prCbVarSet = prCbVarSet;
+    return E_JIP_OK;
+}
+
+
 tsVar *psJIP_LookupVar(tsMib *psMib, tsVar *psStartVar, const char *pcName)
 {
     tsVar *psVar;
@@ -724,7 +724,7 @@ processNode(xmlTextReaderPtr reader) {
                     psNode->u32DeviceId    = u32DeviceId;
                     psNode->u32NumMibs     = 0;
                     
-                    eLockCreate(&psNode->sLock);
+                    /* This node is only used to fill the device cache, so it is never locked */
                 }
             }
             else if (strcmp(NodeName, "Mib") == 0)
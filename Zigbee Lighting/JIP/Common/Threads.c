@@ -86,13 +86,15 @@ teThreadStatus eThreadStart(tprThreadFunction prThreadFunction, tsThread *psThre
 {
     tsThreadPrivate *psThreadPrivate;
     
-    psThreadInfo->eState = E_THREAD_STOPPED;
+    /* Running before the thread starts, so that it does not see a stale state and exit straight away */
+    psThreadInfo->eState = E_THREAD_RUNNING;
     
     DBG_vPrintf(DBG_THREADS, "Start Thread %p to run function %p\n", psThreadInfo, prThreadFunction);
     
     psThreadPrivate = malloc(sizeof(tsThreadPrivate));
     if (!psThreadPrivate)
     {
+        psThreadInfo->eState = E_THREAD_STOPPED;
         return E_THREAD_ERROR_NO_MEM;
     }
     
@@ -131,6 +133,7 @@ teThreadStatus eThreadStart(tprThreadFunction prThreadFunction, tsThread *psThre
         prThreadFunction, psThreadInfo))
     {
         perror("Could not start thread");
+        psThreadInfo->eState = E_THREAD_STOPPED;
         return E_THREAD_ERROR_FAILED;
     }
 
@@ -154,6 +157,7 @@ teThreadStatus eThreadStart(tprThreadFunction prThreadFunction, tsThread *psThre
     if (!psThreadPrivate->thread_handle)
     {
         perror("Could not start thread");
+        psThreadInfo->eState = E_THREAD_STOPPED;
         return E_THREAD_ERROR_FAILED;
     }
 #endif /* WIN32 */
@@ -284,15 +288,73 @@ teLockStatus eLockCreate(tsLock *psLock)
 }
 
 
+/** Number of mutexes shared between all locks created by eLockCreateStriped */
+#define LOCK_STRIPES 256
+
+static tsLockPrivate asLockStripes[LOCK_STRIPES];
+
+#ifndef WIN32
+static pthread_once_t sLockStripesOnce = PTHREAD_ONCE_INIT;
+
+static void vLockStripesInit(void)
+{
+    pthread_mutexattr_t     attr;
+    int i;
+    
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    
+    for (i = 0; i < LOCK_STRIPES; i++)
+    {
+        pthread_mutex_init(&asLockStripes[i].mutex, &attr);
+    }
+    DBG_vPrintf(DBG_LOCKS, "Lock stripes initialised\n");
+}
+#endif /* WIN32 */
+
+
+static inline int iLockIsStriped(tsLockPrivate *psLockPrivate)
+{
+    return (psLockPrivate >= &asLockStripes[0]) && (psLockPrivate < &asLockStripes[LOCK_STRIPES]);
+}
+
+
+teLockStatus eLockCreateStriped(tsLock *psLock, const void *pvKey)
+{
+    uintptr_t uKey = (uintptr_t)pvKey;
+    
+#ifndef WIN32
+    pthread_once(&sLockStripesOnce, vLockStripesInit);
+#else
+    
+#endif /* WIN32 */
+
+    /* Low bits of a heap pointer carry no information, so mix in higher ones */
+    uKey = (uKey >> 4) ^ (uKey >> 12) ^ (uKey >> 20);
+    psLock->pvPriv = &asLockStripes[uKey % LOCK_STRIPES];
+    
+    DBG_vPrintf(DBG_LOCKS, "Lock Create Striped: %p (stripe %d)\n", psLock, (int)(uKey % LOCK_STRIPES));
+    return E_LOCK_OK;
+}
+
+
 teLockStatus eLockDestroy(tsLock *psLock)
 {
     tsLockPrivate *psLockPrivate = (tsLockPrivate *)psLock->pvPriv;
+    
+    if (!psLockPrivate || iLockIsStriped(psLockPrivate))
+    {
+        /* Never created, or shared with other locks */
+        psLock->pvPriv = NULL;
+        return E_LOCK_OK;
+    }
 #ifndef WIN32
     pthread_mutex_destroy(&psLockPrivate->mutex);
 #else
     
 #endif
     free(psLockPrivate);
+    psLock->pvPriv = NULL;
     DBG_vPrintf(DBG_LOCKS, "Lock Destroy: %p\n", psLock);
     return E_LOCK_OK;
 }
@@ -594,3 +656,16 @@ uint32_t u32AtomicAdd(volatile uint32_t *pu32Value, uint32_t u32Operand)
 #endif
 }
 
+
+uint32_t u32TimeMillis(void)
+{
+#ifndef WIN32
+    struct timespec sNow;
+    
+    clock_gettime(CLOCK_MONOTONIC, &sNow);
+    return (uint32_t)((uint64_t)sNow.tv_sec * 1000 + sNow.tv_nsec / 1000000);
+#else
+    return GetTickCount();
+#endif /* WIN32 */
+}
+
@@ -78,7 +78,10 @@ typedef struct
 
 typedef void *(*tprThreadFunction)(void *psThreadInfoVoid);
 
-/** Function to start a thread */
+/** Function to start a thread.
+ *  The thread's eState is E_THREAD_RUNNING from before the thread function is entered until the thread
+ *  is stopped, or E_THREAD_STOPPED if it could not be started.
+ */
 teThreadStatus eThreadStart(tprThreadFunction prThreadFunction, tsThread *psThreadInfo, teThreadDetachState eDetachState);
 
 
@@ -109,6 +112,19 @@ typedef enum
 
 teLockStatus eLockCreate(tsLock *psLock);
 
+/** Create a lock that shares one of a fixed table of mutexes, rather than allocating its own.
+ *  The mutex is selected by hashing pvKey, so locks with different keys may share a mutex.
+ *  This costs no memory per lock, but a thread may have to wait for a lock that is not actually 
+ *  held if it shares a mutex with one that is. Locks are recursive, as with \ref eLockCreate.
+ *  \param  psLock  Pointer to lock structure
+ *  \param  pvKey   Key used to select the shared mutex, usually the address of the protected structure
+ *  \return E_LOCK_OK if created ok
+ */
+teLockStatus eLockCreateStriped(tsLock *psLock, const void *pvKey);
+
+/** Destroy a lock created by \ref eLockCreate or \ref eLockCreateStriped.
+ *  It is safe to destroy a lock that was never created, provided the structure was zeroed.
+ */
 teLockStatus eLockDestroy(tsLock *psLock);
 
 /** Lock the data structure associated with this lock
@@ -177,6 +193,13 @@ uint32_t u32AtomicAdd(volatile uint32_t *pu32Value, uint32_t u32Operand);
 #define u32AtomicGet(pu32Value) u32AtomicAdd(pu32Value, 0)
 
 
+/** Read a monotonic millisecond clock. The value wraps roughly every 49 days,
+ *  so only differences between two readings are meaningful.
+ *  \return Current time in milliseconds
+ */
+uint32_t u32TimeMillis(void);
+
+
 
 #endif /* __THREADS_H__ */
 
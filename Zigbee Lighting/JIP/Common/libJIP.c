@@ -72,6 +72,7 @@ const char *JIP_Version = LIBJIP_VERSION_MAJOR "." LIBJIP_VERSION_MINOR " (r" LI
 teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_ContextType)
 {
     tsJIP_Private *psJIP_Private;
+    int i;
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
     psJIP_Private = malloc(sizeof(tsJIP_Private));
@@ -88,6 +89,11 @@ teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_Cont
     eLockCreate(&psJIP_Private->sLock);
     eJIPLockLock(&psJIP_Private->sLock);
     
+    for (i = 0; i < JIP_ADDRESS_INDEX_LOCKS; i++)
+    {
+        eLockCreate(&psJIP_Private->asAddressIndexLocks[i]);
+    }
+    
     if (Network_Init(&psJIP_Private->sNetworkContext, psJIP_Context) != E_NETWORK_OK)
     {
         free(psJIP_Private);
@@ -117,6 +123,15 @@ teJIP_Status eJIP_Init(tsJIP_Context *psJIP_Context, teJIP_ContextType eJIP_Cont
     
     /* Set up the multicast attempts to the default */
     psJIP_Context->iMulticastSendCount = 2;
+    psJIP_Context->iMulticastSendIntervalMs = 200;
+    
+    /* Each node has its own lock by default */
+    psJIP_Context->eNodeLockType = E_JIP_NODE_LOCK_MUTEX;
+    
+    /* Servers handle requests on the thread that receives them */
+    psJIP_Context->iServerThreads = 1;
+    psJIP_Context->iServerMaxPending = 64;
+    psJIP_Context->iServerMaxDeferred = 1024;
     
     eJIPLockUnlock(&psJIP_Private->sLock);
     
@@ -128,12 +143,17 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
 {
     PRIVATE_CONTEXT(psJIP_Context);
     teJIP_Status eStatus = E_JIP_OK;
+    int i;
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
     /* Stop the network monitor if it is running */
     eJIPService_MonitorNetworkStop(psJIP_Context);
     
+    /* Stop the coalesced set sender and multicast retransmissions if they are running */
+    eJIP_SetCoalescerStop(psJIP_Context);
+    eJIP_MulticastStop(psJIP_Context);
+    
     eJIP_Lock(psJIP_Context);
     
     /* Remove all traps on variables first */
@@ -151,10 +171,10 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
                 while(psVar)
                 {
                     /* Run length of Vars, removing traps if necessary */
-                    if (psVar->prCbVarTrap)
+                    if (psVar->psExt && psVar->psExt->prCbVarTrap)
                     {
                         DBG_vPrintf(DBG_JIP, "Removing trap on variable at %p (%s)\n", psVar, psVar->pcName ? psVar->pcName: "?");
-                        eJIP_UntrapVar(psJIP_Context, psVar, psVar->u8TrapHandle);
+                        eJIP_UntrapVar(psJIP_Context, psVar, psVar->psExt->u8TrapHandle);
                     }
                     psVar = psVar->psNext;
                 }
@@ -168,6 +188,9 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
     /* We should now be done with the network connection, so we can now tear it down and stop receiving any trap notifications */
     Network_Destroy(&psJIP_Private->sNetworkContext);
     
+    /* Server requests still waiting on callbacks can no longer be answered */
+    vJIPserver_DropPending(psJIP_Context, NULL, NULL);
+    
     /* Now destroy all context data */
     eJIP_Lock(psJIP_Context); // There should be no other threads at this point.
     while (psJIP_Context->sNetwork.psNodes)
@@ -181,15 +204,21 @@ teJIP_Status eJIP_Destroy(tsJIP_Context *psJIP_Context)
         }
         else
         {
-            if (eJIP_NetFreeNode(psJIP_Context, psNode) != E_JIP_OK)
+            eJIP_UnlockNode(psNode);
+            if (eJIP_ReleaseNode(psNode) != E_JIP_OK)
             {
                 DBG_vPrintf(DBG_JIP, "Error Free'ing node\n");
             }
         }
     }
     
+    vJIPserver_FreeSchemas(psJIP_Context);
     Cache_Destroy(&psJIP_Private->sCache);
     
+    for (i = 0; i < JIP_ADDRESS_INDEX_LOCKS; i++)
+    {
+        eLockDestroy(&psJIP_Private->asAddressIndexLocks[i]);
+    }
     eLockDestroy(&psJIP_Private->sLock);
     
     free(psJIP_Private);
@@ -407,10 +436,71 @@ teJIP_Status eJIP_SetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvDat
 }
 
 
+teJIP_Status eJIP_SetVars(tsJIP_Context *psJIP_Context, tsSetVarEntry *psEntries, uint32_t u32NumEntries)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);  
+    
+    if (psJIP_Private->eJIP_ContextType == E_JIP_CONTEXT_SERVER)
+    {
+        teJIP_Status eStatus = E_JIP_OK;
+        uint32_t i;
+        
+        for (i = 0; i < u32NumEntries; i++)
+        {
+            psEntries[i].eStatus = eJIP_SetVar(psJIP_Context, psEntries[i].psVar, psEntries[i].pvData, psEntries[i].u32Size);
+            if (eStatus == E_JIP_OK)
+            {
+                eStatus = psEntries[i].eStatus;
+            }
+        }
+        return eStatus;
+    }
+    
+    return eJIP_MulticastSetVars(psJIP_Context, psEntries, u32NumEntries, NULL, 1);
+}
+
+
+uint32_t u32JIP_VarDataSize(teJIP_VarType eVarType, const uint8_t *pu8Data)
+{
+    switch (eVarType)
+    {
+        case(E_JIP_VAR_TYPE_INT8):
+        case(E_JIP_VAR_TYPE_UINT8):
+            return sizeof(uint8_t);
+        
+        case(E_JIP_VAR_TYPE_INT16):
+        case(E_JIP_VAR_TYPE_UINT16):
+            return sizeof(uint16_t);
+        
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+            return sizeof(uint32_t);
+
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+            return sizeof(uint64_t);
+        
+        case (E_JIP_VAR_TYPE_STR):
+        case (E_JIP_VAR_TYPE_BLOB):
+            /* Length byte followed by the data. Without the packet, assume the worst case */
+            return sizeof(uint8_t) + (pu8Data ? pu8Data[0] : UINT8_MAX);
+            
+        default:
+            return 0;
+    }
+}
+
+
 teJIP_Status eJIP_SetVarValue(tsVar *psVar, void *pvData, uint32_t u32Size)
 {
     void *pvNewData;
     
+    /* realloc may keep the same pointer, so the old encoding can't be told apart from the new data */
+    vJIP_VarDropEncoded(psVar);
+    
     pvNewData = realloc(psVar->pvData, u32Size);
     if (!pvNewData && u32Size > 0) 
     {
@@ -226,6 +226,7 @@ typedef enum _eJIP_Status
     E_JIP_ERROR_WOULD_BLOCK         = 0x13,     /**< The operation would block the current thread */
     E_JIP_ERROR_NO_MEM              = 0x14,     /**< Memory allocation failed */
     E_JIP_ERROR_WRONG_CONTEXT       = 0x15,     /**< A function was called that is inappropriate for the context type */
+    E_JIP_PENDING                   = 0x16,     /**< A server callback will finish the request later, with \ref eJIPserver_CompleteVar */
 } PACK teJIP_Status;
 
 
@@ -285,6 +286,20 @@ typedef enum
 } teJIP_NetworkChangeEvent;
 
 
+/** Enumerated type of node lock implementations
+ *  \ingroup Locks
+ */
+typedef enum
+{
+    E_JIP_NODE_LOCK_MUTEX,                      /**< Each node allocates its own mutex */
+    E_JIP_NODE_LOCK_STRIPED,                    /**< Nodes share a fixed table of mutexes selected by hashing the node.
+                                                 * No memory is allocated per node, at the cost of occasional contention 
+                                                 * between unrelated nodes. A thread holding one node lock should not 
+                                                 * wait for another node lock in this mode.
+                                                 */
+} teJIP_NodeLockType;
+
+
 /** Typedef a JIP address to be a IPv6 structure */
 typedef struct sockaddr_in6 tsJIPAddress;
 
@@ -329,17 +344,21 @@ struct _tsJIP_Context;
 
 
 /** Server callback function for when a variable is being read by a client.
+ *  A callback that cannot get the value straight away may return E_JIP_PENDING, and call 
+ *  \ref eJIPserver_CompleteVar once it has it, so that other nodes are not held up meanwhile.
  *  \param psVar        Pointer to the variable being read
- *  \return E_JIP_OK if request was successful
+ *  \return E_JIP_OK if request was successful, E_JIP_PENDING if it will be completed later
  */
 typedef teJIP_Status (*tprCbVarGet)(struct _tsVar *psVar);
 
 /** Server callback function for when a variable is being set by a client.
+ *  As for \ref tprCbVarGet, the callback may return E_JIP_PENDING and call \ref eJIPserver_CompleteVar
+ *  once the update has been made.
  *  \param psVar        Pointer to the variable being updated
  *  \param psMulticastAddress    If this was a multicast set request, this contains a 
  *                      pointer to IPv6 address that was the destination of the request.
  *                      Otherwise, this is NULL.
- *  \return E_JIP_OK if update was successful
+ *  \return E_JIP_OK if update was successful, E_JIP_PENDING if it will be completed later
  */
 typedef teJIP_Status (*tprCbVarSet)(struct _tsVar *psVar, tsJIPAddress *psMulticastAddress);
 
@@ -379,20 +398,92 @@ typedef void (*tprCbVarTrap)(struct _tsVar *psVar);
 typedef void (*tprCbNetworkChange)(teJIP_NetworkChangeEvent eEvent, struct _tsNode *psNode);
 
 
+/** Function prototype for visiting nodes in the network.
+ *  \ingroup Convenience
+ *  The application provides a function with this prototype to \ref eJIP_ForEachNode.
+ *  It is called once for each matching node, with the JIP context locked with \ref eJIP_Lock.
+ *  \param psNode           The Node being visited
+ *  \param pvUser           User data pointer passed to \ref eJIP_ForEachNode
+ *  \return E_JIP_OK to continue visiting nodes. Any other status stops the iteration and is
+ *          returned from \ref eJIP_ForEachNode.
+ */
+typedef teJIP_Status (*tprCbNodeVisit)(struct _tsNode *psNode, void *pvUser);
+
+
+/** Function prototype for multicast completion.
+ *  \ingroup ManipulatingVariables
+ *  Set in the prCbMulticastComplete member of \ref tsJIP_Context. It is called once the last copy of a
+ *  multicast request has been sent, from the libJIP retransmission thread with no locks held. If only
+ *  one copy is sent, it is called before the multicast function returns instead.
+ *  \param psAddress        Multicast address the request was sent to
+ *  \param eStatus          E_JIP_OK if every copy was sent
+ */
+typedef void (*tprCbMulticastComplete)(tsJIPAddress *psAddress, teJIP_Status eStatus);
+
+
+/** Optional extension of a \ref tsVar holding its callbacks and trap state.
+ *  It is only allocated once a callback is registered with \ref eJIP_SetVarCallbacks, or a trap with 
+ *  \ref eJIP_TrapVar, so that the many variables which use neither do not pay for it. A server also
+ *  allocates it for CONST string and blob variables that are read, to keep their encoded data.
+ */
+typedef struct
+{
+    tprCbVarGet             prCbVarGet;         /**< Function to be called upon a get. The function should set the pvData
+                                                 * pointer in the \ref tsVar stucture with the latest data. This data will
+                                                 * be returned to the client.
+                                                 * The callback may be left as NULL if the application will supply data in the
+                                                 * pvData pointer. If both are NULL, the variable will be set to DISABLED.
+                                                 */
+    tprCbVarSet             prCbVarSet;         /**< Function to be called upon a set. The data from the client has been set
+                                                 * in pvData in the \ref tsVar structure.
+                                                 * The callback may be left as NULL if the application does not wish to be 
+                                                 * notified of sets on the variable.
+                                                 */
+    
+    uint8_t                 u8TrapHandle;       /**< A handle value associated with traps from this variable */
+    tprCbVarTrap            prCbVarTrap;        /**< Registered Trap callback function. 
+                                                 * Traps are registered using \ref eJIP_TrapVar
+                                                 */
+    
+    uint32_t                u32LastUpdated;     /**< Time the data was last received from the node, in milliseconds
+                                                 * from a monotonic clock. 0 if it has not been received since the
+                                                 * extension was allocated. Used by \ref eJIP_GetVarCached.
+                                                 */
+    
+    uint16_t                u16SetSequence;     /**< Sequence number of the last unacknowledged set sent by a client with
+                                                 * \ref eJIP_SetVarUnacked, or applied by a server.
+                                                 */
+    uint32_t                u32SetSequenceTime; /**< SERVER mode: time u16SetSequence was applied, from the same clock as
+                                                 * u32LastUpdated. 0 once an acknowledged set has been applied.
+                                                 */
+    
+    uint8_t*                pu8Encoded;         /**< SERVER mode: GET response entry last encoded for a CONST string
+                                                 * or blob variable without a get callback. It is reused while pvData
+                                                 * and the blob size are unchanged, and dropped by \ref eJIP_SetVar.
+                                                 * NULL if there is none.
+                                                 */
+    const void*             pvEncodedData;      /**< SERVER mode: pvData that pu8Encoded was encoded from */
+    uint32_t                u32EncodedSize;     /**< SERVER mode: Number of bytes at pu8Encoded */
+    
+    bool_t                  bInCallback;        /**< SERVER mode: True while the server is calling prCbVarGet or
+                                                 * prCbVarSet for a request that may wait for it
+                                                 */
+    teJIP_Status            eCompletedStatus;   /**< SERVER mode: status \ref eJIPserver_CompleteVar was called with
+                                                 * by that callback, or E_JIP_PENDING if it was not
+                                                 */
+} tsVarExt;
+
+
 /** Structure representing a JIP variable 
  *  The variables are held as a linked list from a \ref tsMib structure.
+ *  Members are ordered largest first so that no padding is needed between them. Not counting the name and data,
+ *  each variable costs five pointers and six bytes, rounded up to pointer alignment: 48 bytes on a 64 bit platform,
+ *  28 bytes on a 32 bit one. Variables with callbacks or traps registered cost an additional \ref tsVarExt,
+ *  as do CONST string and blob variables read from a server.
  */
 typedef struct _tsVar
 {
     char*                   pcName;             /**< Name of the variable */
-    uint8_t                 u8Index;            /**< Index of the variable within it's MiB */
-    uint8_t                 u8Size;             /**< Used for Blobs - Number of bytes of data */
-    
-    teJIP_VarEnable         eEnable;            /**< Determines if the variable is disabled */
-    
-    teJIP_VarType           eVarType;           /**< Type of variable */
-    teJIP_AccessType        eAccessType;        /**< Access type of the variable (const/read/write/etc) */
-    teJIP_Security          eSecurity;          /**< Security type of the variable (none/etc) */
     
     union
     {
@@ -420,30 +511,92 @@ typedef struct _tsVar
                                                  * this may be set to point at the contents of the variable. 
                                                  * Optionally, the \ref prCbVarGet and \ref prCbVarSet callbacks 
                                                  * may be used to populate the variable with data on request.
+                                                 * The data of a CONST string or blob is encoded once for reads, so
+                                                 * it must only be changed with \ref eJIP_SetVar or
+                                                 * \ref eJIP_SetVarValue. Other variables may be written in place.
                                                  */
     
-    tprCbVarGet             prCbVarGet;         /**< Function to be called upon a get. The function should set the pvData
-                                                 * pointer in the \ref tsVar stucture with the latest data. This data will
-                                                 * be returned to the client.
-                                                 * The callback may be left as NULL if the application will supply data in the
-                                                 * pvData pointer. If both are NULL, the variable will be set to DISABLED.
-                                                 */
-    tprCbVarSet             prCbVarSet;         /**< Function to be called upon a set. The data from the client has been set
-                                                 * in pvData in the \ref tsVar structure.
-                                                 * The callback may be left as NULL if the application does not wish to be 
-                                                 * notified of sets on the variable.
-                                                 */
-    
-    uint8_t                 u8TrapHandle;       /**< A handle value associated with traps from this variable */
-    tprCbVarTrap            prCbVarTrap;        /**< Registered Trap callback function. 
-                                                 * Traps are registered using \ref eJIP_TrapVar
-                                                 */
+    tsVarExt*               psExt;              /**< Callbacks and trap state. NULL until one is registered */
     
     struct _tsMib*          psOwnerMib;         /**< Pointer to the owner MiB of this variable */
     struct _tsVar*          psNext;             /**< Pointer to the next variable in the linked list */
+    
+    uint8_t                 u8Index;            /**< Index of the variable within it's MiB */
+    uint8_t                 u8Size;             /**< Used for Blobs - Number of bytes of data */
+    
+    teJIP_VarEnable         eEnable;            /**< Determines if the variable is disabled */
+    
+    teJIP_VarType           eVarType;           /**< Type of variable */
+    teJIP_AccessType        eAccessType;        /**< Access type of the variable (const/read/write/etc) */
+    teJIP_Security          eSecurity;          /**< Security type of the variable (none/etc) */
 } tsVar;
 
 
+/** One variable to update with \ref eJIP_SetVars or \ref eJIP_MulticastSetVars */
+typedef struct
+{
+    tsVar*                  psVar;              /**< Variable to set. All entries of one call must belong to the same \ref tsMib */
+    void*                   pvData;             /**< Pointer to the data to set the variable with */
+    uint32_t                u32Size;            /**< Size of the data, as for \ref eJIP_SetVar */
+    teJIP_Status            eStatus;            /**< Filled in with the result of setting this variable */
+} tsSetVarEntry;
+
+
+/** One setting of a scene, passed to \ref eJIP_SceneCreate */
+typedef struct
+{
+    tsVar*                  psVar;              /**< Variable to set. Unless psGroupAddress is given, it is set on the node that owns it */
+    tsJIPAddress*           psGroupAddress;     /**< Multicast group to set the variable on, or NULL to set it on psVar's node */
+    void*                   pvData;             /**< Pointer to the data to set the variable with */
+    uint32_t                u32Size;            /**< Size of the data, as for \ref eJIP_SetVar */
+} tsSceneEntry;
+
+
+/** A scene compiled by \ref eJIP_SceneCreate. Its contents are internal to libJIP */
+typedef struct _tsScene tsScene;
+
+
+/** How \ref eJIP_SetVarFanout chose to reach its target nodes.
+ *  Costs are estimates of the number of packet transmissions, counting one for each hop a packet crosses.
+ */
+typedef struct
+{
+    uint32_t                u32Unicasts;        /**< Number of nodes set by unicast */
+    uint32_t                u32Multicasts;      /**< Number of multicasts sent */
+    uint32_t                u32MulticastNodes;  /**< Number of nodes reached by the multicasts */
+    uint32_t                u32Cost;            /**< Estimated cost of what was chosen */
+    uint32_t                u32UnicastCost;     /**< Estimated cost of setting every node by unicast */
+} tsFanoutReport;
+
+
+/** Response of one member of a group read by \ref eJIP_MulticastGetVar */
+typedef struct
+{
+    tsJIPAddress            sAddress;           /**< Address of the member that responded */
+    teJIP_Status            eStatus;            /**< Status of the read on that member */
+    bool_t                  bUpdated;           /**< True if the member is a node in the local network and its copy of the variable was updated */
+} tsGroupGetResult;
+
+
+/** Outcome for one member of a group set by \ref eJIP_MulticastSetVarVerified */
+typedef struct
+{
+    tsJIPAddress            sAddress;           /**< Address of the member */
+    teJIP_Status            eStatus;            /**< E_JIP_OK if the member has the new value */
+    bool_t                  bRepaired;          /**< True if the member missed the multicast and was set by unicast */
+} tsGroupSetResult;
+
+
+/** Totals of a group set by \ref eJIP_MulticastSetVarVerified */
+typedef struct
+{
+    uint32_t                u32Members;         /**< Members of the group that have the variable */
+    uint32_t                u32Converged;       /**< Members read back with the new value after the multicast */
+    uint32_t                u32Repaired;        /**< Members set by unicast after missing the multicast */
+    uint32_t                u32Failed;          /**< Members that could not be set */
+} tsGroupSetReport;
+
+
 /** Structure representing a JIP MiB 
  *  The MiBs are held as a linked list from a \ref tsNode structure.
  */
@@ -477,10 +630,19 @@ typedef struct _tsNode
     
     tsLock                  sLock;              /**< Mutex to protect this node */
     
+    volatile uint32_t       u32RefCount;        /**< Number of handles held on this node, including one for the 
+                                                 * network's node list. Managed by \ref psJIP_AcquireNode and \ref eJIP_ReleaseNode.
+                                                 */
+    bool_t                  bRemoved;           /**< Set once the node has been removed from the network. A node held by a handle
+                                                 * remains allocated after removal until the last handle is released.
+                                                 */
+    
     void*                   pvPriv;             /**< Pointer to private data */
     
     struct _tsNetwork*      psOwnerNetwork;     /**< Pointer to the owner network of this node */
     struct _tsNode*         psNext;             /**< Pointer to the next node in the linked list */
+    struct _tsNode*         psNextDeviceId;     /**< Pointer to the next node in the same device ID index bucket. Internal use only */
+    struct _tsNode*         psNextAddress;      /**< Pointer to the next node in the same address index bucket. Internal use only */
 } tsNode;
 
 
@@ -509,7 +671,26 @@ typedef struct _tsJIP_Context
                                                      The default value is the index of the "tun0" interface, or 0 for the 
                                                      default interface. */
     int                     iMulticastSendCount;/**< The number of times to send each multicast set request.
-                                                     The default is 2 to send each request twice. */
+                                                     The default is 2 to send each request twice. The first copy is
+                                                     sent before the call returns, and the rest in the background. */
+    int                     iMulticastSendIntervalMs;/**< Time in milliseconds between copies of a multicast request.
+                                                     The default is 200. */
+    tprCbMulticastComplete  prCbMulticastComplete;/**< Called when the last copy of a multicast request has been sent.
+                                                     The default is NULL for no callback. */
+    teJIP_NodeLockType      eNodeLockType;      /**< How node locks are implemented. This must be set before any nodes are
+                                                     added to the network. The default is \ref E_JIP_NODE_LOCK_MUTEX.
+                                                     \ref E_JIP_NODE_LOCK_STRIPED saves memory in very large networks. */
+    int                     iServerThreads;     /**< The number of threads a server handles requests with. Nodes are shared out
+                                                     between them by address, so requests to one node are still handled in
+                                                     order. With 1 the thread receiving requests handles them too. This must
+                                                     be set before \ref eJIPserver_Listen. The default is 1, and the most is 32. */
+    int                     iServerMaxPending;  /**< The most requests a server holds for callbacks that returned E_JIP_PENDING.
+                                                     Further requests that would wait are not answered, so that clients retry
+                                                     them later. The default is 64. */
+    int                     iServerMaxDeferred; /**< The most responses a server holds to send later: answers to group reads
+                                                     waiting for their random delay, and answers to requests completed with
+                                                     \ref eJIPserver_CompleteVar. Further responses are not sent, so that
+                                                     clients retry them later. The default is 1024. */
     
     
 } tsJIP_Context;
@@ -674,6 +855,57 @@ teJIP_Status eJIPService_MonitorNetworkStop(tsJIP_Context *psJIP_Context);
 teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar);
 
 
+/** Read a variable, answering from memory if the value already held is recent enough.
+ *  The value is fresh if it was received from the node, by a read or a trap, no more than
+ *  u32MaxAgeMs milliseconds ago. Otherwise it is read as \ref eJIP_GetVar would.
+ *  Receive times are only recorded for variables with a \ref tsVarExt, so the first cached
+ *  read of a variable that is not trapped always goes to the node.
+ *  Table variables are always read from the node.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psVar                Pointer to the variable to read
+ *  \param u32MaxAgeMs          Maximum age of a held value, in milliseconds
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_GetVarCached(tsJIP_Context *psJIP_Context, tsVar *psVar, uint32_t u32MaxAgeMs);
+
+
+/** Get the counts of \ref eJIP_GetVarCached calls answered from memory and from the node.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param pu32Hits             [out] Number of reads answered from memory. May be NULL.
+ *  \param pu32Misses           [out] Number of reads that went to the node. May be NULL.
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_GetVarCacheStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Hits, uint32_t *pu32Misses);
+
+
+/** Read several variables of one MIB. Runs of consecutive variables are fetched with a single
+ *  request each, so the full state of a MIB normally takes one round trip. Table variables are
+ *  read row by row as \ref eJIP_GetVar would.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psMib                Pointer to the MIB containing the variables
+ *  \param pu8VarIndices        Array of variable indices to read, or NULL to read every variable in the MIB
+ *  \param u32NumVars           Number of entries in pu8VarIndices
+ *  \return E_JIP_OK if every variable was read. Otherwise the status of the first variable that
+ *          could not be read. The other variables are still updated.
+ */
+teJIP_Status eJIP_GetVars(tsJIP_Context *psJIP_Context, tsMib *psMib, const uint8_t *pu8VarIndices, uint32_t u32NumVars);
+
+
+/** Read every variable of every MIB on a node. Runs of variables from all MIBs are packed into
+ *  multi get requests, so a node's full state normally takes a single round trip. If a response
+ *  fills up, the remaining ranges are requested again. Table variables are read row by row as
+ *  \ref eJIP_GetVar would.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psNode               Pointer to the node to read
+ *  \return E_JIP_OK if every variable was read. Otherwise the status of the first failure.
+ *          Variables that were read successfully are still updated.
+ */
+teJIP_Status eJIP_GetNodeSnapshot(tsJIP_Context *psJIP_Context, tsNode *psNode);
+
+
 /** Sets a variable. In CLIENT mode, a request is made to the node to update the data content of this variable.
  *  If the request succeeds, the pvData member of psVar is allocated and filled with the request data. This
  *  means that the local data is kept in sync with the remote node data.
@@ -690,6 +922,60 @@ teJIP_Status eJIP_GetVar(tsJIP_Context *psJIP_Context, tsVar *psVar);
 teJIP_Status eJIP_SetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvNewData, uint32_t u32Size);
 
 
+/** Set a variable without waiting for the node. This is intended for controls such as sliders
+ *  that produce values faster than they can be sent.
+ *  The value is copied and handed to a sender thread, which is started on first use. Each variable
+ *  has at most one value waiting: a newer value replaces one that has not been sent yet, so only
+ *  the latest value is sent once the previous set has completed. Variables with values waiting take
+ *  turns, one set at a time. Sets of one variable are also spaced by at least the interval given to 
+ *  \ref eJIP_SetCoalescerInterval.
+ *  The result of each set is not reported.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psVar                Pointer to the variable to set
+ *  \param pvNewData            Pointer to the data to set the variable with
+ *  \param u32Size              Size of the data, as for \ref eJIP_SetVar
+ *  \return E_JIP_OK if the value was queued.
+ */
+teJIP_Status eJIP_SetVarCoalesced(tsJIP_Context *psJIP_Context, tsVar *psVar, const void *pvNewData, uint32_t u32Size);
+
+
+/** Set a variable without waiting for, or asking for, a response. This is intended for streams of
+ *  updates such as fades, where waiting for each response would limit the rate to one per round trip.
+ *  Each request carries a sequence number for the variable, and the node ignores requests older
+ *  than one it has already applied. Requests may still be lost, so finish a stream with
+ *  \ref eJIP_SetVar to make sure the node has the final value.
+ *  The local copy of the variable is updated once the request has been sent, although the node may not
+ *  receive it.
+ *  This is only supported in CLIENT mode.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psVar                Pointer to the variable to set
+ *  \param pvNewData            Pointer to the data to set the variable with
+ *  \param u32Size              Size of the data, as for \ref eJIP_SetVar
+ *  \return E_JIP_OK if the request was sent.
+ */
+teJIP_Status eJIP_SetVarUnacked(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvNewData, uint32_t u32Size);
+
+
+/** Set the minimum time between two sets of the same variable made by \ref eJIP_SetVarCoalesced.
+ *  The default is 0, which sends each value as soon as the previous set has completed.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param u32MinIntervalMs     Minimum interval in milliseconds
+ *  \return E_JIP_OK on success
+ */
+teJIP_Status eJIP_SetCoalescerInterval(tsJIP_Context *psJIP_Context, uint32_t u32MinIntervalMs);
+
+
+/** Get the counts of values sent by \ref eJIP_SetVarCoalesced and of values that were
+ *  replaced by a newer one before they could be sent. A value whose set failed is in neither count.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param pu32Sent             [out] Number of values set successfully. May be NULL.
+ *  \param pu32Superseded       [out] Number of values never sent. May be NULL.
+ *  \return E_JIP_OK on success
+ */
+teJIP_Status eJIP_SetCoalescerStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Sent, uint32_t *pu32Superseded);
+
+
 /** Sets a variable using a IPv6 multicast. A request is made to the IPv6 multicast address to update the data content of this variable.
  *  The psVar parameter can be the relevant variable on any node in, or out of, the multicast group. It is used for
  *  all information except the destination IPv6 address, which is contained in psAddress.
@@ -709,6 +995,152 @@ teJIP_Status eJIP_SetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvNew
  */
 teJIP_Status eJIP_MulticastSetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvData, uint32_t u32Size, tsJIPAddress *psAddress, int iMaxHops);
 
+
+/** Sets several variables of one MIB. In CLIENT mode, a single request carrying every new value is sent to
+ *  the node. The node checks all of the entries before applying any of them, so either every variable is set
+ *  or none are, and the set callbacks on the node run once all of the new values are in place.
+ *  The eStatus member of each entry reports the result for that variable, and the local copy of each
+ *  variable that was set is updated.
+ *  In SERVER mode, this function just updates the local data of the variables.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param psEntries            Array of variables and the data to set them with
+ *  \param u32NumEntries        Number of entries in psEntries, at most 255
+ *  \return E_JIP_OK if every variable was set.
+ */
+teJIP_Status eJIP_SetVars(tsJIP_Context *psJIP_Context, tsSetVarEntry *psEntries, uint32_t u32NumEntries);
+
+
+/** Sets several variables of one MIB on every node in a multicast group, using a single request.
+ *  As with \ref eJIP_MulticastSetVar, there is no response and the local data of the variables is not updated.
+ *  The eStatus member of each entry is set to the result of sending the request.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psEntries            Array of variables and the data to set them with
+ *  \param u32NumEntries        Number of entries in psEntries, at most 255
+ *  \param psAddress            IPv6 Multicast address to send the request to, or NULL to send to the node owning the variables.
+ *  \param iMaxHops             Sets the maximum number of hops to the network gateway on the IPv6 multicast datagram.
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_MulticastSetVars(tsJIP_Context *psJIP_Context, tsSetVarEntry *psEntries, uint32_t u32NumEntries, tsJIPAddress *psAddress, int iMaxHops);
+
+
+/** Compile a list of settings into a scene that can be applied many times with \ref eJIP_SceneApply.
+ *  Every request needed to apply the scene is encoded now, so applying it does no encoding.
+ *  Settings for the same node and MIB are carried by one request. Where several nodes are to have a
+ *  variable set to the same value, and there is a multicast group whose members are all among those
+ *  nodes, they are given one multicast to that group instead if that is expected to be cheaper, as 
+ *  described for \ref eJIP_SetVarFanout. Group membership is taken from the Groups
+ *  MIB of each node as last read with \ref eJIP_GetVar. If the membership of any node with a Groups MIB 
+ *  has not been read, no multicasts are used, as other nodes might be in the groups.
+ *  A handle is held on each node named by the scene until it is destroyed. The calling thread must be
+ *  able to access the nodes as for \ref eJIP_AcquireNodeHandle, but must not hold any node lock or the 
+ *  JIP context lock.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param pasEntries           Array of settings. It is copied, and is not needed after the call
+ *  \param u32NumEntries        Number of entries in pasEntries
+ *  \param iMaxHops             Hop limit for any multicasts, as for \ref eJIP_MulticastSetVar
+ *  \param ppsScene[out]        Location to store the new scene
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_SceneCreate(tsJIP_Context *psJIP_Context, const tsSceneEntry *pasEntries, uint32_t u32NumEntries, 
+                              int iMaxHops, tsScene **ppsScene);
+
+
+/** Apply a scene. The multicasts are sent first, then every unicast request is sent before 
+ *  waiting for the responses, which are collected as they arrive. Unanswered requests are retried.
+ *  The local copy of each variable set by unicast is updated. A scene must not be applied by two 
+ *  threads at the same time.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psScene              Scene to apply
+ *  \param paeStatus[out]       Array with an entry for each setting of the scene, filled in with its result. 
+ *                              For settings sent by multicast this is the result of sending the multicast. May be NULL.
+ *  \return E_JIP_OK if every setting succeeded, otherwise the first failure.
+ */
+teJIP_Status eJIP_SceneApply(tsJIP_Context *psJIP_Context, tsScene *psScene, teJIP_Status *paeStatus);
+
+
+/** Get the number of requests that applying a scene sends.
+ *  \param psScene              Scene created by \ref eJIP_SceneCreate
+ *  \param pu32Unicasts[out]    Number of requests sent to single nodes. May be NULL.
+ *  \param pu32Multicasts[out]  Number of multicasts. May be NULL.
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_SceneGetPacketCounts(tsScene *psScene, uint32_t *pu32Unicasts, uint32_t *pu32Multicasts);
+
+
+/** Destroy a scene, releasing the handles it holds on nodes.
+ *  \param psJIP_Context        Pointer to the JIP Context
+ *  \param psScene              Scene created by \ref eJIP_SceneCreate
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_SceneDestroy(tsJIP_Context *psJIP_Context, tsScene *psScene);
+
+
+/** Set the same variable to the same value on several nodes, choosing whether to reach each by unicast
+ *  or through a multicast group. 
+ *  A group is only used if every member of it is a target, as read from the nodes' Groups MIBs (see 
+ *  \ref eJIP_SceneCreate). The choice is made on cost: a multicast is flooded through the whole network, 
+ *  while a unicast and its response cross each hop to the node, and are repeated as often as requests to 
+ *  the node have been lost. The hop count and loss of each node are learnt from earlier exchanges with it.
+ *  As with \ref eJIP_MulticastSetVar, the local data of variables set by multicast is not updated.
+ *  The calling thread must not hold any node lock or the JIP context lock.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param papsVars             The variable to set on each target node
+ *  \param u32NumTargets        Number of entries in papsVars
+ *  \param pvData               Pointer to the data to set the variables with
+ *  \param u32Size              Size of the data, as for \ref eJIP_SetVar
+ *  \param iMaxHops             Hop limit for any multicasts, as for \ref eJIP_MulticastSetVar
+ *  \param paeStatus[out]       Array with an entry for each target, filled in with its result. May be NULL.
+ *  \param psReport[out]        Filled in with what was chosen. May be NULL.
+ *  \return E_JIP_OK if every target succeeded, otherwise the first failure.
+ */
+teJIP_Status eJIP_SetVarFanout(tsJIP_Context *psJIP_Context, tsVar **papsVars, uint32_t u32NumTargets, void *pvData, uint32_t u32Size, 
+                               int iMaxHops, teJIP_Status *paeStatus, tsFanoutReport *psReport);
+
+
+/** Read a variable from every member of a multicast group with a single request.
+ *  Each member that has the variable responds after a random delay of up to u32JitterMs, so that the responses
+ *  of a large group are spread out. Responses are collected until u32JitterMs plus a margin for the network has 
+ *  passed, or until u32MaxResults members have responded. The local copy of the variable is updated on every 
+ *  responding member that is a node in the local network, and can be read from there.
+ *  Members that do not have the variable do not respond. The read is not repeated, so a member may be missed 
+ *  if the request or its response is lost.
+ *  The calling thread must not hold any node lock or the JIP context lock.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psVar                Pointer to the variable on any node, giving the MIB and index to read
+ *  \param psAddress            Multicast group to read the variable from
+ *  \param iMaxHops             Hop limit for the request, as for \ref eJIP_MulticastSetVar
+ *  \param u32JitterMs          Window over which members spread their responses, up to 65535
+ *  \param pasResults[out]      Array filled in with the response of each member
+ *  \param u32MaxResults        Number of entries in pasResults
+ *  \param pu32NumResults[out]  Number of members that responded
+ *  \return E_JIP_OK if the request was sent, whether or not any member responded.
+ */
+teJIP_Status eJIP_MulticastGetVar(tsJIP_Context *psJIP_Context, tsVar *psVar, tsJIPAddress *psAddress, int iMaxHops, uint32_t u32JitterMs,
+                                  tsGroupGetResult *pasResults, uint32_t u32MaxResults, uint32_t *pu32NumResults);
+
+
+/** Set a variable on every member of a multicast group, and make sure that each one has it.
+ *  The set is multicast as \ref eJIP_MulticastSetVar. Once the copies of the multicast have been sent, the 
+ *  variable is read back from all members with \ref eJIP_MulticastGetVar, and only the members that do not 
+ *  respond with the new value are set again, by unicast. The members are found from the nodes' Groups MIBs, which must have been read 
+ *  (see \ref eJIP_SceneCreate). The local copies of the variable on the members are updated.
+ *  Table variables can not be verified.
+ *  The calling thread must not hold any node lock or the JIP context lock.
+ *  \param psJIP_Context        Pointer to the JIP Context (Must be an E_JIP_CONTEXT_CLIENT context)
+ *  \param psVar                Pointer to the variable on any node, giving the MIB and index to set
+ *  \param pvData               Pointer to the data to set the variable with
+ *  \param u32Size              Size of the data, as for \ref eJIP_SetVar
+ *  \param psAddress            Multicast group to set the variable on
+ *  \param iMaxHops             Hop limit for the multicast, as for \ref eJIP_MulticastSetVar
+ *  \param pasResults[out]      Array filled in with the outcome for each member. May be NULL.
+ *  \param u32MaxResults        Number of entries in pasResults. Members beyond this are only counted.
+ *  \param psReport[out]        Filled in with the totals. May be NULL.
+ *  \return E_JIP_OK if every member has the new value, otherwise the first failure.
+ */
+teJIP_Status eJIP_MulticastSetVarVerified(tsJIP_Context *psJIP_Context, tsVar *psVar, void *pvData, uint32_t u32Size, 
+                                          tsJIPAddress *psAddress, int iMaxHops, tsGroupSetResult *pasResults, 
+                                          uint32_t u32MaxResults, tsGroupSetReport *psReport);
+
 /* @} */
 
 
@@ -810,6 +1242,8 @@ teJIP_Status eJIPService_PersistXMLLoadNetwork(tsJIP_Context *psJIP_Context, con
  *  \ref eJIP_Lock / \ref eJIP_Unlock respectively.
  *  Some functions automatically lock the JIP context, to prevent modifications. These include,
  *  \ref tprCbVarTrap and \ref tprCbNetworkChange
+ *  Where a thread needs both, a node must be locked before the JIP context. A thread holding the JIP context
+ *  may only attempt to lock a node with bWait FALSE.
  * @{ */
 
 
@@ -867,9 +1301,10 @@ teJIP_Status eJIP_UnlockNode(tsNode *psNode);
  *  The list of nodes is filtered by u32DeviceIdFilter. If this is specified as \ref JIP_DEVICEID_ALL, then
  *  the returned list contains all known devices in the network. If it is specified as a known device type,
  *  then only devices of this type are returned in the list.
- *  ppsAddresses is malloc'd by libJIP to contain as many node addresses as there are nodes in the network.
- *  This pointer should be free'd when the application is done with the list.
- *  pu32NumAddresses is set to the number of nodes in the network.
+ *  ppsAddresses is malloc'd by libJIP to contain the addresses of the matching nodes.
+ *  This pointer should be free'd when the application is done with the list. If no nodes match, it is set to NULL.
+ *  pu32NumAddresses is set to the number of matching nodes.
+ *  To act on each matching node, \ref eJIP_ForEachNode avoids copying the list and looking each node up again.
  *  \param psJIP_Context        Pointer to JIP Context 
  *  \param u32DeviceIdFilter    Device ID to filter list of nodes with
  *  \param ppsAddresses[out]    Pointer to a pointer that can be malloc'd to contain the node address list
@@ -879,10 +1314,50 @@ teJIP_Status eJIP_UnlockNode(tsNode *psNode);
 teJIP_Status eJIP_GetNodeAddressList(tsJIP_Context *psJIP_Context, const uint32_t u32DeviceIdFilter, tsJIPAddress **ppsAddresses, uint32_t *pu32NumAddresses);
 
 
+/** Get a list of addresses of nodes in the network matching any of a set of device IDs.
+ *  This behaves as \ref eJIP_GetNodeAddressList, but accepts an array of device IDs to filter with.
+ *  A node is returned if it matches any one of the filters, and each node is returned only once.
+ *  If pau32DeviceIdFilters is NULL, or one of the filters is \ref JIP_DEVICEID_ALL, every node is returned.
+ *  ppsAddresses is malloc'd by libJIP to contain exactly the number of matching node addresses, and should be 
+ *  free'd when the application is done with the list. If no nodes match, it is set to NULL.
+ *  \param psJIP_Context        Pointer to JIP Context 
+ *  \param pau32DeviceIdFilters Array of device IDs to filter list of nodes with
+ *  \param u32NumFilters        Number of entries in pau32DeviceIdFilters
+ *  \param ppsAddresses[out]    Pointer to a pointer that can be malloc'd to contain the node address list
+ *  \param pu32NumAddresses     Pointer to a location in which to store the number of matching nodes
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_GetNodeAddressListMulti(tsJIP_Context *psJIP_Context, const uint32_t *pau32DeviceIdFilters, uint32_t u32NumFilters,
+                                          tsJIPAddress **ppsAddresses, uint32_t *pu32NumAddresses);
+
+
+/** Visit every node in the network matching any of a set of device IDs.
+ *  The JIP context is locked once for the whole iteration, and prCbNodeVisit is called for each matching node.
+ *  Nodes with a specific device ID are found through an index, so the cost is proportional to the number of
+ *  matching nodes rather than the size of the network. No copy of the node list is made, so there is no need
+ *  to look each node up again by address.
+ *  The node is not locked by this function. While the callback runs the node cannot be removed from the 
+ *  network, so its address, device ID and MiB/variable definitions may be read. To access variable data the 
+ *  callback may attempt to lock the node using \ref eJIP_LockNode with bWait FALSE.
+ *  If pau32DeviceIdFilters is NULL, or one of the filters is \ref JIP_DEVICEID_ALL, every node is visited.
+ *  \param psJIP_Context        Pointer to JIP Context 
+ *  \param pau32DeviceIdFilters Array of device IDs to filter nodes with
+ *  \param u32NumFilters        Number of entries in pau32DeviceIdFilters
+ *  \param prCbNodeVisit        Callback function to call for each matching node
+ *  \param pvUser               User data pointer passed to each call of prCbNodeVisit
+ *  \return E_JIP_OK if every matching node was visited, otherwise the status returned by prCbNodeVisit
+ *          that stopped the iteration.
+ */
+teJIP_Status eJIP_ForEachNode(tsJIP_Context *psJIP_Context, const uint32_t *pau32DeviceIdFilters, uint32_t u32NumFilters,
+                              tprCbNodeVisit prCbNodeVisit, void *pvUser);
+
+
 /** Get a pointer to a node, if it exists in the network.
- *  This function internally locks the JIP context. If the requested node is found, it is locked by \ref eJIP_LockNode.
- *  The JIP context is then unlocked and the locked node structure returned. Once the thread is finished with the node, 
+ *  This function internally locks the JIP context to find the node. The JIP context is then unlocked and the thread 
+ *  waits for the node to be locked by \ref eJIP_LockNode before the locked node structure is returned. If the node is 
+ *  removed from the network while waiting, NULL is returned. Once the thread is finished with the node, 
  *  it must unlock it via \ref eJIP_UnlockNode.
+ *  Since this function may wait for the node lock, the calling thread must not hold the JIP context lock.
  *  \param psJIP_Context        Pointer to JIP Context 
  *  \param psAddress            Pointer to IPv6 Address structure
  *  \return NULL if node is unknown, otherwise pointer to it's structure
@@ -890,6 +1365,41 @@ teJIP_Status eJIP_GetNodeAddressList(tsJIP_Context *psJIP_Context, const uint32_
 tsNode *psJIP_LookupNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress);
 
 
+/** Get a handle to a node, if it exists in the network.
+ *  Unlike \ref psJIP_LookupNode, the node is not locked. Instead a reference is taken on it, which keeps the
+ *  node structure allocated until it is given back with \ref eJIP_ReleaseNode, even if the node is removed from
+ *  the network in the meantime. The application may therefore keep the handle and use it for many operations
+ *  without looking the node up by address each time.
+ *  Before accessing the node's data it must still be locked using \ref eJIP_LockNode. Once locked, bRemoved
+ *  may be checked to see if the node has since left the network.
+ *  All handles must be released before calling \ref eJIP_Destroy.
+ *  \param psJIP_Context        Pointer to JIP Context 
+ *  \param psAddress            Pointer to IPv6 Address structure
+ *  \return NULL if node is unknown, otherwise a handle to it
+ */
+tsNode *psJIP_AcquireNode(tsJIP_Context *psJIP_Context, tsJIPAddress *psAddress);
+
+
+/** Take an additional handle to a node that the calling thread can already safely access.
+ *  This is the case when the node is locked by the thread, the JIP context is locked (for example 
+ *  within a \ref tprCbNodeVisit or \ref tprCbNetworkChange callback), or the thread already holds a handle.
+ *  The handle must be given back with \ref eJIP_ReleaseNode.
+ *  \param psNode               Pointer to the node
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_AcquireNodeHandle(tsNode *psNode);
+
+
+/** Release a handle to a node taken by \ref psJIP_AcquireNode or \ref eJIP_AcquireNodeHandle.
+ *  If the node has been removed from the network and this was the last handle, the node and all of its
+ *  MiBs and variables are free'd, and psNode must not be used again. The node must not be locked by the 
+ *  calling thread when the last handle is released.
+ *  \param psNode               Pointer to the node
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIP_ReleaseNode(tsNode *psNode);
+
+
 /** Determine if a node has a MiB with the given name. If it does, a pointer to the MiB is returned.
  *  Otherwise, NULL. The calling thread must hold a lock on the parent node structure via \ref eJIP_LockNode
  *  or \ref psJIP_LookupNode.
@@ -1009,6 +1519,17 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
 teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context);
 
 
+/** Get the count of requests the server received but did not answer, so that clients retry them. Requests are
+ *  dropped when there is no memory to queue them for a worker thread (\ref tsJIP_Context::iServerThreads),
+ *  when \ref tsJIP_Context::iServerMaxPending requests are already waiting for callbacks, or when
+ *  \ref tsJIP_Context::iServerMaxDeferred responses are already waiting to be sent.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param pu32Dropped          [out] Number of requests dropped
+ *  \return E_JIP_OK on success.
+ */
+teJIP_Status eJIPserver_GetDropStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Dropped);
+
+
 /** Join a node to a multicast group.
  *  This function causes the node psNode to join the IPv6 multicast address given 
  *  by pcMulticastAddress. The node should be locked via \ref eJIP_LockNode.
@@ -1043,6 +1564,35 @@ teJIP_Status eJIPserver_NodeGroupLeave(tsNode *psNode, const char *pcMulticastAd
 teJIP_Status eJIPserver_NodeGroupMembership(tsNode *psNode, uint32_t *pu32NumGroups, struct in6_addr **pasGroupAddresses);
 
 
+/** Finish the requests waiting on a variable whose get or set callback returned E_JIP_PENDING.
+ *  Each waiting request is answered with its original handle, from the address of the node it was sent to.
+ *  Gets are answered with the variable's current data, which the application should have updated first,
+ *  or with eStatus if that is not E_JIP_OK. Sets are answered with eStatus.
+ *  Only requests for a single variable sent to the node's own address wait. For others, such as requests
+ *  sent to a group, the callback's E_JIP_PENDING is taken as E_JIP_OK and the current data is used.
+ *  The callback may also call this itself before returning E_JIP_PENDING, in which case its request is
+ *  answered straight away as if the callback had returned eStatus.
+ *  This function locks the variable's node with \ref eJIP_LockNode, so the context must not be locked.
+ *  \param psJIP_Context        Pointer to JIP Context (Must be an E_JIP_CONTEXT_SERVER context)
+ *  \param psVar                Pointer to the variable
+ *  \param eStatus              Result of the callback's work
+ *  \return E_JIP_OK if any requests were waiting on the variable
+ */
+teJIP_Status eJIPserver_CompleteVar(tsJIP_Context *psJIP_Context, tsVar *psVar, teJIP_Status eStatus);
+
+
+/** Tell the server that the MIBs or variables of a node have been changed in place.
+ *  The server answers discovery requests from responses encoded when they are first needed. They are
+ *  encoded again after a MIB or variable is added to the node, but an application that renames a MIB or
+ *  variable, changes a variable's type, access or security, or enables or disables a variable by writing
+ *  to it directly must call this afterwards.
+ *  This function locks the node with \ref eJIP_LockNode.
+ *  \param psNode               Pointer to the node
+ *  \return E_JIP_OK
+ */
+teJIP_Status eJIPserver_NodeChanged(tsNode *psNode);
+
+
 /** Utility function for the groups mib. Convert the compressed form used for group addresses
  *  into a full IPv6 multicast address.
  *  \param psAddress[out]   Pointer to location for the IPv6 multicast address to be stored
@@ -1053,6 +1603,17 @@ teJIP_Status eJIPserver_NodeGroupMembership(tsNode *psNode, uint32_t *pu32NumGro
 void vJIPserver_GroupMibCompressedAddressToIn6(struct in6_addr *psAddress, uint8_t *pau8Buffer, uint8_t u8BufferLength);
 
 
+/** Register the server callbacks for a variable.
+ *  This allocates the variable's \ref tsVarExt if it does not already have one.
+ *  The psVar must belong to a \ref tsNode than has been locked using \ref eJIP_LockNode.
+ *  \param psVar            Pointer to variable
+ *  \param prCbVarGet       Function to call when the variable is read, or NULL
+ *  \param prCbVarSet       Function to call when the variable is set, or NULL
+ *  \return E_JIP_OK on success
+ */
+teJIP_Status eJIP_SetVarCallbacks(tsVar *psVar, tprCbVarGet prCbVarGet, tprCbVarSet prCbVarSet);
+
+
 /** Function to update a local \ref tsVar structure with new data.
  *  This function free's any allocated storage for the variable, then
  *  mallocs u32Size new bytes and copies the passed data into it.
@@ -44,7 +44,7 @@ teJIP_Status eGroups_Init(tsNode *psNode)
     tsVar *psVar;
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
     
-    psMib = psJIP_LookupMibId(psNode, NULL, 0xffffff02);
+    psMib = psJIP_LookupMibId(psNode, NULL, JIP_GROUPS_MIB_ID);
     if (psMib)
     {
         psVar = psJIP_LookupVarIndex(psMib, 0);
@@ -62,7 +62,10 @@ teJIP_Status eGroups_Init(tsNode *psNode)
             psVar->ptData = psGroupsTable;
             
             // Get callback to populate table rows with current group membership.
-            psVar->prCbVarGet = eGroups_GroupsGet;
+            if (eJIP_SetVarCallbacks(psVar, eGroups_GroupsGet, NULL) != E_JIP_OK)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
 
             // Enable variable
             psVar->eEnable = E_JIP_VAR_ENABLED;
@@ -73,7 +76,10 @@ teJIP_Status eGroups_Init(tsNode *psNode)
         if (psVar)
         {
             // Set callback
-            psVar->prCbVarSet = eGroups_GroupAddSet;
+            if (eJIP_SetVarCallbacks(psVar, NULL, eGroups_GroupAddSet) != E_JIP_OK)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
             
             // Initial data before the first set
             psVar->pvData = malloc(sizeof(uint8_t));
@@ -93,7 +99,10 @@ teJIP_Status eGroups_Init(tsNode *psNode)
         if (psVar)
         {
             // Set callback
-            psVar->prCbVarSet = eGroups_GroupRemoveSet;
+            if (eJIP_SetVarCallbacks(psVar, NULL, eGroups_GroupRemoveSet) != E_JIP_OK)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
             
             // Initial data before the first set
             psVar->pvData = malloc(sizeof(uint8_t));
@@ -113,7 +122,10 @@ teJIP_Status eGroups_Init(tsNode *psNode)
         if (psVar)
         {
             // Set callback
-            psVar->prCbVarSet = eGroups_GroupClearSet;
+            if (eJIP_SetVarCallbacks(psVar, NULL, eGroups_GroupClearSet) != E_JIP_OK)
+            {
+                return E_JIP_ERROR_NO_MEM;
+            }
             
             // Initial data before the first set
             psVar->pvData = malloc(sizeof(uint8_t));
@@ -40,11 +40,16 @@
 #define DBG_FUNCTION_CALLS 0
 #define DBG_JIP_SERVER 0
 
+/** Time in milliseconds after which the sequence of a stream of unacknowledged sets is forgotten,
+ *  so that a new client can start again from any sequence number */
+#define JIP_SET_SEQUENCE_TIMEOUT_MS 2000
 
-static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetIndexRequest *psGetVar,
-                                         uint8_t *pcSendData, unsigned int *piSendDataLength);
 
-static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetIndexRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                         tsJIP_Msg_GetIndexRequest *psGetVar, uint8_t *pcSendData, unsigned int *piSendDataLength);
+
+static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, 
+                                         tsJIP_Msg_SetIndexRequest *psSetVar,
                                          unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
 
 static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_QueryMibRequest *psQueryMib,
@@ -62,12 +67,38 @@ static teJIP_Status eJIPserver_HandleUntrap(tsJIP_Context *psJIP_Context, tsNode
                                      teJIP_Command *peSendCommand,  uint8_t *pcSendData, unsigned int *piSendDataLength);
 
 
-static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMibRequest *psGetVar,
-                                            uint8_t *pcSendData, unsigned int *piSendDataLength);
+static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                            tsJIP_Msg_GetMibRequest *psGetVar, uint8_t *pcSendData, unsigned int *piSendDataLength);
+
+static teJIP_Status eJIPserver_HandleGetMulti(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMultiRequest *psGetVars,
+                                              unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
+
+static teJIP_Status eJIPserver_AddVarEntries(tsVar *psVar, int iVarCount, bool_t bMayDefer, uint8_t *pcSendData, unsigned int *piPacketOffset, int *piVarsAdded);
+
+static teJIP_Status eJIPserver_AddVarData(tsVar *psVar, uint8_t *pcSendData, unsigned int *piPacketOffset);
 
-static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMibRequest *psSetVar,
+static const tsJIP_Msg_VarDescriptionEntry *psJIPserver_VarEncoded(tsVar *psVar);
+
+static teJIP_Status eJIPserver_CallGetCallback(tsVar *psVar);
+
+static teJIP_Status eJIPserver_CallbackReturned(tsVar *psVar, teJIP_Status eStatus);
+
+static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, 
+                                            tsJIP_Msg_SetMibRequest *psSetVar,
                                             unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
 
+static teJIP_Status eJIPserver_HandleSetMulti(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMultiRequest *psSetVars,
+                                              unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength);
+
+static teJIP_Status eJIPserver_HandleSetUnacked(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetUnackedRequest *psSetVar,
+                                                unsigned int iReceiveDataLength);
+
+static teJIP_Status eJIPserver_DeferRequest(tsJIP_Context *psJIP_Context, tsNode *psNode, tsVar *psVar, 
+                                            tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, tsJIP_MsgHeader *psRequestHeader,
+                                            teJIP_Command eResponseCommand, uint16_t u16FirstEntry, uint8_t u8EntryCount);
+
+static teJIP_Status eJIPserver_NodeSchema(tsJIP_Context *psJIP_Context, tsNode *psNode);
+
 
 
 teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context)
@@ -94,6 +125,20 @@ teJIP_Status eJIPserver_Listen(tsJIP_Context *psJIP_Context)
 }
 
 
+teJIP_Status eJIPserver_GetDropStats(tsJIP_Context *psJIP_Context, uint32_t *pu32Dropped)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_SERVER)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    *pu32Dropped = u32AtomicGet(&psJIP_Private->sNetworkContext.u32ServerDropped);
+    return E_JIP_OK;
+}
+
+
 teJIP_Status eJIPserver_NodeAdd(tsJIP_Context *psJIP_Context, const char *pcAddress, const int iPort, 
                                 uint32_t u32DeviceId, char *pcName, const char *pcVersion, 
                                 tsNode **ppsNode)
@@ -140,7 +185,7 @@ teJIP_Status eJIPserver_NodeAdd(tsJIP_Context *psJIP_Context, const char *pcAddr
     }
     
     freeaddrinfo(res);
-
+    
     /* Set all variables to disabled state */
     psMib = psNewNode->psMibs;
     while (psMib)
@@ -194,6 +239,10 @@ teJIP_Status eJIPserver_NodeAdd(tsJIP_Context *psJIP_Context, const char *pcAddr
     {
         return eStatus;
     }
+    
+    /* Encode the node's discovery responses now that it is set up, or share those of a node like it.
+     * If that fails it is tried again on the first discovery request */
+    (void)eJIPserver_NodeSchema(psJIP_Context, psNewNode);
         
     
     DBG_vPrintf(DBG_JIP_SERVER, "Node created\n");
@@ -240,6 +289,28 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
         
     /* Node found to remove from the network */
     
+    /* Requests waiting on its callbacks will not be answered now */
+    vJIPserver_DropPending(psJIP_Context, psRemovedNode, NULL);
+    
+    {
+        /* Take the node out of the multicast group index so that it no longer refers to the node */
+        tsNode_Private *psNode_Private = (tsNode_Private *)psRemovedNode->pvPriv;
+        struct in6_addr sBlankAddress;
+        int iGroupAddressSlot;
+        
+        memset(&sBlankAddress, 0, sizeof(struct in6_addr));
+        
+        for (iGroupAddressSlot = 0; iGroupAddressSlot < JIP_DEVICE_MAX_GROUPS; iGroupAddressSlot++)
+        {
+            if (memcmp(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sBlankAddress, sizeof(struct in6_addr)))
+            {
+                (void)Network_ServerGroupLeave(&psJIP_Private->sNetworkContext, psRemovedNode, 
+                                               &psNode_Private->asGroupAddresses[iGroupAddressSlot]);
+                memcpy(&psNode_Private->asGroupAddresses[iGroupAddressSlot], &sBlankAddress, sizeof(struct in6_addr));
+            }
+        }
+    }
+    
     /* If the network change callback has been registered, call it here */
     if (psJIP_Private->prCbNetworkChange)
     {
@@ -249,8 +320,9 @@ teJIP_Status eJIPserver_NodeRemove(tsJIP_Context *psJIP_Context, tsNode *psNode)
         psJIP_Private->prCbNetworkChange(E_JIP_NODE_LEAVE, psRemovedNode);
     }
     
-    /* Now we can free the node */
-    return eJIP_NetFreeNode(psJIP_Context, psRemovedNode);
+    /* Now we can drop the network's handle. The node is free'd once no other handles are held on it */
+    eJIP_UnlockNode(psRemovedNode);
+    return eJIP_ReleaseNode(psRemovedNode);
 }
 
 
@@ -270,7 +342,7 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
             tsJIP_Msg_GetIndexRequest *psGetVar = (tsJIP_Msg_GetIndexRequest *)pcReceiveData;
             *peSendCommand = E_JIP_COMMAND_GET_RESPONSE;
             
-            return eJIPserver_HandleGet(psJIP_Context, psNode, psGetVar, pcSendData, piSendDataLength);
+            return eJIPserver_HandleGet(psJIP_Context, psNode, psSrcAddress, psDstAddress, psGetVar, pcSendData, piSendDataLength);
         }
             
         case (E_JIP_COMMAND_SET_REQUEST):
@@ -278,7 +350,7 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
             tsJIP_Msg_SetIndexRequest *psSetVar = (tsJIP_Msg_SetIndexRequest *)pcReceiveData;
             *peSendCommand = E_JIP_COMMAND_SET_RESPONSE;
             
-            return eJIPserver_HandleSet(psJIP_Context, psNode, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSet(psJIP_Context, psNode, psSrcAddress, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
         }
             
         case (E_JIP_COMMAND_QUERY_MIB_REQUEST):
@@ -314,7 +386,7 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
                 psGetVar->sRequest.u8VarCount = 1;
             }
             
-            return eJIPserver_HandleGetMib(psJIP_Context, psNode, psGetVar, pcSendData, piSendDataLength);
+            return eJIPserver_HandleGetMib(psJIP_Context, psNode, psSrcAddress, psDstAddress, psGetVar, pcSendData, piSendDataLength);
         }
         
         case (E_JIP_COMMAND_SET_MIB_REQUEST):
@@ -322,7 +394,59 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
             tsJIP_Msg_SetMibRequest *psSetVar = (tsJIP_Msg_SetMibRequest *)pcReceiveData;
             *peSendCommand = E_JIP_COMMAND_SET_RESPONSE;
             
-            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psSrcAddress, psDstAddress, psSetVar, iReceiveDataLength, pcSendData, piSendDataLength);
+        }
+        
+        case (E_JIP_COMMAND_GET_MULTI_REQUEST):
+        {
+            tsJIP_Msg_GetMultiRequest *psGetVars = (tsJIP_Msg_GetMultiRequest *)pcReceiveData;
+            *peSendCommand = E_JIP_COMMAND_GET_MULTI_RESPONSE;
+            
+            return eJIPserver_HandleGetMulti(psJIP_Context, psNode, psGetVars, iReceiveDataLength, pcSendData, piSendDataLength);
+        }
+        
+        case (E_JIP_COMMAND_SET_MULTI_REQUEST):
+        {
+            tsJIP_Msg_SetMultiRequest *psSetVars = (tsJIP_Msg_SetMultiRequest *)pcReceiveData;
+            *peSendCommand = E_JIP_COMMAND_SET_MULTI_RESPONSE;
+            
+            return eJIPserver_HandleSetMulti(psJIP_Context, psNode, psDstAddress, psSetVars, iReceiveDataLength, pcSendData, piSendDataLength);
+        }
+        
+        case (E_JIP_COMMAND_SET_UNACKED_REQUEST):
+        {
+            tsJIP_Msg_SetUnackedRequest *psSetVar = (tsJIP_Msg_SetUnackedRequest *)pcReceiveData;
+            
+            /* Never responded to, whatever the outcome */
+            (void)eJIPserver_HandleSetUnacked(psJIP_Context, psNode, psDstAddress, psSetVar, iReceiveDataLength);
+            break;
+        }
+        
+        case (E_JIP_COMMAND_GET_GROUP_REQUEST):
+        {
+            tsJIP_Msg_GetGroupRequest *psGetGroup = (tsJIP_Msg_GetGroupRequest *)pcReceiveData;
+            tsJIP_Msg_VarDescriptionHeader *psResponse = (tsJIP_Msg_VarDescriptionHeader *)pcSendData;
+            tsJIP_Msg_GetMibRequest sGetVar;
+            
+            if (iReceiveDataLength < sizeof(tsJIP_Msg_GetGroupRequest))
+            {
+                break;
+            }
+            *peSendCommand = E_JIP_COMMAND_GET_RESPONSE;
+            
+            sGetVar.sHeader                 = psGetGroup->sHeader;
+            sGetVar.u32MibId                = psGetGroup->u32MibId;
+            sGetVar.sRequest.u8VarIndex     = psGetGroup->u8VarIndex;
+            sGetVar.sRequest.u8VarCount     = 1;
+            
+            eStatus = eJIPserver_HandleGetMib(psJIP_Context, psNode, psSrcAddress, psDstAddress, &sGetVar, pcSendData, piSendDataLength);
+            if ((eStatus == E_JIP_OK) &&
+                ((psResponse->eStatus == E_JIP_ERROR_BAD_MIB_INDEX) || (psResponse->eStatus == E_JIP_ERROR_BAD_VAR_INDEX)))
+            {
+                /* Members without the variable stay quiet rather than add to the replies */
+                eStatus = E_JIP_ERROR_FAILED;
+            }
+            return eStatus;
         }
             
         default:
@@ -334,8 +458,8 @@ teJIP_Status eJIPserver_HandlePacket(tsJIP_Context *psJIP_Context, tsNode *psNod
 }
 
 
-static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetIndexRequest *psGetVar,
-                                              uint8_t *pcSendData, unsigned int *piSendDataLength)
+static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                         tsJIP_Msg_GetIndexRequest *psGetVar, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
     tsJIP_Msg_VarDescriptionHeader *psGetResponseHeader = (tsJIP_Msg_VarDescriptionHeader *)pcSendData;
@@ -350,10 +474,11 @@ static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *p
             // Convert get by MIB Index into get by MIB ID request.
             tsJIP_Msg_GetMibRequest psGetVarByMib;
             
+            psGetVarByMib.sHeader  = psGetVar->sHeader;
             psGetVarByMib.u32MibId = psMib->u32MibId;
             psGetVarByMib.sRequest = psGetVar->sRequest;
             
-            return eJIPserver_HandleGetMib(psJIP_Context, psNode, &psGetVarByMib, pcSendData, piSendDataLength);
+            return eJIPserver_HandleGetMib(psJIP_Context, psNode, psSrcAddress, psDstAddress, &psGetVarByMib, pcSendData, piSendDataLength);
         }
     }
     
@@ -368,7 +493,8 @@ static teJIP_Status eJIPserver_HandleGet(tsJIP_Context *psJIP_Context, tsNode *p
 }
 
 
-static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetIndexRequest *psSetVar,
+static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, 
+                                         tsJIP_Msg_SetIndexRequest *psSetVar,
                                          unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
@@ -384,10 +510,11 @@ static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *p
             // Convert get by MIB Index into get by MIB ID request.
             tsJIP_Msg_SetMibRequest psSetVarByMib;
             
+            psSetVarByMib.sHeader  = psSetVar->sHeader;
             psSetVarByMib.u32MibId = psMib->u32MibId;
             psSetVarByMib.sRequest = psSetVar->sRequest;
             
-            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psDstAddress, &psSetVarByMib, iReceiveDataLength, pcSendData, piSendDataLength);
+            return eJIPserver_HandleSetMib(psJIP_Context, psNode, psSrcAddress, psDstAddress, &psSetVarByMib, iReceiveDataLength, pcSendData, piSendDataLength);
         }
     }
     
@@ -401,22 +528,44 @@ static teJIP_Status eJIPserver_HandleSet(tsJIP_Context *psJIP_Context, tsNode *p
 }
 
 
+/** Copy the encoded entries u32First to u32Last - 1 from a schema into a response after its header, leaving out
+ *  any at the end that do not fit in the packet.
+ *  \param pau32Offsets         Offsets of the entries in psSchema->pu8Entries
+ *  \return Index after the last entry copied
+ */
+static uint32_t u32JIPserver_CopyEntries(const tsServerSchema *psSchema, const uint32_t *pau32Offsets, uint32_t u32First, uint32_t u32Last,
+                                         uint8_t *pcSendData, unsigned int *piPacketOffset)
+{
+    while ((u32Last > u32First) && 
+           (*piPacketOffset + pau32Offsets[u32Last] - pau32Offsets[u32First] > PACKET_BUFFER_SIZE))
+    {
+        u32Last--;
+    }
+    memcpy(&pcSendData[*piPacketOffset], &psSchema->pu8Entries[pau32Offsets[u32First]], pau32Offsets[u32Last] - pau32Offsets[u32First]);
+    *piPacketOffset += pau32Offsets[u32Last] - pau32Offsets[u32First];
+    return u32Last;
+}
+
+
 static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_QueryMibRequest *psQueryMib,
                                  uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
-    int i, j, iPacketOffset;
-    tsMib *psMib;
+    const tsServerSchema *psSchema;
     tsJIP_Msg_QueryMibResponseHeader *psQueryMibResponseHeader = (tsJIP_Msg_QueryMibResponseHeader*)pcSendData;
+    uint32_t u32Last = 0;
 
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Start %d, Num %d)\n", __FUNCTION__, psQueryMib->u8MibStartIndex, psQueryMib->u8NumMibs);
     
-    /* Skip initial MIBs */
-    for (i = 0, psMib = psNode->psMibs; 
-        (i < psQueryMib->u8MibStartIndex) && (psMib);
-        i++, psMib = psMib->psNext);
+    if (eJIPserver_NodeSchema(psJIP_Context, psNode) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    psSchema = ((tsNode_Private *)psNode->pvPriv)->psSchema;
+    
+    *piSendDataLength = sizeof(tsJIP_Msg_QueryMibResponseHeader);
     
     /* Now check if we have any MIBs left */
-    if (!psMib)
+    if (psQueryMib->u8MibStartIndex >= psSchema->u32NumMibs)
     {
         /* No Mibs left to return */
         psQueryMibResponseHeader->eStatus               = E_JIP_OK;
@@ -425,32 +574,21 @@ static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNo
         return E_JIP_OK;
     }
     
-    iPacketOffset = sizeof(tsJIP_Msg_QueryMibResponseHeader);
-    
-    /* For each requested MIB in range */
-    for (j = 0;
-        (j < psQueryMib->u8NumMibs) && (psMib);
-        i++, j++, psMib = psMib->psNext)
+    /* The requested MIBs in range, as encoded when the node was added */
+    u32Last = psQueryMib->u8MibStartIndex + psQueryMib->u8NumMibs;
+    if (u32Last > psSchema->u32NumMibs)
     {
-        tsJIP_Msg_QueryMibResponseListEntryHeader* psMibResposeEntry = (tsJIP_Msg_QueryMibResponseListEntryHeader*)&pcSendData[iPacketOffset];
-        
-        DBG_vPrintf(DBG_JIP_SERVER, "Adding MIB %d(0x%08x): %s\n", psMib->u8Index, psMib->u32MibId, psMib->pcName);
-
-        psMibResposeEntry->u8MibIndex   = psMib->u8Index;
-        psMibResposeEntry->u32MibID     = htonl(psMib->u32MibId);
-        psMibResposeEntry->u8NameLen    = strlen(psMib->pcName);
-        strcpy(psMibResposeEntry->acName, psMib->pcName);
-        
-        iPacketOffset += sizeof(tsJIP_Msg_QueryMibResponseListEntryHeader) + psMibResposeEntry->u8NameLen;
+        u32Last = psSchema->u32NumMibs;
     }
+    u32Last = u32JIPserver_CopyEntries(psSchema, psSchema->pau32MibOffsets, psQueryMib->u8MibStartIndex, u32Last, 
+                                       pcSendData, piSendDataLength);
     
-    DBG_vPrintf(DBG_JIP_SERVER, "Return %d MIBs, %d remaining\n", j, psNode->u32NumMibs - i);
+    DBG_vPrintf(DBG_JIP_SERVER, "Return %d MIBs, %d remaining\n", u32Last - psQueryMib->u8MibStartIndex, psSchema->u32NumMibs - u32Last);
     
     psQueryMibResponseHeader->eStatus                   = E_JIP_OK;
-    psQueryMibResponseHeader->u8NumMibsReturned         = j;
-    psQueryMibResponseHeader->u8NumMibsOutstanding      = psNode->u32NumMibs - i;
+    psQueryMibResponseHeader->u8NumMibsReturned         = u32Last - psQueryMib->u8MibStartIndex;
+    psQueryMibResponseHeader->u8NumMibsOutstanding      = psSchema->u32NumMibs - u32Last;
 
-    *piSendDataLength = iPacketOffset;
     return E_JIP_OK;
 }
 
@@ -458,21 +596,25 @@ static teJIP_Status eJIPserver_HandleQueryMib(tsJIP_Context *psJIP_Context, tsNo
 static teJIP_Status eJIPserver_HandleQueryVar(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_QueryVarRequest *psQueryVar,
                                               uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
-    int i, j, iPacketOffset;
-    tsMib *psMib;
-    tsVar *psVar;
+    const tsServerSchema *psSchema;
+    const tsServerSchemaMib *psSchemaMib;
     tsJIP_Msg_QueryVarResponseHeader *psQueryVarResponseHeader = (tsJIP_Msg_QueryVarResponseHeader*)pcSendData;
+    uint32_t u32Last;
 
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib Index %d, Start %d, Num %d)\n", __FUNCTION__, 
                 psQueryVar->u8MibIndex, psQueryVar->u8VarStartIndex, psQueryVar->u8NumVars);
     
-    /* Skip initial Mibs */
-    for (i = 0, psMib = psNode->psMibs; 
-        (i < psQueryVar->u8MibIndex) && (psMib);
-        i++, psMib = psMib->psNext);
+    if (eJIPserver_NodeSchema(psJIP_Context, psNode) != E_JIP_OK)
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    psSchema = ((tsNode_Private *)psNode->pvPriv)->psSchema;
+    
+    *piSendDataLength = sizeof(tsJIP_Msg_QueryVarResponseHeader);
+    psQueryVarResponseHeader->u8MibIndex = psQueryVar->u8MibIndex;
     
     /* Check that the MIB was valid*/
-    if (!psMib)
+    if (psQueryVar->u8MibIndex >= psSchema->u32NumMibs)
     {
         /* No Mibs left to return */
         psQueryVarResponseHeader->eStatus               = E_JIP_ERROR_BAD_MIB_INDEX;
@@ -480,14 +622,10 @@ static teJIP_Status eJIPserver_HandleQueryVar(tsJIP_Context *psJIP_Context, tsNo
         psQueryVarResponseHeader->u8NumVarsOutstanding  = 0;
         return E_JIP_OK;
     }
+    psSchemaMib = &psSchema->pasMibs[psQueryVar->u8MibIndex];
     
-    /* Skip initial Vars */
-    for (i = 0, psVar = psMib->psVars; 
-        (i < psQueryVar->u8VarStartIndex) && (psVar);
-        i++, psVar = psVar->psNext);
-
     /* Now check if we have any Vars left */
-    if (!psVar)
+    if (psQueryVar->u8VarStartIndex >= psSchemaMib->u32NumVars)
     {
         /* No Mibs left to return */
         psQueryVarResponseHeader->eStatus               = E_JIP_OK;
@@ -496,37 +634,21 @@ static teJIP_Status eJIPserver_HandleQueryVar(tsJIP_Context *psJIP_Context, tsNo
         return E_JIP_OK;
     }
     
-    iPacketOffset = sizeof(tsJIP_Msg_QueryVarResponseHeader);
-    
-    /* For each requested Var in range */
-    for (j = 0;
-        (j < psQueryVar->u8NumVars) && (psVar);
-        i++, j++, psVar = psVar->psNext)
+    /* The requested Vars in range, as encoded when the node was added */
+    u32Last = psQueryVar->u8VarStartIndex + psQueryVar->u8NumVars;
+    if (u32Last > psSchemaMib->u32NumVars)
     {
-        tsJIP_Msg_QueryVarResponseListEntryHeader* psVarResposeEntry = (tsJIP_Msg_QueryVarResponseListEntryHeader*)&pcSendData[iPacketOffset];
-        tsJIP_Msg_QueryVarResponseListEntryFooter* psVarResposeEntryFooter;
-        
-        DBG_vPrintf(DBG_JIP_SERVER, "Adding Var %d: %s\n", psVar->u8Index, psVar->pcName);
-
-        psVarResposeEntry->u8VarIndex           = psVar->u8Index;
-        psVarResposeEntry->u8NameLen            = strlen(psVar->pcName);
-        strcpy(psVarResposeEntry->acName, psVar->pcName);
-        
-        psVarResposeEntryFooter = (tsJIP_Msg_QueryVarResponseListEntryFooter*)(psVarResposeEntry->acName + strlen(psVar->pcName));
-        psVarResposeEntryFooter->eVarType       = psVar->eVarType;
-        psVarResposeEntryFooter->eAccessType    = psVar->eAccessType;
-        psVarResposeEntryFooter->eSecurity      = psVar->eSecurity;
-
-        iPacketOffset += sizeof(tsJIP_Msg_QueryVarResponseListEntryHeader) + sizeof(tsJIP_Msg_QueryVarResponseListEntryFooter) + psVarResposeEntry->u8NameLen;
+        u32Last = psSchemaMib->u32NumVars;
     }
+    u32Last = u32JIPserver_CopyEntries(psSchema, psSchemaMib->pau32VarOffsets, psQueryVar->u8VarStartIndex, u32Last, 
+                                       pcSendData, piSendDataLength);
     
-    DBG_vPrintf(DBG_JIP_SERVER, "Return %d vars, %d remaining\n", j, psMib->u32NumVars - i);
+    DBG_vPrintf(DBG_JIP_SERVER, "Return %d vars, %d remaining\n", u32Last - psQueryVar->u8VarStartIndex, psSchemaMib->u32NumVars - u32Last);
 
     psQueryVarResponseHeader->eStatus                   = E_JIP_OK;
-    psQueryVarResponseHeader->u8NumVarsReturned         = j;
-    psQueryVarResponseHeader->u8NumVarsOutstanding      = psMib->u32NumVars - i;
+    psQueryVarResponseHeader->u8NumVarsReturned         = u32Last - psQueryVar->u8VarStartIndex;
+    psQueryVarResponseHeader->u8NumVarsOutstanding      = psSchemaMib->u32NumVars - u32Last;
     
-    *piSendDataLength = iPacketOffset;
     return E_JIP_OK;
 }
 
@@ -547,13 +669,276 @@ static teJIP_Status eJIPserver_HandleUntrap(tsJIP_Context *psJIP_Context, tsNode
 }
 
 
-static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMibRequest *psGetVar,
-                                              uint8_t *pcSendData, unsigned int *piSendDataLength)
+/** Add entries for up to iVarCount variables from psVar onwards to a GET response, calling their get callbacks.
+ *  \param bMayDefer            A callback returning E_JIP_PENDING defers the response, rather than the variable's
+ *                              current data being sent. Only set for a single variable.
+ *  \return E_JIP_OK, E_JIP_ERROR_BAD_BUFFER_SIZE if the response is full, or E_JIP_ERROR_TIMEOUT / E_JIP_PENDING
+ *          if no response should be sent now
+ */
+static teJIP_Status eJIPserver_AddVarEntries(tsVar *psVar, int iVarCount, bool_t bMayDefer, uint8_t *pcSendData, unsigned int *piPacketOffset, int *piVarsAdded)
+{
+    unsigned int iPacketOffset = *piPacketOffset;
+    teJIP_Status eStatus = E_JIP_OK;
+    
+    for (*piVarsAdded = 0; (*piVarsAdded < iVarCount) && psVar; psVar = psVar->psNext)
+    {
+        tsJIP_Msg_VarDescriptionEntry *psEntry = (tsJIP_Msg_VarDescriptionEntry *)&pcSendData[iPacketOffset];
+        
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Add var index %d\n", __FUNCTION__, psVar->u8Index);
+        
+        if (iPacketOffset + sizeof(tsJIP_Msg_VarDescriptionEntryError) > PACKET_BUFFER_SIZE)
+        {
+            eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+            break;
+        }
+        
+        psEntry->eVarType    = psVar->eVarType;
+        
+        if (psVar->psExt && psVar->psExt->prCbVarGet)
+        {
+            /* Variable has get callback - call it */
+            teJIP_Status eGetStatus = eJIPserver_CallGetCallback(psVar);
+            
+            if ((eGetStatus == E_JIP_ERROR_TIMEOUT) || ((eGetStatus == E_JIP_PENDING) && bMayDefer))
+            {
+                /* In case of a timeout, don't return a response. Deferred requests get theirs later */
+                return eGetStatus;
+            }
+            else if ((eGetStatus != E_JIP_OK) && (eGetStatus != E_JIP_PENDING))
+            {
+                /* Get function returned an error - send it back now */
+                DBG_vPrintf(DBG_JIP_SERVER, "%s: Get function returned error %d\n", __FUNCTION__, eGetStatus);
+                psEntry->eStatus     = eGetStatus;
+                iPacketOffset       += sizeof(tsJIP_Msg_VarDescriptionEntryError);
+                (*piVarsAdded)++;
+                continue;
+            }
+        }
+        
+        eStatus = eJIPserver_AddVarData(psVar, pcSendData, &iPacketOffset);
+        if (eStatus != E_JIP_OK)
+        {
+            break;
+        }
+        (*piVarsAdded)++;
+    }
+    
+    *piPacketOffset = iPacketOffset;
+    return eStatus;
+}
+
+
+/** Add the entry for a variable's current data to a GET response, whose status and type fields are 
+ *  at *piPacketOffset. A variable that cannot be sent gets an error entry.
+ *  \return E_JIP_OK, or E_JIP_ERROR_BAD_BUFFER_SIZE if the data does not fit
+ */
+static teJIP_Status eJIPserver_AddVarData(tsVar *psVar, uint8_t *pcSendData, unsigned int *piPacketOffset)
+{
+    unsigned int iPacketOffset = *piPacketOffset;
+    tsJIP_Msg_VarDescriptionEntry *psEntry = (tsJIP_Msg_VarDescriptionEntry *)&pcSendData[iPacketOffset];
+    uint32_t u32Size = 0;
+    
+    psEntry->eVarType    = psVar->eVarType;
+    
+    if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        /* Tables have to be read on their own */
+        psEntry->eStatus     = E_JIP_ERROR_WRONG_TYPE;
+        *piPacketOffset      = iPacketOffset + sizeof(tsJIP_Msg_VarDescriptionEntryError);
+        return E_JIP_OK;
+    }
+    
+    if ((psVar->eEnable != E_JIP_VAR_ENABLED) || !psVar->pvData)
+    {
+        /* Variable has no data - return DISABLED */
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: No data - variable %d disabled\n", __FUNCTION__, psVar->u8Index);
+        psEntry->eStatus     = E_JIP_ERROR_DISABLED;
+        *piPacketOffset      = iPacketOffset + sizeof(tsJIP_Msg_VarDescriptionEntryError);
+        return E_JIP_OK;
+    }
+    
+    if ((psVar->eVarType == E_JIP_VAR_TYPE_STR) || (psVar->eVarType == E_JIP_VAR_TYPE_BLOB))
+    {
+        const tsJIP_Msg_VarDescriptionEntry *psEncoded = psJIPserver_VarEncoded(psVar);
+        
+        if (psEncoded)
+        {
+            /* Unchanged since it was last encoded - copy the whole entry */
+            u32Size = psVar->psExt->u32EncodedSize;
+            if (iPacketOffset + u32Size > PACKET_BUFFER_SIZE)
+            {
+                return E_JIP_ERROR_BAD_BUFFER_SIZE;
+            }
+            memcpy(psEntry, psEncoded, u32Size);
+            *piPacketOffset = iPacketOffset + u32Size;
+            return E_JIP_OK;
+        }
+    }
+    
+    /* Make sure the whole entry fits before writing the data */
+    u32Size = u32JIP_VarDataSize(psVar->eVarType, NULL);
+    if ((psVar->eVarType == E_JIP_VAR_TYPE_STR) || (psVar->eVarType == E_JIP_VAR_TYPE_BLOB))
+    {
+        u32Size = sizeof(uint8_t) + ((psVar->eVarType == E_JIP_VAR_TYPE_STR) ? strlen(psVar->pcData) : psVar->u8Size);
+    }
+    if (iPacketOffset + sizeof(tsJIP_Msg_VarDescriptionEntry) + u32Size > PACKET_BUFFER_SIZE)
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+
+    switch(psVar->eVarType)
+    {
+        case (E_JIP_VAR_TYPE_INT8):
+        case (E_JIP_VAR_TYPE_UINT8):
+            u32Size = sizeof(uint8_t);
+            *(uint8_t *)psEntry->au8Data = *psVar->pu8Data;
+            break;
+            
+        case (E_JIP_VAR_TYPE_INT16):
+        case (E_JIP_VAR_TYPE_UINT16):
+        {
+            uint16_t u16Var = htons(*psVar->pu16Data);
+            u32Size = sizeof(uint16_t);
+            memcpy(psEntry->au8Data, &u16Var, sizeof(uint16_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT32):
+        case (E_JIP_VAR_TYPE_UINT32):
+        case (E_JIP_VAR_TYPE_FLT):
+        {
+            uint32_t u32Var = htonl(*psVar->pu32Data);
+            u32Size = sizeof(uint32_t);
+            memcpy(psEntry->au8Data, &u32Var, sizeof(uint32_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_INT64):
+        case (E_JIP_VAR_TYPE_UINT64):
+        case (E_JIP_VAR_TYPE_DBL):
+        {
+            uint64_t u64Var = htobe64(*psVar->pu64Data);
+            u32Size = sizeof(uint64_t);
+            memcpy(psEntry->au8Data, &u64Var, sizeof(uint64_t));
+            break;
+        }
+        
+        case (E_JIP_VAR_TYPE_STR):
+            u32Size = strlen(psVar->pcData);
+            *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
+            memcpy(&psEntry->au8Data[1], psVar->pcData, u32Size);
+            u32Size += sizeof(uint8_t); /* Size of length component */
+            break;
+            
+        case (E_JIP_VAR_TYPE_BLOB):
+            u32Size = psVar->u8Size;
+            *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
+            memcpy(&psEntry->au8Data[1], psVar->pbData, u32Size);
+            u32Size += sizeof(uint8_t); /* Size of length component */
+            break;
+            
+        default:
+            break;
+    }    
+    
+    psEntry->eStatus     = E_JIP_OK;
+    iPacketOffset += sizeof(tsJIP_Msg_VarDescriptionEntry) + u32Size;
+    *piPacketOffset = iPacketOffset;
+    return E_JIP_OK;
+}
+
+
+/** Call the get callback of a variable for a request.
+ *  \return Status of the callback, as for \ref eJIPserver_CallbackReturned
+ */
+static teJIP_Status eJIPserver_CallGetCallback(tsVar *psVar)
+{
+    psVar->psExt->bInCallback       = True;
+    psVar->psExt->eCompletedStatus  = E_JIP_PENDING;
+    return eJIPserver_CallbackReturned(psVar, psVar->psExt->prCbVarGet(psVar));
+}
+
+
+/** Finish a call of a get or set callback for a request.
+ *  A callback may complete the variable with \ref eJIPserver_CompleteVar before returning E_JIP_PENDING. 
+ *  Its request then has nothing left to wait for, and is answered with the status it was completed with.
+ *  \return eStatus, or the status the variable was completed with by the callback
+ */
+static teJIP_Status eJIPserver_CallbackReturned(tsVar *psVar, teJIP_Status eStatus)
+{
+    psVar->psExt->bInCallback = False;
+    
+    if ((eStatus == E_JIP_PENDING) && (psVar->psExt->eCompletedStatus != E_JIP_PENDING))
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable completed by its callback\n", __FUNCTION__);
+        eStatus = psVar->psExt->eCompletedStatus;
+    }
+    return eStatus;
+}
+
+
+/** Get the GET response entry for an enabled CONST string or blob variable with data, encoding it if it has
+ *  been set since the last time. Other variables are not kept, as the application may write into their data
+ *  in place, and neither are variables with a get callback, as the callback may do the same.
+ *  Must be called with the variable's node locked.
+ *  \return Pointer to the entry, or NULL if the variable's data has to be encoded into the response directly
+ */
+static const tsJIP_Msg_VarDescriptionEntry *psJIPserver_VarEncoded(tsVar *psVar)
+{
+    tsVarExt *psExt = psVar->psExt;
+    tsJIP_Msg_VarDescriptionEntry *psEncoded;
+    uint32_t u32Length;
+    
+    if ((psVar->eAccessType != E_JIP_ACCESS_TYPE_CONST) || (psExt && psExt->prCbVarGet))
+    {
+        return NULL;
+    }
+    
+    if (psExt && psExt->pu8Encoded && (psExt->pvEncodedData == psVar->pvData))
+    {
+        psEncoded = (tsJIP_Msg_VarDescriptionEntry *)psExt->pu8Encoded;
+        
+        /* A blob's size may be changed without moving its data */
+        if ((psVar->eVarType == E_JIP_VAR_TYPE_STR) || (psEncoded->au8Data[0] == psVar->u8Size))
+        {
+            return psEncoded;
+        }
+    }
+    
+    u32Length = (psVar->eVarType == E_JIP_VAR_TYPE_STR) ? strlen(psVar->pcData) : psVar->u8Size;
+    if ((u32Length > UINT8_MAX) || !(psExt = psJIP_VarExt(psVar)))
+    {
+        return NULL;
+    }
+    
+    vJIP_VarDropEncoded(psVar);
+    psEncoded = malloc(sizeof(tsJIP_Msg_VarDescriptionEntry) + sizeof(uint8_t) + u32Length);
+    if (!psEncoded)
+    {
+        return NULL;
+    }
+    
+    psEncoded->eStatus      = E_JIP_OK;
+    psEncoded->eVarType     = psVar->eVarType;
+    psEncoded->au8Data[0]   = (uint8_t)u32Length;
+    memcpy(&psEncoded->au8Data[1], psVar->pvData, u32Length);
+    
+    psExt->pu8Encoded       = (uint8_t *)psEncoded;
+    psExt->pvEncodedData    = psVar->pvData;
+    psExt->u32EncodedSize   = sizeof(tsJIP_Msg_VarDescriptionEntry) + sizeof(uint8_t) + u32Length;
+    return psEncoded;
+}
+
+
+static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress,
+                                            tsJIP_Msg_GetMibRequest *psGetVar, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
     tsMib *psMib;
     tsVar *psVar;
     tsJIP_Msg_VarDescriptionHeader *psGetMibResponseHeader = (tsJIP_Msg_VarDescriptionHeader *)pcSendData;
     teJIP_Status eStatus = E_JIP_OK;
+    /* Only a response for one variable to the node's own address can wait for its callback */
+    bool_t bMayDefer = (psDstAddress->sin6_addr.s6_addr[0] != 0xFF);
     
     DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, Var %d)\n", __FUNCTION__, 
                 ntohl(psGetVar->u32MibId), psGetVar->sRequest.u8VarIndex);
@@ -598,17 +983,22 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
         psGetMibResponseHeader->u8MibIndex  = psMib->u8Index;
         psGetMibResponseHeader->u8VarIndex  = psVar->u8Index;
  
-        if (psVar->prCbVarGet)
+        if (psVar->psExt && psVar->psExt->prCbVarGet)
         {
             /* Variable has get callback - call it */
-            eStatus = psVar->prCbVarGet(psVar);
+            eStatus = eJIPserver_CallGetCallback(psVar);
             
             if (eStatus == E_JIP_ERROR_TIMEOUT)
             {
                 /* In case of a timeout, don't return a response */
                 return eStatus;
             }
-            else if (eStatus != E_JIP_OK)
+            else if ((eStatus == E_JIP_PENDING) && bMayDefer)
+            {
+                return eJIPserver_DeferRequest(psJIP_Context, psNode, psVar, psSrcAddress, psDstAddress, &psGetVar->sHeader,
+                                               E_JIP_COMMAND_GET_RESPONSE, psGetVar->sRequest.u16FirstEntry, psGetVar->sRequest.u8EntryCount);
+            }
+            else if ((eStatus != E_JIP_OK) && (eStatus != E_JIP_PENDING))
             {
                 /* Get function returned an error - send it back now */
                 DBG_vPrintf(DBG_JIP_SERVER, "%s: Get function returned error %d\n", __FUNCTION__, eStatus);
@@ -633,8 +1023,8 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
     }
     else
     {
-        int iVarIndex;
-        int iPacketOffset;
+        unsigned int iPacketOffset;
+        int iVarsAdded;
         /* Non table variable */
         DBG_vPrintf(DBG_JIP_SERVER, "%s: Get variable start index %d, count %d in MIB 0x%08x\n", 
                     __FUNCTION__, psGetVar->sRequest.u8VarIndex, psGetVar->sRequest.u8VarCount, ntohl(psGetVar->u32MibId));
@@ -644,104 +1034,18 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
         
         iPacketOffset = sizeof(tsJIP_Msg_VarDescriptionHeader) - sizeof(tsJIP_Msg_VarDescriptionEntry);
         
-        for (iVarIndex = psGetVar->sRequest.u8VarIndex; 
-            iVarIndex < (psGetVar->sRequest.u8VarIndex + psGetVar->sRequest.u8VarCount) && psVar;
-            iVarIndex++, psVar = psVar->psNext)
+        eStatus = eJIPserver_AddVarEntries(psVar, psGetVar->sRequest.u8VarCount, bMayDefer && (psGetVar->sRequest.u8VarCount == 1),
+                                           pcSendData, &iPacketOffset, &iVarsAdded);
+        if (eStatus == E_JIP_ERROR_TIMEOUT)
         {
-            uint32_t u32Size = 0;
-            tsJIP_Msg_VarDescriptionEntry *psEntry = (tsJIP_Msg_VarDescriptionEntry *)&pcSendData[iPacketOffset];
-            
-            DBG_vPrintf(DBG_JIP_SERVER, "%s: Add var index %d\n", __FUNCTION__, iVarIndex);
-            
-            psEntry->eVarType    = psVar->eVarType;
-            
-            if (psVar->prCbVarGet)
-            {
-                /* Variable has get callback - call it */
-                eStatus = psVar->prCbVarGet(psVar);
-                
-                if (eStatus == E_JIP_ERROR_TIMEOUT)
-                {
-                    /* In case of a timeout, don't return a response */
-                    return eStatus;
-                }
-                else if (eStatus != E_JIP_OK)
-                {
-                    /* Get function returned an error - send it back now */
-                    DBG_vPrintf(DBG_JIP_SERVER, "%s: Get function returned error %d\n", __FUNCTION__, eStatus);
-                    psGetMibResponseHeader->eStatus     = eStatus;
-                    iPacketOffset                      += sizeof(tsJIP_Msg_VarDescriptionEntryError);
-                    continue;
-                }
-            }
-            
-            if ((psVar->eEnable != E_JIP_VAR_ENABLED) || !psVar->pvData)
-            {
-                /* Variable has no data - return DISABLED */
-                DBG_vPrintf(DBG_JIP_SERVER, "%s: No data - variable %d disabled\n", __FUNCTION__, iVarIndex);
-                psEntry->eStatus     = E_JIP_ERROR_DISABLED;
-                iPacketOffset       += sizeof(tsJIP_Msg_VarDescriptionEntryError);
-                continue;
-            }
-
-            switch(psVar->eVarType)
-            {
-                case (E_JIP_VAR_TYPE_INT8):
-                case (E_JIP_VAR_TYPE_UINT8):
-                    u32Size = sizeof(uint8_t);
-                    *(uint8_t *)psEntry->au8Data = *psVar->pu8Data;
-                    break;
-                    
-                case (E_JIP_VAR_TYPE_INT16):
-                case (E_JIP_VAR_TYPE_UINT16):
-                {
-                    uint16_t u16Var = htons(*psVar->pu16Data);
-                    u32Size = sizeof(uint16_t);
-                    memcpy(psEntry->au8Data, &u16Var, sizeof(uint16_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_INT32):
-                case (E_JIP_VAR_TYPE_UINT32):
-                case (E_JIP_VAR_TYPE_FLT):
-                {
-                    uint32_t u32Var = htonl(*psVar->pu32Data);
-                    u32Size = sizeof(uint32_t);
-                    memcpy(psEntry->au8Data, &u32Var, sizeof(uint32_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_INT64):
-                case (E_JIP_VAR_TYPE_UINT64):
-                case (E_JIP_VAR_TYPE_DBL):
-                {
-                    uint64_t u64Var = htobe64(*psVar->pu64Data);
-                    u32Size = sizeof(uint64_t);
-                    memcpy(psEntry->au8Data, &u64Var, sizeof(uint64_t));
-                    break;
-                }
-                
-                case (E_JIP_VAR_TYPE_STR):
-                    u32Size = strlen(psVar->pcData);
-                    *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
-                    memcpy(&psEntry->au8Data[1], psVar->pcData, u32Size);
-                    u32Size += sizeof(uint8_t); /* Size of length component */
-                    break;
-                    
-                case (E_JIP_VAR_TYPE_BLOB):
-                    u32Size = psVar->u8Size;
-                    *(uint8_t *)psEntry->au8Data = (uint8_t)u32Size;
-                    memcpy(&psEntry->au8Data[1], psVar->pbData, u32Size);
-                    u32Size += sizeof(uint8_t); /* Size of length component */
-                    break;
-                    
-                default:
-                    break;
-            }    
-            
-            psEntry->eStatus     = E_JIP_OK;
-            iPacketOffset += sizeof(tsJIP_Msg_VarDescriptionEntry) + u32Size;
-        }
+            /* In case of a timeout, don't return a response */
+            return eStatus;
+        }
+        else if (eStatus == E_JIP_PENDING)
+        {
+            return eJIPserver_DeferRequest(psJIP_Context, psNode, psVar, psSrcAddress, psDstAddress, &psGetVar->sHeader,
+                                           E_JIP_COMMAND_GET_RESPONSE, 0, 0);
+        }
 
         *piSendDataLength = iPacketOffset;
         return E_JIP_OK;
@@ -750,90 +1054,140 @@ static teJIP_Status eJIPserver_HandleGetMib(tsJIP_Context *psJIP_Context, tsNode
 }
 
 
-static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMibRequest *psSetVar,
-                                            unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
+static teJIP_Status eJIPserver_HandleGetMulti(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIP_Msg_GetMultiRequest *psGetVars,
+                                              unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
 {
-    tsMib *psMib;
-    tsVar *psVar;
+    tsJIP_Msg_GetMultiRequestRange *psRequestRanges = (tsJIP_Msg_GetMultiRequestRange *)((uint8_t *)psGetVars + sizeof(tsJIP_Msg_GetMultiRequest));
+    tsJIP_Msg_GetMultiResponseHeader *psResponse = (tsJIP_Msg_GetMultiResponseHeader *)pcSendData;
+    unsigned int iPacketOffset = sizeof(tsJIP_Msg_GetMultiResponseHeader);
     teJIP_Status eStatus;
-    tsJIP_Msg_VarStatus *psSetMibResponse = (tsJIP_Msg_VarStatus *)pcSendData;
-    
-    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, Var %d)\n", __FUNCTION__, 
-                ntohl(psSetVar->u32MibId), psSetVar->sRequest.u8VarIndex);
+    int i;
     
-    /* Set response length */
-    *piSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+    psResponse->eStatus                 = E_JIP_OK;
+    psResponse->u8NumRanges             = 0;
+    psResponse->u8NumRangesOutstanding  = 0;
+    *piSendDataLength                   = iPacketOffset;
     
-    psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psSetVar->u32MibId));
-    if (!psMib)
+    if ((iReceiveDataLength < sizeof(tsJIP_Msg_GetMultiRequest)) ||
+        (iReceiveDataLength < sizeof(tsJIP_Msg_GetMultiRequest) + psGetVars->u8NumRanges * sizeof(tsJIP_Msg_GetMultiRequestRange)))
     {
-        /* MIB not found */
-        DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psSetVar->u32MibId));
-        psSetMibResponse->u8MibIndex  = 0;
-        psSetMibResponse->u8VarIndex  = 0;
-        psSetMibResponse->eStatus     = E_JIP_ERROR_BAD_MIB_INDEX;
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Request too short\n", __FUNCTION__);
+        psResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
         return E_JIP_OK;
     }
     
-    /* MIB found */
-    psVar = psJIP_LookupVarIndex(psMib, psSetVar->sRequest.u8VarIndex);
-    if (!psVar)
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(%d ranges)\n", __FUNCTION__, psGetVars->u8NumRanges);
+    
+    for (i = 0; i < psGetVars->u8NumRanges; i++)
     {
-        /* Variable not found */
-        DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId));
-        psSetMibResponse->u8MibIndex  = 0;
-        psSetMibResponse->u8VarIndex  = 0;
-        psSetMibResponse->eStatus     = E_JIP_ERROR_BAD_VAR_INDEX;
-        return E_JIP_OK;
+        tsJIP_Msg_GetMultiRequestRange *psRequest = &psRequestRanges[i];
+        tsJIP_Msg_GetMultiResponseRange *psRange = (tsJIP_Msg_GetMultiResponseRange *)&pcSendData[iPacketOffset];
+        tsMib *psMib;
+        tsVar *psVar;
+        int iVarsAdded;
+        
+        if (iPacketOffset + sizeof(tsJIP_Msg_GetMultiResponseRange) + sizeof(tsJIP_Msg_VarDescriptionEntryError) > PACKET_BUFFER_SIZE)
+        {
+            /* No room for any more ranges */
+            break;
+        }
+        iPacketOffset += sizeof(tsJIP_Msg_GetMultiResponseRange);
+        psResponse->u8NumRanges++;
+        
+        psRange->u8MibIndex = 0;
+        psRange->u8VarIndex = psRequest->u8VarIndex;
+        psRange->u8NumVars  = 0;
+        
+        psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psRequest->u32MibId));
+        if (!psMib)
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psRequest->u32MibId));
+            psRange->eStatus = E_JIP_ERROR_BAD_MIB_INDEX;
+            continue;
+        }
+        psRange->u8MibIndex = psMib->u8Index;
+        
+        psVar = psJIP_LookupVarIndex(psMib, psRequest->u8VarIndex);
+        if (!psVar)
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psRequest->u8VarIndex, psMib->u32MibId);
+            psRange->eStatus = E_JIP_ERROR_BAD_VAR_INDEX;
+            continue;
+        }
+        
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Get variable start index %d, count %d in MIB 0x%08x\n", 
+                    __FUNCTION__, psRequest->u8VarIndex, psRequest->u8VarCount, psMib->u32MibId);
+        
+        psRange->eStatus = E_JIP_OK;
+        eStatus = eJIPserver_AddVarEntries(psVar, psRequest->u8VarCount, False, pcSendData, &iPacketOffset, &iVarsAdded);
+        psRange->u8NumVars = iVarsAdded;
+        
+        if (eStatus == E_JIP_ERROR_TIMEOUT)
+        {
+            /* In case of a timeout, don't return a response */
+            return eStatus;
+        }
+        else if (eStatus == E_JIP_ERROR_BAD_BUFFER_SIZE)
+        {
+            /* Packet is full part way through this range */
+            break;
+        }
     }
     
-    /* Set up response */
-    psSetMibResponse->u8MibIndex  = psMib->u8Index;
-    psSetMibResponse->u8VarIndex  = psVar->u8Index;
-    
-    if (psSetVar->sRequest.sVar.eVarType != psVar->eVarType)
+    /* Counts a range that was cut short as well as those that weren't reached */
+    psResponse->u8NumRangesOutstanding = psGetVars->u8NumRanges - i;
+    *piSendDataLength = iPacketOffset;
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIPserver_CheckSetVar(tsVar *psVar, teJIP_VarType eVarType)
+{
+    if (eVarType != psVar->eVarType)
     {
         /* Wrong type specified in set message */
-        psSetMibResponse->eStatus = E_JIP_ERROR_WRONG_TYPE;
-        return E_JIP_OK;
+        return E_JIP_ERROR_WRONG_TYPE;
     }
     
     if ((psVar->eAccessType == E_JIP_ACCESS_TYPE_CONST) || (psVar->eAccessType == E_JIP_ACCESS_TYPE_READ_ONLY))
     {
         /* Can't set const or read only variables */
-        psSetMibResponse->eStatus = E_JIP_ERROR_NO_ACCESS;
-        return E_JIP_OK;
+        return E_JIP_ERROR_NO_ACCESS;
     }
     
     if (psVar->eEnable != E_JIP_VAR_ENABLED)
     {
         /* Variable is disabled */
-        psSetMibResponse->eStatus = E_JIP_ERROR_DISABLED;
-        return E_JIP_OK;
+        return E_JIP_ERROR_DISABLED;
     }
     
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIPserver_SetVarFromRequest(tsJIP_Context *psJIP_Context, tsVar *psVar, uint8_t *pu8Data, unsigned int iDataLength)
+{
     /* Assume that the buffer size is going to be wrong */
-    eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+    teJIP_Status eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
     
-    iReceiveDataLength -= sizeof(tsJIP_Msg_SetMibRequest);
-    DBG_vPrintf(DBG_JIP_SERVER, "%s: Data buffer length: %d\n", __FUNCTION__, iReceiveDataLength);
+    DBG_vPrintf(DBG_JIP_SERVER, "%s: Data buffer length: %d\n", __FUNCTION__, iDataLength);
  
     switch (psVar->eVarType)
     {
         case (E_JIP_VAR_TYPE_INT8):
         case (E_JIP_VAR_TYPE_UINT8):
-            if (iReceiveDataLength == sizeof(uint8_t))
+            if (iDataLength == sizeof(uint8_t))
             {
-                eStatus = eJIP_SetVar(psJIP_Context, psVar, psSetVar->sRequest.sVar.au8Data, sizeof(uint8_t));
+                eStatus = eJIP_SetVar(psJIP_Context, psVar, pu8Data, sizeof(uint8_t));
             }
             break;
          
         case (E_JIP_VAR_TYPE_INT16):
         case (E_JIP_VAR_TYPE_UINT16):
-            if (iReceiveDataLength == sizeof(uint16_t))
+            if (iDataLength == sizeof(uint16_t))
             {
                 uint16_t u16Var;
-                memcpy(&u16Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint16_t));
+                memcpy(&u16Var, pu8Data, sizeof(uint16_t));
                 u16Var = ntohs(u16Var);
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u16Var, sizeof(uint16_t));
             }
@@ -842,10 +1196,10 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
         case (E_JIP_VAR_TYPE_INT32):
         case (E_JIP_VAR_TYPE_UINT32):
         case (E_JIP_VAR_TYPE_FLT):
-            if (iReceiveDataLength == sizeof(uint32_t))
+            if (iDataLength == sizeof(uint32_t))
             {
                 uint32_t u32Var;
-                memcpy(&u32Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint32_t));
+                memcpy(&u32Var, pu8Data, sizeof(uint32_t));
                 u32Var = ntohl(u32Var);
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u32Var, sizeof(uint32_t));
             }
@@ -854,23 +1208,23 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
         case (E_JIP_VAR_TYPE_INT64):
         case (E_JIP_VAR_TYPE_UINT64):
         case (E_JIP_VAR_TYPE_DBL):
-            if (iReceiveDataLength == sizeof(uint64_t))
+            if (iDataLength == sizeof(uint64_t))
             {
                 uint64_t u64Var;
-                memcpy(&u64Var, psSetVar->sRequest.sVar.au8Data, sizeof(uint64_t));
+                memcpy(&u64Var, pu8Data, sizeof(uint64_t));
                 u64Var = be64toh(u64Var);                
                 eStatus = eJIP_SetVar(psJIP_Context, psVar, &u64Var, sizeof(uint64_t));
             }
             break;
         
         case (E_JIP_VAR_TYPE_STR):
-            if (iReceiveDataLength >= sizeof(uint8_t))
+            if (iDataLength >= sizeof(uint8_t))
             {
-                uint8_t u8StringLen = *((uint8_t *)psSetVar->sRequest.sVar.au8Data);
+                uint8_t u8StringLen = *pu8Data;
                 
                 DBG_vPrintf(DBG_JIP_SERVER, "%s: Received length: %d\n", __FUNCTION__, u8StringLen);
                 
-                if (u8StringLen == (iReceiveDataLength - 1))
+                if (u8StringLen == (iDataLength - 1))
                 {
                     /* Special case for string due to incoming packet missing the NULL terminator */
                     void *pvNewData;
@@ -883,7 +1237,7 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
                     else
                     {
                         psVar->pvData = pvNewData;
-                        memcpy(psVar->pvData, ((uint8_t *)psSetVar->sRequest.sVar.au8Data)+1, u8StringLen);
+                        memcpy(psVar->pvData, pu8Data+1, u8StringLen);
                         ((char *)psVar->pvData)[u8StringLen] = '\0';
                         psVar->u8Size = u8StringLen + 1;
                         eStatus = E_JIP_OK;
@@ -893,15 +1247,15 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
             break;
             
         case (E_JIP_VAR_TYPE_BLOB):
-            if (iReceiveDataLength >= sizeof(uint8_t))
+            if (iDataLength >= sizeof(uint8_t))
             {
-                uint8_t u8BlobLen = *((uint8_t *)psSetVar->sRequest.sVar.au8Data);
+                uint8_t u8BlobLen = *pu8Data;
                 
                 DBG_vPrintf(DBG_JIP_SERVER, "%s: Received length: %d\n", __FUNCTION__, u8BlobLen);
                 
-                if (u8BlobLen == (iReceiveDataLength - 1))
+                if (u8BlobLen == (iDataLength - 1))
                 {
-                    eStatus = eJIP_SetVar(psJIP_Context, psVar, ((uint8_t *)psSetVar->sRequest.sVar.au8Data)+1, u8BlobLen);
+                    eStatus = eJIP_SetVar(psJIP_Context, psVar, pu8Data+1, u8BlobLen);
                 }
             }
             break;
@@ -909,40 +1263,261 @@ static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode
         default:
             eStatus = E_JIP_ERROR_WRONG_TYPE;
             break;
+    
+    }
+    
+    if ((eStatus == E_JIP_OK) && psVar->psExt)
+    {
+        /* Strings are stored above without eJIP_SetVar */
+        vJIP_VarDropEncoded(psVar);
         
+        /* Any set ends the current stream of unacknowledged sets. eJIPserver_HandleSetUnacked starts a new one after this. */
+        psVar->psExt->u32SetSequenceTime = 0;
+    }
+
+    return eStatus;
+}
+
+
+/** Call the set callback of a variable, if it has one.
+ *  \param bMayDefer            The response can wait for a callback returning E_JIP_PENDING. Otherwise that is taken as E_JIP_OK
+ *  \return Status to respond with
+ */
+static teJIP_Status eJIPserver_CallSetCallback(tsVar *psVar, tsJIPAddress *psDstAddress, bool_t bMayDefer)
+{
+    teJIP_Status eStatus;
+    
+    if (!psVar->psExt || !psVar->psExt->prCbVarSet)
+    {
+        return E_JIP_OK;
+    }
+    
+    /* Variable has set callback - call it */
+    if (psDstAddress->sin6_addr.s6_addr[0] == 0xFF)
+    {
+        /* Multicast */
+        DBG_vPrintf(DBG_JIP_SERVER, "Multicast set request to ");
+        DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psDstAddress->sin6_addr);
+        
+        /* No responses to multicast sets, so a timeout doesn't matter */
+        psVar->psExt->prCbVarSet(psVar, psDstAddress);
+        return E_JIP_OK;
+    }
+    
+    psVar->psExt->bInCallback       = True;
+    psVar->psExt->eCompletedStatus  = E_JIP_PENDING;
+    eStatus = eJIPserver_CallbackReturned(psVar, psVar->psExt->prCbVarSet(psVar, NULL));
+    if ((eStatus == E_JIP_PENDING) && !bMayDefer)
+    {
+        /* The value has been stored, and the application finishes with it in its own time */
+        eStatus = E_JIP_OK;
+    }
+    return eStatus;
+}
+
+
+static teJIP_Status eJIPserver_HandleSetMib(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, 
+                                            tsJIP_Msg_SetMibRequest *psSetVar,
+                                            unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
+{
+    tsMib *psMib;
+    tsVar *psVar;
+    teJIP_Status eStatus;
+    tsJIP_Msg_VarStatus *psSetMibResponse = (tsJIP_Msg_VarStatus *)pcSendData;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, Var %d)\n", __FUNCTION__, 
+                ntohl(psSetVar->u32MibId), psSetVar->sRequest.u8VarIndex);
+    
+    /* Set response length */
+    *piSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+    
+    psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psSetVar->u32MibId));
+    if (!psMib)
+    {
+        /* MIB not found */
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psSetVar->u32MibId));
+        psSetMibResponse->u8MibIndex  = 0;
+        psSetMibResponse->u8VarIndex  = 0;
+        psSetMibResponse->eStatus     = E_JIP_ERROR_BAD_MIB_INDEX;
+        return E_JIP_OK;
+    }
+    
+    /* MIB found */
+    psVar = psJIP_LookupVarIndex(psMib, psSetVar->sRequest.u8VarIndex);
+    if (!psVar)
+    {
+        /* Variable not found */
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId));
+        psSetMibResponse->u8MibIndex  = 0;
+        psSetMibResponse->u8VarIndex  = 0;
+        psSetMibResponse->eStatus     = E_JIP_ERROR_BAD_VAR_INDEX;
+        return E_JIP_OK;
     }
     
+    /* Set up response */
+    psSetMibResponse->u8MibIndex  = psMib->u8Index;
+    psSetMibResponse->u8VarIndex  = psVar->u8Index;
+    
+    eStatus = eJIPserver_CheckSetVar(psVar, psSetVar->sRequest.sVar.eVarType);
+    if (eStatus != E_JIP_OK)
+    {
+        psSetMibResponse->eStatus = eStatus;
+        return E_JIP_OK;
+    }
+    
+    eStatus = eJIPserver_SetVarFromRequest(psJIP_Context, psVar, psSetVar->sRequest.sVar.au8Data, 
+                                           iReceiveDataLength - sizeof(tsJIP_Msg_SetMibRequest));
+    
     if (eStatus == E_JIP_OK)
     {
         /* Only call the set callback if the data has been set ok */
-        if (psVar->prCbVarSet)
+        eStatus = eJIPserver_CallSetCallback(psVar, psDstAddress, True);
+        if (eStatus == E_JIP_ERROR_TIMEOUT)
         {
-            /* Variable has set callback - call it */
-            
-            if (psDstAddress->sin6_addr.s6_addr[0] == 0xFF)
+            /* In case of a timeout, don't return a response */
+            return eStatus;
+        }
+        else if (eStatus == E_JIP_PENDING)
+        {
+            return eJIPserver_DeferRequest(psJIP_Context, psNode, psVar, psSrcAddress, psDstAddress, &psSetVar->sHeader,
+                                           E_JIP_COMMAND_SET_RESPONSE, 0, 0);
+        }
+    }
+    
+    DBG_vPrintf(DBG_JIP_SERVER, "%s: Set Variable %d in MIB 0x%08x status: %d\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId), eStatus);
+    psSetMibResponse->eStatus     = eStatus;
+
+    return E_JIP_OK;
+}
+
+
+static teJIP_Status eJIPserver_HandleSetMulti(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetMultiRequest *psSetVars,
+                                              unsigned int iReceiveDataLength, uint8_t *pcSendData, unsigned int *piSendDataLength)
+{
+    tsMib *psMib;
+    tsVar *apsVars[UINT8_MAX];
+    tsJIP_Msg_SetRequest *apsRequests[UINT8_MAX];
+    uint32_t au32DataLengths[UINT8_MAX];
+    tsJIP_Msg_SetMultiResponseHeader *psResponse = (tsJIP_Msg_SetMultiResponseHeader *)pcSendData;
+    tsJIP_Msg_SetMultiResponseEntry *psResponseEntries = (tsJIP_Msg_SetMultiResponseEntry *)&pcSendData[sizeof(tsJIP_Msg_SetMultiResponseHeader)];
+    teJIP_Status eStatus = E_JIP_OK;
+    bool_t bTimeout = False;
+    unsigned int iOffset;
+    int i, iNumVars;
+    
+    psResponse->u8MibIndex  = 0;
+    psResponse->u8NumVars   = 0;
+    *piSendDataLength       = sizeof(tsJIP_Msg_SetMultiResponseHeader);
+    
+    if (iReceiveDataLength < sizeof(tsJIP_Msg_SetMultiRequest))
+    {
+        psResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+        return E_JIP_OK;
+    }
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, %d vars)\n", __FUNCTION__, 
+                ntohl(psSetVars->u32MibId), psSetVars->u8NumVars);
+    
+    psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psSetVars->u32MibId));
+    if (!psMib)
+    {
+        /* MIB not found */
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psSetVars->u32MibId));
+        psResponse->eStatus = E_JIP_ERROR_BAD_MIB_INDEX;
+        return E_JIP_OK;
+    }
+    psResponse->u8MibIndex = psMib->u8Index;
+    
+    /* Check every entry before storing any of them, so that either all of the variables are set or none are */
+    iNumVars = psSetVars->u8NumVars;
+    iOffset = sizeof(tsJIP_Msg_SetMultiRequest);
+    for (i = 0; i < iNumVars; i++)
+    {
+        tsJIP_Msg_SetRequest *psRequest = (tsJIP_Msg_SetRequest *)((uint8_t *)psSetVars + iOffset);
+        
+        au32DataLengths[i] = 0;
+        if (iOffset + sizeof(tsJIP_Msg_SetRequest) + sizeof(uint8_t) <= iReceiveDataLength)
+        {
+            au32DataLengths[i] = u32JIP_VarDataSize(psRequest->sVar.eVarType, psRequest->sVar.au8Data);
+        }
+        
+        if ((au32DataLengths[i] == 0) || (iOffset + sizeof(tsJIP_Msg_SetRequest) + au32DataLengths[i] > iReceiveDataLength))
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: Malformed entry %d\n", __FUNCTION__, i);
+            psResponse->eStatus = E_JIP_ERROR_BAD_BUFFER_SIZE;
+            return E_JIP_OK;
+        }
+        iOffset += sizeof(tsJIP_Msg_SetRequest) + au32DataLengths[i];
+        
+        apsRequests[i] = psRequest;
+        apsVars[i] = psJIP_LookupVarIndex(psMib, psRequest->u8VarIndex);
+        
+        psResponseEntries[i].u8VarIndex = psRequest->u8VarIndex;
+        if (!apsVars[i])
+        {
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psRequest->u8VarIndex, psMib->u32MibId);
+            psResponseEntries[i].eStatus = E_JIP_ERROR_BAD_VAR_INDEX;
+        }
+        else
+        {
+            psResponseEntries[i].eStatus = eJIPserver_CheckSetVar(apsVars[i], psRequest->sVar.eVarType);
+        }
+        
+        if (psResponseEntries[i].eStatus != E_JIP_OK)
+        {
+            eStatus = E_JIP_ERROR_FAILED;
+        }
+    }
+    
+    psResponse->u8NumVars = iNumVars;
+    *piSendDataLength += iNumVars * sizeof(tsJIP_Msg_SetMultiResponseEntry);
+    
+    if (eStatus != E_JIP_OK)
+    {
+        /* Entries that were acceptable report that they were not applied */
+        for (i = 0; i < iNumVars; i++)
+        {
+            if (psResponseEntries[i].eStatus == E_JIP_OK)
             {
-                /* Multicast */
-                DBG_vPrintf(DBG_JIP_SERVER, "Multicast set request to ");
-                DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psDstAddress->sin6_addr);
-                
-                eStatus = psVar->prCbVarSet(psVar, psDstAddress);
-                /* No responses to multicast sets */
+                psResponseEntries[i].eStatus = E_JIP_ERROR_FAILED;
             }
-            else
+        }
+        psResponse->eStatus = eStatus;
+        return E_JIP_OK;
+    }
+    
+    /* Store all of the new values first, so that each set callback sees the complete new state */
+    for (i = 0; i < iNumVars; i++)
+    {
+        psResponseEntries[i].eStatus = eJIPserver_SetVarFromRequest(psJIP_Context, apsVars[i], apsRequests[i]->sVar.au8Data, au32DataLengths[i]);
+    }
+    
+    for (i = 0; i < iNumVars; i++)
+    {
+        if (psResponseEntries[i].eStatus == E_JIP_OK)
+        {
+            psResponseEntries[i].eStatus = eJIPserver_CallSetCallback(apsVars[i], psDstAddress, False);
+            if (psResponseEntries[i].eStatus == E_JIP_ERROR_TIMEOUT)
             {
-                eStatus = psVar->prCbVarSet(psVar, NULL);
-                if (eStatus == E_JIP_ERROR_TIMEOUT)
-                {
-                    /* In case of a timeout, don't return a response */
-                    return eStatus;
-                }
+                bTimeout = True;
             }
         }
+        
+        if (psResponseEntries[i].eStatus != E_JIP_OK)
+        {
+            eStatus = E_JIP_ERROR_FAILED;
+        }
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Set Variable %d in MIB 0x%08x status: %d\n", __FUNCTION__, 
+                    psResponseEntries[i].u8VarIndex, psMib->u32MibId, psResponseEntries[i].eStatus);
     }
     
-    DBG_vPrintf(DBG_JIP_SERVER, "%s: Set Variable %d in MIB 0x%08x status: %d\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId), eStatus);
-    psSetMibResponse->eStatus     = eStatus;
+    if (bTimeout)
+    {
+        /* In case of a timeout, don't return a response */
+        return E_JIP_ERROR_TIMEOUT;
+    }
 
+    psResponse->eStatus = eStatus;
     return E_JIP_OK;
 }
 
@@ -1101,4 +1676,543 @@ teJIP_Status eJIPserver_NodeGroupMembership(tsNode *psNode, uint32_t *pu32NumGro
 }
 
 
+static teJIP_Status eJIPserver_HandleSetUnacked(tsJIP_Context *psJIP_Context, tsNode *psNode, tsJIPAddress *psDstAddress, tsJIP_Msg_SetUnackedRequest *psSetVar,
+                                                unsigned int iReceiveDataLength)
+{
+    tsMib *psMib;
+    tsVar *psVar;
+    teJIP_Status eStatus;
+    uint16_t u16Sequence;
+    uint32_t u32Now;
+    
+    if (iReceiveDataLength < sizeof(tsJIP_Msg_SetUnackedRequest))
+    {
+        return E_JIP_ERROR_BAD_BUFFER_SIZE;
+    }
+    
+    u16Sequence = ntohs(psSetVar->u16Sequence);
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s(Mib ID 0x%08x, Var %d, Sequence %d)\n", __FUNCTION__, 
+                ntohl(psSetVar->u32MibId), psSetVar->sRequest.u8VarIndex, u16Sequence);
+    
+    psMib = psJIP_LookupMibId(psNode, NULL, ntohl(psSetVar->u32MibId));
+    if (!psMib)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: MIB 0x%08x not found\n", __FUNCTION__, ntohl(psSetVar->u32MibId));
+        return E_JIP_ERROR_BAD_MIB_INDEX;
+    }
+    
+    psVar = psJIP_LookupVarIndex(psMib, psSetVar->sRequest.u8VarIndex);
+    if (!psVar)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Variable %d in MIB 0x%08x not found\n", __FUNCTION__, psSetVar->sRequest.u8VarIndex, ntohl(psSetVar->u32MibId));
+        return E_JIP_ERROR_BAD_VAR_INDEX;
+    }
+    
+    eStatus = eJIPserver_CheckSetVar(psVar, psSetVar->sRequest.sVar.eVarType);
+    if (eStatus != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    
+    if (!psJIP_VarExt(psVar))
+    {
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    u32Now = u32TimeMillis();
+    if ((psVar->psExt->u32SetSequenceTime != 0) && 
+        ((uint32_t)(u32Now - psVar->psExt->u32SetSequenceTime) < JIP_SET_SEQUENCE_TIMEOUT_MS) &&
+        ((int16_t)(u16Sequence - psVar->psExt->u16SetSequence) <= 0))
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Dropping stale sequence %d (last %d)\n", __FUNCTION__, u16Sequence, psVar->psExt->u16SetSequence);
+        return E_JIP_ERROR_BAD_VALUE;
+    }
+    
+    eStatus = eJIPserver_SetVarFromRequest(psJIP_Context, psVar, psSetVar->sRequest.sVar.au8Data, 
+                                           iReceiveDataLength - sizeof(tsJIP_Msg_SetUnackedRequest));
+    if (eStatus != E_JIP_OK)
+    {
+        return eStatus;
+    }
+    
+    psVar->psExt->u16SetSequence     = u16Sequence;
+    psVar->psExt->u32SetSequenceTime = u32Now ? u32Now : 1;
+    
+    /* There is no response, so a timeout in the callback doesn't matter */
+    (void)eJIPserver_CallSetCallback(psVar, psDstAddress, False);
+    return E_JIP_OK;
+}
+
+
+/** Hold a request whose callback returned E_JIP_PENDING until \ref eJIPserver_CompleteVar.
+ *  Called with the node locked.
+ *  \return E_JIP_PENDING if the request is held. E_JIP_ERROR_TIMEOUT if the server already holds as many as 
+ *          it may, so that the request is not answered and the client sends it again later.
+ */
+static teJIP_Status eJIPserver_DeferRequest(tsJIP_Context *psJIP_Context, tsNode *psNode, tsVar *psVar, 
+                                            tsJIPAddress *psSrcAddress, tsJIPAddress *psDstAddress, tsJIP_MsgHeader *psRequestHeader,
+                                            teJIP_Command eResponseCommand, uint16_t u16FirstEntry, uint8_t u8EntryCount)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsServerPendingRequest *psRequest;
+    teJIP_Status eStatus = E_JIP_PENDING;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    psRequest = malloc(sizeof(tsServerPendingRequest));
+    if (!psRequest)
+    {
+        return E_JIP_ERROR_TIMEOUT;
+    }
+    
+    psRequest->psVar            = psVar;
+    psRequest->psNode           = psNode;
+    psRequest->eCommand         = eResponseCommand;
+    psRequest->u8Handle         = psRequestHeader->u8Handle;
+    psRequest->u16FirstEntry    = u16FirstEntry;
+    psRequest->u8EntryCount     = u8EntryCount;
+    psRequest->sClientAddress   = *psSrcAddress;
+    psRequest->sNodeAddress     = psNode->sNode_Address.sin6_addr;
+    psRequest->iInterface       = psDstAddress->sin6_scope_id;
+    
+    eJIP_Lock(psJIP_Context);
+    if ((int)psJIP_Private->u32NumServerPending >= psJIP_Context->iServerMaxPending)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: %d requests already waiting, not answering\n", __FUNCTION__, psJIP_Private->u32NumServerPending);
+        u32AtomicAdd(&psJIP_Private->sNetworkContext.u32ServerDropped, 1);
+        eStatus = E_JIP_ERROR_TIMEOUT;
+    }
+    else
+    {
+        psRequest->psNext = psJIP_Private->psServerPending;
+        psJIP_Private->psServerPending = psRequest;
+        psJIP_Private->u32NumServerPending++;
+        psRequest = NULL;
+    }
+    eJIP_Unlock(psJIP_Context);
+    
+    free(psRequest);
+    return eStatus;
+}
+
+
+void vJIPserver_DropPending(tsJIP_Context *psJIP_Context, tsNode *psNode, tsMib *psMib)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsServerPendingRequest *psRequest, **ppsPosition;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIP_Lock(psJIP_Context);
+    ppsPosition = &psJIP_Private->psServerPending;
+    while ((psRequest = *ppsPosition) != NULL)
+    {
+        if ((!psNode && !psMib) || (psNode && (psRequest->psNode == psNode)) || 
+            (psMib && (psRequest->psVar->psOwnerMib == psMib)))
+        {
+            *ppsPosition = psRequest->psNext;
+            psJIP_Private->u32NumServerPending--;
+            free(psRequest);
+        }
+        else
+        {
+            ppsPosition = &psRequest->psNext;
+        }
+    }
+    eJIP_Unlock(psJIP_Context);
+}
+
+
+/** Encode the GET response of a request that waited for the get callback of psVar.
+ *  Called with the node locked.
+ *  \return E_JIP_OK if the response should be sent
+ */
+static teJIP_Status eJIPserver_EncodeDeferredGet(tsJIP_Context *psJIP_Context, tsServerPendingRequest *psRequest, teJIP_Status eStatus,
+                                                 uint8_t *pcSendData, unsigned int *piSendDataLength)
+{
+    tsVar *psVar = psRequest->psVar;
+    tsJIP_Msg_VarDescriptionHeader *psGetMibResponseHeader = (tsJIP_Msg_VarDescriptionHeader *)pcSendData;
+    
+    psGetMibResponseHeader->u8MibIndex  = psVar->psOwnerMib->u8Index;
+    psGetMibResponseHeader->u8VarIndex  = psVar->u8Index;
+    psGetMibResponseHeader->eVarType    = psVar->eVarType;
+    
+    if (eStatus != E_JIP_OK)
+    {
+        /* Callback failed - send its error back */
+        psGetMibResponseHeader->eStatus = eStatus;
+        *piSendDataLength = sizeof(tsJIP_Msg_VarDescriptionHeaderError);
+        return E_JIP_OK;
+    }
+    
+    if (psVar->eVarType == E_JIP_VAR_TYPE_TABLE_BLOB)
+    {
+        if ((psVar->eEnable != E_JIP_VAR_ENABLED) || !psVar->pvData)
+        {
+            psGetMibResponseHeader->eStatus = E_JIP_ERROR_DISABLED;
+            *piSendDataLength = sizeof(tsJIP_Msg_VarDescriptionHeaderError);
+            return E_JIP_OK;
+        }
+        return eJIPserver_HandleGetTableVar(psJIP_Context, psVar, psRequest->u16FirstEntry, psRequest->u8EntryCount,
+                                            pcSendData, piSendDataLength);
+    }
+    
+    *piSendDataLength = sizeof(tsJIP_Msg_VarDescriptionHeader) - sizeof(tsJIP_Msg_VarDescriptionEntry);
+    (void)eJIPserver_AddVarData(psVar, pcSendData, piSendDataLength);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIPserver_CompleteVar(tsJIP_Context *psJIP_Context, tsVar *psVar, teJIP_Status eStatus)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNode *psNode;
+    tsServerPendingRequest *psDone = NULL, *psRequest, **ppsPosition;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    if (psJIP_Private->eJIP_ContextType != E_JIP_CONTEXT_SERVER)
+    {
+        return E_JIP_ERROR_WRONG_CONTEXT;
+    }
+    
+    /* The node lock is held from taking the requests until they are answered, so that requests the
+     * listener is still deferring under it are left for the next completion */
+    psNode = psVar->psOwnerMib->psOwnerNode;
+    eJIP_LockNode(psNode, True);
+    
+    /* The application may have finished by changing the data in place */
+    vJIP_VarDropEncoded(psVar);
+    
+    if (psVar->psExt && psVar->psExt->bInCallback)
+    {
+        /* Called by the callback itself. Its request is answered with eStatus once the callback returns */
+        psVar->psExt->eCompletedStatus = eStatus;
+    }
+    
+    eJIP_Lock(psJIP_Context);
+    ppsPosition = &psJIP_Private->psServerPending;
+    while ((psRequest = *ppsPosition) != NULL)
+    {
+        if (psRequest->psVar == psVar)
+        {
+            /* Held newest first, so this leaves psDone oldest first */
+            *ppsPosition = psRequest->psNext;
+            psRequest->psNext = psDone;
+            psDone = psRequest;
+            psJIP_Private->u32NumServerPending--;
+        }
+        else
+        {
+            ppsPosition = &psRequest->psNext;
+        }
+    }
+    eJIP_Unlock(psJIP_Context);
+    
+    if (!psDone)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: No requests waiting on variable %s\n", __FUNCTION__, psVar->pcName ? psVar->pcName : "?");
+        eJIP_UnlockNode(psNode);
+        return (psVar->psExt && psVar->psExt->bInCallback) ? E_JIP_OK : E_JIP_ERROR_FAILED;
+    }
+    
+    while (psDone)
+    {
+        uint8_t acSendData[PACKET_BUFFER_SIZE];
+        tsJIP_MsgHeader *psSendHeader = (tsJIP_MsgHeader *)acSendData;
+        unsigned int iSendDataLength = 0;
+        teJIP_Status eSendStatus = E_JIP_OK;
+        
+        psRequest = psDone;
+        psDone = psDone->psNext;
+        
+        if (eStatus == E_JIP_ERROR_TIMEOUT)
+        {
+            /* As for a callback returning a timeout straight away, don't return a response */
+            eSendStatus = E_JIP_ERROR_TIMEOUT;
+        }
+        else if (psRequest->eCommand == E_JIP_COMMAND_SET_RESPONSE)
+        {
+            tsJIP_Msg_VarStatus *psSetMibResponse = (tsJIP_Msg_VarStatus *)acSendData;
+            
+            psSetMibResponse->u8MibIndex  = psVar->psOwnerMib->u8Index;
+            psSetMibResponse->u8VarIndex  = psVar->u8Index;
+            psSetMibResponse->eStatus     = eStatus;
+            iSendDataLength = sizeof(tsJIP_Msg_VarStatus);
+        }
+        else
+        {
+            eSendStatus = eJIPserver_EncodeDeferredGet(psJIP_Context, psRequest, eStatus, acSendData, &iSendDataLength);
+        }
+        
+        if (eSendStatus == E_JIP_OK)
+        {
+            psSendHeader->u8Version = JIP_VERSION;
+            psSendHeader->eCommand  = psRequest->eCommand;
+            psSendHeader->u8Handle  = psRequest->u8Handle;
+            
+            DBG_vPrintf(DBG_JIP_SERVER, "%s: send %d bytes to ", __FUNCTION__, iSendDataLength);
+            DBG_vPrintf_IPv6Address(DBG_JIP_SERVER, psRequest->sClientAddress.sin6_addr);
+            
+            if (Network_ServerSendResponse(&psJIP_Private->sNetworkContext, &psRequest->sClientAddress, &psRequest->sNodeAddress,
+                                           psRequest->iInterface, (char *)acSendData, iSendDataLength) != E_NETWORK_OK)
+            {
+                DBG_vPrintf(DBG_JIP_SERVER, "%s: Could not send response\n", __FUNCTION__);
+            }
+        }
+        free(psRequest);
+    }
+    
+    eJIP_UnlockNode(psNode);
+    return E_JIP_OK;
+}
+
+
+teJIP_Status eJIPserver_NodeChanged(tsNode *psNode)
+{
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIP_LockNode(psNode, True);
+    vJIP_NodeDropSchema(psNode);
+    eJIP_UnlockNode(psNode);
+    return E_JIP_OK;
+}
+
+
+/** Length of a MIB or variable name in a discovery response, which has one byte for it */
+static uint8_t u8JIPserver_NameLength(const char *pcName)
+{
+    size_t iLength = strlen(pcName);
+    
+    return (iLength > UINT8_MAX) ? UINT8_MAX : (uint8_t)iLength;
+}
+
+
+static void vJIPserver_SchemaFree(tsServerSchema *psSchema)
+{
+    if (psSchema)
+    {
+        free(psSchema->pau32MibOffsets);
+        free(psSchema->pasMibs);
+        free(psSchema->pau32VarOffsets);
+        free(psSchema->pu8Entries);
+        free(psSchema);
+    }
+}
+
+
+/** Encode the QUERY_MIB and QUERY_VAR response entries for the MIBs and variables of a node.
+ *  \return New schema, or NULL if there was not enough memory
+ */
+static tsServerSchema *psJIPserver_SchemaBuild(tsNode *psNode)
+{
+    tsServerSchema *psSchema;
+    tsMib *psMib;
+    tsVar *psVar;
+    uint32_t i, u32Offset = 0;
+    uint32_t *pu32VarOffset;
+    
+    psSchema = malloc(sizeof(tsServerSchema));
+    if (!psSchema)
+    {
+        return NULL;
+    }
+    memset(psSchema, 0, sizeof(tsServerSchema));
+    psSchema->u32DeviceId = psNode->u32DeviceId;
+    
+    /* Size everything first */
+    for (psMib = psNode->psMibs; psMib; psMib = psMib->psNext)
+    {
+        psSchema->u32NumMibs++;
+        psSchema->u32NumVarOffsets++;
+        psSchema->u32Size += sizeof(tsJIP_Msg_QueryMibResponseListEntryHeader) + u8JIPserver_NameLength(psMib->pcName);
+        
+        for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+        {
+            psSchema->u32NumVarOffsets++;
+            psSchema->u32Size += sizeof(tsJIP_Msg_QueryVarResponseListEntryHeader) + sizeof(tsJIP_Msg_QueryVarResponseListEntryFooter) + 
+                                 u8JIPserver_NameLength(psVar->pcName);
+        }
+    }
+    
+    /* One more of everything, so that a node without MIBs still gets its allocations */
+    psSchema->pau32MibOffsets   = malloc(sizeof(uint32_t) * (psSchema->u32NumMibs + 1));
+    psSchema->pasMibs           = malloc(sizeof(tsServerSchemaMib) * (psSchema->u32NumMibs + 1));
+    psSchema->pau32VarOffsets   = malloc(sizeof(uint32_t) * (psSchema->u32NumVarOffsets + 1));
+    psSchema->pu8Entries        = malloc(psSchema->u32Size + 1);
+    if (!psSchema->pau32MibOffsets || !psSchema->pasMibs || !psSchema->pau32VarOffsets || !psSchema->pu8Entries)
+    {
+        vJIPserver_SchemaFree(psSchema);
+        return NULL;
+    }
+    
+    /* The MIB entries */
+    for (i = 0, psMib = psNode->psMibs; psMib; i++, psMib = psMib->psNext)
+    {
+        tsJIP_Msg_QueryMibResponseListEntryHeader* psMibResposeEntry = (tsJIP_Msg_QueryMibResponseListEntryHeader*)&psSchema->pu8Entries[u32Offset];
+        
+        psSchema->pau32MibOffsets[i] = u32Offset;
+        
+        psMibResposeEntry->u8MibIndex   = psMib->u8Index;
+        psMibResposeEntry->u32MibID     = htonl(psMib->u32MibId);
+        psMibResposeEntry->u8NameLen    = u8JIPserver_NameLength(psMib->pcName);
+        memcpy(psMibResposeEntry->acName, psMib->pcName, psMibResposeEntry->u8NameLen);
+        
+        u32Offset += sizeof(tsJIP_Msg_QueryMibResponseListEntryHeader) + psMibResposeEntry->u8NameLen;
+    }
+    psSchema->pau32MibOffsets[i] = u32Offset;
+    
+    /* Then the variable entries of each MIB */
+    pu32VarOffset = psSchema->pau32VarOffsets;
+    for (i = 0, psMib = psNode->psMibs; psMib; i++, psMib = psMib->psNext)
+    {
+        psSchema->pasMibs[i].u32NumVars      = 0;
+        psSchema->pasMibs[i].pau32VarOffsets = pu32VarOffset;
+        
+        for (psVar = psMib->psVars; psVar; psVar = psVar->psNext)
+        {
+            tsJIP_Msg_QueryVarResponseListEntryHeader* psVarResposeEntry = (tsJIP_Msg_QueryVarResponseListEntryHeader*)&psSchema->pu8Entries[u32Offset];
+            tsJIP_Msg_QueryVarResponseListEntryFooter* psVarResposeEntryFooter;
+            
+            *pu32VarOffset++ = u32Offset;
+            
+            psVarResposeEntry->u8VarIndex           = psVar->u8Index;
+            psVarResposeEntry->u8NameLen            = u8JIPserver_NameLength(psVar->pcName);
+            memcpy(psVarResposeEntry->acName, psVar->pcName, psVarResposeEntry->u8NameLen);
+            
+            psVarResposeEntryFooter = (tsJIP_Msg_QueryVarResponseListEntryFooter*)(psVarResposeEntry->acName + psVarResposeEntry->u8NameLen);
+            psVarResposeEntryFooter->eVarType       = psVar->eVarType;
+            psVarResposeEntryFooter->eAccessType    = psVar->eAccessType;
+            psVarResposeEntryFooter->eSecurity      = psVar->eSecurity;
+            
+            u32Offset += sizeof(tsJIP_Msg_QueryVarResponseListEntryHeader) + sizeof(tsJIP_Msg_QueryVarResponseListEntryFooter) + psVarResposeEntry->u8NameLen;
+            psSchema->pasMibs[i].u32NumVars++;
+        }
+        *pu32VarOffset++ = u32Offset;
+    }
+    
+    return psSchema;
+}
+
+
+/** Check whether two schemas would give the same discovery responses */
+static bool_t bJIPserver_SchemaEqual(const tsServerSchema *psA, const tsServerSchema *psB)
+{
+    uint32_t i;
+    
+    if ((psA->u32DeviceId != psB->u32DeviceId) || (psA->u32NumMibs != psB->u32NumMibs) ||
+        (psA->u32NumVarOffsets != psB->u32NumVarOffsets) || (psA->u32Size != psB->u32Size))
+    {
+        return False;
+    }
+    
+    for (i = 0; i < psA->u32NumMibs; i++)
+    {
+        if (psA->pasMibs[i].u32NumVars != psB->pasMibs[i].u32NumVars)
+        {
+            return False;
+        }
+    }
+    
+    return (memcmp(psA->pau32MibOffsets, psB->pau32MibOffsets, sizeof(uint32_t) * (psA->u32NumMibs + 1)) == 0) &&
+           (memcmp(psA->pau32VarOffsets, psB->pau32VarOffsets, sizeof(uint32_t) * psA->u32NumVarOffsets) == 0) &&
+           (memcmp(psA->pu8Entries, psB->pu8Entries, psA->u32Size) == 0);
+}
+
+
+/** Make sure that a node has its encoded discovery responses. They are encoded from the node's MIBs and variables,
+ *  and the first node's copy is then shared by every other node whose encoding comes out the same. A node whose
+ *  device ID was defined differently gets a schema of its own. Only schemas of the same device ID are compared.
+ *  Called with the node locked. Takes the context lock.
+ *  \return E_JIP_OK if the node has a schema
+ */
+static teJIP_Status eJIPserver_NodeSchema(tsJIP_Context *psJIP_Context, tsNode *psNode)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsNode_Private *psNode_Private = (tsNode_Private *)psNode->pvPriv;
+    tsServerSchema *psNewSchema, *psSchema, **ppsBucket;
+    
+    if (psNode_Private->psSchema)
+    {
+        return E_JIP_OK;
+    }
+    
+    psNewSchema = psJIPserver_SchemaBuild(psNode);
+    if (!psNewSchema)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Could not allocate schema\n", __FUNCTION__);
+        return E_JIP_ERROR_NO_MEM;
+    }
+    
+    ppsBucket = &psJIP_Private->apsServerSchemas[u32JIP_DeviceIdBucket(psNewSchema->u32DeviceId)];
+    
+    eJIP_Lock(psJIP_Context);
+    for (psSchema = *ppsBucket; psSchema; psSchema = psSchema->psNext)
+    {
+        if (bJIPserver_SchemaEqual(psSchema, psNewSchema))
+        {
+            break;
+        }
+    }
+    if (!psSchema)
+    {
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: New schema for device ID 0x%08x, %d bytes\n", __FUNCTION__, 
+                    psNewSchema->u32DeviceId, psNewSchema->u32Size);
+        psNewSchema->psNext = *ppsBucket;
+        *ppsBucket = psNewSchema;
+        psSchema = psNewSchema;
+        psNewSchema = NULL;
+    }
+    psSchema->u32RefCount++;
+    eJIP_Unlock(psJIP_Context);
+    
+    vJIPserver_SchemaFree(psNewSchema);
+    psNode_Private->psSchema = psSchema;
+    return E_JIP_OK;
+}
+
+
+void vJIPserver_ReleaseSchema(tsJIP_Context *psJIP_Context, tsServerSchema *psSchema)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsServerSchema **ppsSchema;
+    
+    eJIP_Lock(psJIP_Context);
+    if (--psSchema->u32RefCount == 0)
+    {
+        for (ppsSchema = &psJIP_Private->apsServerSchemas[u32JIP_DeviceIdBucket(psSchema->u32DeviceId)]; 
+             *ppsSchema; ppsSchema = &(*ppsSchema)->psNext)
+        {
+            if (*ppsSchema == psSchema)
+            {
+                *ppsSchema = psSchema->psNext;
+                break;
+            }
+        }
+        DBG_vPrintf(DBG_JIP_SERVER, "%s: Freeing schema for device ID 0x%08x\n", __FUNCTION__, psSchema->u32DeviceId);
+        vJIPserver_SchemaFree(psSchema);
+    }
+    eJIP_Unlock(psJIP_Context);
+}
+
 
+void vJIPserver_FreeSchemas(tsJIP_Context *psJIP_Context)
+{
+    PRIVATE_CONTEXT(psJIP_Context);
+    tsServerSchema *psSchema;
+    int i;
+    
+    DBG_vPrintf(DBG_FUNCTION_CALLS, "%s\n", __FUNCTION__);
+    
+    eJIP_Lock(psJIP_Context);
+    for (i = 0; i < JIP_DEVICEID_INDEX_BUCKETS; i++)
+    {
+        while ((psSchema = psJIP_Private->apsServerSchemas[i]) != NULL)
+        {
+            psJIP_Private->apsServerSchemas[i] = psSchema->psNext;
+            vJIPserver_SchemaFree(psSchema);
+        }
+    }
+    eJIP_Unlock(psJIP_Context);
+}
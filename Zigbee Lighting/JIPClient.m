@@ -47,6 +47,8 @@ static JIPClient * sSharedInstance;
             printf("JIP startup failed\n");
             return nil;
         }
+        // space out slider driven writes to a variable
+        eJIP_SetCoalescerInterval(&_sJIP_Context, 50);
         self.nodesArray = [NSMutableArray new];
     }
     return self;
@@ -113,6 +115,19 @@ static JIPClient * sSharedInstance;
     [self connectIPV6:pcIPv6Address port:JIP_DEFAULT_PORT];
 }
 
+static teJIP_Status discoverNodeVisit(tsNode *psNode, void *pvUser)
+{
+    // Runs with the context locked, so only take a handle. The delegate is called once the lock is released.
+    NSMutableArray *handles = (__bridge NSMutableArray *)pvUser;
+    
+    teJIP_Status eStatus = eJIP_AcquireNodeHandle(psNode);
+    
+    if (eStatus == E_JIP_OK) {
+        [handles addObject:[NSValue valueWithPointer:psNode]];
+    }
+    return eStatus;
+}
+
 - (void) discoverWithDeviceIDs:(NSArray *)deviceIDs completion:(void (^)(void))completion
 {
     if (eJIPService_DiscoverNetwork(&_sJIP_Context) != E_JIP_OK)
@@ -123,64 +138,32 @@ static JIPClient * sSharedInstance;
         }
         
     }
-    if (deviceIDs == nil) {
-        uint32_t u32NumAddresses;
-        tsJIPAddress *psAddresses;
-        
-        if (eJIP_GetNodeAddressList(&_sJIP_Context, JIP_DEVICEID_ALL, &psAddresses, &u32NumAddresses) == E_JIP_OK)
-        {
-            for (int nodeIndex = 0 ; nodeIndex < u32NumAddresses; nodeIndex++) {
-                tsNode *psNode = psJIP_LookupNode(&_sJIP_Context, &psAddresses[nodeIndex]);
-                if (!psNode)
-                {
-                    fprintf(stderr, "Node has been removed\n");
-                    continue;
-                }
-                if ([self.delegate respondsToSelector:@selector(JIPClient:didDiscoverNode:)]) {
-                    [self.delegate JIPClient:self didDiscoverNode:[[JIPNode alloc] initWithTsNode:psNode]];
-                }
-                eJIP_UnlockNode(psNode);
-                
-            }
-            free(psAddresses);
-
-        }
-        else
-        {
-            printf("Error getting node list\n\r");
-            if ([self.delegate respondsToSelector:@selector(JIPClientDidFailToDiscover:)]) {
-                [self.delegate JIPClientDidFailToDiscover:self];
-            }
+    uint32_t u32NumFilters = (uint32_t)deviceIDs.count;
+    uint32_t au32DeviceIDs[u32NumFilters > 0 ? u32NumFilters : 1];
+    
+    for (uint32_t filterIndex = 0; filterIndex < u32NumFilters; filterIndex++) {
+        au32DeviceIDs[filterIndex] = [deviceIDs[filterIndex] unsignedIntValue];
+    }
+    
+    NSMutableArray *handles = [NSMutableArray array];
+    
+    if (eJIP_ForEachNode(&_sJIP_Context, (deviceIDs == nil) ? NULL : au32DeviceIDs, u32NumFilters,
+                         discoverNodeVisit, (__bridge void *)handles) != E_JIP_OK)
+    {
+        printf("Error getting node list\n\r");
+        if ([self.delegate respondsToSelector:@selector(JIPClientDidFailToDiscover:)]) {
+            [self.delegate JIPClientDidFailToDiscover:self];
         }
-    } else {
-        for (NSNumber *idNum in deviceIDs) {
-            uint32_t u32NumAddresses;
-            tsJIPAddress *psAddresses;
-            uint32_t deviceID = [idNum unsignedIntValue];
-            if (eJIP_GetNodeAddressList(&_sJIP_Context, deviceID, &psAddresses, &u32NumAddresses) == E_JIP_OK)
-            {
-                tsNode *psNode = psJIP_LookupNode(&_sJIP_Context, &psAddresses[0]);
-                if (!psNode)
-                {
-                    fprintf(stderr, "Node has been removed\n");
-                    continue;
-                }
-                if ([self.delegate respondsToSelector:@selector(JIPClient:didDiscoverNode:)]) {
-                    [self.delegate JIPClient:self didDiscoverNode:[[JIPNode alloc] initWithTsNode:psNode]];
-                }
-                eJIP_UnlockNode(psNode);
-                free(psAddresses);
-            }
-            else
-            {
-                printf("Error getting node list\n\r");
-                if ([self.delegate respondsToSelector:@selector(JIPClientDidFailToDiscover:)]) {
-                    [self.delegate JIPClientDidFailToDiscover:self];
-                }
-                break;
-            }
-
+    }
+    
+    // Building a JIPNode locks the node, which must not be done while holding the context lock
+    for (NSValue *handle in handles) {
+        tsNode *psNode = handle.pointerValue;
+        
+        if ([self.delegate respondsToSelector:@selector(JIPClient:didDiscoverNode:)]) {
+            [self.delegate JIPClient:self didDiscoverNode:[[JIPNode alloc] initWithTsNode:psNode]];
         }
+        eJIP_ReleaseNode(psNode);
     }
     if (completion) {
         completion();
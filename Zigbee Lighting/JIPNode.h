@@ -24,6 +24,8 @@ typedef enum {
 @property (nonatomic, readonly) NSData *data;
 
 - (void) writeData:(NSData *)data;
+// returns without waiting; a newer write replaces one that has not been sent yet
+- (void) writeDataCoalesced:(NSData *)data;
 
 @end
 
@@ -48,6 +50,7 @@ typedef enum {
 @property (nonatomic, strong, readonly) NSString *address;
 @property (nonatomic, strong, readonly) NSArray *MIBs;
 
+// takes a handle on node, which must be safe to access (locked, or inside a JIP callback)
 - (instancetype)initWithTsNode:(tsNode *)node;
 - (JIPMIB *) lookupMibWithName:(NSString *)name;
 - (JIPMIB *) lookupMibWithID:(uint32_t) MibId;
@@ -60,6 +60,15 @@
     }
 }
 
+- (void) writeDataCoalesced:(NSData *)data
+{
+    if (self.enable &&
+        self.accessType == JIPVarAccessTypeReadWrite) {
+        tsJIP_Context *context = self.var->psOwnerMib->psOwnerNode->psOwnerNetwork->psOwnerContext;
+        eJIP_SetVarCoalesced(context, self.var, data.bytes, self.var->u8Size);
+    }
+}
+
 
 
 @end
@@ -148,6 +157,8 @@
 {
     self = [super init];
     if (self) {
+        // hold a handle so the node stays valid if it leaves the network
+        eJIP_AcquireNodeHandle(node);
         self.node = node;
         self.deviceID = node->u32DeviceId;
         char s[128];
@@ -157,6 +168,11 @@
     return self;
 }
 
+- (void)dealloc
+{
+    eJIP_ReleaseNode(self.node);
+}
+
 - (NSArray *)MIBs
 {
     if (self.MIBArray == nil) {
@@ -63,7 +63,7 @@
 - (void)setLum:(uint8_t)lum
 {
     JIPVar *lumTargetVar = [self.bulbControlMib lookupVarWithName:@"LumTarget"];
-    [lumTargetVar writeData:[NSData dataWithBytes:&lum length:1]];
+    [lumTargetVar writeDataCoalesced:[NSData dataWithBytes:&lum length:1]];
 }
 
 - (uint8_t)cct
@@ -79,21 +79,21 @@
 - (void)setCct:(uint8_t)cct
 {
     JIPVar *cctTargetVar = [self.bulbColour lookupVarWithName:@"ColourTempTarget"];
-    [cctTargetVar writeData:[NSData dataWithBytes:&cct length:1]];
+    [cctTargetVar writeDataCoalesced:[NSData dataWithBytes:&cct length:1]];
     
 }
 
 - (void)setHue:(uint16_t)hue
 {
     JIPVar *hueTargetVar = [self.bulbColour lookupVarWithName:@"HueTarget"];
-    [hueTargetVar writeData:[NSData dataWithBytes:&hue length:sizeof(hue)]];
+    [hueTargetVar writeDataCoalesced:[NSData dataWithBytes:&hue length:sizeof(hue)]];
     
 }
 
 - (void)setSaturation:(uint8_t)saturation
 {
     JIPVar *satTargetVar = [self.bulbColour lookupVarWithName:@"SatTarget"];
-    [satTargetVar writeData:[NSData dataWithBytes:&saturation length:sizeof(saturation)]];
+    [satTargetVar writeDataCoalesced:[NSData dataWithBytes:&saturation length:sizeof(saturation)]];
     
 }
 
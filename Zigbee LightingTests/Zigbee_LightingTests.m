@@ -8,6 +8,21 @@
 
 #import <UIKit/UIKit.h>
 #import <XCTest/XCTest.h>
+#include <malloc/malloc.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#import "JIP.h"
+#include "JIP_Private.h"
+#include "JIP_Packets.h"
+#include "Threads.h"
+
+static size_t allocatedBytes(void)
+{
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return stats.size_in_use;
+}
 
 @interface Zigbee_LightingTests : XCTestCase
 
@@ -30,6 +45,1173 @@
     XCTAssert(YES, @"Pass");
 }
 
+- (void)testNodeLockFootprint {
+    // memory used by the locks of a very large network, for each node lock type
+    const int numLocks = 10000;
+    tsLock *locks = calloc(numLocks, sizeof(tsLock));
+    size_t before, mutexBytes, stripedBytes;
+    
+    before = allocatedBytes();
+    for (int i = 0; i < numLocks; i++) {
+        eLockCreate(&locks[i]);
+    }
+    mutexBytes = allocatedBytes() - before;
+    for (int i = 0; i < numLocks; i++) {
+        eLockDestroy(&locks[i]);
+    }
+    
+    before = allocatedBytes();
+    for (int i = 0; i < numLocks; i++) {
+        eLockCreateStriped(&locks[i], &locks[i]);
+    }
+    stripedBytes = allocatedBytes() - before;
+    for (int i = 0; i < numLocks; i++) {
+        eLockDestroy(&locks[i]);
+    }
+    free(locks);
+    
+    NSLog(@"%d node locks: mutex %zu bytes (%zu per node), striped %zu bytes",
+          numLocks, mutexBytes, mutexBytes / numLocks, stripedBytes);
+    XCTAssertLessThan(stripedBytes, mutexBytes);
+}
+
+- (void)testVarFootprint {
+    // Callbacks and trap state live in tsVarExt, allocated only for variables that use them.
+    NSLog(@"sizeof(tsVar) %zu, sizeof(tsVarExt) %zu", sizeof(tsVar), sizeof(tsVarExt));
+    XCTAssertLessThanOrEqual(sizeof(tsVar), 6 * sizeof(void *));
+}
+
+- (void)testSceneApplyPerformance {
+    // A lighting scene for one group, applied as one pre-encoded request, against a multicast set per variable
+    tsJIP_Context context;
+    tsNode node = {0};
+    tsMib mib = {0};
+    tsVar vars[4] = {{0}};
+    tsSceneEntry entries[4];
+    tsJIPAddress group = {0};
+    tsScene *scene = NULL;
+    uint16_t values[4] = {200, 4000, 120, 254};
+    uint32_t unicasts, multicasts;
+    
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_CLIENT), E_JIP_OK);
+    XCTAssertEqual(eJIP_Connect(&context, "::1", JIP_DEFAULT_PORT), E_JIP_OK);
+    context.iMulticastSendCount = 1;
+    
+    eLockCreate(&node.sLock);
+    node.u32RefCount = 1;
+    mib.u32MibId = 0xfffffe04;
+    mib.psOwnerNode = &node;
+    group.sin6_family = AF_INET6;
+    group.sin6_port = htons(JIP_DEFAULT_PORT);
+    inet_pton(AF_INET6, "ff15::f00f", &group.sin6_addr);
+    
+    for (int i = 0; i < 4; i++) {
+        vars[i].psOwnerMib = &mib;
+        vars[i].u8Index = i;
+        vars[i].eVarType = E_JIP_VAR_TYPE_UINT16;
+        entries[i].psVar = &vars[i];
+        entries[i].psGroupAddress = &group;
+        entries[i].pvData = &values[i];
+        entries[i].u32Size = sizeof(uint16_t);
+    }
+    
+    XCTAssertEqual(eJIP_SceneCreate(&context, entries, 4, 2, &scene), E_JIP_OK);
+    eJIP_SceneGetPacketCounts(scene, &unicasts, &multicasts);
+    XCTAssertEqual(unicasts, 0u);
+    XCTAssertEqual(multicasts, 1u);
+    
+    const int applies = 1000;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int n = 0; n < applies; n++) {
+        for (int i = 0; i < 4; i++) {
+            eJIP_MulticastSetVar(&context, &vars[i], &values[i], sizeof(uint16_t), &group, 2);
+        }
+    }
+    CFAbsoluteTime separate = CFAbsoluteTimeGetCurrent() - start;
+    
+    start = CFAbsoluteTimeGetCurrent();
+    for (int n = 0; n < applies; n++) {
+        eJIP_SceneApply(&context, scene, NULL);
+    }
+    CFAbsoluteTime applied = CFAbsoluteTimeGetCurrent() - start;
+    
+    NSLog(@"%d scene applies: separate sets %.1fms, scene %.1fms", applies, separate * 1000, applied * 1000);
+    [self measureBlock:^{
+        for (int n = 0; n < 100; n++) {
+            eJIP_SceneApply(&context, scene, NULL);
+        }
+    }];
+    
+    eJIP_SceneDestroy(&context, scene);
+    eJIP_Destroy(&context);
+    eLockDestroy(&node.sLock);
+}
+
+static NSString *writeBenchDefinitions(NSString *fileName)
+{
+    // One device type, for servers hosting many identical nodes. The string and blob variables come as a
+    // CONST and a read-write pair. The Groups MIB lets clients learn which groups the nodes are in.
+    NSString *definitions = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    NSString *xml = @"<JIP_Cache Version=\"3\">"
+                     "<MibIdCache><Mib ID=\"0xfffffe10\"><Var Index=\"0\" Name=\"Mode\" Type=\"0\" Access=\"0\" Security=\"0\"/>"
+                     "<Var Index=\"1\" Name=\"Sequence\" Type=\"6\" Access=\"2\" Security=\"0\"/>"
+                     "<Var Index=\"2\" Name=\"Name\" Type=\"10\" Access=\"0\" Security=\"0\"/>"
+                     "<Var Index=\"3\" Name=\"Info\" Type=\"11\" Access=\"0\" Security=\"0\"/>"
+                     "<Var Index=\"4\" Name=\"Label\" Type=\"10\" Access=\"2\" Security=\"0\"/>"
+                     "<Var Index=\"5\" Name=\"Data\" Type=\"11\" Access=\"2\" Security=\"0\"/></Mib>"
+                     "<Mib ID=\"0xffffff02\"><Var Index=\"0\" Name=\"Groups\" Type=\"75\" Access=\"1\" Security=\"0\"/></Mib></MibIdCache>"
+                     "<DeviceIdCache><Device ID=\"0x0801beef\"><Mib ID=\"0xfffffe10\" Index=\"0\" Name=\"Bench\"/>"
+                     "<Mib ID=\"0xffffff02\" Index=\"1\" Name=\"Groups\"/></Device></DeviceIdCache>"
+                     "</JIP_Cache>";
+    return [xml writeToFile:definitions atomically:YES encoding:NSUTF8StringEncoding error:nil] ? definitions : nil;
+}
+
+static NSString *writeBenchNetwork(NSString *fileName, NSArray<NSString *> *addresses)
+{
+    // Nodes of the bench device for a client, reached through a border router on the loopback address
+    NSString *network = [NSTemporaryDirectory() stringByAppendingPathComponent:fileName];
+    NSMutableString *xml = [NSMutableString stringWithString:@"<JIP_Cache Version=\"3\"><Network BorderRouter=\"::1\">"];
+    for (NSString *address in addresses) {
+        [xml appendFormat:@"<Node DeviceID=\"0x0801beef\" Address=\"%@\"/>", address];
+    }
+    [xml appendString:@"</Network></JIP_Cache>"];
+    return [xml writeToFile:network atomically:YES encoding:NSUTF8StringEncoding error:nil] ? network : nil;
+}
+
+static tsVar *clientBenchVar(tsJIP_Context *context, const char *address, uint8_t varIndex)
+{
+    // A variable of a client's bench node
+    tsJIPAddress nodeAddress = {0};
+    tsNode *node;
+    tsVar *var;
+    
+    nodeAddress.sin6_family = AF_INET6;
+    nodeAddress.sin6_port = htons(JIP_DEFAULT_PORT);
+    inet_pton(AF_INET6, address, &nodeAddress.sin6_addr);
+    node = psJIP_LookupNode(context, &nodeAddress);
+    if (!node) {
+        return NULL;
+    }
+    var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), varIndex);
+    eJIP_UnlockNode(node);
+    return var;
+}
+
+- (void)testStripedLockAfterFailedAdd {
+    // A node that could not be added must not leave its shared lock stripe held for the nodes that come after it
+    NSString *definitions = writeBenchDefinitions(@"striped_definitions.xml");
+    tsJIP_Context context;
+    tsNode *node;
+    char name[] = "Bench";
+    __block int lockedStripes = 0;
+    __block teJIP_Status nodeLocked = E_JIP_ERROR_FAILED;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    context.eNodeLockType = E_JIP_NODE_LOCK_STRIPED;
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&context, "fd00::1", JIP_DEFAULT_PORT, 0x0badbeef, name, "1", NULL), E_JIP_ERROR_BAD_DEVICE_ID);
+    XCTAssertEqual(eJIPserver_NodeAdd(&context, "fd00::2", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    
+    // The stripes are recursive mutexes, so try them from another thread. The key (i << 4) hashes to stripe i
+    // of the 256 in Threads.c, which covers the stripe of the node that failed.
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        for (uintptr_t i = 0; i < 256; i++) {
+            tsLock lock;
+            eLockCreateStriped(&lock, (void *)(i << 4));
+            if (eJIPLockTryLock(&lock) == E_LOCK_OK) {
+                eJIPLockUnlock(&lock);
+            } else {
+                lockedStripes++;
+            }
+            eLockDestroy(&lock);
+        }
+        nodeLocked = eJIP_LockNode(node, False);
+        if (nodeLocked == E_JIP_OK) {
+            eJIP_UnlockNode(node);
+        }
+        dispatch_semaphore_signal(done);
+    });
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    
+    XCTAssertEqual(lockedStripes, 0);
+    XCTAssertEqual(nodeLocked, E_JIP_OK);
+    
+    eJIP_Destroy(&context);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+typedef tsNode *(*tprDispatchLookup)(tsJIP_Context *context, const struct in6_addr *address);
+
+static tsNode *scanNodeList(tsJIP_Context *context, const struct in6_addr *address)
+{
+    // How the listener found the destination node before the address index
+    tsNode *found = NULL;
+    eJIP_Lock(context);
+    for (tsNode *node = context->sNetwork.psNodes; node; node = node->psNext) {
+        if (memcmp(&node->sNode_Address.sin6_addr, address, sizeof(struct in6_addr)) == 0) {
+            found = node;
+        }
+    }
+    if (found) {
+        eJIP_AcquireNodeHandle(found);
+    }
+    eJIP_Unlock(context);
+    return found;
+}
+
+static double dispatchRate(tsJIP_Context *context, const struct in6_addr *addresses, int numNodes, tprDispatchLookup lookup)
+{
+    // Packets per second dispatched to nodes by destination address and answered, without the socket
+    const int packets = 20000;
+    tsJIP_Msg_QueryMibRequest request = {{JIP_VERSION, E_JIP_COMMAND_QUERY_MIB_REQUEST, 0}, 0, 1};
+    uint8_t response[PACKET_BUFFER_SIZE];
+    tsJIPAddress src = {0}, dst = {0};
+    int answered = 0;
+    
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int p = 0; p < packets; p++) {
+        tsNode *node = lookup(context, &addresses[(p * 7919) % numNodes]);
+        teJIP_Command command;
+        unsigned int length = sizeof(response);
+        if (!node) {
+            continue;
+        }
+        eJIP_LockNode(node, True);
+        if (eJIPserver_HandlePacket(context, node, &src, &dst, request.sHeader.eCommand, (uint8_t *)&request, sizeof(request),
+                                    &command, response, &length) == E_JIP_OK) {
+            answered++;
+        }
+        eJIP_UnlockNode(node);
+        eJIP_ReleaseNode(node);
+    }
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    
+    return (answered == packets) ? packets / elapsed : 0;
+}
+
+- (void)testServerDispatchThroughput {
+    // Unicast dispatch rate of a server hosting many nodes, through the address index against a node list scan
+    NSString *definitions = writeBenchDefinitions(@"dispatch_definitions.xml");
+    XCTAssertNotNil(definitions);
+    
+    const int nodeCounts[] = {100, 1000, 10000};
+    for (int c = 0; c < 3; c++) {
+        const int numNodes = nodeCounts[c];
+        tsJIP_Context context;
+        struct in6_addr *addresses = calloc(numNodes, sizeof(struct in6_addr));
+        char name[] = "Bench";
+        
+        XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+        XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+        for (int i = 0; i < numNodes; i++) {
+            char address[INET6_ADDRSTRLEN];
+            snprintf(address, sizeof(address), "fd00::%x:%x", (i + 1) >> 16, (i + 1) & 0xffff);
+            inet_pton(AF_INET6, address, &addresses[i]);
+            XCTAssertEqual(eJIPserver_NodeAdd(&context, address, JIP_DEFAULT_PORT, 0x0801beef, name, "1", NULL), E_JIP_OK);
+        }
+        
+        double indexed = dispatchRate(&context, addresses, numNodes, psJIP_AcquireNodeByIn6);
+        double scanned = dispatchRate(&context, addresses, numNodes, scanNodeList);
+        NSLog(@"%d nodes: address index %.0f packets/s, node list scan %.0f packets/s", numNodes, indexed, scanned);
+        XCTAssertGreaterThan(indexed, 0);
+        XCTAssertGreaterThan(scanned, 0);
+        
+        eJIP_Destroy(&context);
+        free(addresses);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+#define ORDERED_NODES 64
+
+static uint32_t orderedLastValues[ORDERED_NODES + 1];
+static volatile uint32_t orderedSets, orderedSetsOutOfOrder;
+
+static teJIP_Status orderedVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    // Called by the thread handling the node, with the node locked. Each node is sent increasing values.
+    const struct in6_addr *address = &psVar->psOwnerMib->psOwnerNode->sNode_Address.sin6_addr;
+    int node = (address->s6_addr[14] << 8) | address->s6_addr[15];
+    
+    if (*psVar->pu32Data <= orderedLastValues[node]) {
+        u32AtomicAdd(&orderedSetsOutOfOrder, 1);
+    }
+    orderedLastValues[node] = *psVar->pu32Data;
+    u32AtomicAdd(&orderedSets, 1);
+    return E_JIP_OK;
+}
+
+- (void)testServerThreadScaling {
+    // Multicast sets to a group of nodes, received by the listener and handled on 1, 2 and 4 worker threads.
+    // Every node is sent the same increasing values, and must be set to them in that order.
+    NSString *definitions = writeBenchDefinitions(@"thread_definitions.xml");
+    const int numSets = 2000;
+    unsigned int loopback = if_nametoindex("lo0");
+    double single = 0;
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertNotEqual(loopback, 0u);
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        tsJIP_Context context;
+        char name[] = "Bench";
+        int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+        struct sockaddr_in6 group = {0};
+        uint8_t request[sizeof(tsJIP_Msg_SetMibRequest) + sizeof(uint32_t)];
+        tsJIP_Msg_SetMibRequest *set = (tsJIP_Msg_SetMibRequest *)request;
+        uint32_t dropped = 0, handled = 0;
+        tsNode *nodes[ORDERED_NODES + 1];
+        
+        memset(orderedLastValues, 0, sizeof(orderedLastValues));
+        orderedSets = orderedSetsOutOfOrder = 0;
+        XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+        context.iServerThreads = threads;
+        XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+        for (int i = 1; i <= ORDERED_NODES; i++) {
+            char address[INET6_ADDRSTRLEN];
+            tsNode *node;
+            tsVar *var;
+            snprintf(address, sizeof(address), "fd00::%x", i);
+            XCTAssertEqual(eJIPserver_NodeAdd(&context, address, JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+            var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), 1);
+            eJIP_SetVar(&context, var, &orderedLastValues[i], sizeof(uint32_t));
+            var->eEnable = E_JIP_VAR_ENABLED;
+            eJIP_SetVarCallbacks(var, NULL, orderedVarSet);
+            eJIP_UnlockNode(node);
+            nodes[i] = node;
+        }
+        XCTAssertEqual(eJIPserver_Listen(&context), E_JIP_OK);
+        // The listening socket joins the group
+        for (int i = 1; i <= ORDERED_NODES; i++) {
+            eJIP_LockNode(nodes[i], True);
+            XCTAssertEqual(eJIPserver_NodeGroupJoin(nodes[i], "ff15::f00f"), E_JIP_OK);
+            eJIP_UnlockNode(nodes[i]);
+        }
+        
+        group.sin6_family = AF_INET6;
+        group.sin6_port = htons(JIP_DEFAULT_PORT);
+        group.sin6_scope_id = loopback;
+        inet_pton(AF_INET6, "ff15::f00f", &group.sin6_addr);
+        setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &loopback, sizeof(loopback));
+        
+        set->sHeader.u8Version = JIP_VERSION;
+        set->sHeader.eCommand = E_JIP_COMMAND_SET_MIB_REQUEST;
+        set->u32MibId = htonl(0xfffffe10);
+        set->sRequest.u8VarIndex = 1;
+        set->sRequest.sVar.eVarType = E_JIP_VAR_TYPE_UINT32;
+        
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent(), finish = start;
+        for (uint32_t value = 1; value <= numSets; value++) {
+            uint32_t networkValue = htonl(value);
+            memcpy(set->sRequest.sVar.au8Data, &networkValue, sizeof(networkValue));
+            sendto(sock, request, sizeof(request), 0, (struct sockaddr *)&group, sizeof(group));
+        }
+        // Wait until no more sets have been handled for half a second
+        for (int idle = 0; idle < 25; idle++) {
+            usleep(20000);
+            if (handled != u32AtomicGet(&orderedSets)) {
+                handled = u32AtomicGet(&orderedSets);
+                finish = CFAbsoluteTimeGetCurrent();
+                idle = 0;
+            }
+        }
+        eJIPserver_GetDropStats(&context, &dropped);
+        close(sock);
+        eJIP_Destroy(&context);
+        
+        double rate = handled / (finish - start);
+        if (threads == 1) {
+            single = rate;
+        }
+        NSLog(@"%d server threads: %u of %d node sets handled, %.0f sets/s (%.2fx), %u requests dropped", threads, handled,
+              numSets * ORDERED_NODES, rate, single ? rate / single : 0, dropped);
+        XCTAssertGreaterThan(handled, 0u);
+        XCTAssertEqual(orderedSetsOutOfOrder, 0u);
+    }
+    
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+static tsJIP_Context *slowContext;
+
+static teJIP_Status slowVarGet(tsVar *psVar)
+{
+    // Stands in for slow hardware: the value arrives 100ms later, from another thread
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        uint8_t u8Value = 42;
+        
+        eJIP_LockNode(psVar->psOwnerMib->psOwnerNode, True);
+        eJIP_SetVarValue(psVar, &u8Value, sizeof(u8Value));
+        eJIP_UnlockNode(psVar->psOwnerMib->psOwnerNode);
+        eJIPserver_CompleteVar(slowContext, psVar, E_JIP_OK);
+    });
+    return E_JIP_PENDING;
+}
+
+- (void)testServerDeferredGet {
+    // A get left pending by its callback must not hold up other requests, and is answered later with its own handle
+    NSString *definitions = writeBenchDefinitions(@"deferred_definitions.xml");
+    tsJIP_Context context;
+    tsNode *node;
+    tsVar *var;
+    char name[] = "Bench";
+    uint8_t u8Value = 0;
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    struct sockaddr_in6 server = {0};
+    struct timeval timeout = {1, 0};
+    tsJIP_Msg_GetMibRequest get = {{JIP_VERSION, E_JIP_COMMAND_GET_MIB_REQUEST, 7}, htonl(0xfffffe10), {0, {1}}};
+    tsJIP_Msg_QueryMibRequest query = {{JIP_VERSION, E_JIP_COMMAND_QUERY_MIB_REQUEST, 9}, 0, 1};
+    uint8_t response[PACKET_BUFFER_SIZE];
+    tsJIP_Msg_VarDescriptionHeader *header = (tsJIP_Msg_VarDescriptionHeader *)response;
+    
+    slowContext = &context;
+    XCTAssertNotNil(definitions);
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&context, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), 0);
+    eJIP_SetVarValue(var, &u8Value, sizeof(u8Value));
+    var->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_SetVarCallbacks(var, slowVarGet, NULL);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(eJIPserver_Listen(&context), E_JIP_OK);
+    
+    server.sin6_family = AF_INET6;
+    server.sin6_port = htons(JIP_DEFAULT_PORT);
+    server.sin6_addr = in6addr_loopback;
+    connect(sock, (struct sockaddr *)&server, sizeof(server));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    send(sock, &get, sizeof(get), 0);
+    send(sock, &query, sizeof(query), 0);
+    
+    XCTAssertGreaterThan(recv(sock, response, sizeof(response), 0), 0);
+    XCTAssertEqual(header->sHeader.eCommand, E_JIP_COMMAND_QUERY_MIB_RESPONSE);
+    
+    XCTAssertGreaterThan(recv(sock, response, sizeof(response), 0), 0);
+    XCTAssertEqual(header->sHeader.eCommand, E_JIP_COMMAND_GET_RESPONSE);
+    XCTAssertEqual(header->sHeader.u8Handle, 7);
+    XCTAssertEqual(header->eStatus, E_JIP_OK);
+    XCTAssertEqual(header->au8Payload[0], 42);
+    
+    close(sock);
+    eJIP_Destroy(&context);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+static unsigned int handleRequest(tsJIP_Context *context, tsNode *node, void *request, unsigned int requestLength, uint8_t *response)
+{
+    // Length of the server's response to one request, without the socket
+    tsJIPAddress src = {0}, dst = {0};
+    teJIP_Command command;
+    unsigned int length = PACKET_BUFFER_SIZE;
+    
+    eJIP_LockNode(node, True);
+    if (eJIPserver_HandlePacket(context, node, &src, &dst, ((tsJIP_MsgHeader *)request)->eCommand, request, requestLength,
+                                &command, response, &length) != E_JIP_OK) {
+        length = 0;
+    }
+    eJIP_UnlockNode(node);
+    return length;
+}
+
+static double getRate(tsJIP_Context *context, tsNode *node, uint8_t varIndex)
+{
+    // Gets per second of one variable answered by the server, without the socket
+    const int packets = 200000;
+    tsJIP_Msg_GetMibRequest request = {{JIP_VERSION, E_JIP_COMMAND_GET_MIB_REQUEST, 0}, htonl(0xfffffe10), {varIndex, {1}}};
+    uint8_t response[PACKET_BUFFER_SIZE];
+    int answered = 0;
+    
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int p = 0; p < packets; p++) {
+        if (handleRequest(context, node, &request, sizeof(request), response) > 0) {
+            answered++;
+        }
+    }
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    
+    return (answered == packets) ? packets / elapsed : 0;
+}
+
+- (void)testServerEncodedGet {
+    // Gets of unchanged CONST string and blob variables copy their last encoding. The same data in read-write
+    // variables, which are encoded on every get, is the baseline.
+    NSString *definitions = writeBenchDefinitions(@"encoded_definitions.xml");
+    tsJIP_Context context;
+    tsNode *node;
+    tsVar *vars[6];
+    char name[] = "Bench";
+    char text[129];
+    uint8_t blob[128];
+    tsJIP_Msg_GetMibRequest get = {{JIP_VERSION, E_JIP_COMMAND_GET_MIB_REQUEST, 0}, htonl(0xfffffe10), {2, {1}}};
+    uint8_t request[sizeof(tsJIP_Msg_SetMibRequest) + 4];
+    tsJIP_Msg_SetMibRequest *set = (tsJIP_Msg_SetMibRequest *)request;
+    uint8_t response[PACKET_BUFFER_SIZE];
+    tsJIP_Msg_VarDescriptionHeader *header = (tsJIP_Msg_VarDescriptionHeader *)response;
+    
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    for (int i = 0; i < (int)sizeof(blob); i++) {
+        blob[i] = i;
+    }
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&context, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    for (int v = 2; v < 6; v++) {
+        vars[v] = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), v);
+        vars[v]->eEnable = E_JIP_VAR_ENABLED;
+        if (vars[v]->eVarType == E_JIP_VAR_TYPE_STR) {
+            XCTAssertEqual(eJIP_SetVar(&context, vars[v], text, strlen(text)), E_JIP_OK);
+        } else {
+            XCTAssertEqual(eJIP_SetVar(&context, vars[v], blob, sizeof(blob)), E_JIP_OK);
+        }
+    }
+    
+    for (int v = 2; v < 4; v++) {
+        double kept = getRate(&context, node, v);
+        double encoded = getRate(&context, node, v + 2);
+        NSLog(@"%s: kept encoding %.0f gets/s, encoded every time %.0f gets/s", vars[v]->pcName, kept, encoded);
+        XCTAssertGreaterThan(kept, 0);
+        XCTAssertGreaterThan(encoded, 0);
+    }
+    
+    // eJIP_SetVarValue drops the kept encoding of the string
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertNotEqual(vars[2]->psExt->pu8Encoded, NULL);
+    eJIP_LockNode(node, True);
+    XCTAssertEqual(eJIP_SetVarValue(vars[2], "new", sizeof("new")), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(vars[2]->psExt->pu8Encoded, NULL);
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(header->au8Payload[0], 3);
+    XCTAssertEqual(memcmp(&header->au8Payload[1], "new", 3), 0);
+    
+    // So does changing the size of the blob
+    get.sRequest.u8VarIndex = 3;
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(header->au8Payload[0], sizeof(blob));
+    vars[3]->u8Size = 64;
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(header->au8Payload[0], 64);
+    XCTAssertEqual(memcmp(&header->au8Payload[1], blob, 64), 0);
+    
+    // A client can't set the CONST string, so the kept encoding stays right
+    set->sHeader.u8Version = JIP_VERSION;
+    set->sHeader.eCommand = E_JIP_COMMAND_SET_MIB_REQUEST;
+    set->u32MibId = htonl(0xfffffe10);
+    set->sRequest.u8VarIndex = 2;
+    set->sRequest.sVar.eVarType = E_JIP_VAR_TYPE_STR;
+    set->sRequest.sVar.au8Data[0] = 3;
+    memcpy(&set->sRequest.sVar.au8Data[1], "set", 3);
+    XCTAssertGreaterThan(handleRequest(&context, node, request, sizeof(request), response), 0u);
+    XCTAssertEqual(((tsJIP_Msg_VarStatus *)response)->eStatus, E_JIP_ERROR_NO_ACCESS);
+    get.sRequest.u8VarIndex = 2;
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(memcmp(&header->au8Payload[1], "new", 3), 0);
+    
+    // A read-write string set by a client, or written in place, is sent with its new value
+    set->sRequest.u8VarIndex = 4;
+    XCTAssertGreaterThan(handleRequest(&context, node, request, sizeof(request), response), 0u);
+    XCTAssertEqual(((tsJIP_Msg_VarStatus *)response)->eStatus, E_JIP_OK);
+    get.sRequest.u8VarIndex = 4;
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(header->au8Payload[0], 3);
+    XCTAssertEqual(memcmp(&header->au8Payload[1], "set", 3), 0);
+    vars[4]->pcData[0] = 'S';
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(memcmp(&header->au8Payload[1], "Set", 3), 0);
+    
+    eJIP_Destroy(&context);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+static tsJIP_Context *completingContext;
+static teJIP_Status completingStatus;
+
+static teJIP_Status completingVarGet(tsVar *psVar)
+{
+    // Finishes straight away, but only after saying it will finish later
+    uint32_t value = 99;
+    eJIP_SetVarValue(psVar, &value, sizeof(value));
+    eJIPserver_CompleteVar(completingContext, psVar, completingStatus);
+    return E_JIP_PENDING;
+}
+
+static teJIP_Status completingVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    eJIPserver_CompleteVar(completingContext, psVar, completingStatus);
+    return E_JIP_PENDING;
+}
+
+static teJIP_Status pendingVarGet(tsVar *psVar)
+{
+    return E_JIP_PENDING;
+}
+
+- (void)testServerPendingRequests {
+    // Callbacks that complete their variable before returning E_JIP_PENDING are answered straight away,
+    // and requests waiting on a MIB go with it when it is freed
+    NSString *definitions = writeBenchDefinitions(@"pending_definitions.xml");
+    tsJIP_Context context;
+    tsJIP_Private *private;
+    tsNode *node;
+    tsMib *mib;
+    tsVar *var;
+    char name[] = "Bench";
+    uint32_t value = 0;
+    tsJIP_Msg_GetMibRequest get = {{JIP_VERSION, E_JIP_COMMAND_GET_MIB_REQUEST, 0}, htonl(0xfffffe10), {1, {1}}};
+    uint8_t request[sizeof(tsJIP_Msg_SetMibRequest) + sizeof(uint32_t)];
+    tsJIP_Msg_SetMibRequest *set = (tsJIP_Msg_SetMibRequest *)request;
+    uint8_t response[PACKET_BUFFER_SIZE];
+    tsJIP_Msg_VarDescriptionHeader *header = (tsJIP_Msg_VarDescriptionHeader *)response;
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    private = (tsJIP_Private *)context.pvPriv;
+    completingContext = &context;
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&context, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    mib = psJIP_LookupMibId(node, NULL, 0xfffffe10);
+    var = psJIP_LookupVarIndex(mib, 1);
+    eJIP_SetVarValue(var, &value, sizeof(value));
+    var->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_SetVarCallbacks(var, completingVarGet, completingVarSet);
+    eJIP_UnlockNode(node);
+    
+    completingStatus = E_JIP_OK;
+    XCTAssertGreaterThan(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(header->eStatus, E_JIP_OK);
+    XCTAssertEqual(ntohl(*(uint32_t *)header->au8Payload), 99u);
+    XCTAssertEqual(private->u32NumServerPending, 0u);
+    
+    set->sHeader.u8Version = JIP_VERSION;
+    set->sHeader.eCommand = E_JIP_COMMAND_SET_MIB_REQUEST;
+    set->u32MibId = htonl(0xfffffe10);
+    set->sRequest.u8VarIndex = 1;
+    set->sRequest.sVar.eVarType = E_JIP_VAR_TYPE_UINT32;
+    memset(set->sRequest.sVar.au8Data, 0, sizeof(uint32_t));
+    completingStatus = E_JIP_ERROR_FAILED;
+    XCTAssertGreaterThan(handleRequest(&context, node, request, sizeof(request), response), 0u);
+    XCTAssertEqual(((tsJIP_Msg_VarStatus *)response)->eStatus, E_JIP_ERROR_FAILED);
+    XCTAssertEqual(private->u32NumServerPending, 0u);
+    
+    // A get that really waits is held until the MIB is freed
+    eJIP_SetVarCallbacks(var, pendingVarGet, NULL);
+    XCTAssertEqual(handleRequest(&context, node, &get, sizeof(get), response), 0u);
+    XCTAssertEqual(private->u32NumServerPending, 1u);
+    eJIP_LockNode(node, True);
+    for (tsMib **position = &node->psMibs; *position; position = &(*position)->psNext) {
+        if (*position == mib) {
+            *position = mib->psNext;
+            node->u32NumMibs--;
+            break;
+        }
+    }
+    XCTAssertEqual(eJIP_FreeMib(&context, mib), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(private->u32NumServerPending, 0u);
+    XCTAssertTrue(private->psServerPending == NULL);
+    
+    eJIP_Destroy(&context);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
+- (void)testMulticastGetVar {
+    // A client reads a variable from a group with one request, and the member's response updates its copy
+    NSString *definitions = writeBenchDefinitions(@"group_get_definitions.xml");
+    NSString *network = writeBenchNetwork(@"group_get_network.xml", @[@"::1"]);
+    tsJIP_Context server, client;
+    tsNode *node;
+    tsVar *var, *clientVar;
+    char name[] = "Bench";
+    uint32_t value = 1234, zero = 0, numResults = 0, dropped = 0;
+    tsGroupGetResult results[4];
+    tsJIPAddress group = {0};
+    unsigned int loopback = if_nametoindex("lo0");
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertNotNil(network);
+    XCTAssertEqual(eJIP_Init(&server, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&server, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&server, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), 1);
+    XCTAssertEqual(eJIP_SetVarValue(var, &value, sizeof(value)), E_JIP_OK);
+    var->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(eJIPserver_Listen(&server), E_JIP_OK);
+    eJIP_LockNode(node, True);
+    XCTAssertEqual(eJIPserver_NodeGroupJoin(node, "ff15::f00f"), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    
+    XCTAssertEqual(eJIP_Init(&client, E_JIP_CONTEXT_CLIENT), E_JIP_OK);
+    XCTAssertEqual(eJIP_Connect(&client, "::1", JIP_DEFAULT_PORT), E_JIP_OK);
+    client.iMulticastInterface = loopback;
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&client, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadNetwork(&client, network.fileSystemRepresentation), E_JIP_OK);
+    clientVar = clientBenchVar(&client, "::1", 1);
+    XCTAssertTrue(clientVar != NULL);
+    
+    group.sin6_family = AF_INET6;
+    group.sin6_port = htons(JIP_DEFAULT_PORT);
+    group.sin6_scope_id = loopback;
+    inet_pton(AF_INET6, "ff15::f00f", &group.sin6_addr);
+    
+    XCTAssertEqual(eJIP_MulticastGetVar(&client, clientVar, &group, 1, 200, results, 4, &numResults), E_JIP_OK);
+    XCTAssertEqual(numResults, 1u);
+    XCTAssertEqual(results[0].eStatus, E_JIP_OK);
+    XCTAssertTrue(results[0].bUpdated);
+    XCTAssertTrue(clientVar->pu32Data != NULL);
+    XCTAssertEqual(*clientVar->pu32Data, value);
+    
+    // A server holding as many responses as it may drops the response, and counts it
+    server.iServerMaxDeferred = 0;
+    eJIP_LockNode(clientVar->psOwnerMib->psOwnerNode, True);
+    eJIP_SetVarValue(clientVar, &zero, sizeof(zero));
+    eJIP_UnlockNode(clientVar->psOwnerMib->psOwnerNode);
+    XCTAssertEqual(eJIP_MulticastGetVar(&client, clientVar, &group, 1, 0, results, 4, &numResults), E_JIP_OK);
+    XCTAssertEqual(numResults, 0u);
+    XCTAssertEqual(*clientVar->pu32Data, zero);
+    XCTAssertEqual(eJIPserver_GetDropStats(&server, &dropped), E_JIP_OK);
+    XCTAssertEqual(dropped, 1u);
+    
+    eJIP_Destroy(&client);
+    eJIP_Destroy(&server);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:network error:nil];
+}
+
+static bool serverVarEquals(tsVar *var, const void *value, uint32_t size)
+{
+    // Waits up to a second for a variable of a listening server to take a value
+    bool equal = false;
+    for (int wait = 0; !equal && (wait < 100); wait++) {
+        eJIP_LockNode(var->psOwnerMib->psOwnerNode, True);
+        equal = var->pvData && (memcmp(var->pvData, value, size) == 0);
+        eJIP_UnlockNode(var->psOwnerMib->psOwnerNode);
+        if (!equal) {
+            usleep(10000);
+        }
+    }
+    return equal;
+}
+
+- (void)testSceneApplyToServer {
+    // A scene applied to a listening server, first by one unicast carrying every setting, then merged into a
+    // multicast to a group the node has joined once multicasts are cheap enough. A SET_MULTI is applied
+    // whole or not at all.
+    NSString *definitions = writeBenchDefinitions(@"scene_definitions.xml");
+    NSString *network = writeBenchNetwork(@"scene_network.xml", @[@"::1"]);
+    tsJIP_Context server, client;
+    tsNode *node;
+    tsVar *vars[5], *clientVars[5], *groupsVar;
+    char name[] = "Bench";
+    uint32_t initial = 1, sequence = 1234, groupSequence = 5678, unicasts, multicasts;
+    char label[] = "scene", groupLabel[] = "group", constName[] = "const", changedName[] = "x";
+    tsSceneEntry entries[3] = {{0}};
+    teJIP_Status statuses[3];
+    tsScene *scene = NULL;
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertNotNil(network);
+    XCTAssertEqual(eJIP_Init(&server, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&server, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&server, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    for (int v = 1; v < 5; v++) {
+        vars[v] = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), v);
+        vars[v]->eEnable = E_JIP_VAR_ENABLED;
+    }
+    XCTAssertEqual(eJIP_SetVarValue(vars[1], &initial, sizeof(initial)), E_JIP_OK);
+    XCTAssertEqual(eJIP_SetVar(&server, vars[2], constName, strlen(constName)), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(eJIPserver_Listen(&server), E_JIP_OK);
+    eJIP_LockNode(node, True);
+    XCTAssertEqual(eJIPserver_NodeGroupJoin(node, "ff15::f00f"), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    
+    XCTAssertEqual(eJIP_Init(&client, E_JIP_CONTEXT_CLIENT), E_JIP_OK);
+    XCTAssertEqual(eJIP_Connect(&client, "::1", JIP_DEFAULT_PORT), E_JIP_OK);
+    client.iMulticastInterface = if_nametoindex("lo0");
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&client, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadNetwork(&client, network.fileSystemRepresentation), E_JIP_OK);
+    for (int v = 1; v < 5; v++) {
+        clientVars[v] = clientBenchVar(&client, "::1", v);
+        XCTAssertTrue(clientVars[v] != NULL);
+    }
+    groupsVar = psJIP_LookupVarIndex(psJIP_LookupMibId(clientVars[1]->psOwnerMib->psOwnerNode, NULL, JIP_GROUPS_MIB_ID), 0);
+    XCTAssertTrue(groupsVar != NULL);
+    XCTAssertEqual(eJIP_GetVar(&client, groupsVar), E_JIP_OK);
+    
+    entries[0].psVar = clientVars[1];
+    entries[0].pvData = &sequence;
+    entries[0].u32Size = sizeof(sequence);
+    entries[1].psVar = clientVars[4];
+    entries[1].pvData = label;
+    entries[1].u32Size = strlen(label);
+    entries[2].psVar = clientVars[2];
+    entries[2].pvData = changedName;
+    entries[2].u32Size = strlen(changedName);
+    
+    // Flooding the network is made to cost more than the unicast, so every setting goes in one SET_MULTI.
+    // The CONST variable can't be set, so none of them are.
+    client.iMulticastSendCount = 1000;
+    XCTAssertEqual(eJIP_SceneCreate(&client, entries, 3, 2, &scene), E_JIP_OK);
+    eJIP_SceneGetPacketCounts(scene, &unicasts, &multicasts);
+    XCTAssertEqual(unicasts, 1u);
+    XCTAssertEqual(multicasts, 0u);
+    XCTAssertEqual(eJIP_SceneApply(&client, scene, statuses), E_JIP_ERROR_FAILED);
+    XCTAssertEqual(statuses[0], E_JIP_ERROR_FAILED);
+    XCTAssertEqual(statuses[1], E_JIP_ERROR_FAILED);
+    XCTAssertEqual(statuses[2], E_JIP_ERROR_NO_ACCESS);
+    eJIP_SceneDestroy(&client, scene);
+    XCTAssertTrue(serverVarEquals(vars[1], &initial, sizeof(initial)));
+    XCTAssertTrue(serverVarEquals(vars[2], constName, sizeof(constName)));
+    XCTAssertTrue(clientVars[1]->pvData == NULL);
+    
+    XCTAssertEqual(eJIP_SceneCreate(&client, entries, 2, 2, &scene), E_JIP_OK);
+    eJIP_SceneGetPacketCounts(scene, &unicasts, &multicasts);
+    XCTAssertEqual(unicasts, 1u);
+    XCTAssertEqual(eJIP_SceneApply(&client, scene, statuses), E_JIP_OK);
+    XCTAssertEqual(statuses[0], E_JIP_OK);
+    XCTAssertEqual(statuses[1], E_JIP_OK);
+    eJIP_SceneDestroy(&client, scene);
+    XCTAssertTrue(serverVarEquals(vars[1], &sequence, sizeof(sequence)));
+    XCTAssertTrue(serverVarEquals(vars[4], label, sizeof(label)));
+    XCTAssertTrue(clientVars[1]->pu32Data && (*clientVars[1]->pu32Data == sequence));
+    XCTAssertTrue(clientVars[4]->pcData && (strcmp(clientVars[4]->pcData, label) == 0));
+    
+    // With one copy of each multicast, the group is cheaper than the unicast for both settings
+    client.iMulticastSendCount = 1;
+    entries[0].pvData = &groupSequence;
+    entries[1].pvData = groupLabel;
+    entries[1].u32Size = strlen(groupLabel);
+    XCTAssertEqual(eJIP_SceneCreate(&client, entries, 2, 2, &scene), E_JIP_OK);
+    eJIP_SceneGetPacketCounts(scene, &unicasts, &multicasts);
+    XCTAssertEqual(unicasts, 0u);
+    XCTAssertEqual(multicasts, 1u);
+    XCTAssertEqual(eJIP_SceneApply(&client, scene, NULL), E_JIP_OK);
+    eJIP_SceneDestroy(&client, scene);
+    
+    XCTAssertTrue(serverVarEquals(vars[1], &groupSequence, sizeof(groupSequence)));
+    XCTAssertTrue(serverVarEquals(vars[4], groupLabel, sizeof(groupLabel)));
+    
+    eJIP_Destroy(&client);
+    eJIP_Destroy(&server);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:network error:nil];
+}
+
+static volatile bool coalescerBusy, coalescerLabelSet;
+
+static teJIP_Status busyVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    // Holds the set sender on one set while the test queues more values
+    coalescerBusy = true;
+    usleep(100000);
+    return E_JIP_OK;
+}
+
+static teJIP_Status sequenceVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    // Stands in for a slow network, so that a new value is always written while one is being sent
+    usleep(5000);
+    return E_JIP_OK;
+}
+
+static teJIP_Status labelVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    // Tells the test without it taking the node lock, which would slow down its writes
+    coalescerLabelSet = true;
+    return E_JIP_OK;
+}
+
+- (void)testSetCoalescerFairness {
+    // A variable written faster than it can be sent must not keep another variable's value from being sent
+    NSString *definitions = writeBenchDefinitions(@"coalescer_definitions.xml");
+    NSString *network = writeBenchNetwork(@"coalescer_network.xml", @[@"::1"]);
+    tsJIP_Context server, client;
+    tsNode *node;
+    tsVar *vars[6], *clientVars[6];
+    char name[] = "Bench";
+    char label[] = "turn", nextLabel[] = "again";
+    uint32_t data = 0, sent = 0, superseded = 0;
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertNotNil(network);
+    XCTAssertEqual(eJIP_Init(&server, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&server, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&server, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    for (int v = 1; v < 6; v++) {
+        vars[v] = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), v);
+        vars[v]->eEnable = E_JIP_VAR_ENABLED;
+    }
+    eJIP_SetVarCallbacks(vars[1], NULL, sequenceVarSet);
+    eJIP_SetVarCallbacks(vars[4], NULL, labelVarSet);
+    eJIP_SetVarCallbacks(vars[5], NULL, busyVarSet);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(eJIPserver_Listen(&server), E_JIP_OK);
+    
+    XCTAssertEqual(eJIP_Init(&client, E_JIP_CONTEXT_CLIENT), E_JIP_OK);
+    XCTAssertEqual(eJIP_Connect(&client, "::1", JIP_DEFAULT_PORT), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&client, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadNetwork(&client, network.fileSystemRepresentation), E_JIP_OK);
+    for (int v = 1; v < 6; v++) {
+        clientVars[v] = clientBenchVar(&client, "::1", v);
+        XCTAssertTrue(clientVars[v] != NULL);
+    }
+    
+    // While the sender is busy, the label is queued, then the sequence, which is then written continuously
+    coalescerBusy = false;
+    coalescerLabelSet = false;
+    XCTAssertEqual(eJIP_SetVarCoalesced(&client, clientVars[5], &data, sizeof(data)), E_JIP_OK);
+    for (int wait = 0; !coalescerBusy && (wait < 100); wait++) {
+        usleep(10000);
+    }
+    XCTAssertTrue(coalescerBusy);
+    XCTAssertEqual(eJIP_SetVarCoalesced(&client, clientVars[4], label, strlen(label)), E_JIP_OK);
+    
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (uint32_t sequence = 1; !coalescerLabelSet && (CFAbsoluteTimeGetCurrent() - start < 2.0); sequence++) {
+        XCTAssertEqual(eJIP_SetVarCoalesced(&client, clientVars[1], &sequence, sizeof(sequence)), E_JIP_OK);
+        usleep(1000);
+    }
+    NSLog(@"Label sent after %.1f ms of continuous sets", (CFAbsoluteTimeGetCurrent() - start) * 1000);
+    XCTAssertTrue(coalescerLabelSet);
+    eJIP_LockNode(node, True);
+    XCTAssertTrue(vars[4]->pcData && (strcmp(vars[4]->pcData, label) == 0));
+    eJIP_UnlockNode(node);
+    
+    // The sequence is now ahead of a new label in the list, and has to give way to it after its turn
+    coalescerLabelSet = false;
+    XCTAssertEqual(eJIP_SetVarCoalesced(&client, clientVars[4], nextLabel, strlen(nextLabel)), E_JIP_OK);
+    start = CFAbsoluteTimeGetCurrent();
+    for (uint32_t sequence = 1; !coalescerLabelSet && (CFAbsoluteTimeGetCurrent() - start < 2.0); sequence++) {
+        XCTAssertEqual(eJIP_SetVarCoalesced(&client, clientVars[1], &sequence, sizeof(sequence)), E_JIP_OK);
+        usleep(1000);
+    }
+    XCTAssertTrue(coalescerLabelSet);
+    eJIP_LockNode(node, True);
+    XCTAssertTrue(vars[4]->pcData && (strcmp(vars[4]->pcData, nextLabel) == 0));
+    eJIP_UnlockNode(node);
+    
+    XCTAssertEqual(eJIP_SetCoalescerStats(&client, &sent, &superseded), E_JIP_OK);
+    XCTAssertGreaterThan(superseded, 0u);
+    
+    eJIP_Destroy(&client);
+    eJIP_Destroy(&server);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:network error:nil];
+}
+
+#define VERIFIED_ROUNDS 20
+#define VERIFIED_LOSS_INTERVAL 10
+
+static uint32_t lossyValue;
+static volatile uint32_t lossyMulticastSets, lossyUnicastSets, lossyGets;
+
+static teJIP_Status lossyVarSet(tsVar *psVar, tsJIPAddress *psMulticastAddress)
+{
+    // Stands in for a radio link that loses one multicast in ten: the value the node missed is put back
+    if (psMulticastAddress) {
+        lossyMulticastSets++;
+        if ((lossyMulticastSets % VERIFIED_LOSS_INTERVAL) == 0) {
+            eJIP_SetVarValue(psVar, &lossyValue, sizeof(lossyValue));
+            return E_JIP_OK;
+        }
+    } else {
+        lossyUnicastSets++;
+    }
+    lossyValue = *psVar->pu32Data;
+    return E_JIP_OK;
+}
+
+static teJIP_Status countingVarGet(tsVar *psVar)
+{
+    lossyGets++;
+    return E_JIP_OK;
+}
+
+- (void)testMulticastSetVarConverges {
+    // A verified group set leaves every member with the value when some multicasts are lost. Each round reads
+    // the value back with one group GET, so only the members that missed it cost a unicast.
+    NSString *definitions = writeBenchDefinitions(@"verified_definitions.xml");
+    NSString *network = writeBenchNetwork(@"verified_network.xml", @[@"::1"]);
+    tsJIP_Context server, client;
+    tsNode *node;
+    tsVar *var, *clientVar, *groupsVar;
+    char name[] = "Bench";
+    uint32_t initial = 0, repaired = 0;
+    tsGroupSetResult results[4];
+    tsGroupSetReport report;
+    tsJIPAddress group = {0};
+    unsigned int loopback = if_nametoindex("lo0");
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertNotNil(network);
+    XCTAssertEqual(eJIP_Init(&server, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&server, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPserver_NodeAdd(&server, "::1", JIP_DEFAULT_PORT, 0x0801beef, name, "1", &node), E_JIP_OK);
+    var = psJIP_LookupVarIndex(psJIP_LookupMibId(node, NULL, 0xfffffe10), 1);
+    XCTAssertEqual(eJIP_SetVarValue(var, &initial, sizeof(initial)), E_JIP_OK);
+    var->eEnable = E_JIP_VAR_ENABLED;
+    eJIP_SetVarCallbacks(var, countingVarGet, lossyVarSet);
+    eJIP_UnlockNode(node);
+    XCTAssertEqual(eJIPserver_Listen(&server), E_JIP_OK);
+    eJIP_LockNode(node, True);
+    XCTAssertEqual(eJIPserver_NodeGroupJoin(node, "ff15::f00f"), E_JIP_OK);
+    eJIP_UnlockNode(node);
+    
+    XCTAssertEqual(eJIP_Init(&client, E_JIP_CONTEXT_CLIENT), E_JIP_OK);
+    XCTAssertEqual(eJIP_Connect(&client, "::1", JIP_DEFAULT_PORT), E_JIP_OK);
+    client.iMulticastInterface = loopback;
+    client.iMulticastSendCount = 1;
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&client, definitions.fileSystemRepresentation), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadNetwork(&client, network.fileSystemRepresentation), E_JIP_OK);
+    clientVar = clientBenchVar(&client, "::1", 1);
+    XCTAssertTrue(clientVar != NULL);
+    groupsVar = psJIP_LookupVarIndex(psJIP_LookupMibId(clientVar->psOwnerMib->psOwnerNode, NULL, JIP_GROUPS_MIB_ID), 0);
+    XCTAssertTrue(groupsVar != NULL);
+    XCTAssertEqual(eJIP_GetVar(&client, groupsVar), E_JIP_OK);
+    
+    group.sin6_family = AF_INET6;
+    group.sin6_port = htons(JIP_DEFAULT_PORT);
+    group.sin6_scope_id = loopback;
+    inet_pton(AF_INET6, "ff15::f00f", &group.sin6_addr);
+    
+    lossyValue = initial;
+    lossyMulticastSets = lossyUnicastSets = lossyGets = 0;
+    for (uint32_t round = 1; round <= VERIFIED_ROUNDS; round++) {
+        uint32_t value = 1000 + round;
+        
+        XCTAssertEqual(eJIP_MulticastSetVarVerified(&client, clientVar, &value, sizeof(value), &group, 1, results, 4, &report), E_JIP_OK);
+        XCTAssertEqual(report.u32Members, 1u);
+        XCTAssertEqual(report.u32Converged + report.u32Repaired, 1u);
+        XCTAssertEqual(report.u32Failed, 0u);
+        XCTAssertEqual(results[0].eStatus, E_JIP_OK);
+        XCTAssertEqual(results[0].bRepaired, (round % VERIFIED_LOSS_INTERVAL) == 0);
+        repaired += report.u32Repaired;
+        
+        // The server has the value, and the read back has brought the client's copy up to date
+        XCTAssertTrue(serverVarEquals(var, &value, sizeof(value)));
+        XCTAssertTrue(clientVar->pu32Data && (*clientVar->pu32Data == value));
+    }
+    
+    // One multicast set and one group read per round, and a unicast set only for each lost multicast
+    NSLog(@"%u rounds: %u multicast sets, %u group reads, %u unicast sets (%.0f%% of requests unicast)", VERIFIED_ROUNDS,
+          lossyMulticastSets, lossyGets, lossyUnicastSets, 100.0 * lossyUnicastSets / (lossyMulticastSets + lossyGets + lossyUnicastSets));
+    XCTAssertEqual(lossyMulticastSets, (uint32_t)VERIFIED_ROUNDS);
+    XCTAssertEqual(lossyGets, (uint32_t)VERIFIED_ROUNDS);
+    XCTAssertEqual(lossyUnicastSets, (uint32_t)(VERIFIED_ROUNDS / VERIFIED_LOSS_INTERVAL));
+    XCTAssertEqual(repaired, lossyUnicastSets);
+    
+    eJIP_Destroy(&client);
+    eJIP_Destroy(&server);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:network error:nil];
+}
+
+#define SCHEMA_NODES 1000
+
+static int serverSchemaCount(tsJIP_Context *context)
+{
+    tsJIP_Private *private = (tsJIP_Private *)context->pvPriv;
+    int count = 0;
+    for (int i = 0; i < JIP_DEVICEID_INDEX_BUCKETS; i++) {
+        for (tsServerSchema *schema = private->apsServerSchemas[i]; schema; schema = schema->psNext) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static tsServerSchema *nodeSchema(tsNode *node)
+{
+    return ((tsNode_Private *)node->pvPriv)->psSchema;
+}
+
+- (void)testServerDiscoverySchemas {
+    // Nodes defined alike share one encoding of their discovery responses, which is freed with the last of them
+    NSString *definitions = writeBenchDefinitions(@"schema_definitions.xml");
+    tsJIP_Context context;
+    static tsNode *nodes[SCHEMA_NODES];
+    char name[] = "Bench";
+    tsJIP_Msg_QueryMibRequest queryMib = {{JIP_VERSION, E_JIP_COMMAND_QUERY_MIB_REQUEST, 0}, 0, 255};
+    tsJIP_Msg_QueryVarRequest queryVar = {{JIP_VERSION, E_JIP_COMMAND_QUERY_VAR_REQUEST, 0}, 0, 0, 255};
+    uint8_t response[PACKET_BUFFER_SIZE], first[PACKET_BUFFER_SIZE];
+    unsigned int length, firstLength;
+    tsJIP_Msg_QueryVarResponseHeader *varHeader = (tsJIP_Msg_QueryVarResponseHeader *)response;
+    tsMib *mib;
+    
+    XCTAssertNotNil(definitions);
+    XCTAssertEqual(eJIP_Init(&context, E_JIP_CONTEXT_SERVER), E_JIP_OK);
+    XCTAssertEqual(eJIPService_PersistXMLLoadDefinitions(&context, definitions.fileSystemRepresentation), E_JIP_OK);
+    
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int i = 0; i < SCHEMA_NODES; i++) {
+        char address[INET6_ADDRSTRLEN];
+        snprintf(address, sizeof(address), "fd00::%x", i + 1);
+        XCTAssertEqual(eJIPserver_NodeAdd(&context, address, JIP_DEFAULT_PORT, 0x0801beef, name, "1", &nodes[i]), E_JIP_OK);
+        eJIP_UnlockNode(nodes[i]);
+    }
+    NSLog(@"%d nodes added in %.1f ms", SCHEMA_NODES, (CFAbsoluteTimeGetCurrent() - start) * 1000);
+    XCTAssertEqual(serverSchemaCount(&context), 1);
+    XCTAssertEqual(nodeSchema(nodes[0])->u32RefCount, (uint32_t)SCHEMA_NODES);
+    
+    // Every node gives the same answer. The header is filled in by the listener.
+    firstLength = handleRequest(&context, nodes[0], &queryMib, sizeof(queryMib), first);
+    XCTAssertGreaterThan(firstLength, sizeof(tsJIP_Msg_QueryMibResponseHeader));
+    XCTAssertEqual(((tsJIP_Msg_QueryMibResponseHeader *)first)->eStatus, E_JIP_OK);
+    length = handleRequest(&context, nodes[SCHEMA_NODES - 1], &queryMib, sizeof(queryMib), response);
+    XCTAssertEqual(length, firstLength);
+    XCTAssertEqual(memcmp(&response[sizeof(tsJIP_MsgHeader)], &first[sizeof(tsJIP_MsgHeader)], length - sizeof(tsJIP_MsgHeader)), 0);
+    
+    // A node told it has changed drops its reference, and takes it again on the next discovery request
+    XCTAssertEqual(eJIPserver_NodeChanged(nodes[0]), E_JIP_OK);
+    XCTAssertTrue(nodeSchema(nodes[0]) == NULL);
+    XCTAssertEqual(nodeSchema(nodes[1])->u32RefCount, (uint32_t)SCHEMA_NODES - 1);
+    XCTAssertEqual(handleRequest(&context, nodes[0], &queryMib, sizeof(queryMib), response), firstLength);
+    XCTAssertEqual(memcmp(&response[sizeof(tsJIP_MsgHeader)], &first[sizeof(tsJIP_MsgHeader)], firstLength - sizeof(tsJIP_MsgHeader)), 0);
+    XCTAssertEqual(serverSchemaCount(&context), 1);
+    XCTAssertEqual(nodeSchema(nodes[0])->u32RefCount, (uint32_t)SCHEMA_NODES);
+    
+    // A node given another variable gets a schema of its own, and is not answered from the shared one
+    eJIP_LockNode(nodes[1], True);
+    mib = psJIP_LookupMibId(nodes[1], NULL, 0xfffffe10);
+    for (tsMib *m = nodes[1]->psMibs; m != mib; m = m->psNext) {
+        queryVar.u8MibIndex++;
+    }
+    XCTAssertTrue(psJIP_MibAddVar(mib, 6, "Extra", E_JIP_VAR_TYPE_UINT8, E_JIP_ACCESS_TYPE_READ_ONLY, E_JIP_SECURITY_NONE) != NULL);
+    eJIP_UnlockNode(nodes[1]);
+    XCTAssertGreaterThan(handleRequest(&context, nodes[1], &queryVar, sizeof(queryVar), response), 0u);
+    XCTAssertEqual(varHeader->u8NumVarsReturned, 7);
+    XCTAssertGreaterThan(handleRequest(&context, nodes[2], &queryVar, sizeof(queryVar), response), 0u);
+    XCTAssertEqual(varHeader->u8NumVarsReturned, 6);
+    XCTAssertEqual(serverSchemaCount(&context), 2);
+    XCTAssertEqual(nodeSchema(nodes[1])->u32RefCount, 1u);
+    
+    // Removing a node frees a schema only it used
+    eJIP_LockNode(nodes[1], True);
+    XCTAssertEqual(eJIPserver_NodeRemove(&context, nodes[1]), E_JIP_OK);
+    XCTAssertEqual(serverSchemaCount(&context), 1);
+    XCTAssertEqual(nodeSchema(nodes[0])->u32RefCount, (uint32_t)SCHEMA_NODES - 1);
+    
+    for (int i = 0; i < SCHEMA_NODES; i++) {
+        if (i != 1) {
+            eJIP_LockNode(nodes[i], True);
+            XCTAssertEqual(eJIPserver_NodeRemove(&context, nodes[i]), E_JIP_OK);
+        }
+    }
+    XCTAssertEqual(serverSchemaCount(&context), 0);
+    
+    eJIP_Destroy(&context);
+    [[NSFileManager defaultManager] removeItemAtPath:definitions error:nil];
+}
+
 - (void)testPerformanceExample {
     // This is an example of a performance test case.
     [self measureBlock:^{